@@ -368,13 +368,9 @@ async function fetchSalesSummary(force = false) {
     }
 
     try {
-        const params = [];
-        if (force) {
-            params.push('rebuild=1');
-        }
-        params.push(`ts=${Date.now()}`);
-        const url = `/api/sales/summary?${params.join('&')}`;
-        const response = await fetch(url);
+        const response = force
+            ? await fetch('/api/sales/summary/rebuild', { method: 'POST' })
+            : await fetch(`/api/sales/summary?ts=${Date.now()}`);
         if (!response.ok) {
             throw new Error(`HTTP ${response.status}`);
         }
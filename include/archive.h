@@ -0,0 +1,88 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+#include "store.h"
+
+struct ArchiveSegmentInfo {
+    String sessionId;
+    String path;
+    uint32_t orders{0};
+    // Superseding versions appended by archiveReplaceOrder(); not counted in orders.
+    uint32_t amendments{0};
+    // On flash; rawBytes is the JSONL length, which differs once a sealed segment is compressed.
+    uint32_t bytes{0};
+    uint32_t rawBytes{0};
+    uint32_t firstArchivedAt{0};
+    uint32_t lastArchivedAt{0};
+    bool sealed{false};
+    bool compressed{false};
+};
+
+struct ArchiveCompactionStatus {
+    bool active{false};
+    String sessionId;
+    uint32_t sourceBytes{0};
+    uint32_t processedBytes{0};
+    uint32_t recordsKept{0};
+    uint32_t recordsDropped{0};
+    uint32_t runs{0};
+    uint32_t aborted{0};
+    uint32_t lastReclaimedBytes{0};
+    uint32_t reclaimedBytes{0};
+    uint32_t lastDurationMs{0};
+    // Sealed segments rewritten block-compressed (KDS_COMPRESSED_STORAGE) and the flash that saved.
+    uint32_t compressions{0};
+    uint32_t compressionSavedBytes{0};
+};
+
+// Per-session Bloom filter over archived orderNos. archiveOrderExists() consults it before the
+// index, so "not archived" (the usual answer during WAL replay) costs no flash reads.
+struct ArchiveBloomFilter {
+    String sessionId;
+    // Index entries folded in and the last of them; a filter restored from a snapshot is only
+    // trusted if the index still holds that entry at that position.
+    uint32_t entries{0};
+    uint32_t lastKey{0};
+    uint32_t lastOffset{0};
+    std::vector<uint8_t> bits;
+};
+
+struct ArchiveBloomStats {
+    uint32_t filters{0};
+    uint32_t bytes{0};
+    uint32_t checks{0};
+    uint32_t definitelyNot{0};
+    uint32_t falsePositives{0};
+    uint32_t rebuilds{0};
+    uint32_t restored{0};
+};
+
+using ArchiveOrderVisitor = bool (*)(const Order&, const String&, uint32_t archivedAt, void* context);
+
+bool archiveAppend(const Order& order, const String& sessionId, uint32_t archivedAt);
+// A non-empty sessionIdFilter reads only that session's segment; empty walks every segment.
+bool archiveForEach(const String& sessionIdFilter, ArchiveOrderVisitor visitor, void* context);
+bool archiveFindOrder(const String& sessionIdFilter, const String& orderNo, Order& outOrder, uint32_t* archivedAt = nullptr);
+bool archiveOrderExists(const String& sessionId, const String& orderNo);
+bool archiveReplaceOrder(const Order& order, const String& sessionId, uint32_t archivedAt);
+
+// Marks the session's segment closed in the manifest; called when the session ends. With
+// KDS_COMPRESSED_STORAGE the compactor then rewrites it block-compressed in the background.
+bool archiveSealSession(const String& sessionId);
+// Persists segment counters updated by appends since the last save.
+bool archiveFlushManifest();
+std::vector<ArchiveSegmentInfo> archiveListSegments();
+
+// Advances the background compactor by at most budgetMs; starts a job on its own once a
+// segment's superseded versions cross the dead-record threshold.
+void archiveCompactTick(uint32_t budgetMs);
+ArchiveCompactionStatus getArchiveCompactionStatus();
+
+// Copies of the filters built so far, for the snapshot. False, with nothing copied, while another
+// task holds the archive.
+bool archiveBloomSnapshot(std::vector<ArchiveBloomFilter>& out);
+// Total size of the filters built so far, with the same lock wait as archiveBloomSnapshot().
+bool archiveBloomBytes(uint32_t& out);
+// Filters loaded from a snapshot; each is checked against its index on first use.
+void archiveBloomRestore(std::vector<ArchiveBloomFilter>& filters);
+ArchiveBloomStats getArchiveBloomStats();
@@ -0,0 +1,69 @@
+#pragma once
+#include <Arduino.h>
+
+// Decides when loop() takes a snapshot (a checkpoint that lets the WAL before it go). Only WAL
+// bytes since the last checkpoint and requestSnapshotSave() make the state dirty; clean intervals
+// write nothing, and checkpoints wait for a quiet moment unless the backlog or its age forces them.
+
+// WAL bytes a checkpoint folds in once the log goes idle; twice this forces one mid-burst, which
+// bounds how much replay a power cut leaves behind.
+#ifndef KDS_CHECKPOINT_WAL_BYTES
+#define KDS_CHECKPOINT_WAL_BYTES (16 * 1024)
+#endif
+
+// No WAL appends or snapshot requests for this long counts as idle.
+#ifndef KDS_CHECKPOINT_IDLE_MS
+#define KDS_CHECKPOINT_IDLE_MS 3000
+#endif
+
+// A smaller dirty log is checkpointed when idle, but no more often than this.
+#ifndef KDS_CHECKPOINT_MIN_INTERVAL_MS
+#define KDS_CHECKPOINT_MIN_INTERVAL_MS 120000
+#endif
+
+// Dirty state never waits longer than this, busy or not.
+#ifndef KDS_CHECKPOINT_MAX_INTERVAL_MS
+#define KDS_CHECKPOINT_MAX_INTERVAL_MS 300000
+#endif
+
+// Changes outside the WAL exist only in RAM until a snapshot, so their requests wait for idle
+// only this long.
+#ifndef KDS_CHECKPOINT_REQUEST_DELAY_MS
+#define KDS_CHECKPOINT_REQUEST_DELAY_MS 5000
+#endif
+
+enum CheckpointReason : uint8_t {
+    kCheckpointNone = 0,
+    kCheckpointRequest,
+    kCheckpointWalBytes,
+    kCheckpointIdle,
+    kCheckpointMaxInterval,
+    kCheckpointReasonCount,
+};
+
+struct CheckpointStats {
+    uint32_t started[kCheckpointReasonCount]{};
+    uint32_t failures{0};
+    // Minimum intervals that passed with nothing to write (each was a full snapshot before).
+    uint32_t cleanSkips{0};
+    // Checkpoints that were due but held back because orders kept arriving.
+    uint32_t postponed{0};
+    uint8_t lastReason{kCheckpointNone};
+    uint32_t lastWalBytes{0};
+    uint64_t snapshotBytes{0};
+    uint32_t dirtyWalBytes{0};
+    uint32_t idleMs{0};
+    uint32_t sinceLastMs{0};
+    bool requestPending{false};
+    bool inFlight{false};
+};
+
+// Call once boot recovery is done; the loaded snapshot counts as the last checkpoint.
+void checkpointBegin();
+// Call from loop() while no snapshot is in flight; consumes requestSnapshotSave().
+CheckpointReason checkpointPoll();
+// Report whether snapshotSaveAsync() accepted the checkpoint checkpointPoll() asked for.
+void checkpointStarted(CheckpointReason reason, bool accepted);
+void checkpointFinished(bool ok);
+CheckpointStats getCheckpointStats();
+const char* checkpointReasonName(uint8_t reason);
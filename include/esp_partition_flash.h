@@ -0,0 +1,6 @@
+#pragma once
+#include "wal_ring.h"
+
+// The "wal" data partition from partitions_rawwal.csv, or nullptr when the partition table has
+// none. Device only; host builds supply their own WalRingFlash.
+WalRingFlash* walRingPartitionFlash();
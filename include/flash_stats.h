@@ -0,0 +1,73 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+
+enum FlashSubsystem : uint8_t {
+    kFlashWal = 0,
+    kFlashSnapshot,
+    kFlashArchive,
+    kFlashArchiveIndex,
+    kFlashArchiveCompaction,
+    // The raw "wal" partition (KDS_WAL_RAW_PARTITION), outside LittleFS.
+    kFlashWalPartition,
+    kFlashSubsystemCount,
+};
+
+// Planning figures for /api/system/storage: LittleFS erases 4 KiB blocks, and the ESP32's NOR flash
+// is rated for about 100k erase cycles per sector.
+static const uint32_t kFlashBlockSize = 4096;
+static const uint32_t kFlashEraseCyclesPerBlock = 100000;
+
+// Latency buckets are powers of four starting at 64 us: <64us, <256us, <1ms, ... , >=256ms.
+static const uint8_t kFlashLatencyBuckets = 8;
+
+struct FlashSubsystemStats {
+    uint32_t opens{0};
+    uint32_t writeOpens{0};
+    uint32_t writes{0};
+    uint32_t bytesWritten{0};
+    uint32_t flushes{0};
+    uint32_t renames{0};
+    uint32_t removes{0};
+    uint32_t failures{0};
+    // Exact sector erases; only raw partitions know these.
+    uint32_t erases{0};
+    // Only operations that reach the flash: flush, close of a writable handle, rename, remove.
+    // Individual write() calls mostly land in LittleFS's cache and are counted, not timed.
+    uint32_t latency[kFlashLatencyBuckets]{};
+    uint32_t maxLatencyUs{0};
+    uint64_t totalLatencyUs{0};
+};
+
+// A File that charges writes, flushes and close to a subsystem. Keep it typed as FlashFile (not
+// File) wherever it is closed so close() is timed; writes are counted through any File& alias.
+class FlashFile : public File {
+public:
+    FlashFile() {}
+    FlashFile(const File& file, FlashSubsystem subsystem, bool writable)
+        : File(file), subsystem_(subsystem), writable_(writable) {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buf, size_t size) override;
+    using Print::write;
+    void flush() override;
+    void close();
+
+private:
+    FlashSubsystem subsystem_{kFlashSubsystemCount};
+    bool writable_{false};
+};
+
+FlashFile flashOpen(FlashSubsystem subsystem, const char* path, const char* mode = FILE_READ);
+FlashFile flashOpen(FlashSubsystem subsystem, const String& path, const char* mode = FILE_READ);
+bool flashRemove(FlashSubsystem subsystem, const char* path);
+bool flashRemove(FlashSubsystem subsystem, const String& path);
+bool flashRename(FlashSubsystem subsystem, const char* from, const char* to);
+bool flashRename(FlashSubsystem subsystem, const String& from, const String& to);
+
+// For raw partition I/O that bypasses LittleFS; every write and erase reaches the flash and is timed.
+void flashNoteRawWrite(FlashSubsystem subsystem, size_t bytes, uint32_t elapsedUs, bool ok);
+void flashNoteRawErase(FlashSubsystem subsystem, uint32_t elapsedUs, bool ok);
+
+const char* flashSubsystemName(FlashSubsystem subsystem);
+FlashSubsystemStats getFlashStats(FlashSubsystem subsystem);
@@ -0,0 +1,50 @@
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Reusable buffers for JsonDocuments that are built and dropped once per record (archive lines,
+// legacy WAL lines, streamed archive orders). A document borrows an arena through a lease and
+// allocates by bumping a pointer; the arena rewinds whenever the document frees everything, so a
+// scan over thousands of lines never touches malloc. Anything that does not fit spills to the heap.
+
+// An order line needs roughly 1-3 KiB with ArduinoJson 7; larger documents spill rather than fail.
+#ifndef KDS_JSON_ARENA_BYTES
+#define KDS_JSON_ARENA_BYTES 6144
+#endif
+
+static const size_t kJsonArenaCount = 3;
+static const size_t kJsonArenaBytes = KDS_JSON_ARENA_BYTES;
+
+struct JsonArenaStats {
+    uint32_t leases{0};
+    // Leases that found every arena busy and used the heap allocator instead.
+    uint32_t heapLeases{0};
+    // Allocations a leased arena could not fit and passed to the heap.
+    uint32_t spills{0};
+    uint32_t highWaterBytes{0};
+    uint8_t inUse{0};
+    uint8_t reserved{0};
+};
+
+// Reserves the arenas from the boot heap, before it fragments. Leases reserve lazily otherwise.
+void jsonArenaBegin();
+JsonArenaStats getJsonArenaStats();
+
+// Declare the lease before the document so the document is destroyed first:
+//     JsonArenaLease arena;
+//     JsonDocument doc(arena.allocator());
+class JsonArenaLease {
+public:
+    JsonArenaLease();
+    ~JsonArenaLease();
+
+    ArduinoJson::Allocator* allocator() const { return allocator_; }
+    bool pooled() const { return slot_ < kJsonArenaCount; }
+
+private:
+    JsonArenaLease(const JsonArenaLease&) = delete;
+    JsonArenaLease& operator=(const JsonArenaLease&) = delete;
+
+    size_t slot_;
+    ArduinoJson::Allocator* allocator_;
+};
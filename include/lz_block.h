@@ -0,0 +1,96 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+
+// Sealed archive segments and snapshots are written block-compressed when this is 1. Readers
+// understand both layouts regardless, so the flag can be flipped without migrating anything.
+#ifndef KDS_COMPRESSED_STORAGE
+#define KDS_COMPRESSED_STORAGE 0
+#endif
+
+// LZ77 in the LZ4 sequence layout (token, literals, 16-bit offset, match length). Blocks are
+// compressed independently, so the match window never exceeds one block and a reader only ever
+// holds one block in RAM.
+static const size_t kLzBlockSize = 4096;
+static const size_t kLzHashBits = 10;
+
+// Returns the compressed size, or 0 when the output would not fit in outCap (store the block raw).
+size_t lzCompressBlock(const uint8_t* in, size_t len, uint8_t* out, size_t outCap, uint16_t* table);
+// Bounds-checked; false unless the input decodes to exactly rawLen bytes.
+bool lzDecompressBlock(const uint8_t* in, size_t len, uint8_t* out, size_t rawLen);
+
+// Container layout, starting wherever the writer begins:
+//   header  "KDSZ" u32, version u16, block size u16
+//   blocks  { raw length u16, stored length u16, data } (stored == raw means uncompressed)
+//   index   u32 container offset of each block
+//   footer  block count u32, raw size u32, "KDSZ" u32
+// Every block but the last holds exactly kLzBlockSize raw bytes, so a raw offset maps straight to
+// its block and the index gives the seek target.
+static const uint32_t kLzContainerMagic = 0x5A53444B; // "KDSZ"
+
+// Peeks at the current position and rewinds; true when a container starts there.
+bool lzIsContainer(File& file);
+
+class LzBlockWriter {
+public:
+    explicit LzBlockWriter(File& file) : file_(file) {}
+
+    // Writes the container header; also resets the writer so one instance can be reused.
+    bool begin();
+    void write(const uint8_t* data, size_t len);
+    // Flushes the partial block and writes the index and footer.
+    bool finish();
+
+    uint32_t rawBytes() const { return rawBytes_; }
+    uint32_t storedBytes() const { return storedBytes_; }
+    bool ok() const { return ok_; }
+
+private:
+    void flushBlock();
+
+    File& file_;
+    std::vector<uint8_t> raw_;
+    std::vector<uint8_t> packed_;
+    std::vector<uint16_t> table_;
+    std::vector<uint32_t> offsets_;
+    uint32_t rawBytes_{0};
+    uint32_t storedBytes_{0};
+    bool ok_{true};
+};
+
+// Presents a container as the original byte stream: read, readLine and seek all take raw offsets.
+class LzBlockReader {
+public:
+    bool begin(File& file);
+
+    size_t read(uint8_t* out, size_t len);
+    // Reads up to (and drops) the next '\n', across block boundaries.
+    String readLine();
+    bool seek(uint32_t rawOffset);
+
+    uint32_t position() const { return position_; }
+    uint32_t size() const { return rawSize_; }
+    bool available() const { return position_ < rawSize_; }
+    // False once a block failed to load or decode; the reader then behaves as if at the end.
+    bool ok() const { return ok_; }
+
+private:
+    bool loadBlock(uint32_t block);
+    bool ensureBlock();
+
+    File* file_{nullptr};
+    std::vector<uint8_t> raw_;
+    std::vector<uint8_t> packed_;
+    uint32_t base_{0};
+    uint32_t blockSize_{0};
+    uint32_t blockCount_{0};
+    uint32_t rawSize_{0};
+    uint32_t indexOffset_{0};
+    uint32_t position_{0};
+    uint32_t loadedBlock_{0xFFFFFFFFu};
+    uint32_t loadedLen_{0};
+    // Container offset of the block after the loaded one, so sequential reads skip the index.
+    uint32_t nextBlockOffset_{0};
+    bool ok_{true};
+};
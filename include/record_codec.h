@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <WString.h>
+#include "store.h"
+#include "archive.h"
+#include "sales_rollup.h"
+
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len);
+
+class ByteSink {
+public:
+    virtual ~ByteSink() {}
+    virtual void write(const uint8_t* data, size_t len) = 0;
+};
+
+class VectorSink : public ByteSink {
+public:
+    explicit VectorSink(std::vector<uint8_t>& out) : out_(out) {}
+    void write(const uint8_t* data, size_t len) override { out_.insert(out_.end(), data, data + len); }
+
+private:
+    std::vector<uint8_t>& out_;
+};
+
+// Measures an encoding without storing it, so a length prefix can be emitted before the payload.
+class CountingSink : public ByteSink {
+public:
+    void write(const uint8_t*, size_t len) override { count_ += len; }
+    size_t count() const { return count_; }
+    void reset() { count_ = 0; }
+
+private:
+    size_t count_{0};
+};
+
+class RecordWriter {
+public:
+    explicit RecordWriter(ByteSink& out) : out_(out) {}
+
+    void putU8(uint8_t v) { out_.write(&v, 1); }
+    void putBool(bool v) { putU8(v ? 1 : 0); }
+    void putU32(uint32_t v);
+    void putVarU32(uint32_t v);
+    void putVarI32(int32_t v);
+    void putFloat(float v);
+    void putString(const String& s);
+    void putBytes(const std::vector<uint8_t>& bytes);
+
+private:
+    ByteSink& out_;
+};
+
+class RecordReader {
+public:
+    RecordReader(const uint8_t* data, size_t len) : data_(data), len_(len) {}
+
+    uint8_t getU8();
+    bool getBool() { return getU8() != 0; }
+    uint32_t getU32();
+    uint32_t getVarU32();
+    int32_t getVarI32();
+    float getFloat();
+    bool getString(String& out);
+    bool getBytes(std::vector<uint8_t>& out);
+
+    bool ok() const { return ok_; }
+    size_t remaining() const { return ok_ ? len_ - pos_ : 0; }
+
+private:
+    const uint8_t* data_;
+    size_t len_;
+    size_t pos_{0};
+    bool ok_{true};
+};
+
+void encodeSettings(RecordWriter& w, const Settings& settings);
+bool decodeSettings(RecordReader& r, Settings& settings);
+void encodeSession(RecordWriter& w, const Session& session);
+bool decodeSession(RecordReader& r, Session& session);
+void encodePrinterState(RecordWriter& w, const PrinterState& printer);
+bool decodePrinterState(RecordReader& r, PrinterState& printer);
+void encodeMenuItem(RecordWriter& w, const MenuItem& item);
+bool decodeMenuItem(RecordReader& r, MenuItem& item);
+void encodeOrder(RecordWriter& w, const Order& order);
+bool decodeOrder(RecordReader& r, Order& order);
+void encodeSalesSummary(RecordWriter& w, const SalesSummary& summary);
+bool decodeSalesSummary(RecordReader& r, SalesSummary& summary);
+// The rollup is split so no single record outgrows the snapshot's record size cap: breakdowns in
+// one record, then one record per SKU row.
+void encodeSalesRollupBreakdowns(RecordWriter& w, const SalesRollup& rollup);
+bool decodeSalesRollupBreakdowns(RecordReader& r, SalesRollup& rollup);
+void encodeSalesRollupSku(RecordWriter& w, const SalesRollupSku& row);
+bool decodeSalesRollupSku(RecordReader& r, SalesRollupSku& row);
+void encodeArchiveBloom(RecordWriter& w, const ArchiveBloomFilter& bloom);
+bool decodeArchiveBloom(RecordReader& r, ArchiveBloomFilter& bloom);
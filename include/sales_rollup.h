@@ -0,0 +1,46 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+#include "store.h"
+
+// Orders are bucketed by their creation time (order.ts), in kSalesRollupBucketSeconds slices.
+static const uint32_t kSalesRollupBucketSeconds = 15 * 60;
+
+struct SalesRollupCell {
+    uint32_t bucket{0};
+    int32_t qty{0};
+    int32_t amount{0};
+};
+
+struct SalesRollupSku {
+    String sku;
+    String name;
+    int32_t qty{0};
+    int32_t amount{0};
+    int32_t cancelledQty{0};
+    int32_t cancelledAmount{0};
+    // Sorted by bucket; net of cancellations.
+    std::vector<SalesRollupCell> cells;
+};
+
+struct SalesRollupBreakdown {
+    String key;
+    int32_t qty{0};
+    int32_t amount{0};
+    int32_t cancelledQty{0};
+    int32_t cancelledAmount{0};
+};
+
+struct SalesRollup {
+    std::vector<SalesRollupSku> skus;
+    std::vector<SalesRollupBreakdown> priceModes;
+    std::vector<SalesRollupBreakdown> kinds;
+    uint32_t lastUpdated{0};
+};
+
+const SalesRollup& getSalesRollup();
+void salesRollupReset();
+void salesRollupRestore(SalesRollup& rollup);
+// Orders created already cancelled only land in the cancelled counters.
+void salesRollupAddOrder(const Order& order);
+void salesRollupCancelOrder(const Order& order);
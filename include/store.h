@@ -30,6 +30,17 @@ struct MenuItem {
     int price_as_side{0};
 };
 
+// How far a mutation must be persisted before its HTTP response goes out.
+enum DurabilityLevel : uint8_t {
+    kDurabilityMemory = 0,    // applied in RAM; the WAL group commit follows within its window
+    kDurabilityWal = 1,       // WAL group committed to flash
+    kDurabilitySnapshot = 2,  // WAL committed and a full snapshot written
+    kDurabilityLevelCount,
+};
+
+const char* durabilityLevelName(uint8_t level);
+bool parseDurabilityLevel(const String& name, uint8_t& level);
+
 struct Chinchiro {
     bool enabled{false};
     std::vector<float> multipliers;
@@ -50,6 +61,7 @@ struct Settings {
         bool enabled{false};
         String content{""};
     } qrPrint;
+    uint8_t durability{kDurabilityWal};
 };
 
 struct LineItem {
@@ -92,20 +104,94 @@ struct SalesSummary {
     uint32_t lastUpdated{0};
 };
 
+// Checkpoints append delta frames (records changed since the last checkpoint) to the newest base
+// snapshot until the frames add up to this percentage of the base; the next one writes a new base.
+// 0 writes a full base every time.
+#ifndef KDS_SNAPSHOT_DELTA_PERCENT
+#define KDS_SNAPSHOT_DELTA_PERCENT 100
+#endif
+
+struct SnapshotStats {
+    uint32_t saves{0};
+    uint32_t failures{0};
+    uint32_t lastBytes{0};
+    // Size on flash; below lastBytes when the body was block-compressed.
+    uint32_t lastStoredBytes{0};
+    uint32_t lastRecords{0};
+    uint32_t lastDurationMs{0};
+    uint32_t maxAllocBefore{0};
+    uint32_t maxAllocLowest{0};
+    uint32_t maxAllocAfter{0};
+    uint32_t checkpointLsn{0};
+    // Background saves: time loop() spent encoding S() into RAM, and how big that copy was.
+    uint32_t lastCaptureUs{0};
+    uint32_t lastCaptureBytes{0};
+    // Background saves that streamed from the caller because the body outgrew the RAM budget.
+    uint32_t captureFallbacks{0};
+    // Saves that appended a delta frame to the newest base instead of writing a new one; the
+    // last* fields above then describe the frame.
+    uint32_t deltaSaves{0};
+    uint32_t lastDeltaRecords{0};
+    uint32_t chainBaseBytes{0};
+    uint32_t chainDeltaBytes{0};
+    uint32_t chainDeltas{0};
+    uint32_t loadBytes{0};
+    uint32_t loadRecords{0};
+    uint32_t loadDeltas{0};
+    uint32_t loadDurationMs{0};
+    bool loadedLegacyJson{false};
+};
+
+struct RecoveryStatus {
+    bool inProgress{false};
+    bool completed{false};
+    bool snapshotFailed{false};
+    uint32_t fromLsn{0};
+    uint32_t segmentsTotal{0};
+    uint32_t segmentsDone{0};
+    uint32_t recordsSeen{0};
+    uint32_t recordsApplied{0};
+    uint32_t recordsSkipped{0};
+    uint32_t lastTs{0};
+    uint32_t steps{0};
+    uint32_t startedMs{0};
+    uint32_t durationMs{0};
+};
+
 State& S();
 
+// Held by HTTP handlers that change S(), by loop() code that does, and by snapshot capture, so a
+// capture never sees a change half made and its checkpoint LSN matches what it holds. Recursive:
+// store functions may take it under a handler's lock. Taken before the snapshot and WAL locks.
+class StateLock {
+public:
+    StateLock();
+    ~StateLock();
+
+private:
+    StateLock(const StateLock&) = delete;
+    StateLock& operator=(const StateLock&) = delete;
+};
+
 const SalesSummary& getSalesSummary();
-bool loadSalesSummary();
-bool saveSalesSummary();
 bool recalculateSalesSummary();
-void applyOrderToSalesSummary(const Order& order);
 void applyCancellationToSalesSummary(const Order& order);
 
-using ArchiveOrderVisitor = bool (*)(const Order&, const String&, uint32_t archivedAt, void* context);
 
+// Empty when every number in the range belongs to an active order.
 String allocateOrderNo();
+// Keep the allocator's in-use bitmap in step with S(); bulk changes just invalidate it.
+void markOrderNoUsed(const String& orderNo);
+void releaseOrderNo(const String& orderNo);
+// reloadLease re-reads the cursor from NVS, e.g. after the namespace was cleared.
+void invalidateOrderNoMap(bool reloadLease = false);
 String generateSkuMain();
 String generateSkuSide();
+// Call right after appending to S().menu; replacing the menu wholesale needs invalidateSkuIndex().
+void noteMenuItemAdded();
+// reloadCounters re-reads the SKU counters from NVS, e.g. after the namespace was cleared.
+void invalidateSkuIndex(bool reloadCounters = false);
+MenuItem* findMenuItemBySku(const String& sku);
 
 String normalizeQrContent(const String& raw);
 
@@ -113,25 +199,45 @@ Order* findOrderByNo(const String& orderNo);
 int computeOrderTotal(const Order& order);
 void orderToJson(JsonObject json, const Order& order);
 bool orderFromJson(JsonVariantConst json, Order& order);
-size_t estimateOrderDocumentCapacity(const Order& order);
 
-bool archiveAppend(const Order& order, const String& sessionId, uint32_t archivedAt);
 bool archiveOrderAndRemove(const String& orderNo, const String& sessionId, uint32_t archivedAt = 0, bool logWal = true);
-bool archiveForEach(const String& sessionIdFilter, ArchiveOrderVisitor visitor, void* context);
-bool archiveFindOrder(const String& sessionIdFilter, const String& orderNo, Order& outOrder, uint32_t* archivedAt = nullptr);
-bool archiveReplaceOrder(const Order& order, const String& sessionId, uint32_t archivedAt);
+
+// One order operation, one WAL record: replay applies every effect of it or none.
+// Inserts the order, adds it to the sales summary and queues its ticket. False when the WAL refused
+// the record; the order is in S() either way.
+bool commitOrderCreate(const Order& order, uint32_t* ticket);
+// Marks the order picked up and removes it from S() before logging; the archive file is written
+// once the record is durable. On false the order is back in S(): unchanged if the WAL refused the
+// record, otherwise picked up, since the logged record stands and replay finishes the move.
+bool commitOrderPickup(const String& orderNo, const String& status, uint32_t* ticket);
 
 const String& getMenuEtag();
 void refreshMenuEtag();
 void bumpCatalogVersion();
 
 bool snapshotSave();
+// Encodes S() into RAM on the spot and leaves the flash write to the snapshot task; false if a
+// save is still in flight or unpolled. Call from loop(), then collect the result with snapshotPoll().
+bool snapshotSaveAsync();
+bool isSnapshotSaveInFlight();
+// True once per finished snapshotSaveAsync(), with ok set to whether the file was written.
+bool snapshotPoll(bool& ok);
 bool snapshotLoad();
 void requestSnapshotSave();
 bool consumeSnapshotSaveRequest();
-bool walAppend(const String& line);
 bool recoverToLatest(String &outLastTs);
-bool getLatestSnapshotJson(String& outJson, String& outPath);
+bool getLatestSnapshotPath(String& outPath);
+void writeSnapshotJsonFields(Print& out);
+const SnapshotStats& getSnapshotStats();
+bool getOldestSnapshotCheckpoint(uint32_t& outLsn);
+
+// Boot recovery: beginRecovery() loads the snapshot, stepRecovery() replays the WAL tail in
+// budgeted slices (0 = to the end) and returns true once done. Each call holds StateLock. The
+// API answers 503 meanwhile, reads included, since GET handlers read S() without the lock.
+bool beginRecovery();
+bool stepRecovery(uint32_t budgetMs);
+bool isRecoveryInProgress();
+RecoveryStatus getRecoveryStatus();
 
 void ensureInitialMenu();
 void forceCreateInitialMenu();
@@ -0,0 +1,138 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+#include "store.h"
+
+// Log sequence number. Assigned per appended record, strictly increasing across reboots;
+// doubles as the durability ticket returned by walAppend().
+typedef uint32_t WalTicket;
+
+enum WalAction : uint8_t {
+    kWalOrderCreate = 1,
+    kWalOrderUpdate = 2,
+    kWalOrderCancel = 3,
+    kWalOrderCooked = 4,
+    kWalOrderPicked = 5,
+    kWalOrderArchive = 6,
+    kWalSettingsUpdate = 7,
+    kWalMainUpsert = 8,
+    kWalSideUpsert = 9,
+    kWalSessionEnd = 10,
+    kWalSystemReset = 11,
+    kWalOrderPrinted = 12,
+    // Every effect of one order operation in a single record, so replay sees all of it or none.
+    kWalOrderTxn = 13,
+};
+
+// kWalOrderTxn effects, applied in this order. The record always carries the order as it stands
+// after the operation.
+enum : uint8_t {
+    kWalTxnCreate = 0x01,
+    kWalTxnState = 0x02,
+    kWalTxnArchive = 0x04,
+    kWalTxnSummary = 0x08,
+    kWalTxnPrint = 0x10,
+};
+
+enum : uint8_t {
+    kWalSettingsChinchiro = 0x01,
+    kWalSettingsQrPrint = 0x02,
+    kWalSettingsStore = 0x04,
+};
+
+// One flat record reused for every action; only the fields the action's payload carries are
+// meaningful. Replay decodes into a single instance so string buffers are recycled.
+struct WalRecord {
+    WalTicket lsn{0};
+    WalAction action{kWalOrderUpdate};
+    uint32_t ts{0};
+
+    String orderNo;
+    Order order;
+    bool hasOrder{false};
+    String status;
+    bool cooked{false};
+    bool pickupCalled{false};
+    bool pickedUp{false};
+    bool printed{false};
+    String cancelReason;
+    bool archived{false};
+    String sessionId;
+    uint32_t archivedAt{0};
+    uint8_t effects{0};
+
+    uint8_t settingsMask{0};
+    Settings settings;
+
+    MenuItem item;
+    uint32_t catalogVersion{0};
+};
+
+struct WalStats {
+    uint32_t appends{0};
+    uint32_t commits{0};
+    uint32_t failures{0};
+    uint32_t bytesWritten{0};
+    uint32_t largestGroupBytes{0};
+    uint32_t lastCommitMs{0};
+    uint32_t pendingBytes{0};
+    WalTicket lastLsn{0};
+    // KDS_WAL_RAW_PARTITION: records go to the raw "wal" partition.
+    bool rawPartition{false};
+    uint32_t ringPages{0};
+    uint32_t ringLivePages{0};
+    uint32_t ringErases{0};
+};
+
+struct WalSegmentInfo {
+    uint32_t records{0};
+    WalTicket lastLsn{0};
+    uint32_t skippedRecords{0};
+    bool skipped{false};
+    bool legacyJson{false};
+    bool tornTail{false};
+};
+
+// Resumable position in the segment list, so replay can be spread across several loop() passes.
+struct WalReplayCursor {
+    std::vector<String> segments;
+    size_t segment{0};
+    // Raw partition page sequence (0: not started); offset is then within that page.
+    uint32_t page{0};
+    uint32_t offset{0};
+    WalTicket fromLsn{0};
+    uint32_t records{0};
+    uint32_t skippedRecords{0};
+    uint32_t skippedSegments{0};
+};
+
+typedef bool (*WalRecordVisitor)(const WalRecord& record, void* context);
+
+bool walBegin();
+bool walAppend(const WalRecord& record, WalTicket* ticket = nullptr);
+bool walWaitDurable(WalTicket ticket);
+void walTick();
+bool walFlush();
+// Rotated segments whose records all sit at or below obsoleteThrough are deleted; pass 0 when
+// no snapshot carries a checkpoint yet to keep the newest two instead.
+void walRotate(WalTicket obsoleteThrough = 0);
+// Lets the raw-partition ring reuse pages at or below obsoleteThrough without rotating. The ring
+// does not persist that horizon, so boot calls this once the snapshots have been read.
+void walRelease(WalTicket obsoleteThrough);
+WalTicket walLastLsn();
+// Moves the LSN counter up to at least lsn (never down). walBegin() seeds it from the segments
+// on flash only; recovery raises it past the snapshots' checkpoints.
+void walAdvanceLsn(WalTicket lsn);
+WalStats getWalStats();
+
+// Oldest first: legacy JSON segments, rotated binary segments, then the live segment, or
+// "/kds/wal.ring" for the raw partition.
+std::vector<String> walListSegments();
+// Records below fromLsn are skipped without decoding, and whole segments when their name or
+// format shows they end before it.
+bool walReadSegment(const String& path, WalRecordVisitor visitor, void* context, WalSegmentInfo* info = nullptr,
+                    WalTicket fromLsn = 0);
+
+void walReplayBegin(WalReplayCursor& cursor, WalTicket fromLsn);
+// Returns true once every segment has been read; budgetMs == 0 reads to the end in one call.
+bool walReplayStep(WalReplayCursor& cursor, WalRecordVisitor visitor, void* context, uint32_t budgetMs);
@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// With 1 the WAL goes to the raw "wal" partition from partitions_rawwal.csv instead of LittleFS
+// files. Without that partition it logs an error and stays on LittleFS.
+#ifndef KDS_WAL_RAW_PARTITION
+#define KDS_WAL_RAW_PARTITION 0
+#endif
+
+static const uint8_t kWalRingPartitionSubtype = 0x40;
+static const uint32_t kWalRingPageSize = 4096;
+
+// Raw flash under the ring, addressed from the start of the region. Like NOR flash, write() can
+// only clear bits and erase() resets one kWalRingPageSize page to 0xFF.
+class WalRingFlash {
+public:
+    virtual ~WalRingFlash() {}
+    virtual uint32_t size() const = 0;
+    virtual bool read(uint32_t offset, void* out, size_t len) = 0;
+    virtual bool write(uint32_t offset, const void* data, size_t len) = 0;
+    virtual bool erase(uint32_t offset) = 0;
+};
+
+// Page: magic u32, seq u32, first LSN u32, crc32 of the first 12 bytes.
+// Entry: length u16, LSN u32, crc32 u32, data. An erased length (0xFFFF) ends the page.
+// Page seq s always lives at index s % pages, so headers alone order the log. Entries never
+// span pages, and nothing is written after a torn entry: mount() closes that page instead.
+static const size_t kWalRingPageHeaderSize = 16;
+static const size_t kWalRingEntryHeaderSize = 10;
+static const size_t kWalRingMaxEntry = kWalRingPageSize - kWalRingPageHeaderSize - kWalRingEntryHeaderSize;
+
+struct WalRingPosition {
+    uint32_t seq{0};
+    uint32_t offset{0};
+};
+
+class WalRing {
+public:
+    explicit WalRing(WalRingFlash& flash) : flash_(flash) {}
+
+    // Reads every page header to find the oldest and newest page, then walks the newest page's
+    // entries to find the write position and last LSN. False when the region has under two pages.
+    bool mount();
+
+    // Fails when the next page still holds records above the release horizon (the ring is full).
+    bool append(uint32_t lsn, const uint8_t* data, size_t len);
+    // Erases the page after the head ahead of time so append() does not wait for an erase.
+    // Returns true if it erased something.
+    bool prepare();
+    // Pages whose records all sit at or below obsoleteThrough may be overwritten. The horizon is
+    // kept in RAM only and starts at 0 after mount(), so nothing is overwritten until the owner
+    // releases again; the WAL does that at boot from the snapshots' checkpoints (walRelease()).
+    void release(uint32_t obsoleteThrough);
+
+    // Position of the oldest page that can hold fromLsn (0: the oldest page).
+    WalRingPosition start(uint32_t fromLsn) const;
+    // Next intact entry at or after pos; false once the head is reached. Pages overwritten since
+    // pos was taken are skipped.
+    bool read(WalRingPosition& pos, uint32_t& lsn, std::vector<uint8_t>& out);
+
+    bool empty() const { return headSeq_ == 0; }
+    uint32_t lastLsn() const { return lastLsn_; }
+    uint32_t pages() const { return static_cast<uint32_t>(pages_.size()); }
+    uint32_t livePages() const { return headSeq_ == 0 ? 0 : headSeq_ - tailSeq_ + 1; }
+    uint32_t erases() const { return erases_; }
+    // The newest page ended in a torn entry at mount(); appends continue on the next page.
+    bool tornOnMount() const { return tornOnMount_; }
+
+private:
+    struct PageInfo {
+        uint32_t seq{0};
+        uint32_t firstLsn{0};
+    };
+
+    uint32_t pageIndex(uint32_t seq) const { return seq % pages_.size(); }
+    uint32_t pageAddress(uint32_t seq) const { return pageIndex(seq) * kWalRingPageSize; }
+    bool readPageHeader(uint32_t index, PageInfo& info);
+    bool canReuse(uint32_t seq) const;
+    bool erasePage(uint32_t seq);
+    bool openPage(uint32_t firstLsn);
+
+    WalRingFlash& flash_;
+    std::vector<PageInfo> pages_;
+    uint32_t headSeq_{0};
+    uint32_t tailSeq_{0};
+    uint32_t writeOffset_{kWalRingPageSize};
+    uint32_t lastLsn_{0};
+    uint32_t horizon_{0};
+    uint32_t erases_{0};
+    // The page headSeq_ + 1 maps to has been erased and is ready for openPage().
+    bool nextErased_{false};
+    bool tornOnMount_{false};
+};
@@ -0,0 +1,1825 @@
+#include "archive.h"
+#include "flash_stats.h"
+#include "json_arena.h"
+#include "lz_block.h"
+#include "record_codec.h"
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <time.h>
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+// One JSONL segment per session under /kds/archive, plus a manifest describing each segment so
+// session-filtered scans only open their own file. Lines keep their sessionId so a segment is
+// still self-describing if the manifest is lost.
+//
+// Segments are append-only. Amending an archived order appends a new version carrying "rev" and
+// "supersedes" (the byte offset of the version it replaces); the superseded offsets are also kept
+// in a <segment>.sup sidecar so readers can skip old versions without a second pass.
+//
+// With KDS_COMPRESSED_STORAGE the compactor later rewrites sealed segments as an LZ block
+// container (lz_block.h) under the same path. Every offset, in .idx, .sup and "supersedes", stays
+// an offset into the JSONL stream, so the sidecars are valid for either layout.
+static const char* kArchiveDir = "/kds/archive";
+static const char* kArchiveManifestPath = "/kds/archive/manifest.json";
+static const char* kArchiveManifestTmpPath = "/kds/archive/manifest.tmp";
+static const char* kLegacyArchivePath = "/kds/orders_archive.jsonl";
+static const char* kLegacyArchiveIndexPath = "/kds/orders_archive.idx";
+static const uint16_t kArchiveManifestVersion = 1;
+
+struct ArchiveSegment {
+    ArchiveSegmentInfo info;
+    bool indexReady{false};
+    // Built on the first existence check for this session; empty until then.
+    ArchiveBloomFilter bloom;
+};
+
+static std::vector<ArchiveSegment> g_segments;
+static bool g_manifestLoaded = false;
+static bool g_manifestDirty = false;
+static SemaphoreHandle_t g_archiveMutex = nullptr;
+
+// Recursive because the public entry points call each other (e.g. find falls back to forEach).
+class ArchiveLock {
+public:
+    explicit ArchiveLock(TickType_t wait = portMAX_DELAY) {
+        if (!g_archiveMutex) {
+            g_archiveMutex = xSemaphoreCreateRecursiveMutex();
+        }
+        locked_ = xSemaphoreTakeRecursive(g_archiveMutex, wait) == pdTRUE;
+    }
+    ~ArchiveLock() {
+        if (locked_) {
+            xSemaphoreGiveRecursive(g_archiveMutex);
+        }
+    }
+    bool locked() const { return locked_; }
+
+private:
+    bool locked_{false};
+};
+
+static void putLe32(uint8_t* out, uint32_t v) {
+    out[0] = static_cast<uint8_t>(v);
+    out[1] = static_cast<uint8_t>(v >> 8);
+    out[2] = static_cast<uint8_t>(v >> 16);
+    out[3] = static_cast<uint8_t>(v >> 24);
+}
+
+static uint32_t getLe32(const uint8_t* in) {
+    return static_cast<uint32_t>(in[0]) |
+           (static_cast<uint32_t>(in[1]) << 8) |
+           (static_cast<uint32_t>(in[2]) << 16) |
+           (static_cast<uint32_t>(in[3]) << 24);
+}
+
+static String segmentSidePath(const String& path, const char* suffix) {
+    return path.substring(0, path.lastIndexOf('.')) + suffix;
+}
+
+// Reads a segment as its JSONL byte stream whether it is stored plain or compressed.
+class SegmentReader {
+public:
+    bool open(FlashSubsystem subsystem, const String& path) {
+        file_ = flashOpen(subsystem, path, "r");
+        if (!file_) {
+            return false;
+        }
+        compressed_ = lzIsContainer(file_);
+        if (compressed_ && !lz_.begin(file_)) {
+            Serial.printf("[E] archive container invalid: %s\n", path.c_str());
+            file_.close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (file_) {
+            file_.close();
+        }
+    }
+
+    bool isOpen() const { return file_; }
+    bool compressed() const { return compressed_; }
+    bool ok() const { return !compressed_ || lz_.ok(); }
+    bool available() { return compressed_ ? lz_.available() : file_.available() > 0; }
+    uint32_t position() { return compressed_ ? lz_.position() : static_cast<uint32_t>(file_.position()); }
+    uint32_t size() { return compressed_ ? lz_.size() : static_cast<uint32_t>(file_.size()); }
+    uint32_t storedSize() { return static_cast<uint32_t>(file_.size()); }
+    bool seek(uint32_t offset) { return compressed_ ? lz_.seek(offset) : file_.seek(offset); }
+    size_t read(uint8_t* out, size_t len) { return compressed_ ? lz_.read(out, len) : file_.read(out, len); }
+    String readLine() { return compressed_ ? lz_.readLine() : file_.readStringUntil('\n'); }
+
+private:
+    FlashFile file_;
+    LzBlockReader lz_;
+    bool compressed_{false};
+};
+
+static String segmentPathForSession(const String& sessionId) {
+    String name = sessionId.isEmpty() ? String("_nosession") : sessionId;
+    for (size_t i = 0; i < name.length(); ++i) {
+        char c = name[i];
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+            name.setCharAt(i, '_');
+        }
+    }
+    return String(kArchiveDir) + "/" + name + ".jsonl";
+}
+
+static bool ensureArchiveDir() {
+    if (LittleFS.exists(kArchiveDir)) {
+        return true;
+    }
+    if (!LittleFS.exists("/kds")) {
+        LittleFS.mkdir("/kds");
+    }
+    if (!LittleFS.mkdir(kArchiveDir)) {
+        Serial.printf("[E] archive dir create failed: %s\n", kArchiveDir);
+        return false;
+    }
+    return true;
+}
+
+static void noteArchived(ArchiveSegmentInfo& info, uint32_t archivedAt) {
+    info.orders++;
+    if (archivedAt != 0) {
+        if (info.firstArchivedAt == 0 || archivedAt < info.firstArchivedAt) {
+            info.firstArchivedAt = archivedAt;
+        }
+        if (archivedAt > info.lastArchivedAt) {
+            info.lastArchivedAt = archivedAt;
+        }
+    }
+}
+
+static bool saveArchiveManifest() {
+    if (!ensureArchiveDir()) {
+        return false;
+    }
+
+    JsonDocument doc;
+    doc["version"] = kArchiveManifestVersion;
+    JsonArray segments = doc["segments"].to<JsonArray>();
+    for (const ArchiveSegment& segment : g_segments) {
+        JsonObject entry = segments.add<JsonObject>();
+        entry["sessionId"] = segment.info.sessionId;
+        entry["path"] = segment.info.path;
+        entry["orders"] = segment.info.orders;
+        entry["amendments"] = segment.info.amendments;
+        entry["bytes"] = segment.info.bytes;
+        entry["rawBytes"] = segment.info.rawBytes;
+        entry["firstAt"] = segment.info.firstArchivedAt;
+        entry["lastAt"] = segment.info.lastArchivedAt;
+        entry["sealed"] = segment.info.sealed;
+        entry["compressed"] = segment.info.compressed;
+    }
+
+    FlashFile file = flashOpen(kFlashArchive, kArchiveManifestTmpPath, FILE_WRITE);
+    if (!file) {
+        Serial.printf("[E] archive manifest open failed: %s\n", kArchiveManifestTmpPath);
+        return false;
+    }
+    size_t written = serializeJson(doc, file);
+    file.flush();
+    file.close();
+    if (written == 0) {
+        Serial.println("[E] archive manifest write failed");
+        flashRemove(kFlashArchive, kArchiveManifestTmpPath);
+        return false;
+    }
+    if (LittleFS.exists(kArchiveManifestPath)) {
+        flashRemove(kFlashArchive, kArchiveManifestPath);
+    }
+    if (!flashRename(kFlashArchive, kArchiveManifestTmpPath, kArchiveManifestPath)) {
+        Serial.printf("[E] archive manifest rename failed: %s\n", kArchiveManifestTmpPath);
+        return false;
+    }
+    g_manifestDirty = false;
+    return true;
+}
+
+// Recomputes a segment's counters from its file; used when the manifest lags the data after a
+// power loss, or when a segment file is found without a manifest entry.
+static bool recountSegment(ArchiveSegmentInfo& info) {
+    SegmentReader file;
+    if (!file.open(kFlashArchive, info.path)) {
+        return false;
+    }
+
+    JsonDocument filter;
+    filter["sessionId"] = true;
+    filter["archivedAt"] = true;
+    filter["supersedes"] = true;
+    JsonArenaLease arena;
+    JsonDocument doc(arena.allocator());
+    ArchiveSegmentInfo counted;
+    counted.sessionId = info.sessionId;
+    counted.path = info.path;
+    counted.sealed = info.sealed;
+    while (file.available()) {
+        String line = file.readLine();
+        line.trim();
+        if (line.isEmpty() || deserializeJson(doc, line, DeserializationOption::Filter(filter))) {
+            continue;
+        }
+        if (counted.sessionId.isEmpty()) {
+            counted.sessionId = doc["sessionId"] | String("");
+        }
+        if (doc["supersedes"].is<uint32_t>()) {
+            counted.amendments++;
+        } else {
+            noteArchived(counted, doc["archivedAt"] | 0);
+        }
+    }
+    counted.bytes = file.storedSize();
+    counted.rawBytes = file.size();
+    counted.compressed = file.compressed();
+    file.close();
+    info = counted;
+    return true;
+}
+
+static ArchiveSegment* findSegment(const String& sessionId) {
+    for (ArchiveSegment& segment : g_segments) {
+        if (segment.info.sessionId == sessionId) {
+            return &segment;
+        }
+    }
+    return nullptr;
+}
+
+static ArchiveSegment* findSegmentByPath(const String& path) {
+    for (ArchiveSegment& segment : g_segments) {
+        if (segment.info.path == path) {
+            return &segment;
+        }
+    }
+    return nullptr;
+}
+
+static ArchiveSegment* addSegment(const String& sessionId) {
+    ArchiveSegment segment;
+    segment.info.sessionId = sessionId;
+    segment.info.path = segmentPathForSession(sessionId);
+    g_segments.push_back(segment);
+    g_manifestDirty = true;
+    return &g_segments.back();
+}
+
+static void loadArchiveManifest() {
+    g_segments.clear();
+    if (LittleFS.exists(kArchiveManifestPath)) {
+        FlashFile file = flashOpen(kFlashArchive, kArchiveManifestPath, "r");
+        JsonDocument doc;
+        DeserializationError err = file ? deserializeJson(doc, file) : DeserializationError::InvalidInput;
+        if (file) {
+            file.close();
+        }
+        if (err) {
+            Serial.printf("[E] archive manifest parse failed: %s\n", err.c_str());
+        } else {
+            for (JsonVariantConst value : doc["segments"].as<JsonArrayConst>()) {
+                JsonObjectConst entry = value.as<JsonObjectConst>();
+                ArchiveSegment segment;
+                segment.info.sessionId = entry["sessionId"] | String("");
+                segment.info.path = entry["path"] | String("");
+                segment.info.orders = entry["orders"] | 0;
+                segment.info.amendments = entry["amendments"] | 0;
+                segment.info.bytes = entry["bytes"] | 0;
+                segment.info.rawBytes = entry["rawBytes"] | segment.info.bytes;
+                segment.info.firstArchivedAt = entry["firstAt"] | 0;
+                segment.info.lastArchivedAt = entry["lastAt"] | 0;
+                segment.info.sealed = entry["sealed"] | false;
+                segment.info.compressed = entry["compressed"] | false;
+                String backupPath = segment.info.path + ".bak";
+                if (!segment.info.path.isEmpty() && !LittleFS.exists(segment.info.path) && LittleFS.exists(backupPath)) {
+                    // Power was lost mid-swap of a rewrite; the original segment is still intact.
+                    flashRename(kFlashArchive, backupPath, segment.info.path);
+                    flashRemove(kFlashArchiveIndex, segmentSidePath(segment.info.path, ".idx"));
+                    Serial.printf("[ARCHIVE] restored %s after interrupted compaction\n", segment.info.path.c_str());
+                }
+                if (!segment.info.path.isEmpty() && LittleFS.exists(segment.info.path)) {
+                    g_segments.push_back(segment);
+                }
+            }
+        }
+    }
+
+    // Pick up segment files the manifest does not know about and refresh counters that lag the
+    // file (a crash between an append and the next manifest save).
+    File dir = LittleFS.open(kArchiveDir);
+    if (dir && dir.isDirectory()) {
+        for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+            String path = String(kArchiveDir) + "/" + entry.name();
+            entry.close();
+            if (path.endsWith(".ctmp") || path.endsWith(".itmp") || path.endsWith(".ztmp") || path.endsWith(".jsonl.bak")) {
+                flashRemove(kFlashArchive, path);
+                continue;
+            }
+            if (!path.endsWith(".jsonl") || findSegmentByPath(path)) {
+                continue;
+            }
+            ArchiveSegment segment;
+            segment.info.path = path;
+            segment.info.sealed = true;
+            g_segments.push_back(segment);
+            g_manifestDirty = true;
+        }
+    }
+    for (ArchiveSegment& segment : g_segments) {
+        FlashFile file = flashOpen(kFlashArchive, segment.info.path, "r");
+        uint32_t size = file ? static_cast<uint32_t>(file.size()) : 0;
+        if (file) {
+            file.close();
+        }
+        if (size != segment.info.bytes || segment.info.sessionId.isEmpty()) {
+            recountSegment(segment.info);
+            g_manifestDirty = true;
+        }
+    }
+}
+
+// Splits the single pre-segment archive file into per-session segments, once.
+static void migrateLegacyArchive() {
+    if (!LittleFS.exists(kLegacyArchivePath)) {
+        return;
+    }
+    FlashFile input = flashOpen(kFlashArchive, kLegacyArchivePath, "r");
+    if (!input) {
+        Serial.printf("[E] archive migrate open failed: %s\n", kLegacyArchivePath);
+        return;
+    }
+
+    uint32_t startedMs = millis();
+    JsonDocument filter;
+    filter["sessionId"] = true;
+    filter["archivedAt"] = true;
+    JsonArenaLease arena;
+    JsonDocument doc(arena.allocator());
+    FlashFile out;
+    String outSession;
+    uint32_t migrated = 0;
+    bool ok = true;
+    while (input.available()) {
+        String line = input.readStringUntil('\n');
+        line.trim();
+        if (line.isEmpty() || deserializeJson(doc, line, DeserializationOption::Filter(filter))) {
+            continue;
+        }
+        String sessionId = doc["sessionId"] | String("");
+        ArchiveSegment* segment = findSegment(sessionId);
+        if (!segment) {
+            segment = addSegment(sessionId);
+        }
+        if (!out || outSession != sessionId) {
+            if (out) {
+                out.close();
+            }
+            out = flashOpen(kFlashArchive, segment->info.path, FILE_APPEND);
+            outSession = sessionId;
+            if (!out) {
+                Serial.printf("[E] archive migrate open failed: %s\n", segment->info.path.c_str());
+                ok = false;
+                break;
+            }
+        }
+        if (out.println(line) == 0) {
+            ok = false;
+            break;
+        }
+        segment->info.bytes += line.length() + 2;
+        segment->info.rawBytes = segment->info.bytes;
+        noteArchived(segment->info, doc["archivedAt"] | 0);
+        migrated++;
+    }
+    if (out) {
+        out.close();
+    }
+    input.close();
+
+    const String& current = S().session.sessionId;
+    for (ArchiveSegment& segment : g_segments) {
+        recountSegment(segment.info);
+        segment.info.sealed = segment.info.sessionId != current;
+    }
+    if (!ok || !saveArchiveManifest()) {
+        // Keep the legacy file; the next boot retries from a clean slate.
+        Serial.println("[E] archive migrate failed");
+        for (const ArchiveSegment& segment : g_segments) {
+            flashRemove(kFlashArchive, segment.info.path);
+        }
+        flashRemove(kFlashArchive, kArchiveManifestPath);
+        g_segments.clear();
+        return;
+    }
+    flashRemove(kFlashArchive, kLegacyArchivePath);
+    if (LittleFS.exists(kLegacyArchiveIndexPath)) {
+        flashRemove(kFlashArchiveIndex, kLegacyArchiveIndexPath);
+    }
+    Serial.printf("[ARCHIVE] migrated %u orders into %u segments, %u ms\n", static_cast<unsigned>(migrated),
+                  static_cast<unsigned>(g_segments.size()), static_cast<unsigned>(millis() - startedMs));
+}
+
+static bool ensureArchiveManifest() {
+    if (g_manifestLoaded) {
+        return true;
+    }
+    if (!ensureArchiveDir()) {
+        return false;
+    }
+    loadArchiveManifest();
+    if (LittleFS.exists(kLegacyArchivePath)) {
+        if (!g_segments.empty()) {
+            // A half-finished migration; start it over from the legacy file.
+            for (const ArchiveSegment& segment : g_segments) {
+                flashRemove(kFlashArchive, segment.info.path);
+            }
+            g_segments.clear();
+        }
+        migrateLegacyArchive();
+    }
+    if (g_manifestDirty) {
+        saveArchiveManifest();
+    }
+    g_manifestLoaded = true;
+    return true;
+}
+
+
+// Parses one archive line into doc (reused across lines); false when it is malformed or belongs
+// to another session.
+static bool parseArchiveLine(JsonDocument& doc, const String& line, const String& sessionIdFilter, String& sessionId,
+                             Order& order, uint32_t& archivedAt, uint32_t* rev = nullptr) {
+    DeserializationError err = deserializeJson(doc, line);
+    if (err) {
+        Serial.printf("[E] archive parse failed: %s\n", err.c_str());
+        return false;
+    }
+
+    sessionId = doc["sessionId"] | String("");
+    if (!sessionIdFilter.isEmpty() && sessionId != sessionIdFilter) {
+        return false;
+    }
+
+    JsonVariantConst orderVar = doc["order"];
+    if (!orderVar.is<JsonObjectConst>()) {
+        Serial.println("[E] archive order invalid");
+        return false;
+    }
+
+    order = Order();
+    if (!orderFromJson(orderVar, order)) {
+        JsonObjectConst orderObj = orderVar.as<JsonObjectConst>();
+        order.orderNo = orderObj["orderNo"] | String("");
+        if (order.orderNo.isEmpty()) {
+            Serial.println("[E] archive order missing id");
+            return false;
+        }
+
+        order.status = orderObj["status"] | String("COOKING");
+        order.ts = orderObj["ts"] | 0;
+        order.printed = orderObj["printed"] | false;
+        order.cooked = orderObj["cooked"] | false;
+        order.pickup_called = orderObj["pickup_called"] | false;
+        order.picked_up = orderObj["picked_up"] | false;
+        order.cancelReason = orderObj["cancelReason"] | String("");
+
+        order.items.clear();
+        JsonArrayConst items = orderObj["items"].as<JsonArrayConst>();
+        if (items) {
+            for (JsonVariantConst iv : items) {
+                if (!iv.is<JsonObjectConst>()) {
+                    continue;
+                }
+                JsonObjectConst itemObj = iv.as<JsonObjectConst>();
+                LineItem li;
+                li.sku = itemObj["sku"] | String("");
+                li.name = itemObj["name"] | String("");
+                li.qty = itemObj["qty"] | 1;
+                li.unitPriceApplied = itemObj["unitPriceApplied"] | 0;
+                li.priceMode = itemObj["priceMode"] | String("");
+                li.kind = itemObj["kind"] | String("");
+                li.unitPrice = itemObj["unitPrice"] | 0;
+                li.discountName = itemObj["discountName"] | String("");
+                li.discountValue = itemObj["discountValue"] | 0;
+                order.items.push_back(li);
+            }
+        }
+    }
+
+    archivedAt = doc["archivedAt"] | 0;
+    if (rev) {
+        *rev = doc["rev"] | 0;
+    }
+    return true;
+}
+
+static bool loadSupersededOffsets(const String& segmentPath, std::vector<uint32_t>& out) {
+    out.clear();
+    String path = segmentSidePath(segmentPath, ".sup");
+    if (!LittleFS.exists(path)) {
+        return true;
+    }
+    FlashFile file = flashOpen(kFlashArchiveIndex, path, "r");
+    if (!file) {
+        return false;
+    }
+    out.reserve(file.size() / 4);
+    uint8_t raw[4];
+    while (file.read(raw, sizeof(raw)) == sizeof(raw)) {
+        out.push_back(getLe32(raw));
+    }
+    file.close();
+    std::sort(out.begin(), out.end());
+    return true;
+}
+
+static bool writeSupersededOffsets(const String& segmentPath, const std::vector<uint32_t>& offsets, bool truncate) {
+    String path = segmentSidePath(segmentPath, ".sup");
+    if (offsets.empty() && !truncate) {
+        return true;
+    }
+    FlashFile file = flashOpen(kFlashArchiveIndex, path, truncate ? FILE_WRITE : FILE_APPEND);
+    if (!file) {
+        Serial.printf("[E] archive sup open failed: %s\n", path.c_str());
+        return false;
+    }
+    bool ok = true;
+    for (uint32_t offset : offsets) {
+        uint8_t raw[4];
+        putLe32(raw, offset);
+        ok = file.write(raw, sizeof(raw)) == sizeof(raw) && ok;
+    }
+    file.close();
+    return ok;
+}
+
+
+
+static bool scanSegment(const String& path, const String& sessionIdFilter, ArchiveOrderVisitor visitor, void* context) {
+    SegmentReader file;
+    if (!file.open(kFlashArchive, path)) {
+        return true;
+    }
+
+    std::vector<uint32_t> superseded;
+    loadSupersededOffsets(path, superseded);
+
+    JsonArenaLease arena;
+    JsonDocument doc(arena.allocator());
+    String sessionId;
+    Order order;
+    while (file.available()) {
+        uint32_t offset = file.position();
+        String line = file.readLine();
+        line.trim();
+        if (line.isEmpty()) {
+            continue;
+        }
+        if (!superseded.empty() && std::binary_search(superseded.begin(), superseded.end(), offset)) {
+            continue;
+        }
+
+        uint32_t archivedAt = 0;
+        if (!parseArchiveLine(doc, line, sessionIdFilter, sessionId, order, archivedAt)) {
+            continue;
+        }
+        if (visitor && !visitor(order, sessionId, archivedAt, context)) {
+            file.close();
+            return false;
+        }
+    }
+
+    file.close();
+    return true;
+}
+
+static bool ensureSegmentIndex(ArchiveSegment& segment);
+
+bool archiveForEach(const String& sessionIdFilter, ArchiveOrderVisitor visitor, void* context) {
+    ArchiveLock lock;
+    if (!ensureArchiveManifest()) {
+        return false;
+    }
+    // The index check also brings the .sup sidecar up to date after an interrupted amendment.
+    if (!sessionIdFilter.isEmpty()) {
+        ArchiveSegment* segment = findSegment(sessionIdFilter);
+        if (segment) {
+            ensureSegmentIndex(*segment);
+            scanSegment(segment->info.path, sessionIdFilter, visitor, context);
+        }
+        return true;
+    }
+
+    std::vector<String> paths;
+    paths.reserve(g_segments.size());
+    for (ArchiveSegment& segment : g_segments) {
+        ensureSegmentIndex(segment);
+        paths.push_back(segment.info.path);
+    }
+    for (const String& path : paths) {
+        if (!scanSegment(path, sessionIdFilter, visitor, context)) {
+            break;
+        }
+    }
+    return true;
+}
+
+// Each segment has a sidecar index: an 8-byte header followed by one {crc32(sessionId "\n" orderNo), byte offset}
+// entry per archive line, appended in archive order. Lookups scan it newest-first and then seek
+// straight to the matching line; a key collision just costs one extra line parse.
+static const uint32_t kArchiveIndexMagic = 0x4958444B; // "KDXI"
+static const uint16_t kArchiveIndexVersion = 1;
+static const size_t kArchiveIndexHeaderSize = 8;
+static const size_t kArchiveIndexEntrySize = 8;
+static const size_t kArchiveIndexBlockEntries = 64;
+
+static uint32_t archiveIndexKey(const String& sessionId, const String& orderNo) {
+    static const uint8_t kSeparator = '\n';
+    uint32_t crc = crc32Update(0, reinterpret_cast<const uint8_t*>(sessionId.c_str()), sessionId.length());
+    crc = crc32Update(crc, &kSeparator, 1);
+    return crc32Update(crc, reinterpret_cast<const uint8_t*>(orderNo.c_str()), orderNo.length());
+}
+
+class ArchiveIndexWriter {
+public:
+    explicit ArchiveIndexWriter(File& file) : file_(file) {}
+
+    bool writeHeader() {
+        uint8_t header[kArchiveIndexHeaderSize] = {};
+        putLe32(header, kArchiveIndexMagic);
+        header[4] = static_cast<uint8_t>(kArchiveIndexVersion);
+        header[5] = static_cast<uint8_t>(kArchiveIndexVersion >> 8);
+        return file_.write(header, sizeof(header)) == sizeof(header);
+    }
+
+    void add(uint32_t key, uint32_t offset) {
+        putLe32(buffer_ + used_, key);
+        putLe32(buffer_ + used_ + 4, offset);
+        used_ += kArchiveIndexEntrySize;
+        if (used_ == sizeof(buffer_)) {
+            flush();
+        }
+    }
+
+    bool flush() {
+        if (used_ > 0 && file_.write(buffer_, used_) != used_) {
+            ok_ = false;
+        }
+        used_ = 0;
+        return ok_;
+    }
+
+private:
+    File& file_;
+    uint8_t buffer_[kArchiveIndexBlockEntries * kArchiveIndexEntrySize];
+    size_t used_{0};
+    bool ok_{true};
+};
+
+
+// Indexes every segment line from startOffset on and collects the offsets amendments supersede.
+// Only sessionId, orderNo and supersedes are deserialized.
+static bool indexSegmentFrom(const String& path, uint32_t startOffset, ArchiveIndexWriter& writer, uint32_t& indexed,
+                             std::vector<uint32_t>& superseded) {
+    SegmentReader archive;
+    if (!archive.open(kFlashArchive, path)) {
+        return false;
+    }
+    if (startOffset > 0 && !archive.seek(startOffset)) {
+        archive.close();
+        return false;
+    }
+
+    JsonDocument filter;
+    filter["sessionId"] = true;
+    filter["order"]["orderNo"] = true;
+    filter["supersedes"] = true;
+    JsonArenaLease arena;
+    JsonDocument doc(arena.allocator());
+    while (archive.available()) {
+        uint32_t offset = archive.position();
+        String line = archive.readLine();
+        line.trim();
+        if (line.isEmpty()) {
+            continue;
+        }
+        if (deserializeJson(doc, line, DeserializationOption::Filter(filter))) {
+            continue;
+        }
+        String sessionId = doc["sessionId"] | String("");
+        String orderNo = doc["order"]["orderNo"] | String("");
+        if (orderNo.isEmpty()) {
+            continue;
+        }
+        writer.add(archiveIndexKey(sessionId, orderNo), offset);
+        indexed++;
+        if (doc["supersedes"].is<uint32_t>()) {
+            superseded.push_back(doc["supersedes"].as<uint32_t>());
+        }
+    }
+    bool ok = archive.ok();
+    archive.close();
+    return writer.flush() && ok;
+}
+
+static bool rebuildSegmentIndex(const ArchiveSegment& segment) {
+    uint32_t startedMs = millis();
+    String indexPath = segmentSidePath(segment.info.path, ".idx");
+    String tmpPath = segmentSidePath(segment.info.path, ".itmp");
+    FlashFile index = flashOpen(kFlashArchiveIndex, tmpPath, FILE_WRITE);
+    if (!index) {
+        Serial.printf("[E] archive index open failed: %s\n", tmpPath.c_str());
+        return false;
+    }
+    ArchiveIndexWriter writer(index);
+    uint32_t indexed = 0;
+    std::vector<uint32_t> superseded;
+    bool ok = writer.writeHeader() && indexSegmentFrom(segment.info.path, 0, writer, indexed, superseded);
+    index.close();
+    ok = ok && writeSupersededOffsets(segment.info.path, superseded, true);
+    if (!ok) {
+        Serial.println("[E] archive index rebuild failed");
+        flashRemove(kFlashArchiveIndex, tmpPath);
+        return false;
+    }
+    if (LittleFS.exists(indexPath)) {
+        flashRemove(kFlashArchiveIndex, indexPath);
+    }
+    if (!flashRename(kFlashArchiveIndex, tmpPath, indexPath)) {
+        Serial.printf("[E] archive index rename failed: %s\n", tmpPath.c_str());
+        flashRemove(kFlashArchiveIndex, tmpPath);
+        return false;
+    }
+    Serial.printf("[ARCHIVE] index rebuilt: %s (%u entries, %u ms)\n", indexPath.c_str(), static_cast<unsigned>(indexed),
+                  static_cast<unsigned>(millis() - startedMs));
+    return true;
+}
+
+// Verifies a segment's index once per boot (or after a failed update) and catches up on lines
+// appended after the last entry, e.g. when power was lost between the segment and index writes.
+static bool ensureSegmentIndex(ArchiveSegment& segment) {
+    if (segment.indexReady) {
+        return true;
+    }
+    String indexPath = segmentSidePath(segment.info.path, ".idx");
+    if (!LittleFS.exists(segment.info.path)) {
+        if (LittleFS.exists(indexPath)) {
+            flashRemove(kFlashArchiveIndex, indexPath);
+        }
+        segment.indexReady = true;
+        return true;
+    }
+
+    SegmentReader archive;
+    if (!archive.open(kFlashArchive, segment.info.path)) {
+        return false;
+    }
+    uint32_t archiveSize = archive.size();
+
+    bool usable = false;
+    uint32_t catchUpFrom = 0;
+    FlashFile index = LittleFS.exists(indexPath) ? flashOpen(kFlashArchiveIndex, indexPath, "r") : FlashFile();
+    if (index) {
+        uint8_t header[kArchiveIndexHeaderSize];
+        size_t indexSize = index.size();
+        if (indexSize >= kArchiveIndexHeaderSize && (indexSize - kArchiveIndexHeaderSize) % kArchiveIndexEntrySize == 0 &&
+            index.read(header, sizeof(header)) == sizeof(header) && getLe32(header) == kArchiveIndexMagic &&
+            static_cast<uint16_t>(header[4] | (header[5] << 8)) == kArchiveIndexVersion) {
+            usable = true;
+            if (indexSize > kArchiveIndexHeaderSize) {
+                uint8_t last[kArchiveIndexEntrySize];
+                uint32_t lastOffset = 0;
+                if (index.seek(indexSize - kArchiveIndexEntrySize) && index.read(last, sizeof(last)) == sizeof(last)) {
+                    lastOffset = getLe32(last + 4);
+                } else {
+                    usable = false;
+                }
+                if (usable && lastOffset < archiveSize && archive.seek(lastOffset)) {
+                    archive.readLine();
+                    catchUpFrom = archive.position();
+                } else {
+                    usable = false;
+                }
+            }
+        }
+        index.close();
+    }
+    archive.close();
+    if (usable && segment.info.amendments > 0 && !LittleFS.exists(segmentSidePath(segment.info.path, ".sup"))) {
+        usable = false;
+    }
+
+    if (!usable) {
+        segment.indexReady = rebuildSegmentIndex(segment);
+        return segment.indexReady;
+    }
+    if (catchUpFrom < archiveSize) {
+        FlashFile append = flashOpen(kFlashArchiveIndex, indexPath, FILE_APPEND);
+        if (!append) {
+            return false;
+        }
+        ArchiveIndexWriter writer(append);
+        uint32_t indexed = 0;
+        std::vector<uint32_t> superseded;
+        bool ok = indexSegmentFrom(segment.info.path, catchUpFrom, writer, indexed, superseded);
+        append.close();
+        ok = ok && writeSupersededOffsets(segment.info.path, superseded, false);
+        if (!ok) {
+            segment.indexReady = rebuildSegmentIndex(segment);
+            return segment.indexReady;
+        }
+        if (indexed > 0) {
+            Serial.printf("[ARCHIVE] index caught up: %s (%u entries)\n", indexPath.c_str(), static_cast<unsigned>(indexed));
+        }
+    }
+    segment.indexReady = true;
+    return true;
+}
+
+static bool appendSegmentIndexEntry(const ArchiveSegment& segment, const String& orderNo, uint32_t offset) {
+    FlashFile index = flashOpen(kFlashArchiveIndex, segmentSidePath(segment.info.path, ".idx"), FILE_APPEND);
+    if (!index) {
+        return false;
+    }
+    ArchiveIndexWriter writer(index);
+    bool ok = true;
+    if (index.size() == 0) {
+        ok = writer.writeHeader();
+    }
+    writer.add(archiveIndexKey(segment.info.sessionId, orderNo), offset);
+    ok = writer.flush() && ok;
+    index.close();
+    return ok;
+}
+
+// Bloom filters get at least 12 bits per indexed entry (about 0.4% false positives with 6
+// probes), with a quarter again for growth, and are rebuilt from the index at twice the size
+// once they fill up.
+static const uint32_t kArchiveBloomBitsPerKey = 12;
+static const uint32_t kArchiveBloomProbes = 6;
+static const size_t kArchiveBloomMinBytes = 512;
+static const size_t kArchiveBloomMaxBytes = 8192;
+
+static std::vector<ArchiveBloomFilter> g_restoredBlooms;
+static ArchiveBloomStats g_bloomStats;
+
+static size_t bloomBytesFor(uint32_t entries) {
+    uint64_t bits = (static_cast<uint64_t>(entries) + entries / 4 + 64) * kArchiveBloomBitsPerKey;
+    size_t bytes = kArchiveBloomMinBytes;
+    while (bytes < kArchiveBloomMaxBytes && bytes * 8 < bits) {
+        bytes *= 2;
+    }
+    return bytes;
+}
+
+static bool bloomFull(const ArchiveBloomFilter& bloom) {
+    return bloom.bits.size() < kArchiveBloomMaxBytes &&
+           static_cast<uint64_t>(bloom.entries) * kArchiveBloomBitsPerKey > bloom.bits.size() * 8;
+}
+
+// Double hashing on the index key, which is already a CRC of session and orderNo.
+static uint32_t bloomStep(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x7FEB352D;
+    key ^= key >> 15;
+    return key | 1;
+}
+
+static void bloomAdd(ArchiveBloomFilter& bloom, uint32_t key) {
+    const uint32_t mask = static_cast<uint32_t>(bloom.bits.size() * 8 - 1);
+    const uint32_t step = bloomStep(key);
+    for (uint32_t i = 0; i < kArchiveBloomProbes; ++i) {
+        uint32_t bit = (key + i * step) & mask;
+        bloom.bits[bit >> 3] |= static_cast<uint8_t>(1 << (bit & 7));
+    }
+}
+
+static bool bloomMayContain(const ArchiveBloomFilter& bloom, uint32_t key) {
+    const uint32_t mask = static_cast<uint32_t>(bloom.bits.size() * 8 - 1);
+    const uint32_t step = bloomStep(key);
+    for (uint32_t i = 0; i < kArchiveBloomProbes; ++i) {
+        uint32_t bit = (key + i * step) & mask;
+        if (!(bloom.bits[bit >> 3] & (1 << (bit & 7)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bloomSizeValid(size_t bytes) {
+    return bytes >= kArchiveBloomMinBytes && bytes <= kArchiveBloomMaxBytes && (bytes & (bytes - 1)) == 0;
+}
+
+static bool takeRestoredBloom(const String& sessionId, ArchiveBloomFilter& out) {
+    for (auto it = g_restoredBlooms.begin(); it != g_restoredBlooms.end(); ++it) {
+        if (it->sessionId == sessionId) {
+            out = std::move(*it);
+            g_restoredBlooms.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Builds the segment's filter from its index, or adopts the snapshot's copy when the index still
+// agrees with it and folds in only the entries added since.
+static bool ensureSegmentBloom(ArchiveSegment& segment) {
+    if (!segment.bloom.bits.empty() && !bloomFull(segment.bloom)) {
+        return true;
+    }
+    if (!ensureSegmentIndex(segment)) {
+        return false;
+    }
+    String indexPath = segmentSidePath(segment.info.path, ".idx");
+    FlashFile index = LittleFS.exists(indexPath) ? flashOpen(kFlashArchiveIndex, indexPath, "r") : FlashFile();
+    if (!index && LittleFS.exists(segment.info.path)) {
+        return false;
+    }
+    uint32_t total = index && index.size() > kArchiveIndexHeaderSize
+                         ? (index.size() - kArchiveIndexHeaderSize) / kArchiveIndexEntrySize
+                         : 0;
+
+    ArchiveBloomFilter bloom;
+    uint8_t entry[kArchiveIndexEntrySize];
+    if (segment.bloom.bits.empty() && takeRestoredBloom(segment.info.sessionId, bloom)) {
+        bool matches = bloomSizeValid(bloom.bits.size()) && bloom.entries <= total;
+        if (matches && bloom.entries > 0) {
+            matches = index.seek(kArchiveIndexHeaderSize + (bloom.entries - 1) * kArchiveIndexEntrySize) &&
+                      index.read(entry, sizeof(entry)) == sizeof(entry) && getLe32(entry) == bloom.lastKey &&
+                      getLe32(entry + 4) == bloom.lastOffset;
+        }
+        if (matches && bloom.bits.size() < bloomBytesFor(total) / 2) {
+            matches = false;
+        }
+        if (matches) {
+            g_bloomStats.restored++;
+        } else {
+            bloom = ArchiveBloomFilter();
+        }
+    }
+    if (bloom.bits.empty()) {
+        bloom.bits.assign(bloomBytesFor(total), 0);
+        g_bloomStats.rebuilds++;
+    }
+    bloom.sessionId = segment.info.sessionId;
+
+    uint8_t block[kArchiveIndexBlockEntries * kArchiveIndexEntrySize];
+    bool ok = true;
+    while (bloom.entries < total) {
+        size_t count = std::min<size_t>(total - bloom.entries, kArchiveIndexBlockEntries);
+        size_t bytes = count * kArchiveIndexEntrySize;
+        if (!index.seek(kArchiveIndexHeaderSize + bloom.entries * kArchiveIndexEntrySize) ||
+            index.read(block, bytes) != bytes) {
+            ok = false;
+            break;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            bloom.lastKey = getLe32(block + i * kArchiveIndexEntrySize);
+            bloom.lastOffset = getLe32(block + i * kArchiveIndexEntrySize + 4);
+            bloomAdd(bloom, bloom.lastKey);
+        }
+        bloom.entries += count;
+    }
+    if (index) {
+        index.close();
+    }
+    if (!ok) {
+        return false;
+    }
+    segment.bloom = std::move(bloom);
+    return true;
+}
+
+// Keeps a built filter in step with an index entry just written for this segment.
+static void noteBloomEntry(ArchiveSegment& segment, const String& orderNo, uint32_t offset, bool indexed) {
+    if (segment.bloom.bits.empty()) {
+        return;
+    }
+    if (!indexed) {
+        // The index catch-up will add this entry; rebuild from it rather than drift.
+        segment.bloom = ArchiveBloomFilter();
+        return;
+    }
+    segment.bloom.lastKey = archiveIndexKey(segment.info.sessionId, orderNo);
+    segment.bloom.lastOffset = offset;
+    segment.bloom.entries++;
+    bloomAdd(segment.bloom, segment.bloom.lastKey);
+}
+
+enum ArchiveLookupResult {
+    kArchiveLookupFound,
+    kArchiveLookupMissing,
+    kArchiveLookupUnavailable,
+};
+
+// Scans newest-first, so the latest version of an amended order is the one found.
+static ArchiveLookupResult archiveIndexLookup(ArchiveSegment& segment, const String& orderNo, Order* outOrder,
+                                              uint32_t* archivedAt, uint32_t* outOffset = nullptr,
+                                              uint32_t* outRev = nullptr) {
+    if (!ensureSegmentIndex(segment)) {
+        return kArchiveLookupUnavailable;
+    }
+    String indexPath = segmentSidePath(segment.info.path, ".idx");
+    if (!LittleFS.exists(indexPath)) {
+        return LittleFS.exists(segment.info.path) ? kArchiveLookupUnavailable : kArchiveLookupMissing;
+    }
+    FlashFile index = flashOpen(kFlashArchiveIndex, indexPath, "r");
+    if (!index) {
+        return kArchiveLookupUnavailable;
+    }
+
+    const String& sessionId = segment.info.sessionId;
+    const uint32_t key = archiveIndexKey(sessionId, orderNo);
+    uint8_t block[kArchiveIndexBlockEntries * kArchiveIndexEntrySize];
+    size_t remaining = (index.size() - kArchiveIndexHeaderSize) / kArchiveIndexEntrySize;
+    SegmentReader archive;
+    JsonArenaLease arena;
+    JsonDocument doc(arena.allocator());
+    String storedSession;
+    Order order;
+    ArchiveLookupResult result = kArchiveLookupMissing;
+    while (remaining > 0 && result == kArchiveLookupMissing) {
+        size_t count = std::min(remaining, kArchiveIndexBlockEntries);
+        remaining -= count;
+        size_t bytes = count * kArchiveIndexEntrySize;
+        if (!index.seek(kArchiveIndexHeaderSize + remaining * kArchiveIndexEntrySize) ||
+            index.read(block, bytes) != bytes) {
+            result = kArchiveLookupUnavailable;
+            break;
+        }
+        for (size_t i = count; i-- > 0;) {
+            const uint8_t* entry = block + i * kArchiveIndexEntrySize;
+            if (getLe32(entry) != key) {
+                continue;
+            }
+            if (!archive.isOpen() && !archive.open(kFlashArchive, segment.info.path)) {
+                result = kArchiveLookupUnavailable;
+                break;
+            }
+            uint32_t storedAt = 0;
+            uint32_t storedRev = 0;
+            uint32_t offset = getLe32(entry + 4);
+            if (!archive.seek(offset)) {
+                continue;
+            }
+            String line = archive.readLine();
+            line.trim();
+            if (parseArchiveLine(doc, line, sessionId, storedSession, order, storedAt, &storedRev) && order.orderNo == orderNo) {
+                if (outOrder) {
+                    *outOrder = std::move(order);
+                }
+                if (archivedAt) {
+                    *archivedAt = storedAt;
+                }
+                if (outOffset) {
+                    *outOffset = offset;
+                }
+                if (outRev) {
+                    *outRev = storedRev;
+                }
+                result = kArchiveLookupFound;
+                break;
+            }
+        }
+    }
+    archive.close();
+    index.close();
+    if (result == kArchiveLookupUnavailable) {
+        segment.indexReady = false;
+    }
+    return result;
+}
+
+bool archiveFindOrder(const String& sessionIdFilter, const String& orderNo, Order& outOrder, uint32_t* archivedAt) {
+    ArchiveLock lock;
+    struct FindCtx {
+        const String* targetOrderNo{nullptr};
+        Order* out{nullptr};
+        uint32_t* archivedAtPtr{nullptr};
+        bool found{false};
+        FindCtx(const String& target, Order& dest, uint32_t* archivedPtr)
+          : targetOrderNo(&target), out(&dest), archivedAtPtr(archivedPtr) {}
+    } ctx(orderNo, outOrder, archivedAt);
+
+    auto visitor = [](const Order& order, const String&, uint32_t archivedAtValue, void* rawCtx) -> bool {
+        auto* c = static_cast<FindCtx*>(rawCtx);
+        if (c && c->targetOrderNo && order.orderNo == *c->targetOrderNo) {
+            if (c->out) {
+                *c->out = order;
+            }
+            if (c->archivedAtPtr) {
+                *c->archivedAtPtr = archivedAtValue;
+            }
+            c->found = true;
+            return false;
+        }
+        return true;
+    };
+
+    if (!sessionIdFilter.isEmpty() && ensureArchiveManifest()) {
+        ArchiveSegment* segment = findSegment(sessionIdFilter);
+        if (!segment) {
+            return false;
+        }
+        ArchiveLookupResult indexed = archiveIndexLookup(*segment, orderNo, &outOrder, archivedAt);
+        if (indexed != kArchiveLookupUnavailable) {
+            return indexed == kArchiveLookupFound;
+        }
+    }
+
+    archiveForEach(sessionIdFilter, visitor, &ctx);
+    return ctx.found;
+}
+
+bool archiveOrderExists(const String& sessionId, const String& orderNo) {
+    ArchiveLock lock;
+    struct ExistsCtx {
+        const String* targetOrderNo{nullptr};
+        bool found{false};
+        explicit ExistsCtx(const String& target) : targetOrderNo(&target) {}
+    } ctx(orderNo);
+
+    auto visitor = [](const Order& order, const String&, uint32_t, void* rawCtx) -> bool {
+        auto* c = static_cast<ExistsCtx*>(rawCtx);
+        if (c && c->targetOrderNo && order.orderNo == *c->targetOrderNo) {
+            c->found = true;
+            return false;
+        }
+        return true;
+    };
+
+    if (!sessionId.isEmpty() && ensureArchiveManifest()) {
+        ArchiveSegment* segment = findSegment(sessionId);
+        if (!segment) {
+            return false;
+        }
+        g_bloomStats.checks++;
+        bool filtered = ensureSegmentBloom(*segment);
+        if (filtered && !bloomMayContain(segment->bloom, archiveIndexKey(sessionId, orderNo))) {
+            g_bloomStats.definitelyNot++;
+            return false;
+        }
+        ArchiveLookupResult indexed = archiveIndexLookup(*segment, orderNo, nullptr, nullptr);
+        if (indexed != kArchiveLookupUnavailable) {
+            if (filtered && indexed == kArchiveLookupMissing) {
+                g_bloomStats.falsePositives++;
+            }
+            return indexed == kArchiveLookupFound;
+        }
+    }
+
+    archiveForEach(sessionId, visitor, &ctx);
+    return ctx.found;
+}
+
+// Puts tmpPath in place of a segment file; a power cut in between leaves <segment>.bak, which the
+// next manifest load renames back.
+static bool swapSegmentFile(const String& path, const String& tmpPath) {
+    String backupPath = path + ".bak";
+    if (!flashRename(kFlashArchiveCompaction, path, backupPath)) {
+        return false;
+    }
+    if (!flashRename(kFlashArchiveCompaction, tmpPath, path)) {
+        flashRename(kFlashArchiveCompaction, backupPath, path);
+        return false;
+    }
+    flashRemove(kFlashArchiveCompaction, backupPath);
+    return true;
+}
+
+// Containers cannot be appended to, so a late line for a compressed segment turns it back into
+// plain JSONL first. The byte stream is unchanged, so the sidecars stay valid.
+static bool decompressSegment(ArchiveSegment& segment) {
+    const String& path = segment.info.path;
+    String tmpPath = segmentSidePath(path, ".ztmp");
+    SegmentReader in;
+    if (!in.open(kFlashArchiveCompaction, path)) {
+        return false;
+    }
+    if (!in.compressed()) {
+        in.close();
+        segment.info.compressed = false;
+        return true;
+    }
+    FlashFile out = flashOpen(kFlashArchiveCompaction, tmpPath, FILE_WRITE);
+    bool ok = out;
+    uint8_t chunk[512];
+    while (ok && in.available()) {
+        size_t n = in.read(chunk, sizeof(chunk));
+        ok = n > 0 && out.write(chunk, n) == n;
+    }
+    ok = ok && in.ok();
+    uint32_t rawBytes = in.size();
+    in.close();
+    if (out) {
+        out.close();
+    }
+    if (!ok || !swapSegmentFile(path, tmpPath)) {
+        Serial.printf("[E] archive decompress failed: %s\n", path.c_str());
+        flashRemove(kFlashArchiveCompaction, tmpPath);
+        return false;
+    }
+    segment.info.bytes = rawBytes;
+    segment.info.rawBytes = rawBytes;
+    segment.info.compressed = false;
+    g_manifestDirty = true;
+    Serial.printf("[ARCHIVE] decompressed %s for append (%u bytes)\n", path.c_str(), static_cast<unsigned>(rawBytes));
+    return true;
+}
+
+static bool appendSegmentLine(ArchiveSegment& segment, const String& line, uint32_t& offset) {
+    const String& path = segment.info.path;
+    if (segment.info.compressed && !decompressSegment(segment)) {
+        return false;
+    }
+    FlashFile file = flashOpen(kFlashArchive, path, FILE_APPEND);
+    if (!file) {
+        file = flashOpen(kFlashArchive, path, FILE_WRITE);
+    }
+    if (!file) {
+        Serial.printf("[E] archive open failed: %s\n", path.c_str());
+        return false;
+    }
+    offset = static_cast<uint32_t>(file.size());
+
+    size_t written = file.println(line);
+    file.flush();
+    file.close();
+    if (written == 0) {
+        Serial.println("[E] archive write failed");
+        return false;
+    }
+    segment.info.bytes = offset + written;
+    segment.info.rawBytes = segment.info.bytes;
+    g_manifestDirty = true;
+    return true;
+}
+
+static String serializeArchiveLine(const Order& order, const String& sessionId, uint32_t archivedAt, uint32_t rev,
+                                   uint32_t supersedes) {
+    JsonArenaLease arena;
+    JsonDocument doc(arena.allocator());
+    JsonObject root = doc.to<JsonObject>();
+    root["sessionId"] = sessionId;
+    root["archivedAt"] = archivedAt;
+    if (rev > 0) {
+        root["rev"] = rev;
+        root["supersedes"] = supersedes;
+    }
+    JsonObject orderObj = root.createNestedObject("order");
+    orderToJson(orderObj, order);
+
+    String line;
+    serializeJson(root, line);
+    return line;
+}
+
+bool archiveAppend(const Order& order, const String& sessionId, uint32_t archivedAt) {
+    ArchiveLock lock;
+    if (archivedAt == 0) {
+        archivedAt = static_cast<uint32_t>(time(nullptr));
+    }
+
+    if (!ensureArchiveManifest()) {
+        return false;
+    }
+
+    ArchiveSegment* segment = findSegment(sessionId);
+    if (!segment) {
+        segment = addSegment(sessionId);
+        // Register the segment before its first line so a crash cannot leave an orphan file.
+        saveArchiveManifest();
+    }
+
+    // Bring the index up to date first so the catch-up scan cannot index this line twice.
+    bool indexed = ensureSegmentIndex(*segment);
+
+    String line = serializeArchiveLine(order, sessionId, archivedAt, 0, 0);
+    if (line.isEmpty()) {
+        Serial.println("[E] archive serialize failed");
+        return false;
+    }
+
+    uint32_t offset = 0;
+    if (!appendSegmentLine(*segment, line, offset)) {
+        return false;
+    }
+    noteArchived(segment->info, archivedAt);
+    indexed = indexed && appendSegmentIndexEntry(*segment, order.orderNo, offset);
+    if (!indexed) {
+        segment->indexReady = false;
+    }
+    noteBloomEntry(*segment, order.orderNo, offset, indexed);
+    return true;
+}
+
+bool archiveReplaceOrder(const Order& order, const String& sessionId, uint32_t archivedAt) {
+    ArchiveLock lock;
+    ArchiveSegment* segment = ensureArchiveManifest() ? findSegment(sessionId) : nullptr;
+    if (!segment) {
+        Serial.printf("[E] archive replace segment missing: %s\n", sessionId.c_str());
+        return false;
+    }
+
+    uint32_t previousAt = 0;
+    uint32_t previousOffset = 0;
+    uint32_t previousRev = 0;
+    ArchiveLookupResult found = archiveIndexLookup(*segment, order.orderNo, nullptr, &previousAt, &previousOffset,
+                                                   &previousRev);
+    if (found != kArchiveLookupFound) {
+        Serial.printf("[E] archive replace target missing: %s\n", order.orderNo.c_str());
+        return false;
+    }
+    if (archivedAt == 0) {
+        archivedAt = previousAt;
+    }
+
+    String line = serializeArchiveLine(order, sessionId, archivedAt, previousRev + 1, previousOffset);
+    if (line.isEmpty()) {
+        Serial.println("[E] archive serialize failed");
+        return false;
+    }
+
+    uint32_t offset = 0;
+    if (!appendSegmentLine(*segment, line, offset)) {
+        return false;
+    }
+    segment->info.amendments++;
+    // .sup goes before the index entry: an index catch-up after a power cut re-reads the
+    // amendment's own "supersedes" field, so whatever the crash point the sidecars converge.
+    std::vector<uint32_t> superseded(1, previousOffset);
+    bool indexed = false;
+    if (!writeSupersededOffsets(segment->info.path, superseded, false)) {
+        flashRemove(kFlashArchiveIndex, segmentSidePath(segment->info.path, ".idx"));
+        segment->indexReady = false;
+    } else if (!appendSegmentIndexEntry(*segment, order.orderNo, offset)) {
+        segment->indexReady = false;
+    } else {
+        indexed = true;
+    }
+    noteBloomEntry(*segment, order.orderNo, offset, indexed);
+    return true;
+}
+
+bool archiveSealSession(const String& sessionId) {
+    ArchiveLock lock;
+    if (!ensureArchiveManifest()) {
+        return false;
+    }
+    ArchiveSegment* segment = findSegment(sessionId);
+    if (!segment || segment->info.sealed) {
+        return true;
+    }
+    segment->info.sealed = true;
+    g_manifestDirty = true;
+    Serial.printf("[ARCHIVE] sealed %s: %u orders, %u bytes\n", segment->info.path.c_str(),
+                  static_cast<unsigned>(segment->info.orders), static_cast<unsigned>(segment->info.bytes));
+    return saveArchiveManifest();
+}
+
+bool archiveFlushManifest() {
+    ArchiveLock lock;
+    if (!g_manifestLoaded || !g_manifestDirty) {
+        return true;
+    }
+    return saveArchiveManifest();
+}
+
+std::vector<ArchiveSegmentInfo> archiveListSegments() {
+    ArchiveLock lock;
+    std::vector<ArchiveSegmentInfo> out;
+    if (!ensureArchiveManifest()) {
+        return out;
+    }
+    out.reserve(g_segments.size());
+    for (const ArchiveSegment& segment : g_segments) {
+        out.push_back(segment.info);
+    }
+    return out;
+}
+
+// Background compaction: copies a segment's live lines into <segment>.ctmp a few at a time from
+// loop(), building the new index alongside, then swaps both in under the archive lock. Plain
+// appends that land meanwhile are copied as part of the tail; a new amendment restarts the job
+// because its "supersedes" offset refers to the old layout.
+static const uint32_t kCompactDeadRatioPct = 25;
+static const uint32_t kCompactMinDeadRecords = 16;
+static const uint32_t kCompactRecordsPerTick = 8;
+static const uint32_t kCompactCheckIntervalMs = 5000;
+
+struct CompactionJob {
+    bool active{false};
+    String sessionId;
+    String path;
+    std::vector<uint32_t> superseded;
+    uint32_t amendmentsAtStart{0};
+    uint32_t readOffset{0};
+    uint32_t bytesBefore{0};
+    uint32_t startedMs{0};
+};
+
+static CompactionJob g_compaction;
+static ArchiveCompactionStatus g_compactionStatus;
+static uint32_t g_lastCompactCheckMs = 0;
+
+static void abortCompaction(const char* reason) {
+    flashRemove(kFlashArchiveCompaction, segmentSidePath(g_compaction.path, ".ctmp"));
+    flashRemove(kFlashArchiveCompaction, segmentSidePath(g_compaction.path, ".itmp"));
+    Serial.printf("[ARCHIVE] compaction of %s aborted: %s\n", g_compaction.path.c_str(), reason);
+    g_compaction = CompactionJob();
+    g_compactionStatus.aborted++;
+}
+
+static ArchiveSegment* pickCompactionCandidate() {
+    ArchiveSegment* best = nullptr;
+    uint32_t bestDead = 0;
+    for (ArchiveSegment& segment : g_segments) {
+        uint32_t dead = segment.info.amendments;
+        uint32_t total = segment.info.orders + dead;
+        if (dead < kCompactMinDeadRecords || total == 0 || dead * 100 < total * kCompactDeadRatioPct) {
+            continue;
+        }
+        if (dead > bestDead) {
+            best = &segment;
+            bestDead = dead;
+        }
+    }
+    return best;
+}
+
+static bool startCompaction(ArchiveSegment& segment) {
+    if (!ensureSegmentIndex(segment)) {
+        return false;
+    }
+    CompactionJob job;
+    job.sessionId = segment.info.sessionId;
+    job.path = segment.info.path;
+    job.amendmentsAtStart = segment.info.amendments;
+    job.bytesBefore = segment.info.bytes;
+    job.startedMs = millis();
+    if (!loadSupersededOffsets(job.path, job.superseded)) {
+        return false;
+    }
+
+    FlashFile out = flashOpen(kFlashArchiveCompaction, segmentSidePath(job.path, ".ctmp"), FILE_WRITE);
+    FlashFile index = flashOpen(kFlashArchiveCompaction, segmentSidePath(job.path, ".itmp"), FILE_WRITE);
+    ArchiveIndexWriter writer(index);
+    bool ok = out && index && writer.writeHeader();
+    if (out) {
+        out.close();
+    }
+    if (index) {
+        index.close();
+    }
+    if (!ok) {
+        flashRemove(kFlashArchiveCompaction, segmentSidePath(job.path, ".ctmp"));
+        flashRemove(kFlashArchiveCompaction, segmentSidePath(job.path, ".itmp"));
+        return false;
+    }
+
+    job.active = true;
+    g_compaction = job;
+    g_compactionStatus.active = true;
+    g_compactionStatus.sessionId = job.sessionId;
+    g_compactionStatus.sourceBytes = job.bytesBefore;
+    g_compactionStatus.processedBytes = 0;
+    g_compactionStatus.recordsKept = 0;
+    g_compactionStatus.recordsDropped = 0;
+    Serial.printf("[ARCHIVE] compaction of %s started: %u orders, %u dead\n", job.path.c_str(),
+                  static_cast<unsigned>(segment.info.orders), static_cast<unsigned>(segment.info.amendments));
+    return true;
+}
+
+// Copies up to kCompactRecordsPerTick lines; returns true once the source has been fully read.
+static bool copyCompactionSlice(ArchiveSegment& segment, uint32_t startedMs, uint32_t budgetMs) {
+    SegmentReader in;
+    in.open(kFlashArchiveCompaction, g_compaction.path);
+    FlashFile out = flashOpen(kFlashArchiveCompaction, segmentSidePath(g_compaction.path, ".ctmp"), FILE_APPEND);
+    FlashFile index = flashOpen(kFlashArchiveCompaction, segmentSidePath(g_compaction.path, ".itmp"), FILE_APPEND);
+    if (!in.isOpen() || !out || !index || !in.seek(g_compaction.readOffset)) {
+        abortCompaction("open failed");
+        return false;
+    }
+    ArchiveIndexWriter writer(index);
+    uint32_t outOffset = static_cast<uint32_t>(out.size());
+    uint32_t copied = 0;
+    bool ok = true;
+    JsonArenaLease arena;
+    JsonDocument doc(arena.allocator());
+    while (in.available() && copied < kCompactRecordsPerTick && millis() - startedMs < budgetMs) {
+        uint32_t offset = in.position();
+        String line = in.readLine();
+        g_compaction.readOffset = in.position();
+        line.trim();
+        if (line.isEmpty()) {
+            continue;
+        }
+        copied++;
+        if (std::binary_search(g_compaction.superseded.begin(), g_compaction.superseded.end(), offset)) {
+            g_compactionStatus.recordsDropped++;
+            continue;
+        }
+
+        if (deserializeJson(doc, line)) {
+            // Unparseable lines are dropped by every reader already.
+            g_compactionStatus.recordsDropped++;
+            continue;
+        }
+        if (doc.containsKey("supersedes")) {
+            // The old version is gone and the offset would point into the new layout.
+            doc.remove("supersedes");
+            line = "";
+            serializeJson(doc, line);
+        }
+        String sessionId = doc["sessionId"] | String("");
+        String orderNo = doc["order"]["orderNo"] | String("");
+        size_t written = out.println(line);
+        if (written == 0) {
+            ok = false;
+            break;
+        }
+        if (!orderNo.isEmpty()) {
+            writer.add(archiveIndexKey(sessionId, orderNo), outOffset);
+        }
+        outOffset += written;
+        g_compactionStatus.recordsKept++;
+    }
+    bool done = !in.available();
+    ok = writer.flush() && in.ok() && ok;
+    in.close();
+    out.close();
+    index.close();
+    g_compactionStatus.processedBytes = g_compaction.readOffset;
+    g_compactionStatus.sourceBytes = segment.info.bytes;
+    if (!ok) {
+        abortCompaction("write failed");
+        return false;
+    }
+    return done;
+}
+
+static void finishCompaction(ArchiveSegment& segment) {
+    const String& path = g_compaction.path;
+    String compactPath = segmentSidePath(path, ".ctmp");
+    String indexTmpPath = segmentSidePath(path, ".itmp");
+    String indexPath = segmentSidePath(path, ".idx");
+    String backupPath = path + ".bak";
+
+    FlashFile compacted = flashOpen(kFlashArchiveCompaction, compactPath, "r");
+    uint32_t newBytes = compacted ? static_cast<uint32_t>(compacted.size()) : 0;
+    if (compacted) {
+        compacted.close();
+    }
+
+    // Sidecars go first: a crash after this point rebuilds them from whichever segment survives.
+    flashRemove(kFlashArchiveCompaction, indexPath);
+    flashRemove(kFlashArchiveCompaction, segmentSidePath(path, ".sup"));
+    segment.indexReady = false;
+    segment.bloom = ArchiveBloomFilter();
+    if (!flashRename(kFlashArchiveCompaction, path, backupPath)) {
+        abortCompaction("backup rename failed");
+        return;
+    }
+    if (!flashRename(kFlashArchiveCompaction, compactPath, path)) {
+        flashRename(kFlashArchiveCompaction, backupPath, path);
+        abortCompaction("swap rename failed");
+        return;
+    }
+    flashRemove(kFlashArchiveCompaction, backupPath);
+    segment.indexReady = flashRename(kFlashArchiveCompaction, indexTmpPath, indexPath);
+
+    uint32_t reclaimed = segment.info.bytes > newBytes ? segment.info.bytes - newBytes : 0;
+    segment.info.bytes = newBytes;
+    segment.info.rawBytes = newBytes;
+    segment.info.compressed = false;
+    segment.info.amendments = 0;
+    saveArchiveManifest();
+
+    g_compactionStatus.runs++;
+    g_compactionStatus.lastReclaimedBytes = reclaimed;
+    g_compactionStatus.reclaimedBytes += reclaimed;
+    g_compactionStatus.lastDurationMs = millis() - g_compaction.startedMs;
+    g_compactionStatus.processedBytes = g_compactionStatus.sourceBytes;
+    Serial.printf("[ARCHIVE] compacted %s: kept %u, dropped %u, reclaimed %u bytes in %u ms\n", path.c_str(),
+                  static_cast<unsigned>(g_compactionStatus.recordsKept),
+                  static_cast<unsigned>(g_compactionStatus.recordsDropped), static_cast<unsigned>(reclaimed),
+                  static_cast<unsigned>(g_compactionStatus.lastDurationMs));
+    g_compaction = CompactionJob();
+}
+
+// Compression of sealed segments runs on the same tick once no compaction is due, a block at a
+// time. The container stays open between ticks; appends that land meanwhile are just more input,
+// since the JSONL stream (and every offset into it) is carried over unchanged.
+static const uint32_t kCompressMinBytes = 2 * kLzBlockSize;
+
+struct CompressionJob {
+    bool active{false};
+    String path;
+    uint32_t readOffset{0};
+    uint32_t startedMs{0};
+};
+
+static CompressionJob g_compression;
+static FlashFile g_compressionOut;
+static std::unique_ptr<LzBlockWriter> g_compressionWriter;
+
+static void endCompression() {
+    if (g_compressionOut) {
+        g_compressionOut.close();
+    }
+    g_compressionWriter.reset();
+    g_compression = CompressionJob();
+}
+
+static void abortCompression(const char* reason) {
+    flashRemove(kFlashArchiveCompaction, segmentSidePath(g_compression.path, ".ztmp"));
+    Serial.printf("[ARCHIVE] compression of %s aborted: %s\n", g_compression.path.c_str(), reason);
+    endCompression();
+    g_compactionStatus.aborted++;
+}
+
+static ArchiveSegment* pickCompressionCandidate() {
+    if (!KDS_COMPRESSED_STORAGE) {
+        return nullptr;
+    }
+    for (ArchiveSegment& segment : g_segments) {
+        if (segment.info.sealed && !segment.info.compressed && segment.info.bytes >= kCompressMinBytes) {
+            return &segment;
+        }
+    }
+    return nullptr;
+}
+
+static bool startCompression(ArchiveSegment& segment) {
+    g_compression.path = segment.info.path;
+    g_compression.startedMs = millis();
+    g_compressionOut = flashOpen(kFlashArchiveCompaction, segmentSidePath(segment.info.path, ".ztmp"), FILE_WRITE);
+    g_compressionWriter.reset(new LzBlockWriter(g_compressionOut));
+    if (!g_compressionOut || !g_compressionWriter->begin()) {
+        abortCompression("open failed");
+        return false;
+    }
+    g_compression.active = true;
+    return true;
+}
+
+static void finishCompression(ArchiveSegment& segment) {
+    const String& path = g_compression.path;
+    String tmpPath = segmentSidePath(path, ".ztmp");
+    bool ok = g_compressionWriter->finish();
+    uint32_t rawBytes = g_compressionWriter->rawBytes();
+    uint32_t storedBytes = g_compressionWriter->storedBytes();
+    g_compressionOut.close();
+    if (!ok) {
+        abortCompression("write failed");
+        return;
+    }
+    if (!swapSegmentFile(path, tmpPath)) {
+        abortCompression("swap rename failed");
+        return;
+    }
+    segment.info.bytes = storedBytes;
+    segment.info.rawBytes = rawBytes;
+    segment.info.compressed = true;
+    g_compactionStatus.compressions++;
+    if (rawBytes > storedBytes) {
+        g_compactionStatus.compressionSavedBytes += rawBytes - storedBytes;
+    }
+    saveArchiveManifest();
+    Serial.printf("[ARCHIVE] compressed %s: %u -> %u bytes in %u ms\n", path.c_str(), static_cast<unsigned>(rawBytes),
+                  static_cast<unsigned>(storedBytes), static_cast<unsigned>(millis() - g_compression.startedMs));
+    endCompression();
+}
+
+// Feeds whole blocks so the writer never carries a partial block between ticks.
+static void compressSlice(ArchiveSegment& segment, uint32_t startedMs, uint32_t budgetMs) {
+    FlashFile in = flashOpen(kFlashArchiveCompaction, g_compression.path, "r");
+    if (!in || !in.seek(g_compression.readOffset)) {
+        abortCompression("open failed");
+        return;
+    }
+    std::vector<uint8_t> block(kLzBlockSize);
+    bool done = false;
+    do {
+        size_t n = in.read(block.data(), block.size());
+        g_compressionWriter->write(block.data(), n);
+        g_compression.readOffset += n;
+        done = n < block.size();
+    } while (!done && millis() - startedMs < budgetMs);
+    in.close();
+    if (!g_compressionWriter->ok()) {
+        abortCompression("write failed");
+        return;
+    }
+    if (done) {
+        finishCompression(segment);
+    }
+}
+
+void archiveCompactTick(uint32_t budgetMs) {
+    // Never wait: if a request handler is scanning the archive, try again next loop().
+    ArchiveLock lock(0);
+    if (!lock.locked()) {
+        return;
+    }
+    uint32_t startedMs = millis();
+    if (g_compression.active) {
+        ArchiveSegment* segment = findSegmentByPath(g_compression.path);
+        if (!segment || segment->info.compressed) {
+            abortCompression("segment changed");
+        } else {
+            compressSlice(*segment, startedMs, budgetMs);
+        }
+        return;
+    }
+    if (!g_compaction.active) {
+        g_compactionStatus.active = false;
+        if (startedMs - g_lastCompactCheckMs < kCompactCheckIntervalMs) {
+            return;
+        }
+        g_lastCompactCheckMs = startedMs;
+        if (!ensureArchiveManifest()) {
+            return;
+        }
+        ArchiveSegment* candidate = pickCompactionCandidate();
+        if (!candidate) {
+            candidate = pickCompressionCandidate();
+            if (candidate) {
+                startCompression(*candidate);
+            }
+            return;
+        }
+        if (!startCompaction(*candidate)) {
+            return;
+        }
+    }
+
+    ArchiveSegment* segment = findSegmentByPath(g_compaction.path);
+    if (!segment) {
+        abortCompaction("segment gone");
+        return;
+    }
+    if (segment->info.amendments != g_compaction.amendmentsAtStart) {
+        abortCompaction("amended during compaction");
+        return;
+    }
+    if (copyCompactionSlice(*segment, startedMs, budgetMs) && g_compaction.active) {
+        finishCompaction(*segment);
+    }
+    g_compactionStatus.active = g_compaction.active;
+}
+
+ArchiveCompactionStatus getArchiveCompactionStatus() {
+    ArchiveLock lock;
+    return g_compactionStatus;
+}
+
+bool archiveBloomSnapshot(std::vector<ArchiveBloomFilter>& out) {
+    out.clear();
+    // Called while the snapshot is captured on loop(); a long archive scan must not stall it.
+    ArchiveLock lock(pdMS_TO_TICKS(20));
+    if (!lock.locked()) {
+        return false;
+    }
+    for (const ArchiveSegment& segment : g_segments) {
+        if (!segment.bloom.bits.empty()) {
+            out.push_back(segment.bloom);
+        }
+    }
+    return true;
+}
+
+bool archiveBloomBytes(uint32_t& out) {
+    out = 0;
+    ArchiveLock lock(pdMS_TO_TICKS(20));
+    if (!lock.locked()) {
+        return false;
+    }
+    for (const ArchiveSegment& segment : g_segments) {
+        out += segment.bloom.bits.size();
+    }
+    return true;
+}
+
+void archiveBloomRestore(std::vector<ArchiveBloomFilter>& filters) {
+    ArchiveLock lock;
+    g_restoredBlooms.swap(filters);
+}
+
+ArchiveBloomStats getArchiveBloomStats() {
+    ArchiveLock lock;
+    ArchiveBloomStats stats = g_bloomStats;
+    for (const ArchiveSegment& segment : g_segments) {
+        if (!segment.bloom.bits.empty()) {
+            stats.filters++;
+            stats.bytes += segment.bloom.bits.size();
+        }
+    }
+    return stats;
+}
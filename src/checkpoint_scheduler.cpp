@@ -0,0 +1,156 @@
+#include "checkpoint_scheduler.h"
+#include "store.h"
+#include "wal.h"
+
+static const char* kCheckpointReasonNames[kCheckpointReasonCount] = {"none", "request", "walBytes", "idle",
+                                                                      "maxInterval"};
+
+static CheckpointStats g_checkpointStats;
+static uint32_t g_seenAppends = 0;
+static uint32_t g_lastActivityMs = 0;
+static uint32_t g_lastCheckpointMs = 0;
+static uint32_t g_cleanWindowMs = 0;
+static uint32_t g_requestSinceMs = 0;
+static uint32_t g_failedAtMs = 0;
+// WAL bytes (written or buffered) covered by the last checkpoint, and by the one in flight.
+static uint32_t g_checkpointWalBytes = 0;
+static uint32_t g_inFlightWalBytes = 0;
+static uint32_t g_seenCheckpointLsn = 0;
+static bool g_inFlightHadRequest = false;
+static bool g_postponing = false;
+static bool g_backingOff = false;
+
+static uint32_t walBytesNow(const WalStats& wal) {
+    return wal.bytesWritten + wal.pendingBytes;
+}
+
+const char* checkpointReasonName(uint8_t reason) {
+    return reason < kCheckpointReasonCount ? kCheckpointReasonNames[reason] : "unknown";
+}
+
+void checkpointBegin() {
+    uint32_t now = millis();
+    WalStats wal = getWalStats();
+    g_seenAppends = wal.appends;
+    g_checkpointWalBytes = walBytesNow(wal);
+    g_seenCheckpointLsn = getSnapshotStats().checkpointLsn;
+    g_lastActivityMs = now;
+    g_lastCheckpointMs = now;
+    g_cleanWindowMs = now;
+}
+
+CheckpointReason checkpointPoll() {
+    uint32_t now = millis();
+    WalStats wal = getWalStats();
+    uint32_t walBytes = walBytesNow(wal);
+    if (wal.appends != g_seenAppends) {
+        g_seenAppends = wal.appends;
+        g_lastActivityMs = now;
+    }
+    if (consumeSnapshotSaveRequest()) {
+        if (!g_checkpointStats.requestPending) {
+            g_checkpointStats.requestPending = true;
+            g_requestSinceMs = now;
+        }
+        g_lastActivityMs = now;
+    }
+    // Synchronous snapshotSave() calls (durability=snapshot, session end) checkpoint too.
+    uint32_t checkpointLsn = getSnapshotStats().checkpointLsn;
+    if (checkpointLsn != g_seenCheckpointLsn) {
+        g_seenCheckpointLsn = checkpointLsn;
+        g_checkpointWalBytes = walBytes;
+        g_lastCheckpointMs = now;
+    }
+
+    // Taken before the capture, so anything appended meanwhile still counts as dirty.
+    g_inFlightWalBytes = walBytes;
+    uint32_t dirtyBytes = walBytes - g_checkpointWalBytes;
+    bool requested = g_checkpointStats.requestPending;
+    uint32_t sinceMs = now - g_lastCheckpointMs;
+    bool idle = now - g_lastActivityMs >= KDS_CHECKPOINT_IDLE_MS;
+
+    if (now - g_cleanWindowMs >= KDS_CHECKPOINT_MIN_INTERVAL_MS) {
+        g_cleanWindowMs = now;
+        if (dirtyBytes == 0 && !requested) {
+            g_checkpointStats.cleanSkips++;
+        }
+    }
+    if (dirtyBytes == 0 && !requested) {
+        return kCheckpointNone;
+    }
+    // A failed save is retried after an idle period's worth of time, not on every pass.
+    if (g_backingOff) {
+        if (now - g_failedAtMs < KDS_CHECKPOINT_IDLE_MS) {
+            return kCheckpointNone;
+        }
+        g_backingOff = false;
+    }
+
+    if (requested && (idle || now - g_requestSinceMs >= KDS_CHECKPOINT_REQUEST_DELAY_MS)) {
+        return kCheckpointRequest;
+    }
+    if (dirtyBytes >= 2 * KDS_CHECKPOINT_WAL_BYTES || (idle && dirtyBytes >= KDS_CHECKPOINT_WAL_BYTES)) {
+        return kCheckpointWalBytes;
+    }
+    if (sinceMs >= KDS_CHECKPOINT_MAX_INTERVAL_MS) {
+        return kCheckpointMaxInterval;
+    }
+    if (sinceMs >= KDS_CHECKPOINT_MIN_INTERVAL_MS) {
+        if (idle) {
+            return kCheckpointIdle;
+        }
+        if (!g_postponing) {
+            g_postponing = true;
+            g_checkpointStats.postponed++;
+        }
+    } else if (dirtyBytes >= KDS_CHECKPOINT_WAL_BYTES && !g_postponing) {
+        g_postponing = true;
+        g_checkpointStats.postponed++;
+    }
+    return kCheckpointNone;
+}
+
+void checkpointStarted(CheckpointReason reason, bool accepted) {
+    if (!accepted || reason == kCheckpointNone || reason >= kCheckpointReasonCount) {
+        return;
+    }
+    g_checkpointStats.started[reason]++;
+    g_checkpointStats.lastReason = reason;
+    g_checkpointStats.inFlight = true;
+    g_inFlightHadRequest = g_checkpointStats.requestPending;
+    g_checkpointStats.requestPending = false;
+    g_lastCheckpointMs = millis();
+    g_postponing = false;
+}
+
+void checkpointFinished(bool ok) {
+    if (!g_checkpointStats.inFlight) {
+        return;
+    }
+    g_checkpointStats.inFlight = false;
+    if (!ok) {
+        g_checkpointStats.failures++;
+        g_backingOff = true;
+        g_failedAtMs = millis();
+        // Unlogged changes are still only in RAM; ask again.
+        if (g_inFlightHadRequest && !g_checkpointStats.requestPending) {
+            g_checkpointStats.requestPending = true;
+            g_requestSinceMs = millis();
+        }
+        return;
+    }
+    const SnapshotStats& snap = getSnapshotStats();
+    g_checkpointStats.lastWalBytes = g_inFlightWalBytes - g_checkpointWalBytes;
+    g_checkpointStats.snapshotBytes += snap.lastStoredBytes;
+    g_checkpointWalBytes = g_inFlightWalBytes;
+    g_seenCheckpointLsn = snap.checkpointLsn;
+}
+
+CheckpointStats getCheckpointStats() {
+    uint32_t now = millis();
+    CheckpointStats stats = g_checkpointStats;
+    stats.dirtyWalBytes = walBytesNow(getWalStats()) - g_checkpointWalBytes;
+    stats.idleMs = now - g_lastActivityMs;
+    stats.sinceLastMs = now - g_lastCheckpointMs;
+    return stats;
+}
@@ -1,6 +1,7 @@
 #include <ESPAsyncWebServer.h>
 #include "csv_export.h"
 #include "store.h"
+#include "archive.h"
 
 static inline void writeBOM(AsyncResponseStream *res) {
   static const uint8_t bom[3] = {0xEF,0xBB,0xBF};
@@ -0,0 +1,42 @@
+#include "esp_partition_flash.h"
+#include "flash_stats.h"
+#include <Arduino.h>
+#include <esp_partition.h>
+
+class EspPartitionFlash : public WalRingFlash {
+public:
+    explicit EspPartitionFlash(const esp_partition_t* partition) : partition_(partition) {}
+
+    uint32_t size() const override { return partition_->size; }
+
+    bool read(uint32_t offset, void* out, size_t len) override {
+        return esp_partition_read(partition_, offset, out, len) == ESP_OK;
+    }
+
+    bool write(uint32_t offset, const void* data, size_t len) override {
+        uint32_t startedUs = micros();
+        bool ok = esp_partition_write(partition_, offset, data, len) == ESP_OK;
+        flashNoteRawWrite(kFlashWalPartition, ok ? len : 0, micros() - startedUs, ok);
+        return ok;
+    }
+
+    bool erase(uint32_t offset) override {
+        uint32_t startedUs = micros();
+        bool ok = esp_partition_erase_range(partition_, offset, kWalRingPageSize) == ESP_OK;
+        flashNoteRawErase(kFlashWalPartition, micros() - startedUs, ok);
+        return ok;
+    }
+
+private:
+    const esp_partition_t* partition_;
+};
+
+WalRingFlash* walRingPartitionFlash() {
+    static const esp_partition_t* partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, static_cast<esp_partition_subtype_t>(kWalRingPartitionSubtype), "wal");
+    if (!partition) {
+        return nullptr;
+    }
+    static EspPartitionFlash flash(partition);
+    return &flash;
+}
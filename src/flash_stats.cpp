@@ -0,0 +1,170 @@
+#include "flash_stats.h"
+#include <LittleFS.h>
+#include <freertos/FreeRTOS.h>
+
+static FlashSubsystemStats g_flashStats[kFlashSubsystemCount];
+
+// Writers run on both the AsyncTCP task and loop(); the counters are tiny, so a spinlock is enough.
+static portMUX_TYPE g_flashStatsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* kFlashSubsystemNames[kFlashSubsystemCount] = {
+    "wal",
+    "snapshot",
+    "archive",
+    "archiveIndex",
+    "archiveCompaction",
+    "walPartition",
+};
+
+static uint8_t latencyBucket(uint32_t us) {
+    uint8_t bucket = 0;
+    uint32_t limit = 64;
+    while (bucket < kFlashLatencyBuckets - 1 && us >= limit) {
+        limit <<= 2;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void recordLatency(FlashSubsystemStats& stats, uint32_t us) {
+    stats.latency[latencyBucket(us)]++;
+    if (us > stats.maxLatencyUs) {
+        stats.maxLatencyUs = us;
+    }
+    stats.totalLatencyUs += us;
+}
+
+template <typename Update>
+static void updateStats(FlashSubsystem subsystem, Update update) {
+    if (subsystem >= kFlashSubsystemCount) {
+        return;
+    }
+    portENTER_CRITICAL(&g_flashStatsMux);
+    update(g_flashStats[subsystem]);
+    portEXIT_CRITICAL(&g_flashStatsMux);
+}
+
+size_t FlashFile::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t FlashFile::write(const uint8_t* buf, size_t size) {
+    size_t written = File::write(buf, size);
+    updateStats(subsystem_, [written, size](FlashSubsystemStats& stats) {
+        stats.writes++;
+        stats.bytesWritten += written;
+        if (written != size) {
+            stats.failures++;
+        }
+    });
+    return written;
+}
+
+void FlashFile::flush() {
+    uint32_t startedUs = micros();
+    File::flush();
+    uint32_t elapsedUs = micros() - startedUs;
+    updateStats(subsystem_, [elapsedUs](FlashSubsystemStats& stats) {
+        stats.flushes++;
+        recordLatency(stats, elapsedUs);
+    });
+}
+
+void FlashFile::close() {
+    if (!writable_ || !*this) {
+        File::close();
+        return;
+    }
+    uint32_t startedUs = micros();
+    File::close();
+    uint32_t elapsedUs = micros() - startedUs;
+    updateStats(subsystem_, [elapsedUs](FlashSubsystemStats& stats) { recordLatency(stats, elapsedUs); });
+}
+
+FlashFile flashOpen(FlashSubsystem subsystem, const char* path, const char* mode) {
+    bool writable = mode && mode[0] != 'r';
+    File file = LittleFS.open(path, mode);
+    bool ok = file;
+    updateStats(subsystem, [writable, ok](FlashSubsystemStats& stats) {
+        stats.opens++;
+        if (writable) {
+            stats.writeOpens++;
+        }
+        // Read opens double as existence probes, so only a failed write open is a failure.
+        if (writable && !ok) {
+            stats.failures++;
+        }
+    });
+    return FlashFile(file, subsystem, writable);
+}
+
+FlashFile flashOpen(FlashSubsystem subsystem, const String& path, const char* mode) {
+    return flashOpen(subsystem, path.c_str(), mode);
+}
+
+bool flashRemove(FlashSubsystem subsystem, const char* path) {
+    uint32_t startedUs = micros();
+    bool ok = LittleFS.remove(path);
+    uint32_t elapsedUs = micros() - startedUs;
+    updateStats(subsystem, [ok, elapsedUs](FlashSubsystemStats& stats) {
+        stats.removes++;
+        if (!ok) {
+            stats.failures++;
+        }
+        recordLatency(stats, elapsedUs);
+    });
+    return ok;
+}
+
+bool flashRemove(FlashSubsystem subsystem, const String& path) {
+    return flashRemove(subsystem, path.c_str());
+}
+
+bool flashRename(FlashSubsystem subsystem, const char* from, const char* to) {
+    uint32_t startedUs = micros();
+    bool ok = LittleFS.rename(from, to);
+    uint32_t elapsedUs = micros() - startedUs;
+    updateStats(subsystem, [ok, elapsedUs](FlashSubsystemStats& stats) {
+        stats.renames++;
+        if (!ok) {
+            stats.failures++;
+        }
+        recordLatency(stats, elapsedUs);
+    });
+    return ok;
+}
+
+bool flashRename(FlashSubsystem subsystem, const String& from, const String& to) {
+    return flashRename(subsystem, from.c_str(), to.c_str());
+}
+
+void flashNoteRawWrite(FlashSubsystem subsystem, size_t bytes, uint32_t elapsedUs, bool ok) {
+    updateStats(subsystem, [bytes, elapsedUs, ok](FlashSubsystemStats& stats) {
+        stats.writes++;
+        stats.bytesWritten += bytes;
+        if (!ok) {
+            stats.failures++;
+        }
+        recordLatency(stats, elapsedUs);
+    });
+}
+
+void flashNoteRawErase(FlashSubsystem subsystem, uint32_t elapsedUs, bool ok) {
+    updateStats(subsystem, [elapsedUs, ok](FlashSubsystemStats& stats) {
+        stats.erases++;
+        if (!ok) {
+            stats.failures++;
+        }
+        recordLatency(stats, elapsedUs);
+    });
+}
+
+const char* flashSubsystemName(FlashSubsystem subsystem) {
+    return subsystem < kFlashSubsystemCount ? kFlashSubsystemNames[subsystem] : "unknown";
+}
+
+FlashSubsystemStats getFlashStats(FlashSubsystem subsystem) {
+    FlashSubsystemStats stats;
+    updateStats(subsystem, [&stats](FlashSubsystemStats& current) { stats = current; });
+    return stats;
+}
@@ -0,0 +1,192 @@
+#include "json_arena.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Every block carries its payload size so reallocate() can copy; 8 keeps doubles aligned.
+static const size_t kJsonArenaAlign = 8;
+static const size_t kJsonArenaBlockHeader = 8;
+static const size_t kJsonArenaNoBlock = static_cast<size_t>(-1);
+
+static size_t alignUp(size_t size) {
+    return (size + kJsonArenaAlign - 1) & ~(kJsonArenaAlign - 1);
+}
+
+class HeapJsonAllocator : public ArduinoJson::Allocator {
+public:
+    void* allocate(size_t size) override { return malloc(size); }
+    void deallocate(void* ptr) override { free(ptr); }
+    void* reallocate(void* ptr, size_t newSize) override { return realloc(ptr, newSize); }
+};
+
+class JsonArena : public ArduinoJson::Allocator {
+public:
+    bool reserve() {
+        if (!buffer_) {
+            buffer_ = static_cast<uint8_t*>(malloc(kJsonArenaBytes));
+        }
+        return buffer_ != nullptr;
+    }
+
+    void rewind() {
+        used_ = 0;
+        live_ = 0;
+        last_ = kJsonArenaNoBlock;
+    }
+
+    bool reserved() const { return buffer_ != nullptr; }
+    uint32_t spills() const { return spills_; }
+    uint32_t highWater() const { return highWater_; }
+
+    void* allocate(size_t size) override {
+        size_t need = kJsonArenaBlockHeader + alignUp(size);
+        if (!buffer_ || used_ + need > kJsonArenaBytes) {
+            spills_++;
+            return malloc(size);
+        }
+        last_ = used_;
+        setBlockSize(last_, size);
+        used_ += need;
+        live_++;
+        highWater_ = std::max<uint32_t>(highWater_, used_);
+        return buffer_ + last_ + kJsonArenaBlockHeader;
+    }
+
+    void deallocate(void* ptr) override {
+        if (!ptr) {
+            return;
+        }
+        if (!owns(ptr)) {
+            free(ptr);
+            return;
+        }
+        if (--live_ == 0) {
+            rewind();
+        } else if (offsetOf(ptr) == last_) {
+            used_ = last_;
+            last_ = kJsonArenaNoBlock;
+        }
+    }
+
+    void* reallocate(void* ptr, size_t newSize) override {
+        if (!ptr) {
+            return allocate(newSize);
+        }
+        if (!owns(ptr)) {
+            return realloc(ptr, newSize);
+        }
+        size_t offset = offsetOf(ptr);
+        size_t oldSize = blockSize(offset);
+        if (offset == last_ && offset + kJsonArenaBlockHeader + alignUp(newSize) <= kJsonArenaBytes) {
+            // The newest block grows or shrinks in place; ArduinoJson's string builder relies on this.
+            setBlockSize(offset, newSize);
+            used_ = offset + kJsonArenaBlockHeader + alignUp(newSize);
+            highWater_ = std::max<uint32_t>(highWater_, used_);
+            return ptr;
+        }
+        if (newSize <= oldSize) {
+            return ptr;
+        }
+        void* moved = allocate(newSize);
+        if (!moved) {
+            return nullptr;
+        }
+        memcpy(moved, ptr, oldSize);
+        deallocate(ptr);
+        return moved;
+    }
+
+private:
+    bool owns(const void* ptr) const {
+        const uint8_t* p = static_cast<const uint8_t*>(ptr);
+        return buffer_ && p >= buffer_ && p < buffer_ + kJsonArenaBytes;
+    }
+    size_t offsetOf(const void* ptr) const {
+        return static_cast<const uint8_t*>(ptr) - buffer_ - kJsonArenaBlockHeader;
+    }
+    size_t blockSize(size_t offset) const {
+        uint32_t size;
+        memcpy(&size, buffer_ + offset, sizeof(size));
+        return size;
+    }
+    void setBlockSize(size_t offset, size_t size) {
+        uint32_t stored = static_cast<uint32_t>(size);
+        memcpy(buffer_ + offset, &stored, sizeof(stored));
+    }
+
+    uint8_t* buffer_{nullptr};
+    size_t used_{0};
+    size_t live_{0};
+    // Offset of the newest block, the only one that can be resized or popped in place.
+    size_t last_{kJsonArenaNoBlock};
+    uint32_t spills_{0};
+    uint32_t highWater_{0};
+};
+
+static HeapJsonAllocator g_heapJsonAllocator;
+static JsonArena g_jsonArenas[kJsonArenaCount];
+static bool g_jsonArenaBusy[kJsonArenaCount];
+static uint32_t g_jsonArenaLeases = 0;
+static uint32_t g_jsonArenaHeapLeases = 0;
+static SemaphoreHandle_t g_jsonArenaMutex = nullptr;
+
+class JsonArenaLock {
+public:
+    JsonArenaLock() {
+        if (!g_jsonArenaMutex) {
+            g_jsonArenaMutex = xSemaphoreCreateMutex();
+        }
+        xSemaphoreTake(g_jsonArenaMutex, portMAX_DELAY);
+    }
+    ~JsonArenaLock() { xSemaphoreGive(g_jsonArenaMutex); }
+};
+
+void jsonArenaBegin() {
+    JsonArenaLock lock;
+    for (JsonArena& arena : g_jsonArenas) {
+        if (!arena.reserve()) {
+            Serial.println("[E] json arena reserve failed");
+            return;
+        }
+    }
+}
+
+JsonArenaStats getJsonArenaStats() {
+    JsonArenaLock lock;
+    JsonArenaStats stats;
+    stats.leases = g_jsonArenaLeases;
+    stats.heapLeases = g_jsonArenaHeapLeases;
+    for (size_t i = 0; i < kJsonArenaCount; ++i) {
+        stats.spills += g_jsonArenas[i].spills();
+        stats.highWaterBytes = std::max(stats.highWaterBytes, g_jsonArenas[i].highWater());
+        stats.inUse += g_jsonArenaBusy[i] ? 1 : 0;
+        stats.reserved += g_jsonArenas[i].reserved() ? 1 : 0;
+    }
+    return stats;
+}
+
+JsonArenaLease::JsonArenaLease() : slot_(kJsonArenaCount), allocator_(&g_heapJsonAllocator) {
+    JsonArenaLock lock;
+    g_jsonArenaLeases++;
+    for (size_t i = 0; i < kJsonArenaCount; ++i) {
+        if (!g_jsonArenaBusy[i] && g_jsonArenas[i].reserve()) {
+            g_jsonArenaBusy[i] = true;
+            slot_ = i;
+            allocator_ = &g_jsonArenas[i];
+            return;
+        }
+    }
+    g_jsonArenaHeapLeases++;
+}
+
+JsonArenaLease::~JsonArenaLease() {
+    if (!pooled()) {
+        return;
+    }
+    JsonArenaLock lock;
+    // The document is gone by now; anything it failed to free is abandoned with the rewind.
+    g_jsonArenas[slot_].rewind();
+    g_jsonArenaBusy[slot_] = false;
+}
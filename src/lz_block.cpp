@@ -0,0 +1,375 @@
+#include "lz_block.h"
+#include <string.h>
+#include <algorithm>
+
+static const uint16_t kLzContainerVersion = 1;
+static const size_t kLzHeaderSize = 8;
+static const size_t kLzFrameHeaderSize = 4;
+static const size_t kLzFooterSize = 12;
+static const size_t kLzMinMatch = 4;
+static const uint32_t kLzNoBlock = 0xFFFFFFFFu;
+
+static void putLe16(uint8_t* out, uint16_t v) {
+    out[0] = static_cast<uint8_t>(v);
+    out[1] = static_cast<uint8_t>(v >> 8);
+}
+
+static uint16_t getLe16(const uint8_t* in) {
+    return static_cast<uint16_t>(in[0] | (in[1] << 8));
+}
+
+static void putLe32(uint8_t* out, uint32_t v) {
+    out[0] = static_cast<uint8_t>(v);
+    out[1] = static_cast<uint8_t>(v >> 8);
+    out[2] = static_cast<uint8_t>(v >> 16);
+    out[3] = static_cast<uint8_t>(v >> 24);
+}
+
+static uint32_t getLe32(const uint8_t* in) {
+    return static_cast<uint32_t>(in[0]) |
+           (static_cast<uint32_t>(in[1]) << 8) |
+           (static_cast<uint32_t>(in[2]) << 16) |
+           (static_cast<uint32_t>(in[3]) << 24);
+}
+
+static uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hashSequence(uint32_t v) {
+    return (v * 2654435761u) >> (32 - kLzHashBits);
+}
+
+static bool putLength(uint8_t* out, size_t& op, size_t cap, size_t extra) {
+    while (extra >= 255) {
+        if (op >= cap) {
+            return false;
+        }
+        out[op++] = 255;
+        extra -= 255;
+    }
+    if (op >= cap) {
+        return false;
+    }
+    out[op++] = static_cast<uint8_t>(extra);
+    return true;
+}
+
+// matchLen 0 marks the closing literals-only sequence.
+static bool emitSequence(uint8_t* out, size_t& op, size_t cap, const uint8_t* literals, size_t literalLen,
+                         size_t offset, size_t matchLen) {
+    if (op >= cap) {
+        return false;
+    }
+    size_t matchCode = matchLen > 0 ? matchLen - kLzMinMatch : 0;
+    uint8_t token = static_cast<uint8_t>((std::min<size_t>(literalLen, 15) << 4) | std::min<size_t>(matchCode, 15));
+    out[op++] = token;
+    if (literalLen >= 15 && !putLength(out, op, cap, literalLen - 15)) {
+        return false;
+    }
+    if (literalLen > cap - op) {
+        return false;
+    }
+    memcpy(out + op, literals, literalLen);
+    op += literalLen;
+    if (matchLen == 0) {
+        return true;
+    }
+    if (cap - op < 2) {
+        return false;
+    }
+    putLe16(out + op, static_cast<uint16_t>(offset));
+    op += 2;
+    return matchCode < 15 || putLength(out, op, cap, matchCode - 15);
+}
+
+size_t lzCompressBlock(const uint8_t* in, size_t len, uint8_t* out, size_t outCap, uint16_t* table) {
+    // Table entries hold position + 1 so zero means empty.
+    memset(table, 0, sizeof(uint16_t) << kLzHashBits);
+    size_t op = 0;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + kLzMinMatch <= len) {
+        uint32_t sequence = load32(in + i);
+        uint32_t h = hashSequence(sequence);
+        size_t candidate = table[h];
+        table[h] = static_cast<uint16_t>(i + 1);
+        if (candidate == 0 || load32(in + candidate - 1) != sequence) {
+            i++;
+            continue;
+        }
+        size_t ref = candidate - 1;
+        size_t matchLen = kLzMinMatch;
+        while (i + matchLen < len && in[ref + matchLen] == in[i + matchLen]) {
+            matchLen++;
+        }
+        if (!emitSequence(out, op, outCap, in + anchor, i - anchor, i - ref, matchLen)) {
+            return 0;
+        }
+        i += matchLen;
+        anchor = i;
+    }
+    if (!emitSequence(out, op, outCap, in + anchor, len - anchor, 0, 0)) {
+        return 0;
+    }
+    return op;
+}
+
+static bool getLength(const uint8_t* in, size_t len, size_t& ip, size_t& value) {
+    uint8_t b = 0;
+    do {
+        if (ip >= len) {
+            return false;
+        }
+        b = in[ip++];
+        value += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lzDecompressBlock(const uint8_t* in, size_t len, uint8_t* out, size_t rawLen) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < len) {
+        uint8_t token = in[ip++];
+        size_t literalLen = token >> 4;
+        if (literalLen == 15 && !getLength(in, len, ip, literalLen)) {
+            return false;
+        }
+        if (literalLen > len - ip || literalLen > rawLen - op) {
+            return false;
+        }
+        memcpy(out + op, in + ip, literalLen);
+        ip += literalLen;
+        op += literalLen;
+        if (ip == len) {
+            break;
+        }
+
+        if (len - ip < 2) {
+            return false;
+        }
+        size_t offset = getLe16(in + ip);
+        ip += 2;
+        size_t matchLen = token & 0x0F;
+        if (matchLen == 15 && !getLength(in, len, ip, matchLen)) {
+            return false;
+        }
+        matchLen += kLzMinMatch;
+        if (offset == 0 || offset > op || matchLen > rawLen - op) {
+            return false;
+        }
+        // Byte by byte: a match may overlap the bytes it is producing.
+        const uint8_t* src = out + op - offset;
+        for (size_t k = 0; k < matchLen; ++k) {
+            out[op + k] = src[k];
+        }
+        op += matchLen;
+    }
+    return op == rawLen;
+}
+
+bool lzIsContainer(File& file) {
+    size_t start = file.position();
+    uint8_t magic[4];
+    bool found = file.read(magic, sizeof(magic)) == sizeof(magic) && getLe32(magic) == kLzContainerMagic;
+    file.seek(start);
+    return found;
+}
+
+bool LzBlockWriter::begin() {
+    raw_.clear();
+    offsets_.clear();
+    rawBytes_ = 0;
+    raw_.reserve(kLzBlockSize);
+    packed_.resize(kLzBlockSize);
+    table_.resize(static_cast<size_t>(1) << kLzHashBits);
+    uint8_t header[kLzHeaderSize];
+    putLe32(header, kLzContainerMagic);
+    putLe16(header + 4, kLzContainerVersion);
+    putLe16(header + 6, static_cast<uint16_t>(kLzBlockSize));
+    ok_ = file_.write(header, sizeof(header)) == sizeof(header);
+    storedBytes_ = sizeof(header);
+    return ok_;
+}
+
+void LzBlockWriter::write(const uint8_t* data, size_t len) {
+    rawBytes_ += len;
+    while (len > 0) {
+        size_t n = std::min(len, kLzBlockSize - raw_.size());
+        raw_.insert(raw_.end(), data, data + n);
+        data += n;
+        len -= n;
+        if (raw_.size() == kLzBlockSize) {
+            flushBlock();
+        }
+    }
+}
+
+void LzBlockWriter::flushBlock() {
+    if (raw_.empty()) {
+        return;
+    }
+    offsets_.push_back(storedBytes_);
+    size_t packedLen = lzCompressBlock(raw_.data(), raw_.size(), packed_.data(), raw_.size() - 1, table_.data());
+    const uint8_t* body = packedLen > 0 ? packed_.data() : raw_.data();
+    size_t bodyLen = packedLen > 0 ? packedLen : raw_.size();
+
+    uint8_t frame[kLzFrameHeaderSize];
+    putLe16(frame, static_cast<uint16_t>(raw_.size()));
+    putLe16(frame + 2, static_cast<uint16_t>(bodyLen));
+    if (ok_) {
+        ok_ = file_.write(frame, sizeof(frame)) == sizeof(frame) && file_.write(body, bodyLen) == bodyLen;
+    }
+    storedBytes_ += sizeof(frame) + bodyLen;
+    raw_.clear();
+}
+
+bool LzBlockWriter::finish() {
+    flushBlock();
+    uint8_t entry[4];
+    for (uint32_t offset : offsets_) {
+        putLe32(entry, offset);
+        ok_ = ok_ && file_.write(entry, sizeof(entry)) == sizeof(entry);
+    }
+    uint8_t footer[kLzFooterSize];
+    putLe32(footer, static_cast<uint32_t>(offsets_.size()));
+    putLe32(footer + 4, rawBytes_);
+    putLe32(footer + 8, kLzContainerMagic);
+    ok_ = ok_ && file_.write(footer, sizeof(footer)) == sizeof(footer);
+    storedBytes_ += offsets_.size() * sizeof(entry) + sizeof(footer);
+    return ok_;
+}
+
+bool LzBlockReader::begin(File& file) {
+    file_ = &file;
+    base_ = static_cast<uint32_t>(file.position());
+    size_t fileSize = file.size();
+    if (fileSize < base_ + kLzHeaderSize + kLzFooterSize) {
+        return false;
+    }
+    uint8_t header[kLzHeaderSize];
+    uint8_t footer[kLzFooterSize];
+    if (file.read(header, sizeof(header)) != sizeof(header) || !file.seek(fileSize - kLzFooterSize) ||
+        file.read(footer, sizeof(footer)) != sizeof(footer)) {
+        return false;
+    }
+    blockSize_ = getLe16(header + 6);
+    blockCount_ = getLe32(footer);
+    rawSize_ = getLe32(footer + 4);
+    if (getLe32(header) != kLzContainerMagic || getLe16(header + 4) != kLzContainerVersion ||
+        getLe32(footer + 8) != kLzContainerMagic || blockSize_ == 0 || blockSize_ > kLzBlockSize) {
+        return false;
+    }
+    size_t containerSize = fileSize - base_;
+    if (blockCount_ > (containerSize - kLzHeaderSize - kLzFooterSize) / 4 ||
+        rawSize_ > static_cast<uint64_t>(blockCount_) * blockSize_ ||
+        rawSize_ + blockSize_ <= static_cast<uint64_t>(blockCount_) * blockSize_) {
+        return false;
+    }
+    indexOffset_ = static_cast<uint32_t>(containerSize - kLzFooterSize - blockCount_ * 4);
+    raw_.resize(blockSize_);
+    packed_.resize(blockSize_);
+    position_ = 0;
+    loadedBlock_ = kLzNoBlock;
+    loadedLen_ = 0;
+    nextBlockOffset_ = kLzHeaderSize;
+    ok_ = true;
+    return true;
+}
+
+bool LzBlockReader::loadBlock(uint32_t block) {
+    uint32_t offset = 0;
+    if (block == 0) {
+        offset = kLzHeaderSize;
+    } else if (loadedBlock_ != kLzNoBlock && block == loadedBlock_ + 1) {
+        offset = nextBlockOffset_;
+    } else {
+        uint8_t entry[4];
+        if (!file_->seek(base_ + indexOffset_ + block * 4) || file_->read(entry, sizeof(entry)) != sizeof(entry)) {
+            return false;
+        }
+        offset = getLe32(entry);
+    }
+
+    uint8_t frame[kLzFrameHeaderSize];
+    if (offset > indexOffset_ || !file_->seek(base_ + offset) || file_->read(frame, sizeof(frame)) != sizeof(frame)) {
+        return false;
+    }
+    uint32_t rawLen = getLe16(frame);
+    uint32_t storedLen = getLe16(frame + 2);
+    uint32_t expected = std::min(blockSize_, rawSize_ - block * blockSize_);
+    if (rawLen != expected || storedLen > rawLen || offset + sizeof(frame) + storedLen > indexOffset_) {
+        return false;
+    }
+    if (storedLen == rawLen) {
+        if (file_->read(raw_.data(), rawLen) != rawLen) {
+            return false;
+        }
+    } else if (file_->read(packed_.data(), storedLen) != storedLen ||
+               !lzDecompressBlock(packed_.data(), storedLen, raw_.data(), rawLen)) {
+        return false;
+    }
+    loadedBlock_ = block;
+    loadedLen_ = rawLen;
+    nextBlockOffset_ = offset + sizeof(frame) + storedLen;
+    return true;
+}
+
+bool LzBlockReader::ensureBlock() {
+    uint32_t block = position_ / blockSize_;
+    if (block == loadedBlock_) {
+        return true;
+    }
+    if (loadBlock(block)) {
+        return true;
+    }
+    Serial.printf("[E] compressed block %u unreadable\n", static_cast<unsigned>(block));
+    // Treat the rest as missing rather than handing out garbage.
+    ok_ = false;
+    loadedBlock_ = kLzNoBlock;
+    position_ = rawSize_;
+    return false;
+}
+
+size_t LzBlockReader::read(uint8_t* out, size_t len) {
+    size_t total = 0;
+    while (len > 0 && available() && ensureBlock()) {
+        uint32_t inBlock = position_ % blockSize_;
+        size_t n = std::min<size_t>(len, loadedLen_ - inBlock);
+        memcpy(out, raw_.data() + inBlock, n);
+        out += n;
+        len -= n;
+        total += n;
+        position_ += n;
+    }
+    return total;
+}
+
+String LzBlockReader::readLine() {
+    String line;
+    while (available() && ensureBlock()) {
+        uint32_t inBlock = position_ % blockSize_;
+        const uint8_t* start = raw_.data() + inBlock;
+        size_t avail = loadedLen_ - inBlock;
+        const uint8_t* newline = static_cast<const uint8_t*>(memchr(start, '\n', avail));
+        size_t n = newline ? static_cast<size_t>(newline - start) : avail;
+        line.concat(reinterpret_cast<const char*>(start), n);
+        position_ += n;
+        if (newline) {
+            position_++;
+            break;
+        }
+    }
+    return line;
+}
+
+bool LzBlockReader::seek(uint32_t rawOffset) {
+    if (rawOffset > rawSize_) {
+        return false;
+    }
+    position_ = rawOffset;
+    return true;
+}
@@ -9,6 +9,10 @@
 #include "ws_hub.h"
 #include "server_routes.h"
 #include "store.h"
+#include "wal.h"
+#include "archive.h"
+#include "checkpoint_scheduler.h"
+#include "json_arena.h"
 #include "printer_queue.h"
 #include "printer_render.h"
 
@@ -24,6 +28,18 @@ const char* ntp_server3 = "pool.ntp.org";
 
 AsyncWebServer server(80);
 
+#ifndef KDS_BOOT_RECOVERY_BUDGET_MS
+#define KDS_BOOT_RECOVERY_BUDGET_MS 2000
+#endif
+
+#ifndef KDS_RECOVERY_SLICE_MS
+#define KDS_RECOVERY_SLICE_MS 20
+#endif
+
+#ifndef KDS_ARCHIVE_COMPACT_SLICE_MS
+#define KDS_ARCHIVE_COMPACT_SLICE_MS 4
+#endif
+
 static bool g_apEnabled = false;
 static bool g_apResumeScheduled = false;
 static uint32_t g_apResumeAtMs = 0;
@@ -82,45 +98,27 @@ static void processPendingAccessPointTasks() {
     pollAccessPointResume();
 }
 
-static void rotateWalAfterSnapshot() {
-    if (!LittleFS.exists("/kds/wal.log")) {
-        return;
-    }
-
-    uint32_t epoch = time(nullptr);
-    String archiveName = "/kds/wal." + String(epoch) + ".log";
-
-    if (!LittleFS.rename("/kds/wal.log", archiveName.c_str())) {
-        Serial.println("[E] wal rotate failed");
-        return;
-    }
-
-    File root = LittleFS.open("/kds");
-    std::vector<String> walFiles;
-    while (File file = root.openNextFile()) {
-        String fname = String(file.name());
-        if (fname.startsWith("wal.") && fname.endsWith(".log")) {
-            walFiles.push_back("/kds/" + fname);
-        }
-        file.close();
-    }
-    root.close();
-
-    std::sort(walFiles.begin(), walFiles.end(), std::greater<String>());
-    for (size_t i = 2; i < walFiles.size(); ++i) {
-        LittleFS.remove(walFiles[i].c_str());
+// Runs once the WAL tail has been replayed; snapshots are refused until then.
+static void finishBootRecovery() {
+    ensureInitialMenu();
+    checkpointBegin();
+    // The ring's release horizon lives in RAM; the snapshot checkpoints on flash rebuild it.
+    uint32_t obsoleteThrough = 0;
+    if (getOldestSnapshotCheckpoint(obsoleteThrough)) {
+        walRelease(obsoleteThrough);
     }
 }
 
-static bool performSnapshot(const char* label) {
-    (void)label;
-    if (snapshotSave()) {
-        rotateWalAfterSnapshot();
-        return true;
+// The snapshot task has finished writing; the WAL it covers can go.
+static void finishSnapshot(bool ok) {
+    checkpointFinished(ok);
+    if (!ok) {
+        Serial.println("[E] snapshot failed");
+        return;
     }
-
-    Serial.println("[E] snapshot failed");
-    return false;
+    uint32_t obsoleteThrough = 0;
+    getOldestSnapshotCheckpoint(obsoleteThrough);
+    walRotate(obsoleteThrough);
 }
 
 bool enableAccessPoint() {
@@ -192,6 +190,7 @@ void setup() {
     
     Serial.begin(115200);
     Serial.println("[BOOT] ok");
+    jsonArenaBegin();
     
     setenv("TZ", "JST-9", 1);
     tzset();
@@ -230,14 +229,15 @@ void setup() {
         Serial.println("[E] fs mount failed");
         return;
     }
+    walBegin();
     
-    if (!snapshotLoad()) {
+    if (!beginRecovery()) {
         Serial.println("[E] snapshot load failed");
     }
-    ensureInitialMenu();
 
-    if (!loadSalesSummary()) {
-        Serial.println("[E] sales summary init failed");
+    // Whatever does not fit the budget is replayed from loop() while the API answers 503.
+    if (stepRecovery(KDS_BOOT_RECOVERY_BUDGET_MS)) {
+        finishBootRecovery();
     }
     
     initWsHub(server);
@@ -263,17 +263,30 @@ void loop() {
     M5.update();
     
     tickPrintQueue();
+    walTick();
     processPendingAccessPointTasks();
     
-    static uint32_t lastSnapshotMs = 0;
-    if (consumeSnapshotSaveRequest()) {
-        performSnapshot("即時リクエスト");
-        lastSnapshotMs = millis();
+    if (isRecoveryInProgress()) {
+        if (stepRecovery(KDS_RECOVERY_SLICE_MS)) {
+            finishBootRecovery();
+        }
+        delay(1);
+        return;
+    }
+
+    archiveCompactTick(KDS_ARCHIVE_COMPACT_SLICE_MS);
+
+    bool snapshotOk = false;
+    if (snapshotPoll(snapshotOk)) {
+        finishSnapshot(snapshotOk);
     }
 
-    if (millis() - lastSnapshotMs >= 30000) {
-        performSnapshot("30秒タイマー");
-        lastSnapshotMs = millis();
+    // Requests made while a save is in flight stay pending and are served by the next one.
+    if (!isSnapshotSaveInFlight()) {
+        CheckpointReason reason = checkpointPoll();
+        if (reason != kCheckpointNone) {
+            checkpointStarted(reason, snapshotSaveAsync());
+        }
     }
     
     delay(10);
@@ -25,12 +25,7 @@ Order buildOrderFromClientJson(const JsonDocument& req){
   doc.set(req);
 
   auto findMenu = [&](const String& sku)->const MenuItem*{
-    for (const auto& item : S().menu) {
-      if (item.sku == sku) {
-        return &item;
-      }
-    }
-    return nullptr;
+    return findMenuItemBySku(sku);
   };
 
   if (!doc["lines"].is<JsonArray>()) {
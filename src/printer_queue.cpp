@@ -1,5 +1,6 @@
 #include "printer_queue.h"
 #include "printer_render.h"
+#include "wal.h"
 #include <deque>
 
 extern String getCurrentDateTime();
@@ -83,15 +84,19 @@ void tickPrintQueue() {
 
     OrderPrintJob& job = printQueue.front();
 
-    Order* orderPtr = nullptr;
-    for (auto& order : S().orders) {
-        if (order.orderNo == job.orderNo) {
-            orderPtr = &order;
-            break;
+    // Printing takes a while; it works on a copy so handlers are not held up meanwhile.
+    Order order;
+    bool found = false;
+    {
+        StateLock state;
+        Order* orderPtr = findOrderByNo(job.orderNo);
+        if (orderPtr) {
+            order = *orderPtr;
+            found = true;
         }
     }
 
-    if (!orderPtr) {
+    if (!found) {
         Serial.printf("[E] print order missing: %s\n", job.orderNo.c_str());
         OrderPrintJob retryJob = job;
         printQueue.pop_front();
@@ -106,8 +111,19 @@ void tickPrintQueue() {
 
     g_printerRenderer.printerInit();
 
-    if (g_printerRenderer.printReceiptEN(*orderPtr)) {
+    if (g_printerRenderer.printReceiptEN(order)) {
         Serial.printf("[PRINT] success: %s\n", job.orderNo.c_str());
+        StateLock state;
+        Order* orderPtr = findOrderByNo(job.orderNo);
+        if (orderPtr && !orderPtr->printed) {
+            // Keeps replay from queueing the ticket a second time after a power cut.
+            orderPtr->printed = true;
+            WalRecord walRec;
+            walRec.action = kWalOrderPrinted;
+            walRec.ts = time(nullptr);
+            walRec.orderNo = job.orderNo;
+            walAppend(walRec);
+        }
         printQueue.pop_front();
     } else {
         Serial.printf("[E] print failed: %s\n", job.orderNo.c_str());
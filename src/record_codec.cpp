@@ -0,0 +1,419 @@
+#include "record_codec.h"
+#include <cstring>
+
+static const uint32_t kCrc32Nibble[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ kCrc32Nibble[crc & 0x0F];
+        crc = (crc >> 4) ^ kCrc32Nibble[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+void RecordWriter::putU32(uint32_t v) {
+    uint8_t raw[4] = {
+        static_cast<uint8_t>(v),
+        static_cast<uint8_t>(v >> 8),
+        static_cast<uint8_t>(v >> 16),
+        static_cast<uint8_t>(v >> 24),
+    };
+    out_.write(raw, sizeof(raw));
+}
+
+void RecordWriter::putVarU32(uint32_t v) {
+    uint8_t raw[5];
+    size_t n = 0;
+    while (v >= 0x80) {
+        raw[n++] = static_cast<uint8_t>(v | 0x80);
+        v >>= 7;
+    }
+    raw[n++] = static_cast<uint8_t>(v);
+    out_.write(raw, n);
+}
+
+void RecordWriter::putVarI32(int32_t v) {
+    putVarU32((static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31));
+}
+
+void RecordWriter::putFloat(float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    putU32(bits);
+}
+
+void RecordWriter::putString(const String& s) {
+    putVarU32(s.length());
+    out_.write(reinterpret_cast<const uint8_t*>(s.c_str()), s.length());
+}
+
+void RecordWriter::putBytes(const std::vector<uint8_t>& bytes) {
+    putVarU32(bytes.size());
+    out_.write(bytes.data(), bytes.size());
+}
+
+uint8_t RecordReader::getU8() {
+    if (!ok_ || pos_ >= len_) {
+        ok_ = false;
+        return 0;
+    }
+    return data_[pos_++];
+}
+
+uint32_t RecordReader::getU32() {
+    if (!ok_ || len_ - pos_ < 4) {
+        ok_ = false;
+        return 0;
+    }
+    uint32_t v = static_cast<uint32_t>(data_[pos_]) |
+                 (static_cast<uint32_t>(data_[pos_ + 1]) << 8) |
+                 (static_cast<uint32_t>(data_[pos_ + 2]) << 16) |
+                 (static_cast<uint32_t>(data_[pos_ + 3]) << 24);
+    pos_ += 4;
+    return v;
+}
+
+uint32_t RecordReader::getVarU32() {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t b = getU8();
+        if (!ok_) {
+            return 0;
+        }
+        v |= static_cast<uint32_t>(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            return v;
+        }
+    }
+    ok_ = false;
+    return 0;
+}
+
+int32_t RecordReader::getVarI32() {
+    uint32_t z = getVarU32();
+    return static_cast<int32_t>((z >> 1) ^ (~(z & 1) + 1));
+}
+
+float RecordReader::getFloat() {
+    uint32_t bits = getU32();
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+bool RecordReader::getString(String& out) {
+    uint32_t n = getVarU32();
+    if (!ok_ || n > len_ - pos_) {
+        ok_ = false;
+        out = String();
+        return false;
+    }
+    // Assigning "" keeps the existing buffer, so decoding into a reused String does not allocate.
+    out = "";
+    out.concat(reinterpret_cast<const char*>(data_ + pos_), n);
+    pos_ += n;
+    return true;
+}
+
+bool RecordReader::getBytes(std::vector<uint8_t>& out) {
+    uint32_t n = getVarU32();
+    if (!ok_ || n > len_ - pos_) {
+        ok_ = false;
+        out.clear();
+        return false;
+    }
+    out.assign(data_ + pos_, data_ + pos_ + n);
+    pos_ += n;
+    return true;
+}
+
+void encodeSettings(RecordWriter& w, const Settings& settings) {
+    w.putVarU32(settings.catalogVersion);
+    w.putBool(settings.chinchiro.enabled);
+    w.putVarU32(settings.chinchiro.multipliers.size());
+    for (float m : settings.chinchiro.multipliers) {
+        w.putFloat(m);
+    }
+    w.putString(settings.chinchiro.rounding);
+    w.putVarU32(settings.numbering.min);
+    w.putVarU32(settings.numbering.max);
+    w.putString(settings.store.name);
+    w.putString(settings.store.nameRomaji);
+    w.putString(settings.store.registerId);
+    w.putBool(settings.presaleEnabled);
+    w.putBool(settings.qrPrint.enabled);
+    w.putString(settings.qrPrint.content);
+    w.putU8(settings.durability);
+}
+
+bool decodeSettings(RecordReader& r, Settings& settings) {
+    settings.catalogVersion = r.getVarU32();
+    settings.chinchiro.enabled = r.getBool();
+    uint32_t multCount = r.getVarU32();
+    settings.chinchiro.multipliers.clear();
+    for (uint32_t i = 0; i < multCount && r.ok(); ++i) {
+        settings.chinchiro.multipliers.push_back(r.getFloat());
+    }
+    r.getString(settings.chinchiro.rounding);
+    settings.numbering.min = static_cast<uint16_t>(r.getVarU32());
+    settings.numbering.max = static_cast<uint16_t>(r.getVarU32());
+    r.getString(settings.store.name);
+    r.getString(settings.store.nameRomaji);
+    r.getString(settings.store.registerId);
+    settings.presaleEnabled = r.getBool();
+    settings.qrPrint.enabled = r.getBool();
+    r.getString(settings.qrPrint.content);
+    // Added after the first binary snapshots; older records end here.
+    if (r.remaining() > 0) {
+        settings.durability = r.getU8();
+    }
+    if (settings.durability >= kDurabilityLevelCount) {
+        settings.durability = kDurabilityWal;
+    }
+    return r.ok();
+}
+
+void encodeSession(RecordWriter& w, const Session& session) {
+    w.putString(session.sessionId);
+    w.putVarU32(session.startedAt);
+    w.putBool(session.exported);
+    w.putVarU32(session.nextOrderSeq);
+}
+
+bool decodeSession(RecordReader& r, Session& session) {
+    r.getString(session.sessionId);
+    session.startedAt = r.getVarU32();
+    session.exported = r.getBool();
+    session.nextOrderSeq = static_cast<uint16_t>(r.getVarU32());
+    return r.ok();
+}
+
+void encodePrinterState(RecordWriter& w, const PrinterState& printer) {
+    w.putBool(printer.paperOut);
+    w.putBool(printer.overheat);
+    w.putVarU32(printer.holdJobs);
+}
+
+bool decodePrinterState(RecordReader& r, PrinterState& printer) {
+    printer.paperOut = r.getBool();
+    printer.overheat = r.getBool();
+    printer.holdJobs = static_cast<uint16_t>(r.getVarU32());
+    return r.ok();
+}
+
+void encodeMenuItem(RecordWriter& w, const MenuItem& item) {
+    w.putString(item.sku);
+    w.putString(item.name);
+    w.putString(item.nameRomaji);
+    w.putString(item.category);
+    w.putBool(item.active);
+    w.putVarI32(item.price_normal);
+    w.putVarI32(item.price_presale);
+    w.putVarI32(item.presale_discount_amount);
+    w.putVarI32(item.price_single);
+    w.putVarI32(item.price_as_side);
+}
+
+bool decodeMenuItem(RecordReader& r, MenuItem& item) {
+    r.getString(item.sku);
+    r.getString(item.name);
+    r.getString(item.nameRomaji);
+    r.getString(item.category);
+    item.active = r.getBool();
+    item.price_normal = r.getVarI32();
+    item.price_presale = r.getVarI32();
+    item.presale_discount_amount = r.getVarI32();
+    item.price_single = r.getVarI32();
+    item.price_as_side = r.getVarI32();
+    return r.ok() && !item.sku.isEmpty();
+}
+
+enum : uint8_t {
+    kOrderFlagPrinted = 0x01,
+    kOrderFlagCooked = 0x02,
+    kOrderFlagPickupCalled = 0x04,
+    kOrderFlagPickedUp = 0x08,
+};
+
+void encodeOrder(RecordWriter& w, const Order& order) {
+    uint8_t flags = 0;
+    if (order.printed) flags |= kOrderFlagPrinted;
+    if (order.cooked) flags |= kOrderFlagCooked;
+    if (order.pickup_called) flags |= kOrderFlagPickupCalled;
+    if (order.picked_up) flags |= kOrderFlagPickedUp;
+
+    w.putString(order.orderNo);
+    w.putString(order.status);
+    w.putVarU32(order.ts);
+    w.putU8(flags);
+    w.putString(order.cancelReason);
+    w.putVarU32(order.items.size());
+    for (const auto& item : order.items) {
+        w.putString(item.sku);
+        w.putString(item.name);
+        w.putVarI32(item.qty);
+        w.putVarI32(item.unitPriceApplied);
+        w.putString(item.priceMode);
+        w.putString(item.kind);
+        w.putVarI32(item.unitPrice);
+        w.putString(item.discountName);
+        w.putVarI32(item.discountValue);
+    }
+}
+
+bool decodeOrder(RecordReader& r, Order& order) {
+    r.getString(order.orderNo);
+    r.getString(order.status);
+    order.ts = r.getVarU32();
+    uint8_t flags = r.getU8();
+    order.printed = (flags & kOrderFlagPrinted) != 0;
+    order.cooked = (flags & kOrderFlagCooked) != 0;
+    order.pickup_called = (flags & kOrderFlagPickupCalled) != 0;
+    order.picked_up = (flags & kOrderFlagPickedUp) != 0;
+    r.getString(order.cancelReason);
+
+    uint32_t itemCount = r.getVarU32();
+    if (!r.ok() || itemCount > r.remaining()) {
+        return false;
+    }
+    order.items.resize(itemCount);
+    for (LineItem& li : order.items) {
+        r.getString(li.sku);
+        r.getString(li.name);
+        li.qty = r.getVarI32();
+        li.unitPriceApplied = r.getVarI32();
+        r.getString(li.priceMode);
+        r.getString(li.kind);
+        li.unitPrice = r.getVarI32();
+        r.getString(li.discountName);
+        li.discountValue = r.getVarI32();
+    }
+    return r.ok() && !order.orderNo.isEmpty();
+}
+
+void encodeSalesSummary(RecordWriter& w, const SalesSummary& summary) {
+    w.putVarU32(summary.confirmedOrders);
+    w.putVarU32(summary.cancelledOrders);
+    uint64_t revenue = static_cast<uint64_t>(summary.revenue);
+    w.putU32(static_cast<uint32_t>(revenue));
+    w.putU32(static_cast<uint32_t>(revenue >> 32));
+    uint64_t cancelled = static_cast<uint64_t>(summary.cancelledAmount);
+    w.putU32(static_cast<uint32_t>(cancelled));
+    w.putU32(static_cast<uint32_t>(cancelled >> 32));
+    w.putVarU32(summary.lastUpdated);
+}
+
+bool decodeSalesSummary(RecordReader& r, SalesSummary& summary) {
+    summary.confirmedOrders = r.getVarU32();
+    summary.cancelledOrders = r.getVarU32();
+    uint64_t revenue = r.getU32();
+    revenue |= static_cast<uint64_t>(r.getU32()) << 32;
+    summary.revenue = static_cast<int64_t>(revenue);
+    uint64_t cancelled = r.getU32();
+    cancelled |= static_cast<uint64_t>(r.getU32()) << 32;
+    summary.cancelledAmount = static_cast<int64_t>(cancelled);
+    summary.lastUpdated = r.getVarU32();
+    return r.ok();
+}
+
+static void encodeRollupBreakdownList(RecordWriter& w, const std::vector<SalesRollupBreakdown>& rows) {
+    w.putVarU32(rows.size());
+    for (const auto& row : rows) {
+        w.putString(row.key);
+        w.putVarI32(row.qty);
+        w.putVarI32(row.amount);
+        w.putVarI32(row.cancelledQty);
+        w.putVarI32(row.cancelledAmount);
+    }
+}
+
+static bool decodeRollupBreakdownList(RecordReader& r, std::vector<SalesRollupBreakdown>& rows) {
+    uint32_t count = r.getVarU32();
+    if (!r.ok() || count > r.remaining()) {
+        return false;
+    }
+    rows.resize(count);
+    for (auto& row : rows) {
+        r.getString(row.key);
+        row.qty = r.getVarI32();
+        row.amount = r.getVarI32();
+        row.cancelledQty = r.getVarI32();
+        row.cancelledAmount = r.getVarI32();
+    }
+    return r.ok();
+}
+
+void encodeSalesRollupBreakdowns(RecordWriter& w, const SalesRollup& rollup) {
+    w.putVarU32(rollup.lastUpdated);
+    encodeRollupBreakdownList(w, rollup.priceModes);
+    encodeRollupBreakdownList(w, rollup.kinds);
+}
+
+bool decodeSalesRollupBreakdowns(RecordReader& r, SalesRollup& rollup) {
+    rollup.lastUpdated = r.getVarU32();
+    return decodeRollupBreakdownList(r, rollup.priceModes) && decodeRollupBreakdownList(r, rollup.kinds);
+}
+
+// Cells are stored as bucket deltas; consecutive 15-minute buckets cost a couple of bytes each.
+void encodeSalesRollupSku(RecordWriter& w, const SalesRollupSku& row) {
+    w.putString(row.sku);
+    w.putString(row.name);
+    w.putVarI32(row.qty);
+    w.putVarI32(row.amount);
+    w.putVarI32(row.cancelledQty);
+    w.putVarI32(row.cancelledAmount);
+    w.putVarU32(row.cells.size());
+    uint32_t prev = 0;
+    for (const auto& cell : row.cells) {
+        w.putVarU32(cell.bucket - prev);
+        w.putVarI32(cell.qty);
+        w.putVarI32(cell.amount);
+        prev = cell.bucket;
+    }
+}
+
+bool decodeSalesRollupSku(RecordReader& r, SalesRollupSku& row) {
+    r.getString(row.sku);
+    r.getString(row.name);
+    row.qty = r.getVarI32();
+    row.amount = r.getVarI32();
+    row.cancelledQty = r.getVarI32();
+    row.cancelledAmount = r.getVarI32();
+    uint32_t count = r.getVarU32();
+    if (!r.ok() || count > r.remaining()) {
+        return false;
+    }
+    row.cells.resize(count);
+    uint32_t prev = 0;
+    for (auto& cell : row.cells) {
+        cell.bucket = prev + r.getVarU32();
+        cell.qty = r.getVarI32();
+        cell.amount = r.getVarI32();
+        prev = cell.bucket;
+    }
+    return r.ok();
+}
+
+void encodeArchiveBloom(RecordWriter& w, const ArchiveBloomFilter& bloom) {
+    w.putString(bloom.sessionId);
+    w.putVarU32(bloom.entries);
+    w.putU32(bloom.lastKey);
+    w.putU32(bloom.lastOffset);
+    w.putBytes(bloom.bits);
+}
+
+bool decodeArchiveBloom(RecordReader& r, ArchiveBloomFilter& bloom) {
+    r.getString(bloom.sessionId);
+    bloom.entries = r.getVarU32();
+    bloom.lastKey = r.getU32();
+    bloom.lastOffset = r.getU32();
+    r.getBytes(bloom.bits);
+    return r.ok();
+}
@@ -0,0 +1,124 @@
+#include "sales_rollup.h"
+#include <algorithm>
+
+static SalesRollup g_salesRollup;
+
+const SalesRollup& getSalesRollup() {
+    return g_salesRollup;
+}
+
+void salesRollupReset() {
+    g_salesRollup = SalesRollup{};
+}
+
+void salesRollupRestore(SalesRollup& rollup) {
+    std::swap(g_salesRollup, rollup);
+}
+
+// The menu holds a few dozen SKUs at most, so a linear probe stays cheaper than a hash table.
+static SalesRollupSku& findSku(const LineItem& line) {
+    for (auto& row : g_salesRollup.skus) {
+        if (row.sku == line.sku) {
+            return row;
+        }
+    }
+    g_salesRollup.skus.push_back(SalesRollupSku{});
+    SalesRollupSku& row = g_salesRollup.skus.back();
+    row.sku = line.sku;
+    row.name = line.name;
+    return row;
+}
+
+static SalesRollupBreakdown& findBreakdown(std::vector<SalesRollupBreakdown>& rows, const String& key) {
+    for (auto& row : rows) {
+        if (row.key == key) {
+            return row;
+        }
+    }
+    rows.push_back(SalesRollupBreakdown{});
+    rows.back().key = key;
+    return rows.back();
+}
+
+// Orders arrive in time order, so the hot path hits or extends the last cell.
+static SalesRollupCell& findCell(SalesRollupSku& row, uint32_t bucket) {
+    auto& cells = row.cells;
+    if (cells.empty() || cells.back().bucket < bucket) {
+        cells.push_back(SalesRollupCell{});
+        cells.back().bucket = bucket;
+        return cells.back();
+    }
+    if (cells.back().bucket == bucket) {
+        return cells.back();
+    }
+    auto it = std::lower_bound(cells.begin(), cells.end(), bucket,
+                               [](const SalesRollupCell& cell, uint32_t b) { return cell.bucket < b; });
+    if (it == cells.end() || it->bucket != bucket) {
+        it = cells.insert(it, SalesRollupCell{});
+        it->bucket = bucket;
+    }
+    return *it;
+}
+
+static int32_t lineAmount(const LineItem& line) {
+    return line.unitPriceApplied * line.qty - line.discountValue;
+}
+
+static void addLine(const LineItem& line, uint32_t bucket, int32_t sign) {
+    int32_t qty = line.qty * sign;
+    int32_t amount = lineAmount(line) * sign;
+
+    SalesRollupSku& row = findSku(line);
+    row.qty += qty;
+    row.amount += amount;
+    SalesRollupCell& cell = findCell(row, bucket);
+    cell.qty += qty;
+    cell.amount += amount;
+    if (cell.qty == 0 && cell.amount == 0) {
+        // A bucket emptied by cancellations would otherwise linger in every response and snapshot.
+        row.cells.erase(row.cells.begin() + (&cell - row.cells.data()));
+    }
+
+    SalesRollupBreakdown& mode = findBreakdown(g_salesRollup.priceModes, line.priceMode);
+    mode.qty += qty;
+    mode.amount += amount;
+    SalesRollupBreakdown& kind = findBreakdown(g_salesRollup.kinds, line.kind);
+    kind.qty += qty;
+    kind.amount += amount;
+}
+
+static void addCancelledLine(const LineItem& line) {
+    int32_t amount = lineAmount(line);
+
+    SalesRollupSku& row = findSku(line);
+    row.cancelledQty += line.qty;
+    row.cancelledAmount += amount;
+    SalesRollupBreakdown& mode = findBreakdown(g_salesRollup.priceModes, line.priceMode);
+    mode.cancelledQty += line.qty;
+    mode.cancelledAmount += amount;
+    SalesRollupBreakdown& kind = findBreakdown(g_salesRollup.kinds, line.kind);
+    kind.cancelledQty += line.qty;
+    kind.cancelledAmount += amount;
+}
+
+void salesRollupAddOrder(const Order& order) {
+    uint32_t bucket = order.ts - order.ts % kSalesRollupBucketSeconds;
+    bool cancelled = order.status == "CANCELLED";
+    for (const auto& line : order.items) {
+        if (cancelled) {
+            addCancelledLine(line);
+        } else {
+            addLine(line, bucket, 1);
+        }
+    }
+    g_salesRollup.lastUpdated = static_cast<uint32_t>(time(nullptr));
+}
+
+void salesRollupCancelOrder(const Order& order) {
+    uint32_t bucket = order.ts - order.ts % kSalesRollupBucketSeconds;
+    for (const auto& line : order.items) {
+        addLine(line, bucket, -1);
+        addCancelledLine(line);
+    }
+    g_salesRollup.lastUpdated = static_cast<uint32_t>(time(nullptr));
+}
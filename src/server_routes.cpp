@@ -1,5 +1,11 @@
 #include "server_routes.h"
 #include "store.h"
+#include "archive.h"
+#include "checkpoint_scheduler.h"
+#include "flash_stats.h"
+#include "json_arena.h"
+#include "sales_rollup.h"
+#include "wal.h"
 #include "orders.h"
 #include "printer_queue.h"
 #include "csv_export.h"
@@ -8,11 +14,13 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <LittleFS.h>
 #include <WiFi.h>
 #include <time.h>
 #include <sys/time.h>
 #include <Preferences.h>
 #include <cstdlib>
+#include <algorithm>
 
 extern void requestAccessPointSuspend(uint32_t resumeDelayMs);
 extern bool isAccessPointEnabled();
@@ -22,6 +30,70 @@ extern uint32_t getAccessPointResumeEtaMs();
 static void processReprintRequest(AsyncWebServerRequest *request, const JsonDocument& doc);
 static void processCancelRequest(AsyncWebServerRequest *request, const uint8_t *data, size_t len);
 
+struct DurabilityAckStats {
+  uint32_t acks{0};
+  uint32_t failures{0};
+  uint64_t totalUs{0};
+  uint32_t maxUs{0};
+};
+static DurabilityAckStats g_durabilityAckStats[kDurabilityLevelCount];
+
+// 変更系APIは応答前にここを通す。settings.durability の段階まで永続化を待ち、届かなければ false。
+// ticket == 0 はWALに載らない変更で、スナップショットでしか残らない。
+// appended == false は walAppend が記録を拒否した（大きすぎる等）変更で、段階に関係なく失敗にする
+static bool persistMutation(WalTicket ticket, bool appended = true) {
+  uint8_t level = S().settings.durability < kDurabilityLevelCount ? S().settings.durability
+                                                                  : static_cast<uint8_t>(kDurabilityWal);
+  uint32_t startedUs = micros();
+  bool ok = true;
+  if (!appended) {
+    ok = false;
+  } else if (level == kDurabilitySnapshot) {
+    ok = (ticket == 0 || walWaitDurable(ticket)) && snapshotSave();
+  } else if (ticket == 0) {
+    requestSnapshotSave();
+  } else if (level == kDurabilityWal) {
+    ok = walWaitDurable(ticket);
+  }
+  // memory は walTick() のグループコミットに任せる
+  if (!ok) {
+    Serial.printf("[E] mutation not durable (level=%s)\n", durabilityLevelName(level));
+    requestSnapshotSave();
+  }
+
+  uint32_t elapsedUs = micros() - startedUs;
+  DurabilityAckStats& stats = g_durabilityAckStats[level];
+  stats.acks++;
+  if (!ok) {
+    stats.failures++;
+  }
+  stats.totalUs += elapsedUs;
+  stats.maxUs = std::max(stats.maxUs, elapsedUs);
+  return ok;
+}
+
+static void sendNotDurable(AsyncWebServerRequest *request) {
+  request->send(500, "application/json", "{\"ok\":false,\"error\":\"Failed to persist change\"}");
+}
+
+static void sendSalesSummary(AsyncWebServerRequest *request) {
+  const SalesSummary& summary = getSalesSummary();
+  DynamicJsonDocument doc(256);
+  doc["sessionId"] = S().session.sessionId;
+  doc["updatedAt"] = summary.lastUpdated;
+  doc["confirmedOrders"] = summary.confirmedOrders;
+  doc["cancelledOrders"] = summary.cancelledOrders;
+  doc["totalOrders"] = summary.confirmedOrders + summary.cancelledOrders;
+  doc["netSales"] = summary.revenue;
+  doc["cancelledAmount"] = summary.cancelledAmount;
+  doc["grossSales"] = summary.revenue + summary.cancelledAmount;
+  doc["currency"] = "JPY";
+
+  String out;
+  serializeJson(doc, out);
+  request->send(200, "application/json", out);
+}
+
 static void fillOrderJson(JsonObject obj, const Order& order) {
   obj["orderNo"] = order.orderNo;
   obj["status"] = order.status;
@@ -55,14 +127,37 @@ struct ArchiveStreamContext {
   AsyncResponseStream* stream;
   const String* sessionFilter;
   bool first;
+  size_t count;
 
   ArchiveStreamContext()
-    : stream(nullptr), sessionFilter(nullptr), first(true) {}
+    : stream(nullptr), sessionFilter(nullptr), first(true), count(0) {}
 
   ArchiveStreamContext(AsyncResponseStream* s, const String* filter, bool isFirst)
-    : stream(s), sessionFilter(filter), first(isFirst) {}
+    : stream(s), sessionFilter(filter), first(isFirst), count(0) {}
 };
 
+static bool streamArchivedOrder(const Order& order, const String& storedSession, uint32_t archivedAt, void* rawCtx) {
+  auto* context = static_cast<ArchiveStreamContext*>(rawCtx);
+  if (!context || !context->stream) {
+    return false;
+  }
+  if (context->sessionFilter && !context->sessionFilter->isEmpty() && storedSession != *context->sessionFilter) {
+    return true;
+  }
+  JsonArenaLease arena;
+  JsonDocument orderDoc(arena.allocator());
+  JsonObject obj = orderDoc.to<JsonObject>();
+  fillOrderJson(obj, order);
+  obj["archivedAt"] = archivedAt;
+  if (!context->first) {
+    context->stream->print(',');
+  }
+  serializeJson(orderDoc, *context->stream);
+  context->first = false;
+  context->count++;
+  return true;
+}
+
 static void processReprintRequest(AsyncWebServerRequest *request, const JsonDocument& doc) {
   String orderNo = doc["orderNo"] | "";
   Serial.printf("[API] 🖨️ 再印刷要求受信: '%s'\n", orderNo.c_str());
@@ -251,8 +346,6 @@ static void processCancelRequest(AsyncWebServerRequest *request, const uint8_t *
 
   applyCancellationToSalesSummary(*activeOrder);
 
-  bool requireSnapshot = !fromArchive;
-
   if (fromArchive) {
     if (!archiveReplaceOrder(*activeOrder, S().session.sessionId, archivedAtTs)) {
       Serial.printf("[API] ❌ アーカイブ更新失敗: %s\n", orderNo.c_str());
@@ -261,19 +354,18 @@ static void processCancelRequest(AsyncWebServerRequest *request, const uint8_t *
     }
   }
 
-  StaticJsonDocument<768> walDoc;
-  walDoc["ts"] = static_cast<uint32_t>(time(nullptr));
-  walDoc["action"] = "ORDER_CANCEL";
-  walDoc["orderNo"] = orderNo;
-  walDoc["cancelReason"] = reason;
-  if (fromArchive) {
-    walDoc["archived"] = true;
-  }
-  String walLine; serializeJson(walDoc, walLine);
-  walAppend(walLine);
-
-  if (requireSnapshot) {
-      requestSnapshotSave();
+  WalRecord walRec;
+  walRec.action = kWalOrderCancel;
+  walRec.ts = static_cast<uint32_t>(time(nullptr));
+  walRec.orderNo = orderNo;
+  walRec.cancelReason = reason;
+  walRec.archived = fromArchive;
+  WalTicket walTicket = 0;
+  bool logged = walAppend(walRec, &walTicket);
+
+  if (!persistMutation(walTicket, logged)) {
+    sendNotDurable(request);
+    return;
   }
 
   JsonDocument notify;
@@ -298,8 +390,36 @@ static void processCancelRequest(AsyncWebServerRequest *request, const uint8_t *
   request->send(200, "application/json", out);
 }
 
+// 起動時のWAL再生が終わるまでAPIを止める。再生は loop() から S() を書き換えるが、
+// 参照系ハンドラは StateLock を取らずに S() を読むので、参照系も 503 にする（ping と進捗だけ通す）
+class RecoveryGateHandler : public AsyncWebHandler {
+public:
+  bool canHandle(AsyncWebServerRequest *request) override {
+    if (!isRecoveryInProgress() || !request->url().startsWith("/api/")) {
+      return false;
+    }
+    bool readsNoState = request->method() == HTTP_GET &&
+                        (request->url() == "/api/ping" || request->url() == "/api/system/recovery");
+    return !readsNoState;
+  }
+
+  void handleRequest(AsyncWebServerRequest *request) override {
+    RecoveryStatus status = getRecoveryStatus();
+    JsonDocument res;
+    res["ok"] = false;
+    res["error"] = "recovering";
+    res["segmentsDone"] = status.segmentsDone;
+    res["segmentsTotal"] = status.segmentsTotal;
+    String out; serializeJson(res, out);
+    AsyncWebServerResponse* response = request->beginResponse(503, "application/json", out);
+    response->addHeader("Retry-After", "1");
+    request->send(response);
+  }
+};
+
 void initHttpRoutes(AsyncWebServer &server) {
   refreshMenuEtag();
+  server.addHandler(new RecoveryGateHandler());
   server.on("/api/ping", HTTP_GET, [](AsyncWebServerRequest *request) {
     JsonDocument doc;
     doc["ok"] = true;
@@ -364,6 +484,7 @@ void initHttpRoutes(AsyncWebServer &server) {
     doc["settings"]["numbering"]["min"] = S().settings.numbering.min;
     doc["settings"]["numbering"]["max"] = S().settings.numbering.max;
     doc["settings"]["presaleEnabled"] = S().settings.presaleEnabled;
+    doc["settings"]["durability"] = durabilityLevelName(S().settings.durability);
     doc["settings"]["qrPrint"]["enabled"] = S().settings.qrPrint.enabled;
     doc["settings"]["qrPrint"]["content"] = S().settings.qrPrint.content;
 
@@ -413,6 +534,7 @@ void initHttpRoutes(AsyncWebServer &server) {
   server.on("/api/products/main", HTTP_POST, [](AsyncWebServerRequest *request) {},
     nullptr,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t) {
+      StateLock lock;
       JsonDocument doc;
       if (deserializeJson(doc, (char*)data, len)) {
         request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
@@ -431,8 +553,7 @@ void initHttpRoutes(AsyncWebServer &server) {
 
           if (id.isEmpty()) id = generateSkuMain();
 
-          MenuItem* existing = nullptr;
-          for (auto& it : S().menu) if (it.sku == id) { existing = &it; break; }
+          MenuItem* existing = findMenuItemBySku(id);
 
           if (existing) {
             existing->name = name;
@@ -448,6 +569,7 @@ void initHttpRoutes(AsyncWebServer &server) {
             m.presale_discount_amount = presale_discount_amount;
             m.active = active;
             S().menu.push_back(m);
+            noteMenuItemAdded();
           }
           touchedMenu = true;
         }
@@ -455,28 +577,34 @@ void initHttpRoutes(AsyncWebServer &server) {
       if (touchedMenu) {
         bumpCatalogVersion();
       }
-      // WAL記録（JSON形式）
+      // WAL記録
+      WalTicket walTicket = 0;
+      bool logged = true;
       for (JsonVariantConst v : doc["items"].as<JsonArrayConst>()) {
-  StaticJsonDocument<512> walDoc;
-        walDoc["ts"] = (uint32_t)time(nullptr);
-        walDoc["action"] = "MAIN_UPSERT";
-        walDoc["sku"] = v["id"] | "";
-        walDoc["name"] = v["name"] | "";
-        walDoc["nameRomaji"] = v["nameRomaji"] | "";
-        walDoc["price_normal"] = v["price_normal"] | 0;
-        walDoc["presale_discount_amount"] = v["presale_discount_amount"] | 0;
-        walDoc["active"] = v["active"] | true;
-        walDoc["catalogVersion"] = S().settings.catalogVersion;
-        String walLine; serializeJson(walDoc, walLine);
-        walAppend(walLine);
+        WalRecord walRec;
+        walRec.action = kWalMainUpsert;
+        walRec.ts = (uint32_t)time(nullptr);
+        walRec.item.sku = v["id"] | "";
+        walRec.item.name = v["name"] | "";
+        walRec.item.nameRomaji = v["nameRomaji"] | "";
+        walRec.item.category = "MAIN";
+        walRec.item.price_normal = v["price_normal"] | 0;
+        walRec.item.presale_discount_amount = v["presale_discount_amount"] | 0;
+        walRec.item.active = v["active"] | true;
+        walRec.catalogVersion = S().settings.catalogVersion;
+        logged = walAppend(walRec, &walTicket) && logged;
+      }
+      if (!persistMutation(walTicket, logged)) {
+        sendNotDurable(request);
+        return;
       }
-      requestSnapshotSave();
       request->send(200, "application/json", "{\"ok\":true}");
     });
 
   server.on("/api/products/side", HTTP_POST, [](AsyncWebServerRequest *request) {},
     nullptr,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t) {
+      StateLock lock;
       JsonDocument doc;
       if (deserializeJson(doc, (char*)data, len)) {
         request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
@@ -495,8 +623,7 @@ void initHttpRoutes(AsyncWebServer &server) {
 
           if (id.isEmpty()) id = generateSkuSide();
 
-          MenuItem* existing = nullptr;
-          for (auto& it : S().menu) if (it.sku == id) { existing = &it; break; }
+          MenuItem* existing = findMenuItemBySku(id);
 
           if (existing) {
             existing->name = name;
@@ -512,6 +639,7 @@ void initHttpRoutes(AsyncWebServer &server) {
             m.price_as_side = price_as_side;
             m.active = active;
             S().menu.push_back(m);
+            noteMenuItemAdded();
           }
           touchedMenu = true;
         }
@@ -519,28 +647,34 @@ void initHttpRoutes(AsyncWebServer &server) {
       if (touchedMenu) {
         bumpCatalogVersion();
       }
-      // WAL記録（JSON形式）
+      // WAL記録
+      WalTicket walTicket = 0;
+      bool logged = true;
       for (JsonVariantConst v : doc["items"].as<JsonArrayConst>()) {
-  StaticJsonDocument<512> walDoc;
-        walDoc["ts"] = (uint32_t)time(nullptr);
-        walDoc["action"] = "SIDE_UPSERT";
-        walDoc["sku"] = v["id"] | "";
-        walDoc["name"] = v["name"] | "";
-        walDoc["nameRomaji"] = v["nameRomaji"] | "";
-        walDoc["price_single"] = v["price_single"] | 0;
-        walDoc["price_as_side"] = v["price_as_side"] | 0;
-        walDoc["active"] = v["active"] | true;
-        walDoc["catalogVersion"] = S().settings.catalogVersion;
-        String walLine; serializeJson(walDoc, walLine);
-        walAppend(walLine);
+        WalRecord walRec;
+        walRec.action = kWalSideUpsert;
+        walRec.ts = (uint32_t)time(nullptr);
+        walRec.item.sku = v["id"] | "";
+        walRec.item.name = v["name"] | "";
+        walRec.item.nameRomaji = v["nameRomaji"] | "";
+        walRec.item.category = "SIDE";
+        walRec.item.price_single = v["price_single"] | 0;
+        walRec.item.price_as_side = v["price_as_side"] | 0;
+        walRec.item.active = v["active"] | true;
+        walRec.catalogVersion = S().settings.catalogVersion;
+        logged = walAppend(walRec, &walTicket) && logged;
+      }
+      if (!persistMutation(walTicket, logged)) {
+        sendNotDurable(request);
+        return;
       }
-    requestSnapshotSave();
       request->send(200, "application/json", "{\"ok\":true}");
     });
 
   server.on("/api/settings/chinchiro", HTTP_POST, [](AsyncWebServerRequest *request){},
     nullptr,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t) {
+      StateLock lock;
       JsonDocument doc;
       if (deserializeJson(doc, (char*)data, len)) {
         request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
@@ -557,16 +691,22 @@ void initHttpRoutes(AsyncWebServer &server) {
         }
       }
 
-      // WAL記録（JSON形式）
-  StaticJsonDocument<512> walDoc;
-      walDoc["ts"] = (uint32_t)time(nullptr);
-      walDoc["action"] = "SETTINGS_UPDATE";
-      walDoc["chinchiro"]["enabled"] = S().settings.chinchiro.enabled;
-      walDoc["chinchiro"]["rounding"] = S().settings.chinchiro.rounding;
-      String walLine; serializeJson(walDoc, walLine);
-      walAppend(walLine);
-      
-    requestSnapshotSave();
+      // WAL記録
+      WalRecord walRec;
+      walRec.action = kWalSettingsUpdate;
+      walRec.ts = (uint32_t)time(nullptr);
+      walRec.settingsMask = kWalSettingsChinchiro;
+      walRec.settings.chinchiro.enabled = S().settings.chinchiro.enabled;
+      walRec.settings.chinchiro.rounding = S().settings.chinchiro.rounding;
+      WalTicket walTicket = 0;
+      bool logged = walAppend(walRec, &walTicket);
+
+      // 倍率はWALに載らないのでスナップショットでも残す
+      requestSnapshotSave();
+      if (!persistMutation(walTicket, logged)) {
+        sendNotDurable(request);
+        return;
+      }
 
       JsonDocument sync; sync["type"] = "sync.snapshot";
       String msg; serializeJson(sync, msg); wsBroadcast(msg);
@@ -577,6 +717,7 @@ void initHttpRoutes(AsyncWebServer &server) {
   server.on("/api/settings/qrprint", HTTP_POST, [](AsyncWebServerRequest *request){},
     nullptr,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t) {
+      StateLock lock;
       JsonDocument doc;
       if (deserializeJson(doc, (char*)data, len)) {
         request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
@@ -590,16 +731,20 @@ void initHttpRoutes(AsyncWebServer &server) {
   Serial.printf("QR Print設定更新: enabled=%d, content=%s\n",
         S().settings.qrPrint.enabled, S().settings.qrPrint.content.c_str());
 
-      // WAL記録（JSON形式）
-  StaticJsonDocument<512> walDoc;
-      walDoc["ts"] = (uint32_t)time(nullptr);
-      walDoc["action"] = "SETTINGS_UPDATE";
-      walDoc["qrPrint"]["enabled"] = S().settings.qrPrint.enabled;
-  walDoc["qrPrint"]["content"] = S().settings.qrPrint.content;
-      String walLine; serializeJson(walDoc, walLine);
-      walAppend(walLine);
-      
-    requestSnapshotSave();
+      // WAL記録
+      WalRecord walRec;
+      walRec.action = kWalSettingsUpdate;
+      walRec.ts = (uint32_t)time(nullptr);
+      walRec.settingsMask = kWalSettingsQrPrint;
+      walRec.settings.qrPrint.enabled = S().settings.qrPrint.enabled;
+      walRec.settings.qrPrint.content = S().settings.qrPrint.content;
+      WalTicket walTicket = 0;
+      bool logged = walAppend(walRec, &walTicket);
+
+      if (!persistMutation(walTicket, logged)) {
+        sendNotDurable(request);
+        return;
+      }
 
       JsonDocument sync; sync["type"] = "sync.snapshot";
       String msg; serializeJson(sync, msg); wsBroadcast(msg);
@@ -610,6 +755,7 @@ void initHttpRoutes(AsyncWebServer &server) {
   server.on("/api/orders", HTTP_POST, [](AsyncWebServerRequest *request){},
     nullptr,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t) {
+      StateLock lock;
       Serial.printf("[API] POST /api/orders - URL=%s\n", request->url().c_str());
       
       JsonDocument doc;
@@ -687,6 +833,11 @@ void initHttpRoutes(AsyncWebServer &server) {
         request->send(400, "application/json", "{\"ok\":false,\"error\":\"lines must be a non-empty array\"}");
         return;
       }
+      if (order.orderNo.isEmpty()) {
+        // 番号帯がすべて未受け取りの注文で埋まっている。使用中の番号は再利用しない
+        request->send(503, "application/json", "{\"error\":\"All order numbers are in use\"}");
+        return;
+      }
 
       Serial.println("=== 注文作成デバッグ ===");
       Serial.printf("注文番号: %s\n", order.orderNo.c_str());
@@ -698,23 +849,12 @@ void initHttpRoutes(AsyncWebServer &server) {
           i+1, it.name.c_str(), it.qty, it.unitPriceApplied, it.kind.c_str());
       }
 
-  S().orders.push_back(order);
-  applyOrderToSalesSummary(order);
-      
-    DynamicJsonDocument walDoc(4096);
-      walDoc["ts"] = (uint32_t)time(nullptr);
-      walDoc["action"] = "ORDER_CREATE";
-    walDoc["orderNo"] = order.orderNo;
-      orderToJson(walDoc.createNestedObject("order"), order);
-
-      String walLine; serializeJson(walDoc, walLine);
-      walAppend(walLine);
-      
-      enqueuePrint(order);
-
-      if (!snapshotSave()) {
-        Serial.println("[SNAP] save failed after order create");
-        request->send(500, "application/json", R"({"error":"snapshotSave failed"})");
+      // 追加・売上集計・印刷キューを1件のWALトランザクションで記録する。
+      // 永続化に失敗しても注文はメモリにあるので印刷は出す（再送で二重注文にしないため）
+      WalTicket walTicket = 0;
+      bool logged = commitOrderCreate(order, &walTicket);
+      if (!persistMutation(walTicket, logged)) {
+        sendNotDurable(request);
         return;
       }
 
@@ -731,6 +871,7 @@ void initHttpRoutes(AsyncWebServer &server) {
   server.on("/api/orders/update", HTTP_POST, [](AsyncWebServerRequest *request){},
     nullptr,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t) {
+      StateLock lock;
       JsonDocument doc;
       if (deserializeJson(doc, (char*)data, len)) {
         request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
@@ -751,25 +892,29 @@ void initHttpRoutes(AsyncWebServer &server) {
       }
       if (!found) { request->send(404, "application/json", "{\"error\":\"Order not found\"}"); return; }
 
-      // WAL記録（JSON形式）
+      // WAL記録
+      WalTicket walTicket = 0;
+      bool logged = true;
       for (const auto& o : S().orders) {
         if (o.orderNo == orderNo) {
-          StaticJsonDocument<512> walDoc;
-          walDoc["ts"] = (uint32_t)time(nullptr);
-          walDoc["action"] = "ORDER_UPDATE";
-          walDoc["orderNo"] = orderNo;
-          walDoc["status"] = newStatus;
-          walDoc["cooked"] = o.cooked;
-          walDoc["pickup_called"] = o.pickup_called;
-          walDoc["picked_up"] = o.picked_up;
-          walDoc["printed"] = o.printed;
-          String walLine; serializeJson(walDoc, walLine);
-          walAppend(walLine);
+          WalRecord walRec;
+          walRec.action = kWalOrderUpdate;
+          walRec.ts = (uint32_t)time(nullptr);
+          walRec.orderNo = orderNo;
+          walRec.status = newStatus;
+          walRec.cooked = o.cooked;
+          walRec.pickupCalled = o.pickup_called;
+          walRec.pickedUp = o.picked_up;
+          walRec.printed = o.printed;
+          logged = walAppend(walRec, &walTicket);
           break;
         }
       }
-      
-    requestSnapshotSave();
+
+      if (!persistMutation(walTicket, logged)) {
+        sendNotDurable(request);
+        return;
+      }
 
       JsonDocument notify; notify["type"]="order.updated"; notify["orderNo"]=orderNo; notify["status"]=newStatus;
       String msg; serializeJson(notify, msg); wsBroadcast(msg);
@@ -833,33 +978,87 @@ void initHttpRoutes(AsyncWebServer &server) {
   server.on("/api/orders/cancel", HTTP_POST, [](AsyncWebServerRequest *request) {},
     nullptr,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t) {
+      StateLock lock;
       processCancelRequest(request, data, len);
     });
 
   server.on("/api/sales/summary", HTTP_GET, [](AsyncWebServerRequest *request) {
-    bool rebuild = request->hasParam("rebuild");
-    if (rebuild) {
-      if (!recalculateSalesSummary()) {
-        request->send(500, "application/json", "{\"error\":\"Failed to rebuild sales summary\"}");
-        return;
+    sendSalesSummary(request);
+  });
+
+  // 再集計は g_salesSummary とロールアップを書き換えるので、更新系として StateLock 下で行う
+  server.on("/api/sales/summary/rebuild", HTTP_POST, [](AsyncWebServerRequest *request) {
+    StateLock lock;
+    if (!recalculateSalesSummary()) {
+      request->send(500, "application/json", "{\"error\":\"Failed to rebuild sales summary\"}");
+      return;
+    }
+    sendSalesSummary(request);
+  });
+
+  // 集計済みロールアップをそのまま返す（端末側での再計算なし）
+  server.on("/api/sales/rollup", HTTP_GET, [](AsyncWebServerRequest *request) {
+    const SalesRollup& rollup = getSalesRollup();
+
+    std::vector<uint32_t> buckets;
+    for (const auto& row : rollup.skus) {
+      for (const auto& cell : row.cells) {
+        buckets.push_back(cell.bucket);
       }
     }
+    std::sort(buckets.begin(), buckets.end());
+    buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
 
-    const SalesSummary& summary = getSalesSummary();
-    DynamicJsonDocument doc(256);
-    doc["sessionId"] = S().session.sessionId;
-    doc["updatedAt"] = summary.lastUpdated;
-    doc["confirmedOrders"] = summary.confirmedOrders;
-    doc["cancelledOrders"] = summary.cancelledOrders;
-    doc["totalOrders"] = summary.confirmedOrders + summary.cancelledOrders;
-    doc["netSales"] = summary.revenue;
-    doc["cancelledAmount"] = summary.cancelledAmount;
-    doc["grossSales"] = summary.revenue + summary.cancelledAmount;
-    doc["currency"] = "JPY";
+    AsyncResponseStream* stream = request->beginResponseStream("application/json");
+    stream->printf("{\"sessionId\":\"%s\",\"updatedAt\":%u,\"bucketSeconds\":%u,\"buckets\":[",
+                   S().session.sessionId.c_str(), static_cast<unsigned>(rollup.lastUpdated),
+                   static_cast<unsigned>(kSalesRollupBucketSeconds));
+    for (size_t i = 0; i < buckets.size(); ++i) {
+      stream->printf(i > 0 ? ",%u" : "%u", static_cast<unsigned>(buckets[i]));
+    }
 
-    String out;
-    serializeJson(doc, out);
-    request->send(200, "application/json", out);
+    // cells: [bucketsの添字, 数量, 金額]
+    stream->print("],\"skus\":[");
+    for (size_t i = 0; i < rollup.skus.size(); ++i) {
+      const SalesRollupSku& row = rollup.skus[i];
+      JsonDocument doc;
+      doc["sku"] = row.sku;
+      doc["name"] = row.name;
+      doc["qty"] = row.qty;
+      doc["amount"] = row.amount;
+      doc["cancelledQty"] = row.cancelledQty;
+      doc["cancelledAmount"] = row.cancelledAmount;
+      JsonArray cells = doc["cells"].to<JsonArray>();
+      for (const auto& cell : row.cells) {
+        JsonArray c = cells.add<JsonArray>();
+        c.add(static_cast<uint32_t>(std::lower_bound(buckets.begin(), buckets.end(), cell.bucket) - buckets.begin()));
+        c.add(cell.qty);
+        c.add(cell.amount);
+      }
+      if (i > 0) {
+        stream->print(',');
+      }
+      serializeJson(doc, *stream);
+    }
+
+    // 内訳: キー → [数量, 金額, 取消数量, 取消金額]
+    JsonDocument breakdowns;
+    JsonObject modes = breakdowns["priceModes"].to<JsonObject>();
+    for (const auto& row : rollup.priceModes) {
+      JsonArray v = modes[row.key.isEmpty() ? String("none") : row.key].to<JsonArray>();
+      v.add(row.qty); v.add(row.amount); v.add(row.cancelledQty); v.add(row.cancelledAmount);
+    }
+    JsonObject kinds = breakdowns["kinds"].to<JsonObject>();
+    for (const auto& row : rollup.kinds) {
+      JsonArray v = kinds[row.key.isEmpty() ? String("none") : row.key].to<JsonArray>();
+      v.add(row.qty); v.add(row.amount); v.add(row.cancelledQty); v.add(row.cancelledAmount);
+    }
+    stream->print("],\"priceModes\":");
+    serializeJson(breakdowns["priceModes"], *stream);
+    stream->print(",\"kinds\":");
+    serializeJson(breakdowns["kinds"], *stream);
+    stream->print('}');
+    request->send(stream);
   });
 
   server.on("/api/printer/status", HTTP_GET, [](AsyncWebServerRequest *request) {
@@ -873,7 +1072,12 @@ void initHttpRoutes(AsyncWebServer &server) {
   });
 
   server.on("/api/printer/paper-replaced", HTTP_POST, [](AsyncWebServerRequest *request) {
+    StateLock lock;
     onPaperReplaced();
+    if (!persistMutation(0)) {
+      sendNotDurable(request);
+      return;
+    }
 
     JsonDocument notify;
     notify["type"] = "printer.status";
@@ -951,57 +1155,27 @@ void initHttpRoutes(AsyncWebServer &server) {
   });
 
   server.on("/api/export/snapshot", HTTP_GET, [](AsyncWebServerRequest *request) {
-    String json;
     String path;
-    if (!getLatestSnapshotJson(json, path)) {
+    if (!getLatestSnapshotPath(path)) {
       request->send(404, "application/json", "{\"error\":\"snapshot not found\"}");
       return;
     }
 
-    size_t baseSize = json.length();
-    DynamicJsonDocument snapDoc(baseSize + 16384);
-    DeserializationError err = deserializeJson(snapDoc, json);
-    String filename = path.endsWith("snapA.json") ? "snapshotA.json" : "snapshotB.json";
-    if (!err) {
-      snapDoc["generatedAt"] = static_cast<uint32_t>(time(nullptr));
-      String sessionId = S().session.sessionId;
-      JsonArray archivedArray = snapDoc["archivedOrders"].to<JsonArray>();
-
-      struct SnapshotArchiveContext {
-        JsonArray* array;
-        const String* sessionFilter;
-      } ctx;
-      ctx.array = &archivedArray;
-      ctx.sessionFilter = &sessionId;
-
-      auto visitor = [](const Order& order, const String& storedSession, uint32_t archivedAt, void* rawCtx) -> bool {
-        auto* context = static_cast<SnapshotArchiveContext*>(rawCtx);
-        if (!context || !context->array) {
-          return false;
-        }
-        if (context->sessionFilter && !context->sessionFilter->isEmpty() && storedSession != *context->sessionFilter) {
-          return true;
-        }
-        JsonObject obj = context->array->add<JsonObject>();
-        fillOrderJson(obj, order);
-        obj["archivedAt"] = archivedAt;
-        return true;
-      };
-
-      archiveForEach(sessionId, visitor, &ctx);
+    String filename = path.endsWith("snapA.bin") ? "snapshotA.json" : "snapshotB.json";
+    String sessionId = S().session.sessionId;
+    AsyncResponseStream* stream = request->beginResponseStream("application/json");
+    stream->print('{');
+    writeSnapshotJsonFields(*stream);
+    stream->printf(",\"generatedAt\":%u,\"archivedOrders\":[", static_cast<unsigned>(time(nullptr)));
 
-      String out;
-      serializeJson(snapDoc, out);
-      AsyncWebServerResponse* response = request->beginResponse(200, "application/json", out);
-      response->addHeader("Content-Disposition", "attachment; filename=\"" + filename + "\"");
-      response->addHeader("X-Archive-Count", String(archivedArray.size()));
-      request->send(response);
-      return;
-    }
+    ArchiveStreamContext ctx(stream, &sessionId, true);
+    archiveForEach(sessionId, streamArchivedOrder, &ctx);
 
-    AsyncWebServerResponse* response = request->beginResponse(200, "application/json", json);
-    response->addHeader("Content-Disposition", "attachment; filename=\"" + filename + "\"");
-    request->send(response);
+    stream->print(']');
+    stream->print('}');
+    stream->addHeader("Content-Disposition", "attachment; filename=\"" + filename + "\"");
+    stream->addHeader("X-Archive-Count", String(ctx.count));
+    request->send(stream);
   });
 
   server.on("/api/orders/archive", HTTP_GET, [](AsyncWebServerRequest *request) {
@@ -1016,47 +1190,253 @@ void initHttpRoutes(AsyncWebServer &server) {
   ctx.stream = stream;
   ctx.sessionFilter = &sessionId;
   ctx.first = true;
-    auto visitor = [](const Order& order, const String& storedSession, uint32_t archivedAt, void* rawCtx) -> bool {
-      auto* context = static_cast<ArchiveStreamContext*>(rawCtx);
-      if (!context || !context->stream) {
-        return false;
-      }
-      if (context->sessionFilter && !context->sessionFilter->isEmpty() && storedSession != *context->sessionFilter) {
-        return true;
-      }
-      DynamicJsonDocument orderDoc(estimateOrderDocumentCapacity(order) + 128);
-      JsonObject obj = orderDoc.to<JsonObject>();
-      fillOrderJson(obj, order);
-      obj["archivedAt"] = archivedAt;
-      String json;
-      serializeJson(orderDoc, json);
-      if (!context->first) {
-        context->stream->print(',');
-      }
-      context->stream->print(json);
-      context->first = false;
-      return true;
-    };
-
-    archiveForEach(sessionId, visitor, &ctx);
+    archiveForEach(sessionId, streamArchivedOrder, &ctx);
 
     stream->print(']');
     stream->print('}');
     request->send(stream);
   });
 
+  server.on("/api/archive/segments", HTTP_GET, [](AsyncWebServerRequest *request) {
+    std::vector<ArchiveSegmentInfo> segments = archiveListSegments();
+    AsyncResponseStream* stream = request->beginResponseStream("application/json");
+    stream->print("{\"segments\":[");
+    for (size_t i = 0; i < segments.size(); ++i) {
+      JsonDocument doc;
+      doc["sessionId"] = segments[i].sessionId;
+      doc["path"] = segments[i].path;
+      doc["orders"] = segments[i].orders;
+      doc["amendments"] = segments[i].amendments;
+      doc["bytes"] = segments[i].bytes;
+      doc["rawBytes"] = segments[i].rawBytes;
+      doc["firstArchivedAt"] = segments[i].firstArchivedAt;
+      doc["lastArchivedAt"] = segments[i].lastArchivedAt;
+      doc["sealed"] = segments[i].sealed;
+      doc["compressed"] = segments[i].compressed;
+      if (i > 0) {
+        stream->print(',');
+      }
+      serializeJson(doc, *stream);
+    }
+    stream->print("]}");
+    request->send(stream);
+  });
+
+  server.on("/api/archive/compaction", HTTP_GET, [](AsyncWebServerRequest *request) {
+    ArchiveCompactionStatus status = getArchiveCompactionStatus();
+    JsonDocument doc;
+    doc["active"] = status.active;
+    doc["sessionId"] = status.sessionId;
+    doc["sourceBytes"] = status.sourceBytes;
+    doc["processedBytes"] = status.processedBytes;
+    doc["recordsKept"] = status.recordsKept;
+    doc["recordsDropped"] = status.recordsDropped;
+    doc["runs"] = status.runs;
+    doc["aborted"] = status.aborted;
+    doc["lastReclaimedBytes"] = status.lastReclaimedBytes;
+    doc["reclaimedBytes"] = status.reclaimedBytes;
+    doc["lastDurationMs"] = status.lastDurationMs;
+    doc["compressions"] = status.compressions;
+    doc["compressionSavedBytes"] = status.compressionSavedBytes;
+    String res; serializeJson(doc, res);
+    request->send(200, "application/json", res);
+  });
+
   server.on("/api/system/memory", HTTP_GET, [](AsyncWebServerRequest *request) {
-    StaticJsonDocument<128> doc;
+    StaticJsonDocument<768> doc;
     doc["freeHeap"] = ESP.getFreeHeap();
 #if defined(ESP32)
     doc["minFreeHeap"] = ESP.getMinFreeHeap();
     doc["maxAllocHeap"] = ESP.getMaxAllocHeap();
 #endif
+    ArchiveBloomStats bloomStats = getArchiveBloomStats();
+    JsonObject archiveBloom = doc["archiveBloom"].to<JsonObject>();
+    archiveBloom["filters"] = bloomStats.filters;
+    archiveBloom["bytes"] = bloomStats.bytes;
+    archiveBloom["checks"] = bloomStats.checks;
+    archiveBloom["definitelyNot"] = bloomStats.definitelyNot;
+    archiveBloom["falsePositives"] = bloomStats.falsePositives;
+    archiveBloom["rebuilds"] = bloomStats.rebuilds;
+    archiveBloom["restored"] = bloomStats.restored;
+    JsonArenaStats arenaStats = getJsonArenaStats();
+    JsonObject jsonArena = doc["jsonArena"].to<JsonObject>();
+    jsonArena["reserved"] = arenaStats.reserved;
+    jsonArena["inUse"] = arenaStats.inUse;
+    jsonArena["leases"] = arenaStats.leases;
+    jsonArena["heapLeases"] = arenaStats.heapLeases;
+    jsonArena["spills"] = arenaStats.spills;
+    jsonArena["highWaterBytes"] = arenaStats.highWaterBytes;
+    const SnapshotStats& snap = getSnapshotStats();
+    JsonObject snapshot = doc["snapshot"].to<JsonObject>();
+    snapshot["saves"] = snap.saves;
+    snapshot["failures"] = snap.failures;
+    snapshot["lastBytes"] = snap.lastBytes;
+    snapshot["lastStoredBytes"] = snap.lastStoredBytes;
+    snapshot["lastRecords"] = snap.lastRecords;
+    snapshot["lastDurationMs"] = snap.lastDurationMs;
+    snapshot["maxAllocBefore"] = snap.maxAllocBefore;
+    snapshot["maxAllocLowest"] = snap.maxAllocLowest;
+    snapshot["maxAllocAfter"] = snap.maxAllocAfter;
+    snapshot["checkpointLsn"] = snap.checkpointLsn;
+    snapshot["lastCaptureUs"] = snap.lastCaptureUs;
+    snapshot["lastCaptureBytes"] = snap.lastCaptureBytes;
+    snapshot["captureFallbacks"] = snap.captureFallbacks;
+    snapshot["deltaSaves"] = snap.deltaSaves;
+    snapshot["lastDeltaRecords"] = snap.lastDeltaRecords;
+    snapshot["chainBaseBytes"] = snap.chainBaseBytes;
+    snapshot["chainDeltaBytes"] = snap.chainDeltaBytes;
+    snapshot["chainDeltas"] = snap.chainDeltas;
+    snapshot["loadBytes"] = snap.loadBytes;
+    snapshot["loadRecords"] = snap.loadRecords;
+    snapshot["loadDeltas"] = snap.loadDeltas;
+    snapshot["loadDurationMs"] = snap.loadDurationMs;
+    snapshot["loadedLegacyJson"] = snap.loadedLegacyJson;
+    WalStats walStats = getWalStats();
+    JsonObject wal = doc["wal"].to<JsonObject>();
+    wal["appends"] = walStats.appends;
+    wal["commits"] = walStats.commits;
+    wal["failures"] = walStats.failures;
+    wal["bytesWritten"] = walStats.bytesWritten;
+    wal["largestGroupBytes"] = walStats.largestGroupBytes;
+    wal["lastCommitMs"] = walStats.lastCommitMs;
+    wal["pendingBytes"] = walStats.pendingBytes;
+    wal["lastLsn"] = walStats.lastLsn;
+    wal["rawPartition"] = walStats.rawPartition;
+    JsonObject durability = doc["durability"].to<JsonObject>();
+    durability["level"] = durabilityLevelName(S().settings.durability);
+    for (uint8_t i = 0; i < kDurabilityLevelCount; ++i) {
+      const DurabilityAckStats& ack = g_durabilityAckStats[i];
+      JsonObject level = durability[durabilityLevelName(i)].to<JsonObject>();
+      level["acks"] = ack.acks;
+      level["failures"] = ack.failures;
+      level["avgUs"] = ack.acks > 0 ? static_cast<uint32_t>(ack.totalUs / ack.acks) : 0;
+      level["maxUs"] = ack.maxUs;
+    }
+    if (walStats.rawPartition) {
+      wal["ringPages"] = walStats.ringPages;
+      wal["ringLivePages"] = walStats.ringLivePages;
+      wal["ringErases"] = walStats.ringErases;
+    }
+    String res; serializeJson(doc, res);
+    request->send(200, "application/json", res);
+  });
+
+  // サブシステム別のフラッシュ書き込み量と消去回数の見積もり
+  server.on("/api/system/storage", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonDocument doc;
+    uint32_t totalBytes = LittleFS.totalBytes();
+    uint32_t usedBytes = LittleFS.usedBytes();
+    uint32_t blocks = totalBytes / kFlashBlockSize;
+    JsonObject fs = doc["filesystem"].to<JsonObject>();
+    fs["totalBytes"] = totalBytes;
+    fs["usedBytes"] = usedBytes;
+    fs["freeBytes"] = totalBytes > usedBytes ? totalBytes - usedBytes : 0;
+    fs["blockSize"] = kFlashBlockSize;
+    fs["blocks"] = blocks;
+
+    JsonArray bucketLimits = doc["latencyBucketsUs"].to<JsonArray>();
+    for (uint32_t i = 0, limit = 64; i + 1 < kFlashLatencyBuckets; ++i, limit <<= 2) {
+      bucketLimits.add(limit);
+    }
+
+    // 1ブロック/4KiB書き込み + 1ブロック/メタデータ更新で見積もる（LittleFSはまとめて書くので多めに出る）
+    uint64_t estimatedErases = 0;
+    JsonArray subsystems = doc["subsystems"].to<JsonArray>();
+    for (uint8_t i = 0; i < kFlashSubsystemCount; ++i) {
+      FlashSubsystem id = static_cast<FlashSubsystem>(i);
+      FlashSubsystemStats stats = getFlashStats(id);
+      uint32_t timed = 0;
+      JsonObject sub = subsystems.add<JsonObject>();
+      sub["name"] = flashSubsystemName(id);
+      sub["opens"] = stats.opens;
+      sub["writeOpens"] = stats.writeOpens;
+      sub["writes"] = stats.writes;
+      sub["bytesWritten"] = stats.bytesWritten;
+      sub["flushes"] = stats.flushes;
+      sub["renames"] = stats.renames;
+      sub["removes"] = stats.removes;
+      sub["failures"] = stats.failures;
+      JsonArray histogram = sub["latency"].to<JsonArray>();
+      for (uint8_t b = 0; b < kFlashLatencyBuckets; ++b) {
+        histogram.add(stats.latency[b]);
+        timed += stats.latency[b];
+      }
+      sub["maxLatencyUs"] = stats.maxLatencyUs;
+      sub["avgLatencyUs"] = timed > 0 ? static_cast<uint32_t>(stats.totalLatencyUs / timed) : 0;
+      if (id == kFlashWalPartition) {
+        // LittleFS外の専用パーティション：消去回数は実測値。LittleFSの寿命見積もりには含めない
+        sub["erases"] = stats.erases;
+        continue;
+      }
+      uint64_t erases = (stats.bytesWritten + kFlashBlockSize - 1) / kFlashBlockSize + stats.flushes + stats.renames + stats.removes;
+      sub["estimatedErases"] = erases;
+      estimatedErases += erases;
+    }
+
+    uint32_t uptimeMs = millis();
+    uint64_t budget = static_cast<uint64_t>(blocks) * kFlashEraseCyclesPerBlock;
+    JsonObject endurance = doc["endurance"].to<JsonObject>();
+    endurance["cyclesPerBlock"] = kFlashEraseCyclesPerBlock;
+    endurance["eraseBudget"] = budget;
+    endurance["estimatedErasesSinceBoot"] = estimatedErases;
+    endurance["uptimeMs"] = uptimeMs;
+    if (uptimeMs > 0 && estimatedErases > 0) {
+      double perHour = static_cast<double>(estimatedErases) * 3600000.0 / uptimeMs;
+      endurance["erasesPerHour"] = perHour;
+      // 均等にウェアレベリングされる前提での寿命
+      endurance["projectedLifetimeDays"] = static_cast<double>(budget) / perHour / 24.0;
+    }
+
+    // スナップショットの実行判断。walBytes を上げると書き込みが減り、起動時の再生が長くなる
+    CheckpointStats cp = getCheckpointStats();
+    JsonObject checkpoints = doc["checkpoints"].to<JsonObject>();
+    JsonObject started = checkpoints["started"].to<JsonObject>();
+    for (uint8_t i = kCheckpointNone + 1; i < kCheckpointReasonCount; ++i) {
+      started[checkpointReasonName(i)] = cp.started[i];
+    }
+    checkpoints["failures"] = cp.failures;
+    checkpoints["cleanSkips"] = cp.cleanSkips;
+    checkpoints["postponed"] = cp.postponed;
+    checkpoints["lastReason"] = checkpointReasonName(cp.lastReason);
+    checkpoints["lastWalBytes"] = cp.lastWalBytes;
+    checkpoints["snapshotBytes"] = cp.snapshotBytes;
+    checkpoints["dirtyWalBytes"] = cp.dirtyWalBytes;
+    checkpoints["idleMs"] = cp.idleMs;
+    checkpoints["sinceLastMs"] = cp.sinceLastMs;
+    checkpoints["requestPending"] = cp.requestPending;
+    checkpoints["inFlight"] = cp.inFlight;
+    JsonObject config = checkpoints["config"].to<JsonObject>();
+    config["walBytes"] = KDS_CHECKPOINT_WAL_BYTES;
+    config["idleMs"] = KDS_CHECKPOINT_IDLE_MS;
+    config["minIntervalMs"] = KDS_CHECKPOINT_MIN_INTERVAL_MS;
+    config["maxIntervalMs"] = KDS_CHECKPOINT_MAX_INTERVAL_MS;
+    config["requestDelayMs"] = KDS_CHECKPOINT_REQUEST_DELAY_MS;
+
+    String res; serializeJson(doc, res);
+    request->send(200, "application/json", res);
+  });
+
+  server.on("/api/system/recovery", HTTP_GET, [](AsyncWebServerRequest *request) {
+    RecoveryStatus status = getRecoveryStatus();
+    JsonDocument doc;
+    doc["inProgress"] = status.inProgress;
+    doc["completed"] = status.completed;
+    doc["snapshotFailed"] = status.snapshotFailed;
+    doc["fromLsn"] = status.fromLsn;
+    doc["segmentsTotal"] = status.segmentsTotal;
+    doc["segmentsDone"] = status.segmentsDone;
+    doc["recordsSeen"] = status.recordsSeen;
+    doc["recordsApplied"] = status.recordsApplied;
+    doc["recordsSkipped"] = status.recordsSkipped;
+    doc["lastTs"] = status.lastTs;
+    doc["steps"] = status.steps;
+    doc["durationMs"] = status.durationMs;
     String res; serializeJson(doc, res);
     request->send(200, "application/json", res);
   });
 
   server.on("/api/recover", HTTP_POST, [](AsyncWebServerRequest *request) {
+    StateLock lock;
     Serial.println("[API] POST /api/recover");
     
     String lastTs;
@@ -1095,6 +1475,7 @@ void initHttpRoutes(AsyncWebServer &server) {
   server.on("^/api/orders/([0-9]{4})$", HTTP_PATCH, [](AsyncWebServerRequest *request){},
     nullptr,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t) {
+      StateLock lock;
       JsonDocument doc;
       if (deserializeJson(doc, (char*)data, len)) {
         request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
@@ -1116,50 +1497,44 @@ void initHttpRoutes(AsyncWebServer &server) {
 
       if (!updatedOrder) { request->send(404, "application/json", "{\"error\":\"Order not found\"}"); return; }
 
-      Order originalOrder = *updatedOrder;
       String notifyType = "order.updated";
-
-      updatedOrder->status = newStatus;
-      if (newStatus == "DONE" || newStatus == "COOKED") {
-        updatedOrder->cooked = true;
-        updatedOrder->pickup_called = true;
-        notifyType = "order.cooked";
-        Serial.printf("  → 互換処理: pickup_called=true (呼び出し画面に追加)\n");
-      } else if (newStatus == "READY" || newStatus == "PICKED") {
-        updatedOrder->picked_up = true;
-        updatedOrder->pickup_called = false;
+      WalTicket walTicket = 0;
+      bool logged = true;
+      if (updatedOrder->picked_up || newStatus == "READY" || newStatus == "PICKED") {
+        // 品出し済みは状態変更とアーカイブ移動を1件のトランザクションで記録する。
+        // 失敗時の S() は commitOrderPickup が整える（記録が拒否されたら元に戻し、
+        // 記録済みなら品出し済みのまま残して再生に任せる）ので、ここでは戻さない
         notifyType = "order.picked";
         Serial.printf("  → 互換処理: pickup_called=false (呼び出し画面から削除)\n");
-      }
-
-      Order orderSnapshot = *updatedOrder;
-
-      // WAL記録（JSON形式）
-      StaticJsonDocument<512> walDoc;
-      walDoc["ts"] = (uint32_t)time(nullptr);
-      walDoc["action"] = "ORDER_UPDATE";
-      walDoc["orderNo"] = orderNo;
-      walDoc["status"] = newStatus;
-      walDoc["cooked"] = orderSnapshot.cooked;
-      walDoc["pickup_called"] = orderSnapshot.pickup_called;
-      walDoc["picked_up"] = orderSnapshot.picked_up;
-      walDoc["printed"] = orderSnapshot.printed;
-      String walLine; serializeJson(walDoc, walLine);
-      walAppend(walLine);
-
-      bool shouldArchive = orderSnapshot.picked_up;
-      if (shouldArchive) {
-        if (!archiveOrderAndRemove(orderNo, S().session.sessionId)) {
-          if (updatedOrder) {
-            *updatedOrder = originalOrder;
-          }
+        if (!commitOrderPickup(orderNo, newStatus, &walTicket)) {
           request->send(500, "application/json", "{\"error\":\"Failed to archive order\"}");
           return;
         }
-        updatedOrder = nullptr;
+      } else {
+        updatedOrder->status = newStatus;
+        if (newStatus == "DONE" || newStatus == "COOKED") {
+          updatedOrder->cooked = true;
+          updatedOrder->pickup_called = true;
+          notifyType = "order.cooked";
+          Serial.printf("  → 互換処理: pickup_called=true (呼び出し画面に追加)\n");
+        }
+
+        WalRecord walRec;
+        walRec.action = kWalOrderUpdate;
+        walRec.ts = (uint32_t)time(nullptr);
+        walRec.orderNo = orderNo;
+        walRec.status = newStatus;
+        walRec.cooked = updatedOrder->cooked;
+        walRec.pickupCalled = updatedOrder->pickup_called;
+        walRec.pickedUp = updatedOrder->picked_up;
+        walRec.printed = updatedOrder->printed;
+        logged = walAppend(walRec, &walTicket);
+      }
+
+      if (!persistMutation(walTicket, logged)) {
+        sendNotDurable(request);
+        return;
       }
-      
-    requestSnapshotSave();
 
       JsonDocument notify; 
       notify["type"] = notifyType;
@@ -1175,6 +1550,7 @@ void initHttpRoutes(AsyncWebServer &server) {
     });
 
   server.on("^\\/api\\/orders\\/([0-9]+)\\/cooked$", HTTP_POST, [](AsyncWebServerRequest *request) {
+    StateLock lock;
     String path = request->url();
     Serial.printf("[API] POST リクエスト受信: %s\n", path.c_str());
     
@@ -1200,15 +1576,18 @@ void initHttpRoutes(AsyncWebServer &server) {
       return; 
     }
     
-    // WAL記録（JSON形式）
-  StaticJsonDocument<512> walDoc;
-    walDoc["ts"] = (uint32_t)time(nullptr);
-    walDoc["action"] = "ORDER_COOKED";
-    walDoc["orderNo"] = orderNo;
-    String walLine; serializeJson(walDoc, walLine);
-    walAppend(walLine);
-    
-    requestSnapshotSave();
+    // WAL記録
+    WalRecord walRec;
+    walRec.action = kWalOrderCooked;
+    walRec.ts = (uint32_t)time(nullptr);
+    walRec.orderNo = orderNo;
+    WalTicket walTicket = 0;
+    bool logged = walAppend(walRec, &walTicket);
+
+    if (!persistMutation(walTicket, logged)) {
+      sendNotDurable(request);
+      return;
+    }
     
     JsonDocument notify;
     notify["type"] = "order.cooked";
@@ -1220,6 +1599,7 @@ void initHttpRoutes(AsyncWebServer &server) {
   });
 
   server.on("^\\/api\\/orders\\/([0-9]+)\\/picked$", HTTP_POST, [](AsyncWebServerRequest *request) {
+    StateLock lock;
     String path = request->url();
     Serial.printf("[API] POST リクエスト受信: %s\n", path.c_str());
     
@@ -1242,26 +1622,18 @@ void initHttpRoutes(AsyncWebServer &server) {
       return; 
     }
 
-    Order originalOrder = *targetOrder;
-    targetOrder->picked_up = true;
-    targetOrder->pickup_called = false;
-    Serial.printf("  ✅ 注文 %s を品出し済みにマークしました\n", orderNo.c_str());
-    
-    // WAL記録（JSON形式）
-  StaticJsonDocument<512> walDoc;
-    walDoc["ts"] = (uint32_t)time(nullptr);
-    walDoc["action"] = "ORDER_PICKED";
-    walDoc["orderNo"] = orderNo;
-    String walLine; serializeJson(walDoc, walLine);
-    walAppend(walLine);
-
-      if (!archiveOrderAndRemove(orderNo, S().session.sessionId)) {
-        *targetOrder = originalOrder;
+    // 品出し＋アーカイブ移動を1件のWALトランザクションで記録
+    WalTicket walTicket = 0;
+    if (!commitOrderPickup(orderNo, "", &walTicket)) {
       request->send(500, "application/json", "{\"error\":\"Failed to archive order\"}");
       return;
     }
-    
-    requestSnapshotSave();
+    Serial.printf("  ✅ 注文 %s を品出し済みにマークしました\n", orderNo.c_str());
+
+    if (!persistMutation(walTicket)) {
+      sendNotDurable(request);
+      return;
+    }
     
     JsonDocument notify;
     notify["type"] = "order.picked";
@@ -1311,6 +1683,7 @@ void initHttpRoutes(AsyncWebServer &server) {
   server.on("/api/settings/system", HTTP_POST, [](AsyncWebServerRequest *request){},
     nullptr,
     [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t) {
+      StateLock lock;
       JsonDocument doc;
       if (deserializeJson(doc, (char*)data, len)) {
         request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
@@ -1330,13 +1703,31 @@ void initHttpRoutes(AsyncWebServer &server) {
         if (doc["numbering"]["max"].is<int>()) S().settings.numbering.max = doc["numbering"]["max"].as<uint16_t>();
       }
 
-      requestSnapshotSave();
+      if (doc["durability"].is<const char*>()) {
+        uint8_t level = 0;
+        if (!parseDurabilityLevel(doc["durability"].as<String>(), level)) {
+          request->send(400, "application/json", "{\"error\":\"durability must be memory, wal or snapshot\"}");
+          return;
+        }
+        S().settings.durability = level;
+      }
+
+      // システム設定はWALに載らない
+      if (!persistMutation(0)) {
+        sendNotDurable(request);
+        return;
+      }
       Serial.println("システム設定を保存しました");
       request->send(200, "application/json", "{\"ok\":true}");
     });
 
   server.on("/api/session/end", HTTP_POST, [](AsyncWebServerRequest *request) {
+    StateLock lock;
+    if (!archiveSealSession(S().session.sessionId)) {
+      Serial.printf("[E] archive seal failed: %s\n", S().session.sessionId.c_str());
+    }
     S().orders.clear();
+    invalidateOrderNoMap();
     S().session.exported = false;
     S().session.nextOrderSeq = 1;
 
@@ -1350,14 +1741,16 @@ void initHttpRoutes(AsyncWebServer &server) {
     S().printer.overheat = false;
     S().printer.holdJobs = 0;
 
-    requestSnapshotSave();
+    // WAL記録（再生では使わないので、新しいセッションはスナップショットで残す）
+    WalRecord walRec;
+    walRec.action = kWalSessionEnd;
+    walRec.ts = (uint32_t)time(nullptr);
+    walAppend(walRec);
 
-    // WAL記録（JSON形式）
-  StaticJsonDocument<512> walDoc;
-    walDoc["ts"] = (uint32_t)time(nullptr);
-    walDoc["action"] = "SESSION_END";
-    String walLine; serializeJson(walDoc, walLine);
-    walAppend(walLine);
+    if (!persistMutation(0)) {
+      sendNotDurable(request);
+      return;
+    }
 
     JsonDocument notify; notify["type"]="session.ended"; String msg; serializeJson(notify, msg); wsBroadcast(msg);
 
@@ -1365,24 +1758,24 @@ void initHttpRoutes(AsyncWebServer &server) {
   });
 
   server.on("/api/system/reset", HTTP_POST, [](AsyncWebServerRequest *request) {
+    StateLock lock;
     Serial.println("=== システム完全初期化開始 ===");
 
     Preferences prefs; prefs.begin("kds", false); prefs.clear(); prefs.end();
     Serial.println("NVS クリア完了");
 
-    S().menu.clear(); S().orders.clear();
+    S().menu.clear(); S().orders.clear(); invalidateOrderNoMap(true); invalidateSkuIndex(true);
     S().session.sessionId = ""; S().session.startedAt = 0; S().session.exported = false;
     S().printer.paperOut = false; S().printer.overheat = false; S().printer.holdJobs = 0;
 
     ensureInitialMenu();
     if (snapshotSave()) Serial.println("スナップショット保存完了"); else Serial.println("警告: スナップショット保存失敗");
 
-    // WAL記録（JSON形式）
-  StaticJsonDocument<512> walDoc;
-    walDoc["ts"] = (uint32_t)time(nullptr);
-    walDoc["action"] = "SYSTEM_RESET";
-    String walLine; serializeJson(walDoc, walLine);
-    walAppend(walLine);
+    // WAL記録
+    WalRecord walRec;
+    walRec.action = kWalSystemReset;
+    walRec.ts = (uint32_t)time(nullptr);
+    walAppend(walRec);
 
     JsonDocument notify; notify["type"]="system.reset"; String msg; serializeJson(notify, msg); wsBroadcast(msg);
 
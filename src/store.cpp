@@ -1,11 +1,25 @@
 #include "store.h"
+#include "archive.h"
+#include "flash_stats.h"
+#include "lz_block.h"
+#include "printer_queue.h"
+#include "record_codec.h"
+#include "sales_rollup.h"
+#include "wal.h"
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 #include <Preferences.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <time.h>
 #include <sys/time.h>
 #include <algorithm>
+#include <map>
+#include <memory>
+#include <new>
 #include <cstdlib>
+#include <functional>
 #include <utility>
 #include <cstring>
 #include <cstdio>
@@ -108,6 +122,19 @@ State& S() {
     return g_state;
 }
 
+static SemaphoreHandle_t g_stateMutex = nullptr;
+
+StateLock::StateLock() {
+    if (!g_stateMutex) {
+        g_stateMutex = xSemaphoreCreateRecursiveMutex();
+    }
+    xSemaphoreTakeRecursive(g_stateMutex, portMAX_DELAY);
+}
+
+StateLock::~StateLock() {
+    xSemaphoreGiveRecursive(g_stateMutex);
+}
+
 static String buildMenuEtagValue() {
     uint32_t version = S().settings.catalogVersion;
     if (version == 0) {
@@ -147,6 +174,22 @@ void bumpCatalogVersion() {
     refreshMenuEtag();
 }
 
+static const char* kDurabilityLevelNames[kDurabilityLevelCount] = {"memory", "wal", "snapshot"};
+
+const char* durabilityLevelName(uint8_t level) {
+    return level < kDurabilityLevelCount ? kDurabilityLevelNames[level] : "unknown";
+}
+
+bool parseDurabilityLevel(const String& name, uint8_t& level) {
+    for (uint8_t i = 0; i < kDurabilityLevelCount; ++i) {
+        if (name == kDurabilityLevelNames[i]) {
+            level = i;
+            return true;
+        }
+    }
+    return false;
+}
+
 void requestSnapshotSave() {
     g_snapshotSaveRequested = true;
 }
@@ -159,8 +202,7 @@ bool consumeSnapshotSaveRequest() {
 
 static Preferences prefs;
 static const char* kDataDir = "/kds";
-static const char* kArchivePath = "/kds/orders_archive.jsonl";
-static const char* kSalesSummaryPath = "/kds/sales_summary.json";
+static const char* kLegacySalesSummaryPath = "/kds/sales_summary.json";
 
 static bool ensureDataDir();
 
@@ -170,6 +212,7 @@ const SalesSummary& getSalesSummary() {
 
 static void resetSalesSummary() {
     g_salesSummary = SalesSummary{};
+    salesRollupReset();
 }
 
 static void accumulateOrderForSummary(SalesSummary& summary, const Order& order) {
@@ -185,59 +228,19 @@ static void accumulateOrderForSummary(SalesSummary& summary, const Order& order)
         summary.confirmedOrders += 1;
         summary.revenue += total;
     }
-}
-
-bool saveSalesSummary() {
-    if (!ensureDataDir()) {
-        return false;
-    }
-
-    DynamicJsonDocument doc(256);
-    doc["confirmedOrders"] = g_salesSummary.confirmedOrders;
-    doc["cancelledOrders"] = g_salesSummary.cancelledOrders;
-    doc["revenue"] = g_salesSummary.revenue;
-    doc["cancelledAmount"] = g_salesSummary.cancelledAmount;
-    doc["lastUpdated"] = g_salesSummary.lastUpdated;
-
-    File file = LittleFS.open(kSalesSummaryPath, "w");
-    if (!file) {
-        Serial.printf("[E] sales summary save failed: %s\n", kSalesSummaryPath);
-        return false;
-    }
-
-    size_t written = serializeJson(doc, file);
-    file.println();
-    file.flush();
-    file.close();
-
-    return written > 0;
+    salesRollupAddOrder(order);
 }
 
 bool recalculateSalesSummary() {
     SalesSummary summary;
+    salesRollupReset();
 
     for (const auto& order : S().orders) {
         accumulateOrderForSummary(summary, order);
     }
 
-    if (LittleFS.exists(kArchivePath)) {
-        File archiveFile = LittleFS.open(kArchivePath, "r");
-        if (archiveFile) {
-            while (archiveFile.available()) {
-                String line = archiveFile.readStringUntil('\n');
-                line.trim();
-                if (line.isEmpty()) {
-                    continue;
-                }
-            }
-            archiveFile.close();
-        } else {
-            Serial.println("[E] archive open failed: /kds/orders_archive.jsonl");
-        }
-    }
-
     const String sessionId = S().session.sessionId;
-    auto visitor = [](const Order& order, const String& storedSession, uint32_t, void* ctx) -> bool {
+    auto visitor = [](const Order& order, const String&, uint32_t, void* ctx) -> bool {
         auto* summaryPtr = static_cast<SalesSummary*>(ctx);
         if (!summaryPtr) {
             return false;
@@ -246,47 +249,15 @@ bool recalculateSalesSummary() {
         return true;
     };
 
-    archiveForEach(sessionId, visitor, &summary);
+    bool ok = archiveForEach(sessionId, visitor, &summary);
 
     summary.lastUpdated = static_cast<uint32_t>(time(nullptr));
     g_salesSummary = summary;
-    return saveSalesSummary();
-}
-
-bool loadSalesSummary() {
-    if (!LittleFS.exists(kSalesSummaryPath)) {
-        return recalculateSalesSummary();
-    }
-
-    File file = LittleFS.open(kSalesSummaryPath, "r");
-    if (!file) {
-        Serial.println("[E] sales summary open failed");
-        return recalculateSalesSummary();
-    }
-
-    DynamicJsonDocument doc(256);
-    DeserializationError err = deserializeJson(doc, file);
-    file.close();
-    if (err) {
-        Serial.printf("[E] sales summary parse failed: %s\n", err.c_str());
-        return recalculateSalesSummary();
-    }
-
-    g_salesSummary.confirmedOrders = doc["confirmedOrders"] | static_cast<uint32_t>(0);
-    g_salesSummary.cancelledOrders = doc["cancelledOrders"] | static_cast<uint32_t>(0);
-    g_salesSummary.revenue = doc["revenue"] | static_cast<int64_t>(0);
-    g_salesSummary.cancelledAmount = doc["cancelledAmount"] | static_cast<int64_t>(0);
-    g_salesSummary.lastUpdated = doc["lastUpdated"] | static_cast<uint32_t>(0);
-
-    return true;
+    requestSnapshotSave();
+    return ok;
 }
 
-void applyOrderToSalesSummary(const Order& order) {
-    if (order.status == "CANCELLED") {
-        applyCancellationToSalesSummary(order);
-        return;
-    }
-
+static void addOrderToSummary(const Order& order, uint32_t ts) {
     int64_t total = static_cast<int64_t>(computeOrderTotal(order));
     if (total < 0) {
         total = 0;
@@ -294,32 +265,48 @@ void applyOrderToSalesSummary(const Order& order) {
 
     g_salesSummary.confirmedOrders += 1;
     g_salesSummary.revenue += total;
-    g_salesSummary.lastUpdated = static_cast<uint32_t>(time(nullptr));
-
-    saveSalesSummary();
+    g_salesSummary.lastUpdated = ts;
+    salesRollupAddOrder(order);
 }
 
-void applyCancellationToSalesSummary(const Order& order) {
+// wasConfirmed is false for orders created already cancelled, which never entered the confirmed counters.
+static void addCancellationToSummary(const Order& order, uint32_t ts, bool wasConfirmed) {
     int64_t total = static_cast<int64_t>(computeOrderTotal(order));
     if (total < 0) {
         total = 0;
     }
 
-    if (g_salesSummary.confirmedOrders > 0) {
-        g_salesSummary.confirmedOrders -= 1;
+    if (wasConfirmed) {
+        if (g_salesSummary.confirmedOrders > 0) {
+            g_salesSummary.confirmedOrders -= 1;
+        }
+        g_salesSummary.revenue -= total;
+        if (g_salesSummary.revenue < 0) {
+            g_salesSummary.revenue = 0;
+        }
+        salesRollupCancelOrder(order);
+    } else {
+        salesRollupAddOrder(order);
     }
     g_salesSummary.cancelledOrders += 1;
-    g_salesSummary.revenue -= total;
-    if (g_salesSummary.revenue < 0) {
-        g_salesSummary.revenue = 0;
-    }
     g_salesSummary.cancelledAmount += total;
     if (g_salesSummary.cancelledAmount < 0) {
         g_salesSummary.cancelledAmount = 0;
     }
-    g_salesSummary.lastUpdated = static_cast<uint32_t>(time(nullptr));
+    g_salesSummary.lastUpdated = ts;
+}
+
+// RAM only: the summary is persisted with the next snapshot and rebuilt from WAL deltas after a crash.
+static void addNewOrderToSummary(const Order& order, uint32_t ts) {
+    if (order.status == "CANCELLED") {
+        addCancellationToSummary(order, ts, false);
+        return;
+    }
+    addOrderToSummary(order, ts);
+}
 
-    saveSalesSummary();
+void applyCancellationToSalesSummary(const Order& order) {
+    addCancellationToSummary(order, static_cast<uint32_t>(time(nullptr)), true);
 }
 
 static bool ensureDataDir() {
@@ -333,155 +320,648 @@ static bool ensureDataDir() {
     return true;
 }
 
-size_t estimateOrderDocumentCapacity(const Order& order) {
-    size_t cap = 512;
-    cap += order.items.size() * 196;
-    return cap;
+static const char* kSnapshotPathA = "/kds/snapA.bin";
+static const char* kSnapshotPathB = "/kds/snapB.bin";
+static const char* kLegacySnapshotPathA = "/kds/snapA.json";
+static const char* kLegacySnapshotPathB = "/kds/snapB.json";
+// Delta frames belonging to the base in the same slot; removed whenever that slot gets a new base.
+static const char* kSnapshotDeltaPathA = "/kds/snapA.delta";
+static const char* kSnapshotDeltaPathB = "/kds/snapB.delta";
+
+static const uint32_t kSnapshotMagic = 0x5353444Bu; // "KDSS"
+// v2 appends the WAL checkpoint LSN to the header; v1 files still load, without a checkpoint.
+static const uint16_t kSnapshotVersion = 2;
+static const uint16_t kSnapshotVersionNoCheckpoint = 1;
+static const size_t kSnapshotHeaderSizeV1 = 12;
+static const size_t kSnapshotHeaderSize = 16;
+static const size_t kSnapshotRecordHeaderSize = 5;
+// Header flag: everything after the header is an LZ block container (lz_block.h). The CRC still
+// covers the uncompressed bytes.
+static const uint16_t kSnapshotFlagCompressed = 0x0001;
+
+// Delta frame: magic, version, flags, base generation, checkpoint LSN, body length, then the body
+// (records up to kSnapRecEnd) and a CRC32 over header and body. Frames are never compressed.
+static const uint32_t kSnapshotDeltaMagic = 0x4453444Bu; // "KDSD"
+static const uint16_t kSnapshotDeltaVersion = 1;
+static const size_t kSnapshotDeltaHeaderSize = 20;
+
+// Background snapshots hold the encoded body in RAM; beyond this they stream from loop() instead.
+static const size_t kSnapshotCaptureMaxBytes = 48 * 1024;
+static const size_t kSnapshotCaptureChunk = 2048;
+static const uint32_t kSnapshotTaskStackSize = 8192;
+
+// Snapshot files are written by loop(), HTTP handlers and the snapshot task; one writer at a time,
+// and header probes never see a half-written file.
+static SemaphoreHandle_t g_snapshotMutex = nullptr;
+
+class SnapshotLock {
+public:
+    SnapshotLock() {
+        if (!g_snapshotMutex) {
+            g_snapshotMutex = xSemaphoreCreateMutex();
+        }
+        xSemaphoreTake(g_snapshotMutex, portMAX_DELAY);
+    }
+    ~SnapshotLock() { xSemaphoreGive(g_snapshotMutex); }
+};
+
+enum SnapshotRecordType : uint8_t {
+    kSnapRecEnd = 0,
+    kSnapRecSettings = 1,
+    kSnapRecSession = 2,
+    kSnapRecPrinter = 3,
+    kSnapRecMenuItem = 4,
+    kSnapRecOrder = 5,
+    kSnapRecSalesSummary = 6,
+    kSnapRecSalesRollup = 7,
+    kSnapRecSalesRollupSku = 8,
+    kSnapRecArchiveBloom = 9,
+    // Delta frames only: the order whose number hashes to the u32 payload was archived or dropped.
+    kSnapRecOrderRemoved = 10,
+};
+static const size_t kSnapRecTypeCount = kSnapRecOrderRemoved + 1;
+
+struct SnapshotHeader {
+    uint32_t magic{0};
+    uint16_t version{0};
+    uint16_t flags{0};
+    uint32_t generation{0};
+    uint32_t checkpointLsn{0};
+    bool hasCheckpoint{false};
+};
+
+// What the newest checkpoint holds for one record: deltas carry only records whose digest changed.
+// Key is the CRC of the order number or SKU, 0 for records that exist once.
+struct SnapshotDigest {
+    uint32_t key;
+    uint32_t crc;
+    uint16_t index;
+    uint8_t type;
+};
+
+// The base snapshot that delta frames are appended to, and the digests of everything it and its
+// frames hold so far. basePath is null until a base was written or loaded; the next save is a base.
+struct SnapshotChain {
+    const char* basePath{nullptr};
+    uint32_t generation{0};
+    uint32_t baseBytes{0};
+    uint32_t deltaBytes{0};
+    uint32_t deltas{0};
+    std::vector<SnapshotDigest> digests;
+    // Archive filter bytes the base carries; deltas leave the filters out.
+    uint32_t bloomBytes{0};
+    // Plan number of the last write, so a background job planned before it is not written after it.
+    uint32_t writtenSeq{0};
+};
+
+struct SnapshotPlan {
+    uint32_t seq{0};
+    bool delta{false};
+    uint32_t records{0};
+    // Sorted by type and key once the plan is complete.
+    std::vector<SnapshotDigest> digests;
+    uint32_t bloomBytes{0};
+};
+
+static SnapshotChain g_snapshotChain;
+static uint32_t g_snapshotPlanSeq = 0;
+
+static WalTicket g_loadedCheckpointLsn = 0;
+static bool g_loadedHasCheckpoint = false;
+// Snapshots written before the summary record existed leave this false; recovery then rebuilds it.
+static bool g_loadedHasSalesSummary = false;
+
+static void putLe32(uint8_t* out, uint32_t v) {
+    out[0] = static_cast<uint8_t>(v);
+    out[1] = static_cast<uint8_t>(v >> 8);
+    out[2] = static_cast<uint8_t>(v >> 16);
+    out[3] = static_cast<uint8_t>(v >> 24);
 }
 
-static size_t estimateSnapshotCapacity() {
-    size_t base = 64 * 1024;
-    base += S().menu.size() * 256;
-    for (const auto& order : S().orders) {
-        base += 400;
-        base += order.items.size() * 220;
-    }
-    base += 16 * 1024;
-    return base;
+static uint32_t getLe32(const uint8_t* in) {
+    return static_cast<uint32_t>(in[0]) |
+           (static_cast<uint32_t>(in[1]) << 8) |
+           (static_cast<uint32_t>(in[2]) << 16) |
+           (static_cast<uint32_t>(in[3]) << 24);
 }
 
-static String pickSnapshotPathForWrite() {
-    File fileA = LittleFS.open("/kds/snapA.json", "r");
-    File fileB = LittleFS.open("/kds/snapB.json", "r");
+// Reads the header from the current position; raw receives the bytes for CRC accounting.
+static bool readSnapshotHeader(File& f, SnapshotHeader& header, uint8_t (&raw)[kSnapshotHeaderSize], size_t& rawLen) {
+    rawLen = f.read(raw, kSnapshotHeaderSizeV1);
+    if (rawLen != kSnapshotHeaderSizeV1) {
+        return false;
+    }
+    header.magic = getLe32(raw);
+    header.version = static_cast<uint16_t>(raw[4] | (raw[5] << 8));
+    header.flags = static_cast<uint16_t>(raw[6] | (raw[7] << 8));
+    header.generation = getLe32(raw + 8);
+    if (header.magic != kSnapshotMagic) {
+        return false;
+    }
+    if (header.version == kSnapshotVersionNoCheckpoint) {
+        header.hasCheckpoint = false;
+        return true;
+    }
+    if (header.version != kSnapshotVersion) {
+        return false;
+    }
+    size_t extra = kSnapshotHeaderSize - kSnapshotHeaderSizeV1;
+    if (f.read(raw + rawLen, extra) != extra) {
+        return false;
+    }
+    rawLen += extra;
+    header.checkpointLsn = getLe32(raw + 12);
+    header.hasCheckpoint = true;
+    return true;
+}
 
-    String target = "/kds/snapA.json";
-    if (fileA && fileB) {
-        target = (fileA.getLastWrite() <= fileB.getLastWrite()) ? "/kds/snapA.json" : "/kds/snapB.json";
-    } else if (fileA && !fileB) {
-        target = "/kds/snapB.json";
-    } else if (!fileA && fileB) {
-        target = "/kds/snapA.json";
+static bool readSnapshotHeader(const char* path, SnapshotHeader& header) {
+    FlashFile f = flashOpen(kFlashSnapshot, path, "r");
+    if (!f) {
+        return false;
     }
+    uint8_t raw[kSnapshotHeaderSize];
+    size_t rawLen = 0;
+    bool ok = readSnapshotHeader(f, header, raw, rawLen);
+    f.close();
+    return ok;
+}
 
-    fileA.close();
-    fileB.close();
-    return target;
+static const char* snapshotDeltaPath(const char* basePath) {
+    return basePath == kSnapshotPathA ? kSnapshotDeltaPathA : kSnapshotDeltaPathB;
 }
 
-static bool populateStateFromSnapshotDoc(const JsonDocument& doc, const char* sourceLabel);
+struct SnapshotDeltaFrame {
+    uint32_t generation{0};
+    uint32_t checkpointLsn{0};
+    uint32_t bodyLen{0};
+};
 
-static size_t computeSnapshotLoadCapacity(size_t fileSize) {
-    size_t base = fileSize + fileSize / 2 + 16 * 1024;
-    base = std::max<size_t>(base, 32 * 1024);
-    base = std::min<size_t>(base, 1024 * 1024);
-    return base;
+static bool readSnapshotDeltaHeader(File& f, SnapshotDeltaFrame& frame, uint8_t (&raw)[kSnapshotDeltaHeaderSize]) {
+    if (f.read(raw, sizeof(raw)) != sizeof(raw)) {
+        return false;
+    }
+    uint16_t version = static_cast<uint16_t>(raw[4] | (raw[5] << 8));
+    frame.generation = getLe32(raw + 8);
+    frame.checkpointLsn = getLe32(raw + 12);
+    frame.bodyLen = getLe32(raw + 16);
+    return getLe32(raw) == kSnapshotDeltaMagic && version == kSnapshotDeltaVersion &&
+           frame.bodyLen <= kSnapshotCaptureMaxBytes;
 }
 
-String allocateOrderNo() {
-    prefs.begin("kds", false);
-    uint16_t seq = prefs.getUShort("nextSeq", 1);
-    
-    for (int i = 0; i < 100; i++) {
-        String candidate = String(seq);
-        while (candidate.length() < 4) {
-            candidate = "0" + candidate;
-        }
-        
-        bool exists = false;
-        for (const auto& order : S().orders) {
-            if (order.orderNo == candidate) {
-                exists = true;
+struct SnapshotDeltaScan {
+    uint32_t frames{0};
+    uint32_t bytes{0};
+    WalTicket lastLsn{0};
+    // Where the chain ended before its last frame: the base's LSN when there is only one frame.
+    WalTicket previousLsn{0};
+    // Bytes after the last valid frame, left by a torn append.
+    bool torn{false};
+};
+
+// Walks the frames that extend base, stopping at the first one that is short, foreign or fails its CRC.
+static void scanSnapshotDeltas(const char* basePath, const SnapshotHeader& base, SnapshotDeltaScan& scan) {
+    scan = SnapshotDeltaScan();
+    scan.lastLsn = base.checkpointLsn;
+    scan.previousLsn = base.checkpointLsn;
+    const char* path = snapshotDeltaPath(basePath);
+    if (!base.hasCheckpoint || !LittleFS.exists(path)) {
+        return;
+    }
+    FlashFile f = flashOpen(kFlashSnapshot, path, "r");
+    if (!f) {
+        return;
+    }
+    size_t fileSize = f.size();
+    uint8_t buffer[256];
+    while (scan.bytes < fileSize) {
+        SnapshotDeltaFrame frame;
+        uint8_t raw[kSnapshotDeltaHeaderSize];
+        if (!readSnapshotDeltaHeader(f, frame, raw) || frame.generation != base.generation) {
+            scan.torn = true;
+            break;
+        }
+        uint32_t crc = crc32Update(0, raw, sizeof(raw));
+        uint32_t left = frame.bodyLen;
+        while (left > 0) {
+            size_t n = f.read(buffer, std::min<size_t>(left, sizeof(buffer)));
+            if (n == 0) {
                 break;
             }
+            crc = crc32Update(crc, buffer, n);
+            left -= n;
         }
-        
-        if (!exists) {
-            seq++;
-            if (seq > 9999) seq = 1;
-            prefs.putUShort("nextSeq", seq);
-            prefs.end();
-            return candidate;
+        uint8_t trailer[4];
+        if (left > 0 || f.read(trailer, sizeof(trailer)) != sizeof(trailer) || getLe32(trailer) != crc) {
+            scan.torn = true;
+            break;
         }
-        
-        seq++;
-        if (seq > 9999) seq = 1;
+        scan.frames++;
+        scan.bytes += kSnapshotDeltaHeaderSize + frame.bodyLen + sizeof(trailer);
+        scan.previousLsn = scan.lastLsn;
+        scan.lastLsn = frame.checkpointLsn;
     }
-    
-    prefs.end();
-    return "9999";
+    f.close();
 }
 
-static uint16_t findMaxSeq(const char* prefix, const char* category) {
-    uint16_t maxSeq = 0;
-    const size_t prefixLen = strlen(prefix);
-    for (const auto& item : S().menu) {
-        if (item.category == category && item.sku.startsWith(prefix)) {
-            uint16_t value = item.sku.substring(prefixLen).toInt();
-            if (value > maxSeq) {
-                maxSeq = value;
-            }
+// Newest first; paths without a valid header are left out.
+static int listSnapshotsByGeneration(const char* out[2], uint32_t* newestGeneration = nullptr) {
+    SnapshotHeader headerA;
+    SnapshotHeader headerB;
+    bool hasA = LittleFS.exists(kSnapshotPathA) && readSnapshotHeader(kSnapshotPathA, headerA);
+    bool hasB = LittleFS.exists(kSnapshotPathB) && readSnapshotHeader(kSnapshotPathB, headerB);
+
+    int count = 0;
+    if (hasA && hasB) {
+        bool aNewer = headerA.generation >= headerB.generation;
+        out[count++] = aNewer ? kSnapshotPathA : kSnapshotPathB;
+        out[count++] = aNewer ? kSnapshotPathB : kSnapshotPathA;
+    } else if (hasA) {
+        out[count++] = kSnapshotPathA;
+    } else if (hasB) {
+        out[count++] = kSnapshotPathB;
+    }
+
+    if (newestGeneration) {
+        *newestGeneration = std::max(hasA ? headerA.generation : 0, hasB ? headerB.generation : 0);
+    }
+    return count;
+}
+
+// WAL is kept back to the checkpoint before the newest one, as it was with two plain bases: the
+// frame before a chain's last one, or the other slot's chain end when the newest save was a base.
+bool getOldestSnapshotCheckpoint(WalTicket& outLsn) {
+    SnapshotLock lock;
+    SnapshotHeader headers[2];
+    const char* paths[2] = {kSnapshotPathA, kSnapshotPathB};
+    bool valid[2] = {false, false};
+    for (int i = 0; i < 2; ++i) {
+        if (!LittleFS.exists(paths[i]) || !readSnapshotHeader(paths[i], headers[i])) {
+            continue;
+        }
+        if (!headers[i].hasCheckpoint) {
+            return false;
+        }
+        valid[i] = true;
+    }
+    if (!valid[0] && !valid[1]) {
+        return false;
+    }
+    int newest = (!valid[1] || (valid[0] && headers[0].generation >= headers[1].generation)) ? 0 : 1;
+    SnapshotDeltaScan scan;
+    scanSnapshotDeltas(paths[newest], headers[newest], scan);
+    if (scan.frames > 0) {
+        outLsn = scan.previousLsn;
+        return true;
+    }
+    outLsn = headers[newest].checkpointLsn;
+    int other = 1 - newest;
+    if (valid[other]) {
+        scanSnapshotDeltas(paths[other], headers[other], scan);
+        outLsn = std::min(outLsn, scan.lastLsn);
+    }
+    return true;
+}
+
+// Highest checkpoint either slot holds, delta frames included; 0 when neither has one.
+static WalTicket newestSnapshotCheckpoint() {
+    SnapshotLock lock;
+    const char* paths[2] = {kSnapshotPathA, kSnapshotPathB};
+    WalTicket newest = 0;
+    for (const char* path : paths) {
+        SnapshotHeader header;
+        if (!LittleFS.exists(path) || !readSnapshotHeader(path, header) || !header.hasCheckpoint) {
+            continue;
+        }
+        SnapshotDeltaScan scan;
+        scanSnapshotDeltas(path, header, scan);
+        newest = std::max(newest, scan.lastLsn);
+    }
+    return newest;
+}
+
+static const char* pickSnapshotPathForWrite(uint32_t& nextGeneration) {
+    const char* ordered[2] = {nullptr, nullptr};
+    uint32_t newest = 0;
+    int count = listSnapshotsByGeneration(ordered, &newest);
+    nextGeneration = newest + 1;
+    if (count == 0) {
+        return kSnapshotPathA;
+    }
+    // Overwrite the older (or invalid) slot so the newest valid snapshot survives a torn write.
+    return (ordered[0] == kSnapshotPathA) ? kSnapshotPathB : kSnapshotPathA;
+}
+
+// Largest single record the loader will buffer; an order with dozens of line items is a few hundred bytes.
+static const size_t kSnapshotMaxRecordSize = 16 * 1024;
+
+// One bit per number in settings.numbering, set while an order holding it is in S().orders.
+// NVS only records where the current lease of sequence numbers ends; a reboot resumes there.
+static const char* kOrderSeqKey = "nextSeq";
+static const uint16_t kOrderSeqLeaseBlock = 128;
+static std::vector<uint32_t> g_orderNoBitmap;
+static uint16_t g_orderNoMin = 0;
+static uint16_t g_orderNoMax = 0;
+static uint16_t g_orderNoCursor = 0;
+static uint16_t g_orderNoLeaseLeft = 0;
+static bool g_orderNoBitmapValid = false;
+static bool g_orderNoCursorLoaded = false;
+
+static void orderNumberingRange(uint16_t& lo, uint16_t& hi) {
+    lo = S().settings.numbering.min;
+    hi = S().settings.numbering.max;
+    if (lo < 1) {
+        lo = 1;
+    }
+    if (hi > 9999) {
+        hi = 9999;
+    }
+    if (hi < lo) {
+        lo = 1;
+        hi = 9999;
+    }
+}
+
+static int32_t orderNoIndex(const String& orderNo) {
+    long value = orderNo.toInt();
+    if (value < g_orderNoMin || value > g_orderNoMax) {
+        return -1;
+    }
+    return static_cast<int32_t>(value - g_orderNoMin);
+}
+
+static void setOrderNoBit(const String& orderNo, bool used) {
+    if (!g_orderNoBitmapValid) {
+        return;
+    }
+    int32_t idx = orderNoIndex(orderNo);
+    if (idx < 0) {
+        return;
+    }
+    uint32_t mask = 1u << (idx & 31);
+    if (used) {
+        g_orderNoBitmap[idx >> 5] |= mask;
+    } else {
+        g_orderNoBitmap[idx >> 5] &= ~mask;
+    }
+}
+
+static void rebuildOrderNoBitmap() {
+    orderNumberingRange(g_orderNoMin, g_orderNoMax);
+    uint32_t span = static_cast<uint32_t>(g_orderNoMax - g_orderNoMin) + 1;
+    g_orderNoBitmap.assign((span + 31) / 32, 0);
+    if (span & 31) {
+        // Bits past the end of the range read as used, so the scan never hands them out.
+        g_orderNoBitmap.back() = ~((1u << (span & 31)) - 1);
+    }
+    g_orderNoBitmapValid = true;
+    for (const auto& order : S().orders) {
+        setOrderNoBit(order.orderNo, true);
+    }
+    if (g_orderNoCursor < g_orderNoMin || g_orderNoCursor > g_orderNoMax) {
+        g_orderNoCursor = g_orderNoMin;
+    }
+}
+
+// Word-at-a-time scan from start, wrapping once; -1 when every number is taken.
+static int32_t findFreeOrderNoIndex(uint32_t start) {
+    size_t words = g_orderNoBitmap.size();
+    size_t w = start >> 5;
+    uint32_t free = ~g_orderNoBitmap[w] & (~0u << (start & 31));
+    for (size_t n = 0; n <= words; ++n) {
+        if (free) {
+            return static_cast<int32_t>((w << 5) + __builtin_ctz(free));
         }
+        w = (w + 1) % words;
+        free = ~g_orderNoBitmap[w];
+    }
+    return -1;
+}
+
+void markOrderNoUsed(const String& orderNo) {
+    setOrderNoBit(orderNo, true);
+}
+
+void releaseOrderNo(const String& orderNo) {
+    setOrderNoBit(orderNo, false);
+}
+
+void invalidateOrderNoMap(bool reloadLease) {
+    g_orderNoBitmapValid = false;
+    if (reloadLease) {
+        g_orderNoCursorLoaded = false;
+        g_orderNoLeaseLeft = 0;
+    }
+}
+
+String allocateOrderNo() {
+    uint16_t lo = 0;
+    uint16_t hi = 0;
+    orderNumberingRange(lo, hi);
+    if (!g_orderNoBitmapValid || lo != g_orderNoMin || hi != g_orderNoMax) {
+        rebuildOrderNoBitmap();
+    }
+    if (!g_orderNoCursorLoaded) {
+        prefs.begin("kds", true);
+        uint16_t stored = prefs.getUShort(kOrderSeqKey, g_orderNoMin);
+        prefs.end();
+        g_orderNoCursor = (stored < g_orderNoMin || stored > g_orderNoMax) ? g_orderNoMin : stored;
+        g_orderNoCursorLoaded = true;
+    }
+
+    uint32_t span = static_cast<uint32_t>(g_orderNoMax - g_orderNoMin) + 1;
+    uint32_t from = g_orderNoCursor - g_orderNoMin;
+    int32_t idx = findFreeOrderNoIndex(from);
+    if (idx < 0) {
+        Serial.printf("[E] order numbers exhausted (%u-%u)\n", static_cast<unsigned>(g_orderNoMin),
+                      static_cast<unsigned>(g_orderNoMax));
+        return String();
     }
-    return maxSeq;
+    uint16_t seq = static_cast<uint16_t>(g_orderNoMin + idx);
+    g_orderNoCursor = (seq == g_orderNoMax) ? g_orderNoMin : seq + 1;
+
+    // Taking seq moves the cursor this far through the lease; once it would run past the end,
+    // the next block is leased before seq is handed out.
+    uint32_t advance = (static_cast<uint32_t>(idx) + span - from) % span + 1;
+    if (advance > g_orderNoLeaseLeft) {
+        // A narrow range gets a shorter lease so resuming at its end cannot wrap past the cursor.
+        uint16_t block = static_cast<uint16_t>(std::max<uint32_t>(1, std::min<uint32_t>(kOrderSeqLeaseBlock, span / 2)));
+        uint16_t leaseEnd = static_cast<uint16_t>(g_orderNoMin + (g_orderNoCursor - g_orderNoMin + block) % span);
+        prefs.begin("kds", false);
+        prefs.putUShort(kOrderSeqKey, leaseEnd);
+        prefs.end();
+        g_orderNoLeaseLeft = block;
+    } else {
+        g_orderNoLeaseLeft -= advance;
+    }
+
+    char buffer[8];
+    snprintf(buffer, sizeof(buffer), "%04u", static_cast<unsigned>(seq));
+    return String(buffer);
 }
 
+// Per-prefix map from SKU sequence number to menu position, kept alongside S().menu. Items are
+// only ever appended or replaced wholesale, so the indexed item count doubles as a staleness check.
+// Only canonical "<prefix>NNNN" SKUs are indexed; for those a miss is authoritative.
+struct SkuIndex {
+    const char* prefix;
+    const char* counterKey;
+    std::map<uint16_t, size_t> used;
+    uint16_t counter;
+    bool dirty;
+};
+
+static SkuIndex g_skuIndexes[] = {
+    {"main_", "mainSeq", {}, 0, false},
+    {"side_", "sideSeq", {}, 0, false},
+};
+static size_t g_skuIndexedItems = 0;
+static bool g_skuIndexValid = false;
+
 static String formatSku(const char* prefix, uint16_t seq) {
     char buffer[16];
     snprintf(buffer, sizeof(buffer), "%s%04u", prefix, seq);
     return String(buffer);
 }
 
-static String nextSku(const char* prefix, const char* category, const char* counterKey) {
-    prefs.begin("kds", false);
-    uint16_t storedSeq = prefs.getUShort(counterKey, 1);
+// Returns the index owning sku's prefix and its sequence number, or nullptr when sku is not canonical.
+static SkuIndex* parseCanonicalSku(const String& sku, uint16_t& seq) {
+    for (auto& index : g_skuIndexes) {
+        size_t prefixLen = strlen(index.prefix);
+        if (sku.length() != prefixLen + 4 || !sku.startsWith(index.prefix)) {
+            continue;
+        }
+        long value = sku.substring(prefixLen).toInt();
+        if (value <= 0 || value > 9999 || formatSku(index.prefix, static_cast<uint16_t>(value)) != sku) {
+            return nullptr;
+        }
+        seq = static_cast<uint16_t>(value);
+        return &index;
+    }
+    return nullptr;
+}
 
-    // Keep the counter ahead of anything already stored so we do not overwrite existing entries.
-    uint16_t maxExisting = findMaxSeq(prefix, category);
-    if (storedSeq <= maxExisting) {
-        storedSeq = maxExisting + 1;
+static void indexMenuItem(const MenuItem& item, size_t position) {
+    uint16_t seq = 0;
+    SkuIndex* index = parseCanonicalSku(item.sku, seq);
+    if (index) {
+        index->used[seq] = position;
     }
+}
 
-    uint16_t seq = storedSeq == 0 ? 1 : storedSeq;
-    String candidate;
-    bool resolved = false;
-    for (int attempts = 0; attempts < 10000; ++attempts) {
-        if (seq > 9999) {
-            seq = 1;
+static void ensureSkuIndex() {
+    if (g_skuIndexValid && g_skuIndexedItems == S().menu.size()) {
+        return;
+    }
+    for (auto& index : g_skuIndexes) {
+        index.used.clear();
+    }
+    for (size_t i = 0; i < S().menu.size(); ++i) {
+        indexMenuItem(S().menu[i], i);
+    }
+    g_skuIndexedItems = S().menu.size();
+    g_skuIndexValid = true;
+}
+
+void noteMenuItemAdded() {
+    if (!g_skuIndexValid || g_skuIndexedItems + 1 != S().menu.size()) {
+        g_skuIndexValid = false;
+        return;
+    }
+    indexMenuItem(S().menu.back(), g_skuIndexedItems);
+    g_skuIndexedItems++;
+}
+
+void invalidateSkuIndex(bool reloadCounters) {
+    g_skuIndexValid = false;
+    if (reloadCounters) {
+        for (auto& index : g_skuIndexes) {
+            index.counter = 0;
+            index.dirty = false;
         }
-        candidate = formatSku(prefix, seq);
-        bool exists = false;
-        for (const auto& item : S().menu) {
-            if (item.sku == candidate) {
-                exists = true;
-                break;
-            }
+    }
+}
+
+MenuItem* findMenuItemBySku(const String& sku) {
+    ensureSkuIndex();
+    uint16_t seq = 0;
+    SkuIndex* index = parseCanonicalSku(sku, seq);
+    if (index) {
+        auto it = index->used.find(seq);
+        if (it != index->used.end() && S().menu[it->second].sku != sku) {
+            // The menu was replaced without invalidating the index; rebuild once and retry.
+            g_skuIndexValid = false;
+            ensureSkuIndex();
+            it = index->used.find(seq);
         }
-        if (!exists) {
-            resolved = true;
-            break;
+        return it == index->used.end() ? nullptr : &S().menu[it->second];
+    }
+    // SKUs outside the generated scheme (imported catalogs) are not indexed.
+    for (auto& item : S().menu) {
+        if (item.sku == sku) {
+            return &item;
+        }
+    }
+    return nullptr;
+}
+
+// Counters only need to stay ahead of SKUs that no longer exist, so they ride along with snapshots.
+static void flushSkuCounters() {
+    bool opened = false;
+    for (auto& index : g_skuIndexes) {
+        if (!index.dirty) {
+            continue;
+        }
+        if (!opened) {
+            prefs.begin("kds", false);
+            opened = true;
         }
-        seq++;
+        prefs.putUShort(index.counterKey, index.counter);
+        index.dirty = false;
     }
+    if (opened) {
+        prefs.end();
+    }
+}
 
-    uint16_t nextSeq = seq + 1;
-    if (nextSeq > 9999) {
-        nextSeq = 1;
+static String nextSku(SkuIndex& index) {
+    ensureSkuIndex();
+    if (index.counter == 0) {
+        prefs.begin("kds", true);
+        index.counter = prefs.getUShort(index.counterKey, 1);
+        prefs.end();
+        if (index.counter == 0 || index.counter > 9999) {
+            index.counter = 1;
+        }
     }
-    prefs.putUShort(counterKey, nextSeq);
-    prefs.end();
 
-    if (!resolved) {
-        return formatSku(prefix, 9999);
+    // Keep the counter ahead of anything already stored so we do not overwrite existing entries.
+    uint32_t seq = index.counter;
+    if (!index.used.empty() && seq <= index.used.rbegin()->first) {
+        seq = index.used.rbegin()->first + 1u;
+    }
+    if (seq > 9999) {
+        // Past the top of the range: take the lowest gap instead.
+        seq = 1;
+        for (auto it = index.used.begin(); it != index.used.end() && it->first == seq; ++it) {
+            seq++;
+        }
+        if (seq > 9999) {
+            return formatSku(index.prefix, 9999);
+        }
     }
-    return candidate;
+
+    index.counter = seq >= 9999 ? 1 : static_cast<uint16_t>(seq + 1);
+    index.dirty = true;
+    return formatSku(index.prefix, static_cast<uint16_t>(seq));
 }
 
 String generateSkuMain() {
-    return nextSku("main_", "MAIN", "mainSeq");
+    return nextSku(g_skuIndexes[0]);
 }
 
 String generateSkuSide() {
-    return nextSku("side_", "SIDE", "sideSeq");
+    return nextSku(g_skuIndexes[1]);
 }
 
 Order* findOrderByNo(const String& orderNo) {
@@ -588,941 +1068,1765 @@ bool orderFromJson(JsonVariantConst json, Order& order) {
     return true;
 }
 
-bool archiveForEach(const String& sessionIdFilter, ArchiveOrderVisitor visitor, void* context) {
-    File file = LittleFS.open(kArchivePath, "r");
-    if (!file) {
-        return true;
+bool archiveOrderAndRemove(const String& orderNo, const String& sessionId, uint32_t archivedAt, bool logWal) {
+    if (archivedAt == 0) {
+        archivedAt = static_cast<uint32_t>(time(nullptr));
     }
 
-    while (file.available()) {
-        String line = file.readStringUntil('\n');
-        line.trim();
-        if (line.isEmpty()) {
-            continue;
+    int index = -1;
+    for (int i = 0; i < static_cast<int>(S().orders.size()); ++i) {
+        if (S().orders[i].orderNo == orderNo) {
+            index = i;
+            break;
         }
+    }
 
-        DynamicJsonDocument doc(8192);
-        DeserializationError err = deserializeJson(doc, line);
-        if (err == DeserializationError::NoMemory) {
-            DynamicJsonDocument docRetry(16384);
-            err = deserializeJson(docRetry, line);
-            if (!err) {
-                doc = std::move(docRetry);
-            }
-        }
-        if (err) {
-            Serial.printf("[E] archive parse failed: %s\n", err.c_str());
-            continue;
-        }
+    if (index < 0) {
+        Serial.printf("[E] archive missing order: %s\n", orderNo.c_str());
+        return false;
+    }
 
-        String sessionId = doc["sessionId"] | String("");
-        if (!sessionIdFilter.isEmpty() && sessionId != sessionIdFilter) {
-            continue;
-        }
+    Order orderCopy = S().orders[index];
 
-        JsonVariantConst orderVar = doc["order"];
-        if (!orderVar.is<JsonObjectConst>()) {
-            Serial.println("[E] archive order invalid");
-            continue;
+    bool alreadyArchived = !logWal && archiveOrderExists(sessionId, orderNo);
+    if (!alreadyArchived) {
+        if (!archiveAppend(orderCopy, sessionId, archivedAt)) {
+            Serial.printf("[E] archive append failed: %s\n", orderNo.c_str());
+            return false;
         }
+    }
 
-        Order order;
-        if (!orderFromJson(orderVar, order)) {
-            JsonObjectConst orderObj = orderVar.as<JsonObjectConst>();
-            order.orderNo = orderObj["orderNo"] | String("");
-            if (order.orderNo.isEmpty()) {
-                Serial.println("[E] archive order missing id");
-                continue;
-            }
+    S().orders.erase(S().orders.begin() + index);
+    releaseOrderNo(orderCopy.orderNo);
 
-            order.status = orderObj["status"] | String("COOKING");
-            order.ts = orderObj["ts"] | 0;
-            order.printed = orderObj["printed"] | false;
-            order.cooked = orderObj["cooked"] | false;
-            order.pickup_called = orderObj["pickup_called"] | false;
-            order.picked_up = orderObj["picked_up"] | false;
-            order.cancelReason = orderObj["cancelReason"] | String("");
-
-            order.items.clear();
-            JsonArrayConst items = orderObj["items"].as<JsonArrayConst>();
-            if (items) {
-                for (JsonVariantConst iv : items) {
-                    if (!iv.is<JsonObjectConst>()) {
-                        continue;
-                    }
-                    JsonObjectConst itemObj = iv.as<JsonObjectConst>();
-                    LineItem li;
-                    li.sku = itemObj["sku"] | String("");
-                    li.name = itemObj["name"] | String("");
-                    li.qty = itemObj["qty"] | 1;
-                    li.unitPriceApplied = itemObj["unitPriceApplied"] | 0;
-                    li.priceMode = itemObj["priceMode"] | String("");
-                    li.kind = itemObj["kind"] | String("");
-                    li.unitPrice = itemObj["unitPrice"] | 0;
-                    li.discountName = itemObj["discountName"] | String("");
-                    li.discountValue = itemObj["discountValue"] | 0;
-                    order.items.push_back(li);
-                }
-            }
+    if (logWal) {
+        WalRecord walRec;
+        walRec.action = kWalOrderArchive;
+        walRec.ts = archivedAt;
+        walRec.orderNo = orderCopy.orderNo;
+        walRec.sessionId = sessionId;
+        walRec.archivedAt = archivedAt;
+        walRec.order = orderCopy;
+        walRec.hasOrder = true;
+        walAppend(walRec);
+    }
+    return true;
+}
+
+void writeSnapshotJsonFields(Print& out) {
+    JsonDocument part;
+    part["catalogVersion"] = S().settings.catalogVersion;
+    part["chinchiro"]["enabled"] = S().settings.chinchiro.enabled;
+    JsonArray mult = part["chinchiro"]["multipliers"].to<JsonArray>();
+    for (float m : S().settings.chinchiro.multipliers) {
+        mult.add(m);
+    }
+    part["chinchiro"]["rounding"] = S().settings.chinchiro.rounding;
+    part["numbering"]["min"] = S().settings.numbering.min;
+    part["numbering"]["max"] = S().settings.numbering.max;
+    part["store"]["name"] = S().settings.store.name;
+    part["store"]["nameRomaji"] = S().settings.store.nameRomaji;
+    part["store"]["registerId"] = S().settings.store.registerId;
+    part["qrPrint"]["enabled"] = S().settings.qrPrint.enabled;
+    part["qrPrint"]["content"] = S().settings.qrPrint.content;
+    out.print("\"settings\":");
+    serializeJson(part, out);
+
+    part.clear();
+    part["sessionId"] = S().session.sessionId;
+    part["startedAt"] = S().session.startedAt;
+    part["exported"] = S().session.exported;
+    part["nextOrderSeq"] = S().session.nextOrderSeq;
+    out.print(",\"session\":");
+    serializeJson(part, out);
+
+    part.clear();
+    part["paperOut"] = S().printer.paperOut;
+    part["overheat"] = S().printer.overheat;
+    part["holdJobs"] = S().printer.holdJobs;
+    out.print(",\"printer\":");
+    serializeJson(part, out);
+
+    out.print(",\"menu\":[");
+    bool first = true;
+    for (const auto& item : S().menu) {
+        part.clear();
+        part["sku"] = item.sku;
+        part["name"] = item.name;
+        part["nameRomaji"] = item.nameRomaji;
+        part["category"] = item.category;
+        part["active"] = item.active;
+        part["price_normal"] = item.price_normal;
+        part["price_presale"] = item.price_presale;
+        part["presale_discount_amount"] = item.presale_discount_amount;
+        part["price_single"] = item.price_single;
+        part["price_as_side"] = item.price_as_side;
+        if (!first) {
+            out.print(',');
         }
+        serializeJson(part, out);
+        first = false;
+    }
 
-        uint32_t archivedAt = doc["archivedAt"] | 0;
-        if (visitor && !visitor(order, sessionId, archivedAt, context)) {
-            file.close();
-            return true;
+    out.print("],\"orders\":[");
+    first = true;
+    for (const auto& order : S().orders) {
+        part.clear();
+        orderToJson(part.to<JsonObject>(), order);
+        if (!first) {
+            out.print(',');
         }
+        serializeJson(part, out);
+        first = false;
     }
+    out.print(']');
+}
 
-    file.close();
-    return true;
+static SnapshotStats g_snapshotStats;
+
+const SnapshotStats& getSnapshotStats() {
+    return g_snapshotStats;
+}
+
+static uint32_t currentMaxAllocHeap() {
+#if defined(ESP32)
+    return ESP.getMaxAllocHeap();
+#else
+    return 0;
+#endif
 }
 
-bool archiveFindOrder(const String& sessionIdFilter, const String& orderNo, Order& outOrder, uint32_t* archivedAt) {
-    struct FindCtx {
-        const String* targetOrderNo{nullptr};
-        Order* out{nullptr};
-        uint32_t* archivedAtPtr{nullptr};
-        bool found{false};
-        FindCtx(const String& target, Order& dest, uint32_t* archivedPtr)
-          : targetOrderNo(&target), out(&dest), archivedAtPtr(archivedPtr) {}
-    } ctx(orderNo, outOrder, archivedAt);
-
-    auto visitor = [](const Order& order, const String&, uint32_t archivedAtValue, void* rawCtx) -> bool {
-        auto* c = static_cast<FindCtx*>(rawCtx);
-        if (c && c->targetOrderNo && order.orderNo == *c->targetOrderNo) {
-            if (c->out) {
-                *c->out = order;
+// Everything headed for the snapshot file passes through one fixed buffer, so peak memory
+// stays the same no matter how many orders are open.
+class SnapshotFileSink : public ByteSink {
+public:
+    explicit SnapshotFileSink(File& file) : file_(file) {}
+
+    // Routes everything written from here on through packer; call flush() first.
+    void compressInto(LzBlockWriter* packer) { packer_ = packer; }
+
+    void write(const uint8_t* data, size_t len) override {
+        crc_ = crc32Update(crc_, data, len);
+        bytes_ += len;
+        while (len > 0) {
+            size_t n = std::min(len, sizeof(buffer_) - used_);
+            memcpy(buffer_ + used_, data, n);
+            used_ += n;
+            data += n;
+            len -= n;
+            if (used_ == sizeof(buffer_)) {
+                flush();
             }
-            if (c->archivedAtPtr) {
-                *c->archivedAtPtr = archivedAtValue;
+        }
+    }
+
+    void flush() {
+        if (used_ > 0 && ok_) {
+            if (packer_) {
+                packer_->write(buffer_, used_);
+                ok_ = packer_->ok();
+            } else {
+                ok_ = file_.write(buffer_, used_) == used_;
             }
-            c->found = true;
-            return false;
         }
-        return true;
-    };
+        used_ = 0;
+        uint32_t maxAlloc = currentMaxAllocHeap();
+        if (maxAlloc < lowestMaxAlloc_) {
+            lowestMaxAlloc_ = maxAlloc;
+        }
+    }
+
+    uint32_t crc() const { return crc_; }
+    size_t bytes() const { return bytes_; }
+    bool ok() const { return ok_; }
+    uint32_t lowestMaxAlloc() const { return lowestMaxAlloc_; }
+
+private:
+    File& file_;
+    LzBlockWriter* packer_{nullptr};
+    uint8_t buffer_[512];
+    size_t used_{0};
+    size_t bytes_{0};
+    uint32_t crc_{0};
+    uint32_t lowestMaxAlloc_{0xFFFFFFFFu};
+    bool ok_{true};
+};
+
+// Body of a background snapshot, encoded into RAM in fixed chunks so no large contiguous block is
+// needed. Once captured it is immutable: later changes to S() cannot leak into the file.
+class SnapshotCapture : public ByteSink {
+public:
+    explicit SnapshotCapture(size_t limit) : limit_(limit) {}
+
+    void write(const uint8_t* data, size_t len) override {
+        if (!ok_ || bytes_ + len > limit_) {
+            ok_ = false;
+            return;
+        }
+        while (len > 0) {
+            if (chunks_.empty() || used_ == kSnapshotCaptureChunk) {
+                uint8_t* chunk = new (std::nothrow) uint8_t[kSnapshotCaptureChunk];
+                if (!chunk) {
+                    ok_ = false;
+                    return;
+                }
+                chunks_.emplace_back(chunk);
+                used_ = 0;
+            }
+            size_t n = std::min(len, kSnapshotCaptureChunk - used_);
+            memcpy(chunks_.back().get() + used_, data, n);
+            used_ += n;
+            bytes_ += n;
+            data += n;
+            len -= n;
+        }
+    }
+
+    void replay(ByteSink& out) const {
+        for (size_t i = 0; i < chunks_.size(); ++i) {
+            out.write(chunks_[i].get(), i + 1 == chunks_.size() ? used_ : kSnapshotCaptureChunk);
+        }
+    }
+
+    size_t bytes() const { return bytes_; }
+    bool ok() const { return ok_; }
+
+private:
+    std::vector<std::unique_ptr<uint8_t[]>> chunks_;
+    size_t limit_;
+    size_t used_{0};
+    size_t bytes_{0};
+    bool ok_{true};
+};
+
+// Measures a record's payload and checksums it in the same pass; the CRC becomes its digest.
+class SnapshotRecordDigest : public ByteSink {
+public:
+    void write(const uint8_t* data, size_t len) override {
+        crc_ = crc32Update(crc_, data, len);
+        bytes_ += len;
+    }
+
+    uint32_t crc() const { return crc_; }
+    size_t bytes() const { return bytes_; }
+
+private:
+    uint32_t crc_{0};
+    size_t bytes_{0};
+};
+
+typedef std::function<void(RecordWriter&)> SnapshotRecordEncoder;
 
-    archiveForEach(sessionIdFilter, visitor, &ctx);
-    return ctx.found;
+static uint32_t snapshotKey(const String& id) {
+    return crc32Update(0, reinterpret_cast<const uint8_t*>(id.c_str()), id.length());
 }
 
-static bool archiveOrderExists(const String& sessionId, const String& orderNo) {
-    struct ExistsCtx {
-        const String* targetOrderNo{nullptr};
-        bool found{false};
-        explicit ExistsCtx(const String& target) : targetOrderNo(&target) {}
-    } ctx(orderNo);
+template <typename Encode>
+static void putSnapshotRecord(ByteSink& out, uint8_t type, size_t len, Encode encode) {
+    uint8_t head[kSnapshotRecordHeaderSize];
+    head[0] = type;
+    putLe32(head + 1, static_cast<uint32_t>(len));
+    out.write(head, sizeof(head));
 
-    auto visitor = [](const Order& order, const String&, uint32_t, void* rawCtx) -> bool {
-        auto* c = static_cast<ExistsCtx*>(rawCtx);
-        if (c && c->targetOrderNo && order.orderNo == *c->targetOrderNo) {
-            c->found = true;
+    RecordWriter w(out);
+    encode(w);
+}
+
+// Returns the CRC of the payload.
+template <typename Encode>
+static uint32_t writeSnapshotRecord(ByteSink& out, uint8_t type, Encode encode) {
+    SnapshotRecordDigest measure;
+    RecordWriter w(measure);
+    encode(w);
+    putSnapshotRecord(out, type, measure.bytes(), encode);
+    return measure.crc();
+}
+
+// Every record a checkpoint tracks, in file order: the base body minus archive filters and the end
+// record. visit(type, key, encode) runs once per record.
+template <typename Visit>
+static void forEachSnapshotRecord(Visit visit) {
+    visit(kSnapRecSettings, 0, SnapshotRecordEncoder([](RecordWriter& w) { encodeSettings(w, S().settings); }));
+    visit(kSnapRecSession, 0, SnapshotRecordEncoder([](RecordWriter& w) { encodeSession(w, S().session); }));
+    visit(kSnapRecPrinter, 0, SnapshotRecordEncoder([](RecordWriter& w) { encodePrinterState(w, S().printer); }));
+
+    for (const auto& item : S().menu) {
+        visit(kSnapRecMenuItem, snapshotKey(item.sku),
+              SnapshotRecordEncoder([&item](RecordWriter& w) { encodeMenuItem(w, item); }));
+    }
+
+    for (const auto& order : S().orders) {
+        visit(kSnapRecOrder, snapshotKey(order.orderNo),
+              SnapshotRecordEncoder([&order](RecordWriter& w) { encodeOrder(w, order); }));
+    }
+
+    visit(kSnapRecSalesSummary, 0,
+          SnapshotRecordEncoder([](RecordWriter& w) { encodeSalesSummary(w, g_salesSummary); }));
+    const SalesRollup& rollup = getSalesRollup();
+    visit(kSnapRecSalesRollup, 0,
+          SnapshotRecordEncoder([&rollup](RecordWriter& w) { encodeSalesRollupBreakdowns(w, rollup); }));
+    for (const auto& row : rollup.skus) {
+        visit(kSnapRecSalesRollupSku, snapshotKey(row.sku),
+              SnapshotRecordEncoder([&row](RecordWriter& w) { encodeSalesRollupSku(w, row); }));
+    }
+}
+
+static bool snapshotDigestLess(const SnapshotDigest& a, const SnapshotDigest& b) {
+    return a.type != b.type ? a.type < b.type : a.key < b.key;
+}
+
+// False when two records share a type and key; a delta could not tell them apart.
+static bool sortSnapshotDigests(std::vector<SnapshotDigest>& digests) {
+    std::sort(digests.begin(), digests.end(), snapshotDigestLess);
+    for (size_t i = 1; i < digests.size(); ++i) {
+        if (!snapshotDigestLess(digests[i - 1], digests[i])) {
             return false;
         }
-        return true;
-    };
+    }
+    return true;
+}
+
+// Every record after the file header, up to and including kSnapRecEnd; returns the record count.
+// digests, when given, receives the digest of every tracked record; bloomBytes the filter bytes written.
+static uint32_t encodeSnapshotBody(ByteSink& out, std::vector<SnapshotDigest>* digests,
+                                   uint32_t* bloomBytes = nullptr) {
+    uint32_t records = 0;
+    uint16_t indexes[kSnapRecTypeCount] = {};
+    if (digests) {
+        digests->clear();
+        digests->reserve(S().menu.size() + S().orders.size() + getSalesRollup().skus.size() + 8);
+    }
+    forEachSnapshotRecord([&](uint8_t type, uint32_t key, const SnapshotRecordEncoder& encode) {
+        uint32_t crc = writeSnapshotRecord(out, type, encode);
+        if (digests) {
+            digests->push_back(SnapshotDigest{key, crc, indexes[type]++, type});
+        }
+        records++;
+    });
 
-    archiveForEach(sessionId, visitor, &ctx);
-    return ctx.found;
+    std::vector<ArchiveBloomFilter> blooms;
+    archiveBloomSnapshot(blooms);
+    if (bloomBytes) {
+        *bloomBytes = 0;
+    }
+    for (const auto& bloom : blooms) {
+        writeSnapshotRecord(out, kSnapRecArchiveBloom, [&bloom](RecordWriter& w) { encodeArchiveBloom(w, bloom); });
+        if (bloomBytes) {
+            *bloomBytes += bloom.bits.size();
+        }
+        records++;
+    }
+
+    writeSnapshotRecord(out, kSnapRecEnd, [records](RecordWriter& w) { w.putU32(records); });
+    return records;
 }
 
-bool archiveAppend(const Order& order, const String& sessionId, uint32_t archivedAt) {
-    if (archivedAt == 0) {
-        archivedAt = static_cast<uint32_t>(time(nullptr));
+// Encodes into body the records whose digest differs from the chain's, plus a tombstone for every
+// order that left, and says whether that may go out as a delta frame: the chain has a base, only
+// orders went away, records kept their order with new ones after them (upserts replayed onto the
+// base must rebuild S() exactly), and the chain stays within KDS_SNAPSHOT_DELTA_PERCENT of the base.
+// Archive filters are left to the base; the archive checks them against its index anyway. Once a
+// filter has been built, resized or dropped since the base, a new base is written so a reboot
+// does not have to rebuild it from the index.
+// Call with StateLock and SnapshotLock held.
+static bool planSnapshotDeltaLocked(SnapshotCapture& body, SnapshotPlan& plan) {
+    plan.seq = ++g_snapshotPlanSeq;
+    plan.delta = false;
+    plan.records = 0;
+    plan.digests.clear();
+    const SnapshotChain& chain = g_snapshotChain;
+    if (!chain.basePath || KDS_SNAPSHOT_DELTA_PERCENT == 0) {
+        return false;
+    }
+    uint32_t bloomBytes = 0;
+    if (archiveBloomBytes(bloomBytes) && bloomBytes != chain.bloomBytes) {
+        return false;
     }
 
-    if (!ensureDataDir()) {
+    const std::vector<SnapshotDigest>& previous = chain.digests;
+    std::vector<bool> kept(previous.size(), false);
+    int32_t lastIndex[kSnapRecTypeCount];
+    std::fill(lastIndex, lastIndex + kSnapRecTypeCount, -1);
+    bool added[kSnapRecTypeCount] = {};
+    uint16_t indexes[kSnapRecTypeCount] = {};
+    bool usable = true;
+    uint32_t records = 0;
+    plan.digests.reserve(previous.size() + 8);
+    forEachSnapshotRecord([&](uint8_t type, uint32_t key, const SnapshotRecordEncoder& encode) {
+        if (!usable) {
+            return;
+        }
+        SnapshotRecordDigest measure;
+        RecordWriter w(measure);
+        encode(w);
+        SnapshotDigest digest{key, measure.crc(), indexes[type]++, type};
+        plan.digests.push_back(digest);
+
+        auto it = std::lower_bound(previous.begin(), previous.end(), digest, snapshotDigestLess);
+        if (it != previous.end() && it->type == type && it->key == key) {
+            if (added[type] || static_cast<int32_t>(it->index) <= lastIndex[type]) {
+                usable = false;
+                return;
+            }
+            lastIndex[type] = it->index;
+            kept[it - previous.begin()] = true;
+            if (it->crc == digest.crc) {
+                return;
+            }
+        } else {
+            added[type] = true;
+        }
+        putSnapshotRecord(body, type, measure.bytes(), encode);
+        records++;
+    });
+
+    for (size_t i = 0; usable && i < previous.size(); ++i) {
+        if (kept[i]) {
+            continue;
+        }
+        if (previous[i].type != kSnapRecOrder) {
+            usable = false;
+            break;
+        }
+        uint32_t key = previous[i].key;
+        writeSnapshotRecord(body, kSnapRecOrderRemoved, [key](RecordWriter& w) { w.putU32(key); });
+        records++;
+    }
+    if (!usable || !sortSnapshotDigests(plan.digests)) {
         return false;
     }
+    writeSnapshotRecord(body, kSnapRecEnd, [records](RecordWriter& w) { w.putU32(records); });
 
-    File file = LittleFS.open(kArchivePath, FILE_APPEND);
-    if (!file) {
-        file = LittleFS.open(kArchivePath, FILE_WRITE);
+    uint64_t chainBytes = chain.deltaBytes + kSnapshotDeltaHeaderSize + body.bytes() + 4;
+    if (!body.ok() || chainBytes * 100 > static_cast<uint64_t>(chain.baseBytes) * KDS_SNAPSHOT_DELTA_PERCENT) {
+        return false;
     }
+    plan.records = records;
+    plan.delta = true;
+    return true;
+}
+
+static void noteSnapshotChainStats() {
+    g_snapshotStats.chainBaseBytes = g_snapshotChain.basePath ? g_snapshotChain.baseBytes : 0;
+    g_snapshotStats.chainDeltaBytes = g_snapshotChain.deltaBytes;
+    g_snapshotStats.chainDeltas = g_snapshotChain.deltas;
+}
+
+// Writes a new base into the older slot from capture, or encodes S() straight into the file when
+// capture is null, and starts a new chain on it.
+static bool writeSnapshotBase(WalTicket checkpointLsn, const SnapshotCapture* capture, SnapshotPlan& plan) {
+    Serial.println("[SNAPSHOT] start");
+    uint32_t startedMs = millis();
+    uint32_t maxAllocBefore = currentMaxAllocHeap();
+
+    uint32_t generation = 0;
+    const char* filename = pickSnapshotPathForWrite(generation);
+    // Nothing can be appended until the new base is complete; frames of the slot's old base go now.
+    g_snapshotChain.basePath = nullptr;
+    noteSnapshotChainStats();
+    const char* deltaPath = snapshotDeltaPath(filename);
+    if (LittleFS.exists(deltaPath)) {
+        flashRemove(kFlashSnapshot, deltaPath);
+    }
+    FlashFile file = flashOpen(kFlashSnapshot, filename, "w");
     if (!file) {
-        Serial.printf("[E] archive open failed: %s\n", kArchivePath);
+        Serial.printf("[E] snapshot open failed: %s\n", filename);
+        g_snapshotStats.failures++;
         return false;
     }
 
-    DynamicJsonDocument doc(estimateOrderDocumentCapacity(order));
-    JsonObject root = doc.to<JsonObject>();
-    root["sessionId"] = sessionId;
-    root["archivedAt"] = archivedAt;
-    JsonObject orderObj = root.createNestedObject("order");
-    orderToJson(orderObj, order);
+    SnapshotFileSink out(file);
+    const uint16_t flags = KDS_COMPRESSED_STORAGE ? kSnapshotFlagCompressed : 0;
 
-    String line;
-    serializeJson(root, line);
-    if (line.isEmpty()) {
-        Serial.println("[E] archive serialize failed");
-        file.close();
-        return false;
+    uint8_t header[kSnapshotHeaderSize];
+    putLe32(header, kSnapshotMagic);
+    header[4] = static_cast<uint8_t>(kSnapshotVersion);
+    header[5] = static_cast<uint8_t>(kSnapshotVersion >> 8);
+    header[6] = static_cast<uint8_t>(flags);
+    header[7] = static_cast<uint8_t>(flags >> 8);
+    putLe32(header + 8, generation);
+    putLe32(header + 12, checkpointLsn);
+    out.write(header, sizeof(header));
+
+    // The header stays plain so generation and checkpoint can be read without decompressing.
+    std::unique_ptr<LzBlockWriter> packer;
+    if (flags & kSnapshotFlagCompressed) {
+        out.flush();
+        packer.reset(new LzBlockWriter(file));
+        packer->begin();
+        out.compressInto(packer.get());
+    }
+
+    uint32_t records = plan.records;
+    if (capture) {
+        capture->replay(out);
+    } else {
+        records = encodeSnapshotBody(out, &plan.digests, &plan.bloomBytes);
     }
 
-    size_t written = file.println(line);
+    uint8_t trailer[4];
+    putLe32(trailer, out.crc());
+    out.write(trailer, sizeof(trailer));
+    out.flush();
+    bool packed = !packer || packer->finish();
+    uint32_t storedBytes = static_cast<uint32_t>(packer ? kSnapshotHeaderSize + packer->storedBytes() : out.bytes());
+    packer.reset();
     file.flush();
     file.close();
-    if (written == 0) {
-        Serial.println("[E] archive write failed");
+    if (!out.ok() || !packed) {
+        Serial.printf("[E] snapshot write failed: %s\n", filename);
+        g_snapshotStats.failures++;
         return false;
     }
+
+    if (LittleFS.exists(kLegacySnapshotPathA)) {
+        flashRemove(kFlashSnapshot, kLegacySnapshotPathA);
+    }
+    if (LittleFS.exists(kLegacySnapshotPathB)) {
+        flashRemove(kFlashSnapshot, kLegacySnapshotPathB);
+    }
+    if (LittleFS.exists(kLegacySalesSummaryPath)) {
+        flashRemove(kFlashSnapshot, kLegacySalesSummaryPath);
+    }
+
+    g_snapshotStats.saves++;
+    g_snapshotStats.checkpointLsn = checkpointLsn;
+    g_snapshotStats.lastBytes = static_cast<uint32_t>(out.bytes());
+    g_snapshotStats.lastStoredBytes = storedBytes;
+    g_snapshotStats.lastRecords = records;
+    g_snapshotStats.lastDurationMs = millis() - startedMs;
+    g_snapshotStats.maxAllocBefore = maxAllocBefore;
+    g_snapshotStats.maxAllocLowest = std::min(out.lowestMaxAlloc(), maxAllocBefore);
+    g_snapshotStats.maxAllocAfter = currentMaxAllocHeap();
+
+    g_snapshotChain.basePath = sortSnapshotDigests(plan.digests) ? filename : nullptr;
+    g_snapshotChain.generation = generation;
+    g_snapshotChain.baseBytes = storedBytes;
+    g_snapshotChain.deltaBytes = 0;
+    g_snapshotChain.deltas = 0;
+    g_snapshotChain.digests.swap(plan.digests);
+    g_snapshotChain.bloomBytes = plan.bloomBytes;
+    noteSnapshotChainStats();
+
+    Serial.printf("[SNAPSHOT] saved: %s (gen=%u, lsn=%u, %u bytes, %u ms, maxAlloc %u/%u/%u)\n", filename,
+                  static_cast<unsigned>(generation), static_cast<unsigned>(checkpointLsn),
+                  static_cast<unsigned>(g_snapshotStats.lastBytes),
+                  static_cast<unsigned>(g_snapshotStats.lastDurationMs),
+                  static_cast<unsigned>(g_snapshotStats.maxAllocBefore),
+                  static_cast<unsigned>(g_snapshotStats.maxAllocLowest),
+                  static_cast<unsigned>(g_snapshotStats.maxAllocAfter));
     return true;
 }
 
-bool archiveOrderAndRemove(const String& orderNo, const String& sessionId, uint32_t archivedAt, bool logWal) {
-    if (archivedAt == 0) {
-        archivedAt = static_cast<uint32_t>(time(nullptr));
+// Appends body as one frame to the chain's delta file.
+static bool writeSnapshotDelta(WalTicket checkpointLsn, const SnapshotCapture& body, SnapshotPlan& plan) {
+    uint32_t startedMs = millis();
+    const char* path = snapshotDeltaPath(g_snapshotChain.basePath);
+    FlashFile file = flashOpen(kFlashSnapshot, path, FILE_APPEND);
+    if (!file) {
+        Serial.printf("[E] snapshot delta open failed: %s\n", path);
+        g_snapshotStats.failures++;
+        g_snapshotChain.basePath = nullptr;
+        noteSnapshotChainStats();
+        return false;
     }
 
-    int index = -1;
-    for (int i = 0; i < static_cast<int>(S().orders.size()); ++i) {
-        if (S().orders[i].orderNo == orderNo) {
-            index = i;
-            break;
-        }
+    SnapshotFileSink out(file);
+    uint8_t header[kSnapshotDeltaHeaderSize];
+    putLe32(header, kSnapshotDeltaMagic);
+    header[4] = static_cast<uint8_t>(kSnapshotDeltaVersion);
+    header[5] = static_cast<uint8_t>(kSnapshotDeltaVersion >> 8);
+    header[6] = 0;
+    header[7] = 0;
+    putLe32(header + 8, g_snapshotChain.generation);
+    putLe32(header + 12, checkpointLsn);
+    putLe32(header + 16, static_cast<uint32_t>(body.bytes()));
+    out.write(header, sizeof(header));
+    body.replay(out);
+
+    uint8_t trailer[4];
+    putLe32(trailer, out.crc());
+    out.write(trailer, sizeof(trailer));
+    out.flush();
+    file.flush();
+    file.close();
+    if (!out.ok()) {
+        // The loader stops at the torn frame; the next save starts over with a base.
+        Serial.printf("[E] snapshot delta write failed: %s\n", path);
+        g_snapshotStats.failures++;
+        g_snapshotChain.basePath = nullptr;
+        noteSnapshotChainStats();
+        return false;
     }
 
-    if (index < 0) {
-        Serial.printf("[E] archive missing order: %s\n", orderNo.c_str());
+    uint32_t frameBytes = static_cast<uint32_t>(out.bytes());
+    g_snapshotChain.deltaBytes += frameBytes;
+    g_snapshotChain.deltas++;
+    g_snapshotChain.digests.swap(plan.digests);
+    noteSnapshotChainStats();
+
+    g_snapshotStats.saves++;
+    g_snapshotStats.deltaSaves++;
+    g_snapshotStats.checkpointLsn = checkpointLsn;
+    g_snapshotStats.lastBytes = frameBytes;
+    g_snapshotStats.lastStoredBytes = frameBytes;
+    g_snapshotStats.lastRecords = plan.records;
+    g_snapshotStats.lastDeltaRecords = plan.records;
+    g_snapshotStats.lastDurationMs = millis() - startedMs;
+
+    Serial.printf("[SNAPSHOT] delta saved: %s (gen=%u, lsn=%u, %u records, %u bytes, chain %u/%u bytes)\n", path,
+                  static_cast<unsigned>(g_snapshotChain.generation), static_cast<unsigned>(checkpointLsn),
+                  static_cast<unsigned>(plan.records), static_cast<unsigned>(frameBytes),
+                  static_cast<unsigned>(g_snapshotChain.deltaBytes),
+                  static_cast<unsigned>(g_snapshotChain.baseBytes));
+    return true;
+}
+
+// Writes what snapshotSaveAsync() planned and captured, or plans and writes a checkpoint straight
+// from S() when capture is null; the caller then holds StateLock.
+static bool writeSnapshotFile(WalTicket checkpointLsn, const SnapshotCapture* capture, SnapshotPlan* plan) {
+    SnapshotLock lock;
+    if (!ensureDataDir()) {
         return false;
     }
 
-    Order orderCopy = S().orders[index];
+    SnapshotPlan local;
+    std::unique_ptr<SnapshotCapture> delta;
+    if (!capture) {
+        delta.reset(new SnapshotCapture(kSnapshotCaptureMaxBytes));
+        if (planSnapshotDeltaLocked(*delta, local)) {
+            capture = delta.get();
+        } else {
+            delta.reset();
+        }
+        plan = &local;
+    } else if (plan->seq < g_snapshotChain.writtenSeq) {
+        // A save planned after this one already reached flash and covers everything this one holds.
+        Serial.println("[SNAPSHOT] skipped: superseded");
+        g_snapshotStats.lastBytes = 0;
+        g_snapshotStats.lastStoredBytes = 0;
+        return true;
+    }
+    g_snapshotChain.writtenSeq = plan->seq;
+    return plan->delta ? writeSnapshotDelta(checkpointLsn, *capture, *plan)
+                       : writeSnapshotBase(checkpointLsn, capture, *plan);
+}
 
-    bool alreadyArchived = !logWal && archiveOrderExists(sessionId, orderNo);
-    if (!alreadyArchived) {
-        if (!archiveAppend(orderCopy, sessionId, archivedAt)) {
-            Serial.printf("[E] archive append failed: %s\n", orderNo.c_str());
+// Segment counters ride along with the snapshot cadence instead of costing a write per archive.
+// Both touch state owned by loop() and HTTP handlers, so the snapshot task never calls this.
+static void afterSnapshotSaved() {
+    archiveFlushManifest();
+    flushSkuCounters();
+}
+
+bool snapshotSave() {
+    if (isRecoveryInProgress()) {
+        // A checkpoint taken now would claim WAL records that have not been replayed yet.
+        Serial.println("[SNAPSHOT] skipped: recovery in progress");
+        return false;
+    }
+    // Every record up to this LSN was applied to S() before it was logged, so the snapshot covers it.
+    {
+        StateLock state;
+        if (!writeSnapshotFile(walLastLsn(), nullptr, nullptr)) {
             return false;
         }
     }
+    afterSnapshotSaved();
+    return true;
+}
 
-    S().orders.erase(S().orders.begin() + index);
+struct SnapshotJob {
+    std::unique_ptr<SnapshotCapture> capture;
+    WalTicket checkpointLsn{0};
+    SnapshotPlan plan;
+};
 
-    if (logWal) {
-        DynamicJsonDocument walDoc(estimateOrderDocumentCapacity(orderCopy) + 512);
-        walDoc["ts"] = archivedAt;
-        walDoc["action"] = "ORDER_ARCHIVE";
-        walDoc["orderNo"] = orderCopy.orderNo;
-        walDoc["sessionId"] = sessionId;
-        walDoc["archivedAt"] = archivedAt;
-        JsonObject orderObj = walDoc.createNestedObject("order");
-        orderToJson(orderObj, orderCopy);
-
-        String walLine;
-        serializeJson(walDoc, walLine);
-        walAppend(walLine);
+static TaskHandle_t g_snapshotTask = nullptr;
+// Owned by the task from hand-off until it clears the pointer; g_snapshotDone then waits for
+// snapshotPoll().
+static SnapshotJob* volatile g_snapshotJob = nullptr;
+static volatile bool g_snapshotDone = false;
+static volatile bool g_snapshotOk = false;
+
+static void snapshotTaskMain(void*) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        SnapshotJob* job = g_snapshotJob;
+        if (!job) {
+            continue;
+        }
+        bool ok = writeSnapshotFile(job->checkpointLsn, job->capture.get(), &job->plan);
+        delete job;
+        g_snapshotOk = ok;
+        g_snapshotJob = nullptr;
+        g_snapshotDone = true;
     }
-    return true;
 }
 
-bool archiveReplaceOrder(const Order& order, const String& sessionId, uint32_t archivedAt) {
-    File input = LittleFS.open(kArchivePath, "r");
-    if (!input) {
-        Serial.printf("[E] archive replace open failed: %s\n", kArchivePath);
+bool snapshotSaveAsync() {
+    if (g_snapshotJob || g_snapshotDone) {
+        return false;
+    }
+    if (isRecoveryInProgress()) {
+        Serial.println("[SNAPSHOT] skipped: recovery in progress");
         return false;
     }
+    if (!g_snapshotTask &&
+        xTaskCreate(snapshotTaskMain, "snapshot", kSnapshotTaskStackSize, nullptr, 1, &g_snapshotTask) != pdPASS) {
+        Serial.println("[E] snapshot task create failed");
+        g_snapshotTask = nullptr;
+    }
+
+    uint32_t startedUs = micros();
+    std::unique_ptr<SnapshotJob> job(new SnapshotJob);
+    {
+        // Handlers change S() from the web server task; the LSN and the capture have to agree.
+        StateLock state;
+        job->checkpointLsn = walLastLsn();
+        // The chain is shared with the task; the full body is only encoded when no delta will do.
+        SnapshotLock lock;
+        job->capture.reset(new SnapshotCapture(kSnapshotCaptureMaxBytes));
+        if (!planSnapshotDeltaLocked(*job->capture, job->plan)) {
+            job->capture.reset();
+            job->capture.reset(new SnapshotCapture(kSnapshotCaptureMaxBytes));
+            job->plan.records = encodeSnapshotBody(*job->capture, &job->plan.digests, &job->plan.bloomBytes);
+        }
+    }
+    g_snapshotStats.lastCaptureUs = micros() - startedUs;
 
-    const char* tempPath = "/kds/orders_archive.tmp";
-    File temp = LittleFS.open(tempPath, "w");
-    if (!temp) {
-        Serial.printf("[E] archive replace temp failed: %s\n", tempPath);
-        input.close();
+    if (!g_snapshotTask || !job->capture->ok()) {
+        // Too big to hold in RAM (or no task): stream it from here as before.
+        g_snapshotStats.captureFallbacks++;
+        job.reset();
+        StateLock state;
+        g_snapshotOk = writeSnapshotFile(walLastLsn(), nullptr, nullptr);
+        g_snapshotDone = true;
+        return true;
+    }
+    g_snapshotStats.lastCaptureBytes = static_cast<uint32_t>(job->capture->bytes());
+    g_snapshotJob = job.release();
+    xTaskNotifyGive(g_snapshotTask);
+    return true;
+}
+
+bool isSnapshotSaveInFlight() {
+    return g_snapshotJob != nullptr;
+}
+
+bool snapshotPoll(bool& ok) {
+    if (!g_snapshotDone) {
         return false;
     }
+    ok = g_snapshotOk;
+    g_snapshotDone = false;
+    if (ok) {
+        afterSnapshotSaved();
+    }
+    return true;
+}
 
-    bool updated = false;
-    while (input.available()) {
-        String line = input.readStringUntil('\n');
-        line.trim();
-        if (line.isEmpty()) {
-            temp.println();
-            continue;
+// Everything a snapshot restores, decoded aside until the base and its frames have checked out.
+struct SnapshotStaging {
+    Settings settings;
+    Session session;
+    PrinterState printer;
+    std::vector<MenuItem> menu;
+    std::vector<Order> orders;
+    SalesSummary summary;
+    bool hasSummary{false};
+    SalesRollup rollup;
+    bool hasRollup{false};
+    std::vector<ArchiveBloomFilter> blooms;
+};
+
+// Bases append rows; delta frames replace the row with the same key or append a new one.
+template <typename Row>
+static void stageSnapshotRow(std::vector<Row>& rows, Row& row, String Row::*key, bool upsert) {
+    if (upsert) {
+        for (auto& existing : rows) {
+            if (existing.*key == row.*key) {
+                existing = std::move(row);
+                return;
+            }
         }
+    }
+    rows.push_back(std::move(row));
+}
 
-        DynamicJsonDocument doc(std::max<size_t>(estimateOrderDocumentCapacity(order) + 512, 8192));
-        DeserializationError err = deserializeJson(doc, line);
-        if (err) {
-            Serial.printf("[E] archive replace parse failed: %s\n", err.c_str());
-            temp.println(line);
-            continue;
+static bool decodeSnapshotRecord(uint8_t type, RecordReader& r, SnapshotStaging& staging, bool upsert) {
+    switch (type) {
+        case kSnapRecSettings:
+            return decodeSettings(r, staging.settings);
+        case kSnapRecSession:
+            return decodeSession(r, staging.session);
+        case kSnapRecPrinter:
+            return decodePrinterState(r, staging.printer);
+        case kSnapRecMenuItem: {
+            MenuItem item;
+            if (!decodeMenuItem(r, item)) {
+                return false;
+            }
+            stageSnapshotRow(staging.menu, item, &MenuItem::sku, upsert);
+            return true;
         }
-
-        String existingSession = doc["sessionId"] | String("");
-        JsonObject orderObj = doc["order"].is<JsonObject>() ? doc["order"].as<JsonObject>() : JsonObject();
-        String existingOrderNo = orderObj["orderNo"] | String("");
-
-        if (!updated && existingSession == sessionId && existingOrderNo == order.orderNo) {
-            if (archivedAt == 0) {
-                archivedAt = doc["archivedAt"] | archivedAt;
+        case kSnapRecOrder: {
+            Order order;
+            if (!decodeOrder(r, order)) {
+                return false;
             }
-            doc["sessionId"] = sessionId;
-            doc["archivedAt"] = archivedAt;
-            if (doc.containsKey("order")) {
-                doc.remove("order");
+            stageSnapshotRow(staging.orders, order, &Order::orderNo, upsert);
+            return true;
+        }
+        case kSnapRecOrderRemoved: {
+            uint32_t key = r.getU32();
+            for (auto it = staging.orders.begin(); it != staging.orders.end(); ++it) {
+                if (snapshotKey(it->orderNo) == key) {
+                    staging.orders.erase(it);
+                    break;
+                }
             }
-            JsonObject newOrderObj = doc.createNestedObject("order");
-            orderToJson(newOrderObj, order);
-            updated = true;
+            return r.ok();
         }
-
-        String outLine;
-        serializeJson(doc, outLine);
-        temp.println(outLine);
+        case kSnapRecSalesSummary:
+            staging.hasSummary = decodeSalesSummary(r, staging.summary);
+            return staging.hasSummary;
+        case kSnapRecSalesRollup:
+            staging.hasRollup = decodeSalesRollupBreakdowns(r, staging.rollup);
+            return staging.hasRollup;
+        case kSnapRecSalesRollupSku: {
+            SalesRollupSku row;
+            if (!decodeSalesRollupSku(r, row)) {
+                return false;
+            }
+            stageSnapshotRow(staging.rollup.skus, row, &SalesRollupSku::sku, upsert);
+            return true;
+        }
+        case kSnapRecArchiveBloom: {
+            ArchiveBloomFilter bloom;
+            if (!decodeArchiveBloom(r, bloom)) {
+                return false;
+            }
+            staging.blooms.push_back(std::move(bloom));
+            return true;
+        }
+        default:
+            // Unknown record types from newer firmware are skipped.
+            return true;
     }
+}
 
-    temp.flush();
-    temp.close();
-    input.close();
+// Reads records up to and including kSnapRecEnd, folding every byte into crc; false on a short
+// read, a record that does not decode or an end count that does not match.
+template <typename Read>
+static bool readSnapshotRecords(Read read, size_t limit, SnapshotStaging& staging, bool upsert, uint32_t& crc,
+                                uint32_t& records) {
+    std::vector<uint8_t> payload;
+    payload.reserve(512);
+    records = 0;
+    while (true) {
+        uint8_t head[kSnapshotRecordHeaderSize];
+        if (read(head, sizeof(head)) != sizeof(head)) {
+            return false;
+        }
+        uint8_t type = head[0];
+        uint32_t len = getLe32(head + 1);
+        if (len > limit || len > kSnapshotMaxRecordSize) {
+            return false;
+        }
+        payload.resize(len);
+        if (len > 0 && read(payload.data(), len) != len) {
+            return false;
+        }
+        crc = crc32Update(crc, head, sizeof(head));
+        crc = crc32Update(crc, payload.data(), len);
 
-    if (!updated) {
-        Serial.printf("[E] archive replace target missing: %s\n", order.orderNo.c_str());
-        LittleFS.remove(tempPath);
-        return false;
+        RecordReader r(payload.data(), len);
+        if (type == kSnapRecEnd) {
+            return r.getU32() == records;
+        }
+        if (!decodeSnapshotRecord(type, r, staging, upsert)) {
+            return false;
+        }
+        records++;
     }
+}
 
-    String backupPath = String(kArchivePath) + ".bak";
-    if (LittleFS.exists(backupPath)) {
-        LittleFS.remove(backupPath);
+// Replays the first frames of basePath's delta file onto staging; scanSnapshotDeltas() has already
+// checked their CRCs.
+static bool applySnapshotDeltas(const char* basePath, uint32_t frames, SnapshotStaging& staging, uint32_t& records) {
+    FlashFile f = flashOpen(kFlashSnapshot, snapshotDeltaPath(basePath), "r");
+    if (!f) {
+        return false;
     }
+    auto readFrame = [&f](uint8_t* out, size_t len) -> size_t { return f.read(out, len); };
+    uint32_t offset = 0;
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < frames; ++i) {
+        SnapshotDeltaFrame frame;
+        uint8_t raw[kSnapshotDeltaHeaderSize];
+        uint32_t crc = 0;
+        uint32_t frameRecords = 0;
+        ok = readSnapshotDeltaHeader(f, frame, raw) &&
+             readSnapshotRecords(readFrame, frame.bodyLen, staging, true, crc, frameRecords);
+        records += frameRecords;
+        offset += kSnapshotDeltaHeaderSize + frame.bodyLen + 4;
+        ok = ok && f.seek(offset);
+    }
+    f.close();
+    return ok;
+}
 
-    if (!LittleFS.rename(kArchivePath, backupPath)) {
-        Serial.printf("[E] archive replace backup failed: %s\n", backupPath.c_str());
-        LittleFS.remove(tempPath);
+// Records are decoded into a staging area and only swapped into S() once the CRC matches,
+// so a torn snapshot never leaves a half-loaded state behind.
+static bool loadBinarySnapshot(const char* path) {
+    FlashFile f = flashOpen(kFlashSnapshot, path, "r");
+    if (!f) {
         return false;
     }
 
-    if (!LittleFS.rename(tempPath, kArchivePath)) {
-        Serial.printf("[E] archive replace rename failed: %s\n", tempPath);
-        LittleFS.rename(backupPath, kArchivePath);
-        LittleFS.remove(tempPath);
+    uint32_t startedMs = millis();
+    size_t fileSize = f.size();
+    uint32_t crc = 0;
+    SnapshotHeader header;
+    uint8_t rawHeader[kSnapshotHeaderSize];
+    size_t rawHeaderLen = 0;
+    if (!readSnapshotHeader(f, header, rawHeader, rawHeaderLen)) {
+        Serial.printf("[E] snapshot header invalid: %s\n", path);
+        f.close();
         return false;
     }
+    crc = crc32Update(crc, rawHeader, rawHeaderLen);
 
-    LittleFS.remove(backupPath);
-    return true;
-}
-
-bool snapshotSave() {
-    if (!ensureDataDir()) {
+    LzBlockReader unpacker;
+    bool compressed = (header.flags & kSnapshotFlagCompressed) != 0;
+    if (compressed && !unpacker.begin(f)) {
+        Serial.printf("[E] snapshot container invalid: %s\n", path);
+        f.close();
         return false;
     }
+    size_t bodySize = compressed ? unpacker.size() : fileSize;
+    auto readBody = [&](uint8_t* out, size_t len) -> size_t {
+        return compressed ? unpacker.read(out, len) : f.read(out, len);
+    };
 
-    Serial.println("[SNAPSHOT] start");
+    SnapshotStaging staging;
+    staging.settings = S().settings;
+    staging.session = S().session;
+    staging.printer = S().printer;
+    uint32_t records = 0;
+    bool valid = readSnapshotRecords(readBody, bodySize, staging, false, crc, records);
 
-    size_t docCapacity = std::max<size_t>(estimateSnapshotCapacity(), 32 * 1024);
-    DynamicJsonDocument doc(docCapacity);
-    doc["settings"]["catalogVersion"] = S().settings.catalogVersion;
-    doc["settings"]["chinchiro"]["enabled"] = S().settings.chinchiro.enabled;
-    JsonArray mult = doc["settings"]["chinchiro"]["multipliers"].to<JsonArray>();
-    for (float m : S().settings.chinchiro.multipliers) {
-        mult.add(m);
-    }
-    doc["settings"]["chinchiro"]["rounding"] = S().settings.chinchiro.rounding;
-    doc["settings"]["numbering"]["min"] = S().settings.numbering.min;
-    doc["settings"]["numbering"]["max"] = S().settings.numbering.max;
-    doc["settings"]["store"]["name"] = S().settings.store.name;
-    doc["settings"]["store"]["nameRomaji"] = S().settings.store.nameRomaji;
-    doc["settings"]["store"]["registerId"] = S().settings.store.registerId;
-    doc["settings"]["qrPrint"]["enabled"] = S().settings.qrPrint.enabled;
-    doc["settings"]["qrPrint"]["content"] = S().settings.qrPrint.content;
-
-    doc["session"]["sessionId"] = S().session.sessionId;
-    doc["session"]["startedAt"] = S().session.startedAt;
-    doc["session"]["exported"] = S().session.exported;
-    doc["session"]["nextOrderSeq"] = S().session.nextOrderSeq;
-
-    doc["printer"]["paperOut"] = S().printer.paperOut;
-    doc["printer"]["overheat"] = S().printer.overheat;
-    doc["printer"]["holdJobs"] = S().printer.holdJobs;
-    JsonArray menuArray = doc["menu"].to<JsonArray>();
-    for (const auto& item : S().menu) {
-        JsonObject menuItem = menuArray.add<JsonObject>();
-        menuItem["sku"] = item.sku;
-        menuItem["name"] = item.name;
-        menuItem["nameRomaji"] = item.nameRomaji;
-        menuItem["category"] = item.category;
-        menuItem["active"] = item.active;
-        menuItem["price_normal"] = item.price_normal;
-        menuItem["price_presale"] = item.price_presale;
-        menuItem["presale_discount_amount"] = item.presale_discount_amount;
-        menuItem["price_single"] = item.price_single;
-        menuItem["price_as_side"] = item.price_as_side;
-    }
-
-    JsonArray ordersArray = doc["orders"].to<JsonArray>();
-    for (const auto& order : S().orders) {
-        JsonObject orderObj = ordersArray.add<JsonObject>();
-        orderToJson(orderObj, order);
+    uint8_t trailer[4];
+    if (valid && (readBody(trailer, sizeof(trailer)) != sizeof(trailer) || getLe32(trailer) != crc)) {
+        Serial.printf("[E] snapshot crc mismatch: %s\n", path);
+        valid = false;
     }
+    f.close();
 
-    String filename = pickSnapshotPathForWrite();
-    File file = LittleFS.open(filename, "w");
-    if (!file) {
-        Serial.printf("[E] snapshot open failed: %s\n", filename.c_str());
+    if (!valid) {
+        Serial.printf("[E] snapshot invalid: %s\n", path);
         return false;
     }
 
-    size_t written = serializeJson(doc, file);
-    file.println();
-    file.flush();
-    file.close();
-    if (written == 0) {
-        Serial.printf("[E] snapshot write failed: %s\n", filename.c_str());
+    // Frames checkpointed on top of the base; a torn last frame is left out, its changes are in the WAL.
+    SnapshotDeltaScan deltas;
+    scanSnapshotDeltas(path, header, deltas);
+    if (deltas.frames > 0 && !applySnapshotDeltas(path, deltas.frames, staging, records)) {
+        Serial.printf("[E] snapshot delta invalid: %s\n", snapshotDeltaPath(path));
         return false;
     }
 
-    Serial.printf("[SNAPSHOT] saved: %s\n", filename.c_str());
+    S().settings = staging.settings;
+    S().session = staging.session;
+    S().printer = staging.printer;
+    S().menu.swap(staging.menu);
+    S().orders.swap(staging.orders);
+    g_loadedCheckpointLsn = deltas.lastLsn;
+    g_loadedHasCheckpoint = header.hasCheckpoint;
+    // Both have to be present for WAL deltas to land on a consistent base.
+    g_loadedHasSalesSummary = staging.hasSummary && staging.hasRollup;
+    if (g_loadedHasSalesSummary) {
+        g_salesSummary = staging.summary;
+        salesRollupRestore(staging.rollup);
+    }
+    uint32_t loadedBloomBytes = 0;
+    for (const auto& bloom : staging.blooms) {
+        loadedBloomBytes += bloom.bits.size();
+    }
+    archiveBloomRestore(staging.blooms);
+
+    // The next checkpoint appends to this chain, unless its tail is torn or the base is too old to
+    // carry everything a delta would be compared against. Digests come from what was just loaded.
+    g_snapshotChain = SnapshotChain();
+    if (header.hasCheckpoint && g_loadedHasSalesSummary && !deltas.torn) {
+        CountingSink discard;
+        std::vector<SnapshotDigest> digests;
+        encodeSnapshotBody(discard, &digests);
+        if (sortSnapshotDigests(digests)) {
+            g_snapshotChain.basePath = path;
+            g_snapshotChain.generation = header.generation;
+            g_snapshotChain.baseBytes = fileSize;
+            g_snapshotChain.deltaBytes = deltas.bytes;
+            g_snapshotChain.deltas = deltas.frames;
+            g_snapshotChain.digests.swap(digests);
+            g_snapshotChain.bloomBytes = loadedBloomBytes;
+        }
+    }
+    noteSnapshotChainStats();
+
+    if (S().menu.empty()) {
+        ensureInitialMenu();
+    }
+    refreshMenuEtag();
+
+    g_snapshotStats.loadBytes = fileSize + deltas.bytes;
+    g_snapshotStats.loadRecords = records;
+    g_snapshotStats.loadDeltas = deltas.frames;
+    g_snapshotStats.loadDurationMs = millis() - startedMs;
+    g_snapshotStats.loadedLegacyJson = false;
+    Serial.printf("[SNAPSHOT] loaded: %s (lsn=%u, %u bytes, %u records, %u deltas, %u ms)\n", path,
+                  static_cast<unsigned>(g_loadedCheckpointLsn),
+                  static_cast<unsigned>(g_snapshotStats.loadBytes), static_cast<unsigned>(records),
+                  static_cast<unsigned>(deltas.frames),
+                  static_cast<unsigned>(g_snapshotStats.loadDurationMs));
     return true;
 }
 
-bool snapshotLoad() {
-    const char* pathA = "/kds/snapA.json";
-    const char* pathB = "/kds/snapB.json";
+static void applySnapshotSettingsJson(JsonObjectConst settings, Settings& out) {
+    out.catalogVersion = settings["catalogVersion"] | 1;
+    out.chinchiro.enabled = settings["chinchiro"]["enabled"] | true;
+    out.chinchiro.rounding = settings["chinchiro"]["rounding"] | "round";
 
-    File fileA = LittleFS.open(pathA, "r");
-    File fileB = LittleFS.open(pathB, "r");
+    out.chinchiro.multipliers.clear();
+    JsonArrayConst chinMult = settings["chinchiro"]["multipliers"].as<JsonArrayConst>();
+    if (chinMult) {
+        for (JsonVariantConst v : chinMult) {
+            out.chinchiro.multipliers.push_back(v.as<float>());
+        }
+    }
 
-    bool hasA = fileA;
-    bool hasB = fileB;
-    time_t timeA = hasA ? fileA.getLastWrite() : 0;
-    time_t timeB = hasB ? fileB.getLastWrite() : 0;
-    fileA.close();
-    fileB.close();
+    out.numbering.min = settings["numbering"]["min"] | 1;
+    out.numbering.max = settings["numbering"]["max"] | 9999;
+    out.store.name = settings["store"]["name"] | "KDS BURGER";
+    out.store.nameRomaji = settings["store"]["nameRomaji"] | "KDS BURGER";
+    out.store.registerId = settings["store"]["registerId"] | "REG-01";
+    out.qrPrint.enabled = settings["qrPrint"]["enabled"] | false;
+    out.qrPrint.content = settings["qrPrint"]["content"] | "";
+}
 
-    if (!hasA && !hasB) {
-        ensureInitialMenu();
-        return true;
-    }
+static void applySnapshotSessionJson(JsonObjectConst session, Session& out) {
+    out.sessionId = session["sessionId"] | "";
+    out.startedAt = session["startedAt"] | 0;
+    out.exported = session["exported"] | false;
+    out.nextOrderSeq = session["nextOrderSeq"] | 1;
+}
 
-    const char* newer = nullptr;
-    const char* older = nullptr;
-    if (hasA && hasB) {
-        if (timeA >= timeB) {
-            newer = pathA;
-            older = pathB;
-        } else {
-            newer = pathB;
-            older = pathA;
+static void applySnapshotPrinterJson(JsonObjectConst printer, PrinterState& out) {
+    out.paperOut = printer["paperOut"] | false;
+    out.overheat = printer["overheat"] | false;
+    out.holdJobs = printer["holdJobs"] | 0;
+}
+
+static void menuItemFromSnapshotJson(JsonVariantConst v, MenuItem& item) {
+    item.sku = v["sku"] | "";
+    item.name = v["name"] | "";
+    item.nameRomaji = v["nameRomaji"] | "";
+    item.category = v["category"] | "";
+    item.active = v["active"] | true;
+    item.price_normal = v["price_normal"] | 0;
+    item.price_presale = v["price_presale"] | 0;
+    item.presale_discount_amount = v["presale_discount_amount"] | 0;
+    item.price_single = v["price_single"] | 0;
+    item.price_as_side = v["price_as_side"] | 0;
+}
+
+static void orderFromSnapshotJson(JsonVariantConst v, Order& order) {
+    if (orderFromJson(v, order)) {
+        return;
+    }
+    order.orderNo = v["orderNo"] | "";
+    order.status = v["status"] | "";
+    order.ts = v["ts"] | 0;
+    order.printed = v["printed"] | false;
+    order.cancelReason = v["cancelReason"] | "";
+    order.cooked = v["cooked"] | false;
+    order.picked_up = v["picked_up"] | false;
+    order.pickup_called = v["pickup_called"] | false;
+
+    JsonArrayConst items = v["items"].as<JsonArrayConst>();
+    if (items) {
+        for (JsonVariantConst iv : items) {
+            LineItem item;
+            item.sku = iv["sku"] | "";
+            item.name = iv["name"] | "";
+            item.qty = iv["qty"] | 1;
+            item.unitPriceApplied = iv["unitPriceApplied"] | 0;
+            item.priceMode = iv["priceMode"] | "";
+            item.kind = iv["kind"] | "";
+            item.unitPrice = iv["unitPrice"] | 0;
+            item.discountName = iv["discountName"] | "";
+            item.discountValue = iv["discountValue"] | 0;
+            order.items.push_back(item);
         }
-    } else if (hasA) {
-        newer = pathA;
-    } else if (hasB) {
-        newer = pathB;
     }
+}
 
-    auto tryLoad = [&](const char* path) -> bool {
-        if (!path) {
-            return false;
+static int skipJsonWhitespace(Stream& in) {
+    while (true) {
+        int c = in.peek();
+        if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+            in.read();
+            continue;
         }
-        File f = LittleFS.open(path, "r");
-        if (!f) {
+        return c;
+    }
+}
+
+// Top-level keys are plain identifiers written by this firmware, so no escape handling is needed.
+static bool readJsonKey(Stream& in, String& key) {
+    if (skipJsonWhitespace(in) != '"') {
+        return false;
+    }
+    in.read();
+    key = String();
+    while (true) {
+        int c = in.read();
+        if (c < 0) {
             return false;
         }
-        size_t loadCapacity = computeSnapshotLoadCapacity(f.size());
-        DynamicJsonDocument doc(loadCapacity);
-        if (doc.capacity() == 0) {
-            Serial.printf("[E] snapshot alloc failed: %s (%u bytes)\n", path, static_cast<unsigned>(loadCapacity));
-            f.close();
-            return false;
+        if (c == '"') {
+            break;
         }
-        DeserializationError err = deserializeJson(doc, f);
-        f.close();
+        key += static_cast<char>(c);
+    }
+    if (skipJsonWhitespace(in) != ':') {
+        return false;
+    }
+    in.read();
+    return true;
+}
+
+// Parses each array element into the same small document so memory tracks the largest
+// element rather than the whole array.
+template <typename Visit>
+static bool forEachJsonArrayElement(Stream& in, JsonDocument& part, uint32_t& records, Visit visit) {
+    if (skipJsonWhitespace(in) != '[') {
+        return false;
+    }
+    in.read();
+    if (skipJsonWhitespace(in) == ']') {
+        in.read();
+        return true;
+    }
+    while (true) {
+        DeserializationError err = deserializeJson(part, in);
         if (err) {
-            Serial.printf("[E] snapshot parse failed: %s (%s)\n", path, err.c_str());
+            Serial.printf("[E] snapshot element parse failed (%s)\n", err.c_str());
             return false;
         }
-        if (!populateStateFromSnapshotDoc(doc, path)) {
-            Serial.printf("[E] snapshot invalid: %s\n", path);
+        visit(part.as<JsonVariantConst>());
+        records++;
+        int c = skipJsonWhitespace(in);
+        in.read();
+        if (c == ']') {
+            return true;
+        }
+        if (c != ',') {
             return false;
         }
-        return true;
-    };
-
-    if (tryLoad(newer)) {
-        return true;
     }
-
-    if (tryLoad(older)) {
-        return true;
-    }
-
-    ensureInitialMenu();
-    return false;
 }
 
-static bool populateStateFromSnapshotDoc(const JsonDocument& doc, const char* sourceLabel) {
-    JsonObjectConst root = doc.as<JsonObjectConst>();
-    if (!root) {
-        Serial.printf("[E] snapshot root invalid: %s\n", sourceLabel);
+// Pre-binary firmware wrote one JSON object; walk its top-level members instead of building a DOM
+// for the whole file, which stopped fitting in RAM once the order list grew.
+static bool loadLegacyJsonSnapshot(const char* path) {
+    if (!path) {
+        return false;
+    }
+    FlashFile f = flashOpen(kFlashSnapshot, path, "r");
+    if (!f) {
         return false;
     }
 
-    JsonObjectConst settings = root["settings"].as<JsonObjectConst>();
-    if (settings) {
-        S().settings.catalogVersion = settings["catalogVersion"] | 1;
-        S().settings.chinchiro.enabled = settings["chinchiro"]["enabled"] | true;
-        S().settings.chinchiro.rounding = settings["chinchiro"]["rounding"] | "round";
+    uint32_t startedMs = millis();
+    size_t fileSize = f.size();
+
+    Settings settings = S().settings;
+    Session session = S().session;
+    PrinterState printer = S().printer;
+    std::vector<MenuItem> menu;
+    std::vector<Order> orders;
+
+    JsonDocument part;
+    uint32_t records = 0;
+    bool valid = skipJsonWhitespace(f) == '{';
+    if (valid) {
+        f.read();
+        valid = skipJsonWhitespace(f) != '}';
+    }
 
-        S().settings.chinchiro.multipliers.clear();
-        JsonArrayConst chinMult = settings["chinchiro"]["multipliers"].as<JsonArrayConst>();
-        if (chinMult) {
-            for (JsonVariantConst v : chinMult) {
-                S().settings.chinchiro.multipliers.push_back(v.as<float>());
+    String key;
+    while (valid) {
+        if (!readJsonKey(f, key)) {
+            valid = false;
+            break;
+        }
+        if (key == "menu") {
+            valid = forEachJsonArrayElement(f, part, records, [&](JsonVariantConst v) {
+                MenuItem item;
+                menuItemFromSnapshotJson(v, item);
+                menu.push_back(item);
+            });
+        } else if (key == "orders") {
+            valid = forEachJsonArrayElement(f, part, records, [&](JsonVariantConst v) {
+                Order order;
+                orderFromSnapshotJson(v, order);
+                orders.push_back(order);
+            });
+        } else {
+            DeserializationError err = deserializeJson(part, f);
+            if (err) {
+                Serial.printf("[E] snapshot parse failed: %s (%s)\n", path, err.c_str());
+                valid = false;
+                break;
             }
+            JsonObjectConst obj = part.as<JsonObjectConst>();
+            if (key == "settings" && obj) {
+                applySnapshotSettingsJson(obj, settings);
+            } else if (key == "session" && obj) {
+                applySnapshotSessionJson(obj, session);
+            } else if (key == "printer" && obj) {
+                applySnapshotPrinterJson(obj, printer);
+            }
+            records++;
+        }
+        if (!valid) {
+            break;
         }
 
-        S().settings.numbering.min = settings["numbering"]["min"] | 1;
-        S().settings.numbering.max = settings["numbering"]["max"] | 9999;
-        S().settings.store.name = settings["store"]["name"] | "KDS BURGER";
-        S().settings.store.nameRomaji = settings["store"]["nameRomaji"] | "KDS BURGER";
-        S().settings.store.registerId = settings["store"]["registerId"] | "REG-01";
-        S().settings.qrPrint.enabled = settings["qrPrint"]["enabled"] | false;
-        S().settings.qrPrint.content = settings["qrPrint"]["content"] | "";
+        int c = skipJsonWhitespace(f);
+        f.read();
+        if (c == '}') {
+            break;
+        }
+        if (c != ',') {
+            valid = false;
+        }
     }
+    f.close();
 
-    JsonObjectConst session = root["session"].as<JsonObjectConst>();
-    if (session) {
-        S().session.sessionId = session["sessionId"] | "";
-        S().session.startedAt = session["startedAt"] | 0;
-        S().session.exported = session["exported"] | false;
-        S().session.nextOrderSeq = session["nextOrderSeq"] | 1;
+    if (!valid) {
+        Serial.printf("[E] snapshot invalid: %s\n", path);
+        return false;
     }
 
-    JsonObjectConst printer = root["printer"].as<JsonObjectConst>();
-    if (printer) {
-        S().printer.paperOut = printer["paperOut"] | false;
-        S().printer.overheat = printer["overheat"] | false;
-        S().printer.holdJobs = printer["holdJobs"] | 0;
+    S().settings = settings;
+    S().session = session;
+    S().printer = printer;
+    S().menu.swap(menu);
+    S().orders.swap(orders);
+    g_loadedCheckpointLsn = 0;
+    g_loadedHasCheckpoint = false;
+    g_loadedHasSalesSummary = false;
+
+    if (S().menu.empty()) {
+        ensureInitialMenu();
     }
+    refreshMenuEtag();
 
-    S().menu.clear();
-    JsonArrayConst menu = root["menu"].as<JsonArrayConst>();
-    if (menu) {
-        for (JsonVariantConst v : menu) {
-            MenuItem item;
-            item.sku = v["sku"] | "";
-            item.name = v["name"] | "";
-            item.nameRomaji = v["nameRomaji"] | "";
-            item.category = v["category"] | "";
-            item.active = v["active"] | true;
-            item.price_normal = v["price_normal"] | 0;
-            item.price_presale = v["price_presale"] | 0;
-            item.presale_discount_amount = v["presale_discount_amount"] | 0;
-            item.price_single = v["price_single"] | 0;
-            item.price_as_side = v["price_as_side"] | 0;
-            S().menu.push_back(item);
-        }
-    }
-
-    S().orders.clear();
-    JsonArrayConst orders = root["orders"].as<JsonArrayConst>();
-    if (orders) {
-        for (JsonVariantConst v : orders) {
-            Order order;
-            bool parsed = orderFromJson(v, order);
-            if (!parsed) {
-                order.orderNo = v["orderNo"] | "";
-                order.status = v["status"] | "";
-                order.ts = v["ts"] | 0;
-                order.printed = v["printed"] | false;
-                order.cancelReason = v["cancelReason"] | "";
-                order.cooked = v["cooked"] | false;
-                order.picked_up = v["picked_up"] | false;
-                order.pickup_called = v["pickup_called"] | false;
-
-                JsonArrayConst items = v["items"].as<JsonArrayConst>();
-                if (items) {
-                    for (JsonVariantConst iv : items) {
-                        LineItem item;
-                        item.sku = iv["sku"] | "";
-                        item.name = iv["name"] | "";
-                        item.qty = iv["qty"] | 1;
-                        item.unitPriceApplied = iv["unitPriceApplied"] | 0;
-                        item.priceMode = iv["priceMode"] | "";
-                        item.kind = iv["kind"] | "";
-                        item.unitPrice = iv["unitPrice"] | 0;
-                        item.discountName = iv["discountName"] | "";
-                        item.discountValue = iv["discountValue"] | 0;
-                        order.items.push_back(item);
-                    }
-                }
-            }
+    g_snapshotStats.loadBytes = fileSize;
+    g_snapshotStats.loadRecords = records;
+    g_snapshotStats.loadDurationMs = millis() - startedMs;
+    g_snapshotStats.loadedLegacyJson = true;
+    Serial.printf("[SNAPSHOT] loaded legacy: %s (%u bytes, %u values, %u ms)\n", path,
+                  static_cast<unsigned>(fileSize), static_cast<unsigned>(records),
+                  static_cast<unsigned>(g_snapshotStats.loadDurationMs));
+    return true;
+}
 
-            S().orders.push_back(order);
+bool snapshotLoad() {
+    const char* ordered[2] = {nullptr, nullptr};
+    int count = listSnapshotsByGeneration(ordered);
+    for (int i = 0; i < count; ++i) {
+        if (loadBinarySnapshot(ordered[i])) {
+            return true;
         }
     }
 
-    if (S().menu.empty()) {
+    // Pre-binary firmware left JSON snapshots behind; load them once, the next save converts.
+    FlashFile fileA = flashOpen(kFlashSnapshot, kLegacySnapshotPathA, "r");
+    FlashFile fileB = flashOpen(kFlashSnapshot, kLegacySnapshotPathB, "r");
+    bool hasA = fileA;
+    bool hasB = fileB;
+    time_t timeA = hasA ? fileA.getLastWrite() : 0;
+    time_t timeB = hasB ? fileB.getLastWrite() : 0;
+    fileA.close();
+    fileB.close();
+
+    if (count == 0 && !hasA && !hasB) {
         ensureInitialMenu();
+        return true;
     }
 
-    refreshMenuEtag();
-    return true;
-}
-
-static bool isWalLogPath(const String& path) {
-    String name = path;
-    int slash = name.lastIndexOf('/');
-    if (slash >= 0) {
-        name = name.substring(slash + 1);
+    const char* newer = nullptr;
+    const char* older = nullptr;
+    if (hasA && hasB) {
+        newer = (timeA >= timeB) ? kLegacySnapshotPathA : kLegacySnapshotPathB;
+        older = (timeA >= timeB) ? kLegacySnapshotPathB : kLegacySnapshotPathA;
+    } else if (hasA) {
+        newer = kLegacySnapshotPathA;
+    } else if (hasB) {
+        newer = kLegacySnapshotPathB;
     }
-    if (name == "wal.log") {
+
+    if (loadLegacyJsonSnapshot(newer)) {
         return true;
     }
-    if (name.startsWith("wal.") && name.endsWith(".log")) {
+    if (loadLegacyJsonSnapshot(older)) {
         return true;
     }
+
+    ensureInitialMenu();
     return false;
 }
 
-static uint32_t walSortKey(const String& path) {
-    String name = path;
-    int slash = name.lastIndexOf('/');
-    if (slash >= 0) {
-        name = name.substring(slash + 1);
-    }
+// Orders whose ticket was queued by a replayed transaction; printed ones are dropped once replay ends.
+static std::vector<String> g_replayPrintOrders;
 
-    if (name == "wal.log") {
-        return 0xFFFFFFFFu;
+// Idempotent: the archive line may already be on flash when the record is replayed.
+static bool redoOrderArchive(const WalRecord& rec, const String& sourceLabel) {
+    String sessionId = rec.sessionId.isEmpty() ? S().session.sessionId : rec.sessionId;
+    uint32_t archivedAt = rec.archivedAt ? rec.archivedAt : rec.ts;
+
+    if (findOrderByNo(rec.orderNo)) {
+        return archiveOrderAndRemove(rec.orderNo, sessionId, archivedAt, false);
+    }
+    if (!rec.hasOrder) {
+        Serial.printf("[E] wal archive missing payload (%s)\n", sourceLabel.c_str());
+        return false;
     }
-    if (name.startsWith("wal.") && name.endsWith(".log")) {
-        String tsPart = name.substring(4, name.length() - 4);
-        uint32_t value = static_cast<uint32_t>(strtoul(tsPart.c_str(), nullptr, 10));
-        return value;
+    if (!archiveOrderExists(sessionId, rec.orderNo)) {
+        return archiveAppend(rec.order, sessionId, archivedAt);
     }
-    return 0xFFFFFFFEu;
+    return true;
 }
 
-static std::vector<String> listWalFilesForRecovery() {
-    std::vector<String> result;
-    File dir = LittleFS.open("/kds");
-    if (!dir) {
-        return result;
+// Applies a transaction the way replay finds it in the WAL; commitOrderCreate() uses it live too.
+// commitOrderPickup() splits it instead, so the archive line is written only once the record is durable.
+static bool applyOrderTxn(const WalRecord& rec, bool replaying) {
+    if (!rec.hasOrder) {
+        return false;
     }
+    const Order& order = rec.order;
 
-    while (true) {
-        File file = dir.openNextFile();
-        if (!file) {
-            break;
-        }
-
-        String fname = String(file.name());
-        file.close();
-        if (fname.length() == 0) {
-            continue;
-        }
-
-        if (!fname.startsWith("/")) {
-            fname = String("/kds/") + fname;
+    if (rec.effects & kWalTxnCreate) {
+        Order* existing = findOrderByNo(order.orderNo);
+        if (existing) {
+            *existing = order;
+        } else {
+            S().orders.push_back(order);
+            if (!replaying) {
+                markOrderNoUsed(order.orderNo);
+            }
+            if ((rec.effects & kWalTxnSummary) && (!replaying || g_loadedHasSalesSummary)) {
+                addNewOrderToSummary(order, rec.ts);
+            }
         }
+    }
 
-        if (isWalLogPath(fname)) {
-            result.push_back(fname);
+    if (rec.effects & kWalTxnState) {
+        Order* target = findOrderByNo(order.orderNo);
+        if (target) {
+            target->status = order.status;
+            target->cooked = order.cooked;
+            target->pickup_called = order.pickup_called;
+            target->picked_up = order.picked_up;
+            target->printed = order.printed;
         }
     }
 
-    dir.close();
+    bool ok = true;
+    if (rec.effects & kWalTxnArchive) {
+        ok = redoOrderArchive(rec, replaying ? String("replay") : String("live"));
+    }
 
-    std::sort(result.begin(), result.end(), [](const String& a, const String& b) {
-        uint32_t ka = walSortKey(a);
-        uint32_t kb = walSortKey(b);
-        if (ka == kb) {
-            return a.compareTo(b) < 0;
+    if ((rec.effects & kWalTxnPrint) && !order.printed) {
+        if (replaying) {
+            g_replayPrintOrders.push_back(order.orderNo);
+        } else {
+            enqueuePrint(order);
         }
-        return ka < kb;
-    });
-
-    return result;
+    }
+    return ok;
 }
 
-static void applyWalEntriesFromStream(File& walFile, const String& sourceLabel, String& lastTimestamp, int& entriesApplied) {
-    while (walFile.available()) {
-        String line = walFile.readStringUntil('\n');
-        line.trim();
-        if (line.length() == 0) {
-            continue;
-        }
-
-        DynamicJsonDocument doc(8192);
-        DeserializationError error = deserializeJson(doc, line);
-        if (error) {
-            Serial.printf("[E] wal parse failed (%s): %s\n", sourceLabel.c_str(), error.c_str());
-            continue;
-        }
+bool commitOrderCreate(const Order& order, uint32_t* ticket) {
+    WalRecord txn;
+    txn.action = kWalOrderTxn;
+    txn.effects = kWalTxnCreate | kWalTxnSummary | kWalTxnPrint;
+    txn.ts = static_cast<uint32_t>(time(nullptr));
+    txn.orderNo = order.orderNo;
+    txn.order = order;
+    txn.hasOrder = true;
+
+    applyOrderTxn(txn, false);
+    if (!walAppend(txn, ticket)) {
+        Serial.printf("[E] create txn not logged: %s\n", order.orderNo.c_str());
+        return false;
+    }
+    return true;
+}
 
-        uint32_t ts = doc["ts"] | 0;
-        String action = doc["action"] | doc["type"] | "";
-        if (action.isEmpty()) {
-            Serial.printf("[E] wal missing action (%s)\n", sourceLabel.c_str());
-            continue;
-        }
+// Puts an order taken out by commitOrderPickup() back where it was.
+static void restorePickedOrder(const Order& order, size_t index) {
+    index = std::min(index, S().orders.size());
+    S().orders.insert(S().orders.begin() + index, order);
+    markOrderNoUsed(order.orderNo);
+}
 
-        lastTimestamp = String(ts);
-        bool appliedEntry = false;
+bool commitOrderPickup(const String& orderNo, const String& status, uint32_t* ticket) {
+    size_t index = 0;
+    while (index < S().orders.size() && S().orders[index].orderNo != orderNo) {
+        ++index;
+    }
+    if (index == S().orders.size()) {
+        return false;
+    }
+    Order previous = S().orders[index];
+    Order& target = S().orders[index];
+    if (!status.isEmpty()) {
+        target.status = status;
+    }
+    target.picked_up = true;
+    target.pickup_called = false;
+
+    WalRecord txn;
+    txn.action = kWalOrderTxn;
+    txn.effects = kWalTxnState | kWalTxnArchive;
+    txn.ts = static_cast<uint32_t>(time(nullptr));
+    txn.orderNo = orderNo;
+    txn.order = target;
+    txn.hasOrder = true;
+    txn.sessionId = S().session.sessionId;
+    txn.archivedAt = txn.ts;
+
+    // S() changes before the record is logged, like every other mutation, so a snapshot whose
+    // checkpoint covers the record never still holds the order as active.
+    S().orders.erase(S().orders.begin() + index);
+    releaseOrderNo(orderNo);
 
-        if (action == "ORDER_CREATE") {
-            Order restored;
-            bool parsed = false;
-            if (doc["order"].is<JsonObject>()) {
-                parsed = orderFromJson(doc["order"], restored);
-            }
-            if (!parsed) {
-                restored.orderNo = doc["orderNo"] | String("");
-                if (!restored.orderNo.isEmpty() && doc["items"].is<JsonArrayConst>()) {
-                    restored.status = doc["status"] | String("PENDING");
-                    restored.ts = doc["orderTs"] | (uint32_t)(doc["ts"] | 0);
-                    restored.printed = doc["printed"] | false;
-                    restored.cooked = doc["cooked"] | false;
-                    restored.pickup_called = doc["pickup_called"] | false;
-                    restored.picked_up = doc["picked_up"] | false;
-                    restored.cancelReason = doc["cancelReason"] | String("");
-                    restored.items.clear();
-                    for (JsonVariantConst itemVar : doc["items"].as<JsonArrayConst>()) {
-                        if (!itemVar.is<JsonObjectConst>()) {
-                            continue;
-                        }
-                        JsonObjectConst itemObj = itemVar.as<JsonObjectConst>();
-                        LineItem item;
-                        item.sku = itemObj["sku"] | String("");
-                        item.name = itemObj["name"] | String("");
-                        item.qty = itemObj["qty"] | 1;
-                        item.unitPriceApplied = itemObj["unitPriceApplied"] | 0;
-                        item.priceMode = itemObj["priceMode"] | String("");
-                        item.kind = itemObj["kind"] | String("");
-                        item.unitPrice = itemObj["unitPrice"] | 0;
-                        item.discountName = itemObj["discountName"] | String("");
-                        item.discountValue = itemObj["discountValue"] | 0;
-                        restored.items.push_back(item);
-                    }
-                    parsed = !restored.items.empty();
-                }
-            }
+    WalTicket committed = 0;
+    if (!walAppend(txn, &committed)) {
+        // Refused outright, so nothing will ever replay it: undo the pickup.
+        Serial.printf("[E] pickup txn not logged: %s\n", orderNo.c_str());
+        restorePickedOrder(previous, index);
+        return false;
+    }
+    if (ticket) {
+        *ticket = committed;
+    }
+    // Write-ahead: the archive line may only reach flash once the record that redoes it has.
+    if (!walWaitDurable(committed) || !redoOrderArchive(txn, "live")) {
+        // The record is logged, and if not yet durable it can still go out with a later group
+        // commit, so the pickup stands. Keep the order, picked up, rather than lose it: a
+        // snapshot then holds it and a retried pickup archives it, and until then replaying the
+        // record redoes the archive.
+        Serial.printf("[E] pickup archive deferred: %s\n", orderNo.c_str());
+        restorePickedOrder(txn.order, index);
+        return false;
+    }
+    return true;
+}
 
-            if (!parsed) {
+static bool applyWalRecord(const WalRecord& rec, const String& sourceLabel) {
+    switch (rec.action) {
+        case kWalOrderCreate: {
+            if (!rec.hasOrder) {
                 Serial.printf("[E] wal create payload missing (%s)\n", sourceLabel.c_str());
-                continue;
+                return false;
             }
-
-            Order* existing = findOrderByNo(restored.orderNo);
+            Order* existing = findOrderByNo(rec.order.orderNo);
             if (existing) {
-                *existing = restored;
+                *existing = rec.order;
             } else {
-                S().orders.push_back(restored);
-            }
-            appliedEntry = true;
-
-        } else if (action == "ORDER_UPDATE") {
-            String orderNo = doc["orderNo"] | "";
-            if (!orderNo.isEmpty()) {
-                Order* target = findOrderByNo(orderNo);
-                if (target) {
-                    String status = doc["status"] | String(target->status);
-                    target->status = status;
-                    if (doc["cooked"].is<bool>()) target->cooked = doc["cooked"];
-                    if (doc["pickup_called"].is<bool>()) target->pickup_called = doc["pickup_called"];
-                    if (doc["picked_up"].is<bool>()) target->picked_up = doc["picked_up"];
-                    if (doc["printed"].is<bool>()) target->printed = doc["printed"];
-                    appliedEntry = true;
+                S().orders.push_back(rec.order);
+                if (g_loadedHasSalesSummary) {
+                    addNewOrderToSummary(rec.order, rec.ts);
                 }
             }
+            return true;
+        }
 
-        } else if (action == "ORDER_CANCEL") {
-            String orderNo = doc["orderNo"] | "";
-            Order* target = orderNo.isEmpty() ? nullptr : findOrderByNo(orderNo);
-            if (target) {
-                target->status = "CANCELLED";
-                target->cancelReason = doc["cancelReason"] | String("");
-                target->cooked = false;
-                target->pickup_called = false;
-                target->picked_up = false;
-                appliedEntry = true;
+        case kWalOrderUpdate: {
+            Order* target = rec.orderNo.isEmpty() ? nullptr : findOrderByNo(rec.orderNo);
+            if (!target) {
+                return false;
             }
-
-        } else if (action == "ORDER_COOKED") {
-            String orderNo = doc["orderNo"] | "";
-            Order* target = orderNo.isEmpty() ? nullptr : findOrderByNo(orderNo);
-            if (target) {
-                target->cooked = true;
-                target->pickup_called = true;
-                appliedEntry = true;
+            if (!rec.status.isEmpty()) {
+                target->status = rec.status;
             }
+            target->cooked = rec.cooked;
+            target->pickup_called = rec.pickupCalled;
+            target->picked_up = rec.pickedUp;
+            target->printed = rec.printed;
+            return true;
+        }
 
-        } else if (action == "ORDER_PICKED") {
-            String orderNo = doc["orderNo"] | "";
-            Order* target = orderNo.isEmpty() ? nullptr : findOrderByNo(orderNo);
-            if (target) {
-                target->picked_up = true;
-                target->pickup_called = false;
-                appliedEntry = true;
+        case kWalOrderCancel: {
+            Order* target = rec.orderNo.isEmpty() ? nullptr : findOrderByNo(rec.orderNo);
+            if (!target) {
+                // The archive line was amended before logging; only the summary still needs the delta.
+                Order archived;
+                if (!rec.archived || !archiveFindOrder(S().session.sessionId, rec.orderNo, archived)) {
+                    return false;
+                }
+                if (g_loadedHasSalesSummary) {
+                    addCancellationToSummary(archived, rec.ts, true);
+                }
+                return true;
             }
-
-        } else if (action == "ORDER_ARCHIVE") {
-            String orderNo = doc["orderNo"] | "";
-            if (orderNo.isEmpty()) {
-                Serial.printf("[E] wal archive missing orderNo (%s)\n", sourceLabel.c_str());
-                continue;
+            if (g_loadedHasSalesSummary && target->status != "CANCELLED") {
+                addCancellationToSummary(*target, rec.ts, true);
             }
+            target->status = "CANCELLED";
+            target->cancelReason = rec.cancelReason;
+            target->cooked = false;
+            target->pickup_called = false;
+            target->picked_up = false;
+            return true;
+        }
 
-            String sessionId = doc["sessionId"] | String("");
-            if (sessionId.isEmpty()) {
-                sessionId = S().session.sessionId;
+        case kWalOrderCooked: {
+            Order* target = rec.orderNo.isEmpty() ? nullptr : findOrderByNo(rec.orderNo);
+            if (!target) {
+                return false;
             }
-            uint32_t archivedAt = doc["archivedAt"] | ts;
-
-            Order* target = findOrderByNo(orderNo);
-            Order payload;
-            bool hasPayload = false;
-            if (target) {
-                payload = *target;
-                hasPayload = true;
-            } else if (doc["order"].is<JsonObjectConst>()) {
-                hasPayload = orderFromJson(doc["order"], payload);
+            target->cooked = true;
+            target->pickup_called = true;
+            return true;
+        }
+
+        case kWalOrderPicked: {
+            Order* target = rec.orderNo.isEmpty() ? nullptr : findOrderByNo(rec.orderNo);
+            if (!target) {
+                return false;
             }
+            target->picked_up = true;
+            target->pickup_called = false;
+            return true;
+        }
 
-            if (!hasPayload) {
-                Serial.printf("[E] wal archive missing payload (%s)\n", sourceLabel.c_str());
-                continue;
+        case kWalOrderPrinted: {
+            Order* target = rec.orderNo.isEmpty() ? nullptr : findOrderByNo(rec.orderNo);
+            if (!target) {
+                return false;
             }
+            target->printed = true;
+            return true;
+        }
 
-            if (target) {
-                archiveOrderAndRemove(orderNo, sessionId, archivedAt, false);
-            } else if (!archiveOrderExists(sessionId, orderNo)) {
-                archiveAppend(payload, sessionId, archivedAt);
+        case kWalOrderArchive:
+            if (rec.orderNo.isEmpty()) {
+                Serial.printf("[E] wal archive missing orderNo (%s)\n", sourceLabel.c_str());
+                return false;
             }
-            appliedEntry = true;
+            return redoOrderArchive(rec, sourceLabel);
+
+        case kWalOrderTxn:
+            return applyOrderTxn(rec, true);
 
-        } else if (action == "SETTINGS_UPDATE") {
-            if (doc["chinchiro"].is<JsonObject>()) {
-                S().settings.chinchiro.enabled = doc["chinchiro"]["enabled"] | S().settings.chinchiro.enabled;
-                S().settings.chinchiro.rounding = doc["chinchiro"]["rounding"] | S().settings.chinchiro.rounding;
+        case kWalSettingsUpdate:
+            if (rec.settingsMask & kWalSettingsChinchiro) {
+                S().settings.chinchiro.enabled = rec.settings.chinchiro.enabled;
+                S().settings.chinchiro.rounding = rec.settings.chinchiro.rounding;
             }
-            if (doc["qrPrint"].is<JsonObject>()) {
-                S().settings.qrPrint.enabled = doc["qrPrint"]["enabled"] | S().settings.qrPrint.enabled;
-                S().settings.qrPrint.content = doc["qrPrint"]["content"] | S().settings.qrPrint.content;
+            if (rec.settingsMask & kWalSettingsQrPrint) {
+                S().settings.qrPrint.enabled = rec.settings.qrPrint.enabled;
+                S().settings.qrPrint.content = rec.settings.qrPrint.content;
             }
-            if (doc["store"].is<JsonObject>()) {
-                S().settings.store.name = doc["store"]["name"] | S().settings.store.name;
-                S().settings.store.nameRomaji = doc["store"]["nameRomaji"] | S().settings.store.nameRomaji;
-                S().settings.store.registerId = doc["store"]["registerId"] | S().settings.store.registerId;
+            if (rec.settingsMask & kWalSettingsStore) {
+                S().settings.store.name = rec.settings.store.name;
+                S().settings.store.nameRomaji = rec.settings.store.nameRomaji;
+                S().settings.store.registerId = rec.settings.store.registerId;
             }
-            appliedEntry = true;
-
-        } else if (action == "MAIN_UPSERT" || action == "SIDE_UPSERT") {
-            String sku = doc["sku"] | "";
-            if (!sku.isEmpty()) {
-                MenuItem* existing = nullptr;
-                for (auto& m : S().menu) {
-                    if (m.sku == sku) {
-                        existing = &m;
-                        break;
-                    }
-                }
+            return true;
 
-                if (existing) {
-                    existing->name = doc["name"] | existing->name;
-                    existing->nameRomaji = doc["nameRomaji"] | existing->nameRomaji;
-                    existing->active = doc["active"] | existing->active;
-                    if (action == "MAIN_UPSERT") {
-                        existing->price_normal = doc["price_normal"] | existing->price_normal;
-                        existing->presale_discount_amount = doc["presale_discount_amount"] | existing->presale_discount_amount;
-                    } else {
-                        existing->price_single = doc["price_single"] | existing->price_single;
-                        existing->price_as_side = doc["price_as_side"] | existing->price_as_side;
-                    }
+        case kWalMainUpsert:
+        case kWalSideUpsert: {
+            if (rec.item.sku.isEmpty()) {
+                return false;
+            }
+            bool isMain = rec.action == kWalMainUpsert;
+            MenuItem* existing = findMenuItemBySku(rec.item.sku);
+
+            if (existing) {
+                existing->name = rec.item.name;
+                existing->nameRomaji = rec.item.nameRomaji;
+                existing->active = rec.item.active;
+                if (isMain) {
+                    existing->price_normal = rec.item.price_normal;
+                    existing->presale_discount_amount = rec.item.presale_discount_amount;
                 } else {
-                    MenuItem newItem;
-                    newItem.sku = sku;
-                    newItem.name = doc["name"] | "";
-                    newItem.nameRomaji = doc["nameRomaji"] | "";
-                    newItem.category = (action == "MAIN_UPSERT") ? "MAIN" : "SIDE";
-                    newItem.active = doc["active"] | true;
-                    if (action == "MAIN_UPSERT") {
-                        newItem.price_normal = doc["price_normal"] | 0;
-                        newItem.presale_discount_amount = doc["presale_discount_amount"] | 0;
-                    } else {
-                        newItem.price_single = doc["price_single"] | 0;
-                        newItem.price_as_side = doc["price_as_side"] | 0;
-                    }
-                    S().menu.push_back(newItem);
+                    existing->price_single = rec.item.price_single;
+                    existing->price_as_side = rec.item.price_as_side;
                 }
-                uint32_t walCatalog = doc["catalogVersion"] | static_cast<uint32_t>(0);
-                if (walCatalog > 0) {
-                    S().settings.catalogVersion = walCatalog;
-                }
-                refreshMenuEtag();
-                appliedEntry = true;
+            } else {
+                MenuItem newItem = rec.item;
+                newItem.category = isMain ? "MAIN" : "SIDE";
+                S().menu.push_back(newItem);
+                noteMenuItemAdded();
             }
+            if (rec.catalogVersion > 0) {
+                S().settings.catalogVersion = rec.catalogVersion;
+            }
+            refreshMenuEtag();
+            return true;
         }
 
-        if (appliedEntry) {
-            entriesApplied++;
-        }
+        default:
+            return false;
     }
 }
 
-bool walAppend(const String& line) {
-    if (!ensureDataDir()) {
-        return false;
+struct WalReplayContext {
+    const WalReplayCursor* cursor{nullptr};
+    uint32_t lastTs{0};
+    uint32_t entriesSeen{0};
+    uint32_t entriesApplied{0};
+};
+
+static WalReplayCursor g_recoveryCursor;
+static WalReplayContext g_recoveryContext;
+static RecoveryStatus g_recoveryStatus;
+static volatile bool g_recoveryInProgress = false;
+
+static bool replayWalRecord(const WalRecord& rec, void* rawCtx) {
+    auto* ctx = static_cast<WalReplayContext*>(rawCtx);
+    ctx->lastTs = rec.ts;
+    ctx->entriesSeen++;
+    const String& label = ctx->cursor->segments[ctx->cursor->segment];
+    if (applyWalRecord(rec, label)) {
+        ctx->entriesApplied++;
     }
-    
-    const char* walPath = "/kds/wal.log";
+    return true;
+}
 
-    if (!LittleFS.exists(walPath)) {
-        File create = LittleFS.open(walPath, FILE_WRITE);
-        if (!create) {
-            Serial.printf("[E] wal create failed: %s\n", walPath);
-            return false;
-        }
-        create.close();
+bool isRecoveryInProgress() {
+    return g_recoveryInProgress;
+}
+
+RecoveryStatus getRecoveryStatus() {
+    RecoveryStatus status = g_recoveryStatus;
+    status.inProgress = g_recoveryInProgress;
+    if (status.inProgress) {
+        status.durationMs = millis() - status.startedMs;
     }
+    return status;
+}
 
-    File file = LittleFS.open(walPath, FILE_APPEND);
-    if (!file) {
-        Serial.printf("[E] wal append open failed: %s\n", walPath);
+bool beginRecovery() {
+    StateLock state;
+    g_recoveryStatus = RecoveryStatus();
+    g_recoveryStatus.startedMs = millis();
+    g_recoveryInProgress = true;
+    g_loadedHasSalesSummary = false;
+    resetSalesSummary();
+    invalidateOrderNoMap();
+    invalidateSkuIndex();
+    g_replayPrintOrders.clear();
+
+    if (!snapshotLoad()) {
+        Serial.println("[E] recover snapshot load failed");
+        g_recoveryStatus.snapshotFailed = true;
+    }
+    // Pruning may have removed every segment the WAL seeds its counter from; new records must
+    // still land above any checkpoint, or the next boot would skip them.
+    walAdvanceLsn(newestSnapshotCheckpoint());
+
+    // Only records after the snapshot's checkpoint are missing from it; without a checkpoint
+    // (legacy snapshot) everything is replayed as before.
+    WalTicket fromLsn = g_loadedHasCheckpoint ? g_loadedCheckpointLsn + 1 : 0;
+    walReplayBegin(g_recoveryCursor, fromLsn);
+    g_recoveryContext = WalReplayContext();
+    g_recoveryContext.cursor = &g_recoveryCursor;
+    g_recoveryStatus.fromLsn = fromLsn;
+    g_recoveryStatus.segmentsTotal = g_recoveryCursor.segments.size();
+    return !g_recoveryStatus.snapshotFailed;
+}
+
+bool stepRecovery(uint32_t budgetMs) {
+    if (!g_recoveryInProgress) {
+        return true;
+    }
+    // Replay rewrites S().orders from loop(); one slice at a time, like any other mutation.
+    StateLock state;
+
+    bool finished = walReplayStep(g_recoveryCursor, replayWalRecord, &g_recoveryContext, budgetMs);
+    g_recoveryStatus.steps++;
+    g_recoveryStatus.segmentsDone = g_recoveryCursor.segment;
+    g_recoveryStatus.recordsApplied = g_recoveryContext.entriesApplied;
+    g_recoveryStatus.recordsSeen = g_recoveryContext.entriesSeen;
+    g_recoveryStatus.recordsSkipped = g_recoveryCursor.skippedRecords;
+    g_recoveryStatus.lastTs = g_recoveryContext.lastTs;
+    if (!finished) {
         return false;
     }
 
-    size_t written = file.println(line);
-    file.flush();
-    file.close();
-    if (written == 0) {
-        Serial.println("[E] wal append write failed");
-        return false;
+    // Without a summary record in the snapshot there was no base to replay deltas onto.
+    if (!g_loadedHasSalesSummary && !recalculateSalesSummary()) {
+        Serial.println("[E] recover sales summary failed");
+    }
+    if (g_recoveryContext.entriesApplied > 0) {
+        refreshMenuEtag();
     }
+    // Tickets queued before the power cut that never printed (or were not logged as printed).
+    for (const String& orderNo : g_replayPrintOrders) {
+        const Order* order = findOrderByNo(orderNo);
+        if (order && !order->printed && order->status != "CANCELLED") {
+            enqueuePrint(*order);
+        }
+    }
+    g_replayPrintOrders.clear();
+    invalidateOrderNoMap();
+    invalidateSkuIndex();
+    g_recoveryStatus.durationMs = millis() - g_recoveryStatus.startedMs;
+    g_recoveryStatus.completed = true;
+    g_recoveryInProgress = false;
+
+    // Fold the replayed tail into a fresh checkpoint so the next boot starts after it.
+    if (g_recoveryContext.entriesApplied > 0) {
+        requestSnapshotSave();
+    }
+
+    Serial.printf("[RECOVER] from lsn=%u: %u/%u segments, %u applied, %u skipped, %u steps, %u ms\n",
+                  static_cast<unsigned>(g_recoveryStatus.fromLsn),
+                  static_cast<unsigned>(g_recoveryStatus.segmentsTotal - g_recoveryCursor.skippedSegments),
+                  static_cast<unsigned>(g_recoveryStatus.segmentsTotal),
+                  static_cast<unsigned>(g_recoveryStatus.recordsApplied),
+                  static_cast<unsigned>(g_recoveryStatus.recordsSkipped),
+                  static_cast<unsigned>(g_recoveryStatus.steps),
+                  static_cast<unsigned>(g_recoveryStatus.durationMs));
     return true;
 }
 
 bool recoverToLatest(String &outLastTs) {
-    if (!snapshotLoad()) {
+    walFlush();
+    if (!beginRecovery()) {
+        g_recoveryInProgress = false;
         outLastTs = "snapshot load failed";
-        Serial.println("[E] recover snapshot load failed");
         return false;
     }
+    bool snapshotOnly = g_recoveryCursor.segments.empty();
+    stepRecovery(0);
 
-    std::vector<String> walFiles = listWalFilesForRecovery();
-    if (walFiles.empty()) {
+    if (snapshotOnly) {
         outLastTs = "snapshot only";
-        return true;
-    }
-
-    int entriesApplied = 0;
-    String lastTimestamp = "";
-
-    for (const String& walPath : walFiles) {
-        File walFile = LittleFS.open(walPath, "r");
-        if (!walFile) {
-            Serial.printf("[E] recover wal open failed: %s\n", walPath.c_str());
-            continue;
-        }
-        applyWalEntriesFromStream(walFile, walPath, lastTimestamp, entriesApplied);
-        walFile.close();
-    }
-
-    if (lastTimestamp.length() > 0) {
-        uint32_t ts = lastTimestamp.toInt();
+    } else if (g_recoveryContext.entriesSeen > 0) {
+        uint32_t ts = g_recoveryContext.lastTs;
         if (ts > 1000000000) { // epoch time
-            struct tm* timeinfo = localtime((time_t*)&ts);
+            time_t when = static_cast<time_t>(ts);
+            struct tm* timeinfo = localtime(&when);
             char buffer[32];
             strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
             outLastTs = String(buffer);
@@ -1533,9 +2837,6 @@ bool recoverToLatest(String &outLastTs) {
         outLastTs = "no WAL entries";
     }
 
-    if (!recalculateSalesSummary()) {
-        Serial.println("[E] recover sales summary failed");
-    }
     refreshMenuEtag();
     
     Serial.println("[RECOVER] ok");
@@ -1544,6 +2845,7 @@ bool recoverToLatest(String &outLastTs) {
 
 void forceCreateInitialMenu() {
     S().menu.clear();
+    invalidateSkuIndex();
     createInitialMenuItems();
 }
 
@@ -1632,47 +2934,11 @@ void ensureInitialMenu() {
     snapshotSave();
 }
 
-bool getLatestSnapshotJson(String& outJson, String& outPath) {
-    const char* pathA = "/kds/snapA.json";
-    const char* pathB = "/kds/snapB.json";
-
-    File fileA = LittleFS.open(pathA, "r");
-    File fileB = LittleFS.open(pathB, "r");
-
-    bool hasA = fileA;
-    bool hasB = fileB;
-    time_t timeA = hasA ? fileA.getLastWrite() : 0;
-    time_t timeB = hasB ? fileB.getLastWrite() : 0;
-
-    const char* target = nullptr;
-    if (hasA && hasB) {
-        target = (timeA >= timeB) ? pathA : pathB;
-    } else if (hasA) {
-        target = pathA;
-    } else if (hasB) {
-        target = pathB;
-    }
-
-    fileA.close();
-    fileB.close();
-
-    if (!target) {
+bool getLatestSnapshotPath(String& outPath) {
+    const char* ordered[2] = {nullptr, nullptr};
+    if (listSnapshotsByGeneration(ordered) == 0) {
         return false;
     }
-
-    File snapshot = LittleFS.open(target, "r");
-    if (!snapshot) {
-        return false;
-    }
-
-    size_t size = snapshot.size();
-    outJson = "";
-    outJson.reserve(size + 1);
-    while (snapshot.available()) {
-        outJson += static_cast<char>(snapshot.read());
-    }
-    snapshot.close();
-
-    outPath = target;
+    outPath = ordered[0];
     return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1070 @@
+#include "wal.h"
+#include "esp_partition_flash.h"
+#include "flash_stats.h"
+#include "json_arena.h"
+#include "record_codec.h"
+#include "wal_ring.h"
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+static const char* kWalDir = "/kds";
+static const char* kWalLivePath = "/kds/wal.bin";
+// Stands for the raw partition in segment lists; there is no such file.
+static const char* kWalRingPath = "/kds/wal.ring";
+static const size_t kWalGroupBytes = 4096;
+static const uint32_t kWalGroupWindowMs = 20;
+static const size_t kWalKeepRotated = 2;
+
+// Frame: magic(u8) action(u8) payloadLen(u16) lsn(u32) ts(u32) payload crc32(u32).
+// The CRC covers header and payload, so a torn tail fails the check instead of parsing as garbage.
+static const uint8_t kWalFrameMagic = 0xA5;
+static const size_t kWalFrameHeaderSize = 12;
+static const size_t kWalFrameTrailerSize = 4;
+static const size_t kWalMaxPayload = 16 * 1024;
+// A ring entry never spans pages, so one frame has to fit in a single entry.
+static const size_t kWalRingMaxPayload = kWalRingMaxEntry - kWalFrameHeaderSize - kWalFrameTrailerSize;
+// Ask for a snapshot (which releases old pages) once this share of the ring is live.
+static const uint32_t kWalRingSnapshotPercent = 75;
+
+static SemaphoreHandle_t g_walMutex = nullptr;
+static FlashFile g_walFile;
+static std::vector<uint8_t> g_walBuffer;
+static uint32_t g_walOldestPendingMs = 0;
+static WalTicket g_walLastLsn = 0;
+static WalTicket g_walDurableLsn = 0;
+// Last LSN of a live segment with a torn tail that still has to be renamed; 0 when none.
+static WalTicket g_walTornSegmentLsn = 0;
+static WalStats g_walStats;
+// Set by walBegin() when KDS_WAL_RAW_PARTITION found and mounted the partition.
+static WalRing* g_walRing = nullptr;
+
+// HTTP handlers append from the AsyncTCP task while loop() commits and rotates.
+class WalLock {
+public:
+    WalLock() {
+        if (!g_walMutex) {
+            g_walMutex = xSemaphoreCreateMutex();
+        }
+        xSemaphoreTake(g_walMutex, portMAX_DELAY);
+    }
+    ~WalLock() { xSemaphoreGive(g_walMutex); }
+};
+
+static void putLe16(uint8_t* out, uint16_t v) {
+    out[0] = static_cast<uint8_t>(v);
+    out[1] = static_cast<uint8_t>(v >> 8);
+}
+
+static void putLe32(uint8_t* out, uint32_t v) {
+    out[0] = static_cast<uint8_t>(v);
+    out[1] = static_cast<uint8_t>(v >> 8);
+    out[2] = static_cast<uint8_t>(v >> 16);
+    out[3] = static_cast<uint8_t>(v >> 24);
+}
+
+static uint32_t getLe32(const uint8_t* in) {
+    return static_cast<uint32_t>(in[0]) |
+           (static_cast<uint32_t>(in[1]) << 8) |
+           (static_cast<uint32_t>(in[2]) << 16) |
+           (static_cast<uint32_t>(in[3]) << 24);
+}
+
+enum : uint8_t {
+    kWalFlagCooked = 0x01,
+    kWalFlagPickupCalled = 0x02,
+    kWalFlagPickedUp = 0x04,
+    kWalFlagPrinted = 0x08,
+};
+
+static void encodeWalPayload(RecordWriter& w, const WalRecord& rec) {
+    switch (rec.action) {
+        case kWalOrderCreate:
+            encodeOrder(w, rec.order);
+            break;
+        case kWalOrderUpdate: {
+            uint8_t flags = 0;
+            if (rec.cooked) flags |= kWalFlagCooked;
+            if (rec.pickupCalled) flags |= kWalFlagPickupCalled;
+            if (rec.pickedUp) flags |= kWalFlagPickedUp;
+            if (rec.printed) flags |= kWalFlagPrinted;
+            w.putString(rec.orderNo);
+            w.putString(rec.status);
+            w.putU8(flags);
+            break;
+        }
+        case kWalOrderCancel:
+            w.putString(rec.orderNo);
+            w.putString(rec.cancelReason);
+            w.putBool(rec.archived);
+            break;
+        case kWalOrderCooked:
+        case kWalOrderPicked:
+        case kWalOrderPrinted:
+            w.putString(rec.orderNo);
+            break;
+        case kWalOrderTxn:
+            w.putU8(rec.effects);
+            if (rec.effects & kWalTxnArchive) {
+                w.putString(rec.sessionId);
+                w.putVarU32(rec.archivedAt);
+            }
+            encodeOrder(w, rec.order);
+            break;
+        case kWalOrderArchive:
+            w.putString(rec.orderNo);
+            w.putString(rec.sessionId);
+            w.putVarU32(rec.archivedAt);
+            w.putBool(rec.hasOrder);
+            if (rec.hasOrder) {
+                encodeOrder(w, rec.order);
+            }
+            break;
+        case kWalSettingsUpdate:
+            w.putU8(rec.settingsMask);
+            if (rec.settingsMask & kWalSettingsChinchiro) {
+                w.putBool(rec.settings.chinchiro.enabled);
+                w.putString(rec.settings.chinchiro.rounding);
+            }
+            if (rec.settingsMask & kWalSettingsQrPrint) {
+                w.putBool(rec.settings.qrPrint.enabled);
+                w.putString(rec.settings.qrPrint.content);
+            }
+            if (rec.settingsMask & kWalSettingsStore) {
+                w.putString(rec.settings.store.name);
+                w.putString(rec.settings.store.nameRomaji);
+                w.putString(rec.settings.store.registerId);
+            }
+            break;
+        case kWalMainUpsert:
+        case kWalSideUpsert:
+            encodeMenuItem(w, rec.item);
+            w.putVarU32(rec.catalogVersion);
+            break;
+        case kWalSessionEnd:
+        case kWalSystemReset:
+            break;
+    }
+}
+
+// Returns false only for a payload that does not match its action; unknown actions decode as
+// empty so newer logs can still be replayed past them.
+static bool decodeWalPayload(RecordReader& r, WalRecord& rec) {
+    switch (rec.action) {
+        case kWalOrderCreate:
+            rec.hasOrder = decodeOrder(r, rec.order);
+            rec.orderNo = rec.order.orderNo;
+            return rec.hasOrder;
+        case kWalOrderUpdate: {
+            r.getString(rec.orderNo);
+            r.getString(rec.status);
+            uint8_t flags = r.getU8();
+            rec.cooked = (flags & kWalFlagCooked) != 0;
+            rec.pickupCalled = (flags & kWalFlagPickupCalled) != 0;
+            rec.pickedUp = (flags & kWalFlagPickedUp) != 0;
+            rec.printed = (flags & kWalFlagPrinted) != 0;
+            return r.ok();
+        }
+        case kWalOrderCancel:
+            r.getString(rec.orderNo);
+            r.getString(rec.cancelReason);
+            rec.archived = r.getBool();
+            return r.ok();
+        case kWalOrderCooked:
+        case kWalOrderPicked:
+        case kWalOrderPrinted:
+            r.getString(rec.orderNo);
+            return r.ok();
+        case kWalOrderTxn:
+            rec.effects = r.getU8();
+            if (rec.effects & kWalTxnArchive) {
+                r.getString(rec.sessionId);
+                rec.archivedAt = r.getVarU32();
+            }
+            rec.hasOrder = decodeOrder(r, rec.order);
+            rec.orderNo = rec.order.orderNo;
+            return rec.hasOrder && r.ok();
+        case kWalOrderArchive:
+            r.getString(rec.orderNo);
+            r.getString(rec.sessionId);
+            rec.archivedAt = r.getVarU32();
+            rec.hasOrder = r.getBool();
+            if (rec.hasOrder) {
+                rec.hasOrder = decodeOrder(r, rec.order);
+            }
+            return r.ok();
+        case kWalSettingsUpdate:
+            rec.settingsMask = r.getU8();
+            if (rec.settingsMask & kWalSettingsChinchiro) {
+                rec.settings.chinchiro.enabled = r.getBool();
+                r.getString(rec.settings.chinchiro.rounding);
+            }
+            if (rec.settingsMask & kWalSettingsQrPrint) {
+                rec.settings.qrPrint.enabled = r.getBool();
+                r.getString(rec.settings.qrPrint.content);
+            }
+            if (rec.settingsMask & kWalSettingsStore) {
+                r.getString(rec.settings.store.name);
+                r.getString(rec.settings.store.nameRomaji);
+                r.getString(rec.settings.store.registerId);
+            }
+            return r.ok();
+        case kWalMainUpsert:
+        case kWalSideUpsert:
+            if (!decodeMenuItem(r, rec.item)) {
+                return false;
+            }
+            rec.catalogVersion = r.getVarU32();
+            return r.ok();
+        default:
+            return true;
+    }
+}
+
+static String rotatedSegmentPath(WalTicket lastLsn);
+
+// Retries the rename retireTornSegmentLocked() could not finish.
+static bool renameTornSegmentLocked() {
+    if (g_walTornSegmentLsn == 0) {
+        return true;
+    }
+    if (LittleFS.exists(kWalLivePath) &&
+        !flashRename(kFlashWal, kWalLivePath, rotatedSegmentPath(g_walTornSegmentLsn))) {
+        Serial.println("[E] wal torn segment rotate failed");
+        return false;
+    }
+    g_walTornSegmentLsn = 0;
+    return true;
+}
+
+static bool openWalLocked() {
+    if (g_walFile) {
+        return true;
+    }
+    if (!renameTornSegmentLocked()) {
+        return false;
+    }
+    if (!LittleFS.exists(kWalDir) && !LittleFS.mkdir(kWalDir)) {
+        Serial.printf("[E] wal dir create failed: %s\n", kWalDir);
+        return false;
+    }
+    g_walFile = flashOpen(kFlashWal, kWalLivePath, FILE_APPEND);
+    if (!g_walFile) {
+        Serial.printf("[E] wal append open failed: %s\n", kWalLivePath);
+        return false;
+    }
+    return true;
+}
+
+static size_t frameSizeAt(size_t offset) {
+    const uint8_t* header = g_walBuffer.data() + offset;
+    return kWalFrameHeaderSize + static_cast<size_t>(header[2] | (header[3] << 8)) + kWalFrameTrailerSize;
+}
+
+// Packs whole frames into as few ring entries as fit; each entry is keyed by its first LSN.
+static size_t writeRingLocked() {
+    size_t start = 0;
+    while (start < g_walBuffer.size()) {
+        size_t end = start;
+        while (end < g_walBuffer.size() && end - start + frameSizeAt(end) <= kWalRingMaxEntry) {
+            end += frameSizeAt(end);
+        }
+        if (end == start || !g_walRing->append(getLe32(g_walBuffer.data() + start + 4), g_walBuffer.data() + start,
+                                               end - start)) {
+            break;
+        }
+        start = end;
+    }
+    return start;
+}
+
+// A short write leaves a torn frame at the end of the live segment, and replay stops there, so
+// nothing may be appended behind it. The segment is retired under the LSN of its last whole
+// frame; frames that did not fully reach flash stay buffered for a fresh live segment.
+static void retireTornSegmentLocked(size_t written) {
+    size_t wholeBytes = g_walFile.size() - written;
+    WalTicket lastLsn = g_walDurableLsn;
+    size_t keepFrom = 0;
+    while (keepFrom < g_walBuffer.size() && keepFrom + frameSizeAt(keepFrom) <= written) {
+        lastLsn = getLe32(g_walBuffer.data() + keepFrom + 4);
+        keepFrom += frameSizeAt(keepFrom);
+    }
+    wholeBytes += keepFrom;
+    g_walFile.close();
+    g_walDurableLsn = lastLsn;
+    g_walBuffer.erase(g_walBuffer.begin(), g_walBuffer.begin() + keepFrom);
+    if (wholeBytes == 0) {
+        flashRemove(kFlashWal, kWalLivePath);
+        return;
+    }
+    g_walTornSegmentLsn = lastLsn;
+    renameTornSegmentLocked();
+}
+
+static bool commitWalLocked() {
+    if (g_walBuffer.empty()) {
+        return true;
+    }
+    if (!g_walRing && !openWalLocked()) {
+        g_walStats.failures++;
+        return false;
+    }
+
+    uint32_t startedMs = millis();
+    size_t len = g_walBuffer.size();
+    if (g_walRing) {
+        size_t written = writeRingLocked();
+        if (written != len) {
+            Serial.printf("[E] wal ring append failed (%u/%u, %u/%u pages live)\n", static_cast<unsigned>(written),
+                          static_cast<unsigned>(len), static_cast<unsigned>(g_walRing->livePages()),
+                          static_cast<unsigned>(g_walRing->pages()));
+            g_walStats.failures++;
+            // Written entries are whole frames; the rest stays buffered for the next attempt.
+            g_walBuffer.erase(g_walBuffer.begin(), g_walBuffer.begin() + written);
+            requestSnapshotSave();
+            return false;
+        }
+    }
+    size_t written = g_walRing ? len : g_walFile.write(g_walBuffer.data(), len);
+    if (!g_walRing) {
+        g_walFile.flush();
+    }
+    if (written != len) {
+        Serial.printf("[E] wal commit write failed (%u/%u)\n", static_cast<unsigned>(written), static_cast<unsigned>(len));
+        g_walStats.failures++;
+        retireTornSegmentLocked(written);
+        return false;
+    }
+
+    g_walStats.commits++;
+    g_walStats.bytesWritten += len;
+    g_walStats.largestGroupBytes = std::max<uint32_t>(g_walStats.largestGroupBytes, len);
+    g_walStats.lastCommitMs = millis() - startedMs;
+    g_walDurableLsn = g_walLastLsn;
+    g_walBuffer.clear();
+    return true;
+}
+
+static String rotatedSegmentPath(WalTicket lastLsn) {
+    char name[32];
+    snprintf(name, sizeof(name), "/kds/wal.%010u.bin", static_cast<unsigned>(lastLsn));
+    return String(name);
+}
+
+static bool isLegacySegmentName(const String& name) {
+    return name == "wal.log" || (name.startsWith("wal.") && name.endsWith(".log"));
+}
+
+static bool isRotatedSegmentName(const String& name) {
+    return name.startsWith("wal.") && name.endsWith(".bin") && name != "wal.bin";
+}
+
+static String segmentFileName(const String& path) {
+    int slash = path.lastIndexOf('/');
+    return slash >= 0 ? path.substring(slash + 1) : path;
+}
+
+static WalTicket rotatedSegmentLastLsn(const String& name) {
+    return static_cast<WalTicket>(strtoul(name.c_str() + 4, nullptr, 10));
+}
+
+static uint32_t legacySegmentSortKey(const String& name) {
+    if (name == "wal.log") {
+        return 0xFFFFFFFFu;
+    }
+    String tsPart = name.substring(4, name.length() - 4);
+    return static_cast<uint32_t>(strtoul(tsPart.c_str(), nullptr, 10));
+}
+
+std::vector<String> walListSegments() {
+    std::vector<String> legacy;
+    std::vector<String> rotated;
+    bool hasLive = false;
+
+    File dir = LittleFS.open(kWalDir);
+    if (!dir) {
+        return legacy;
+    }
+    while (File file = dir.openNextFile()) {
+        String name = segmentFileName(String(file.name()));
+        file.close();
+        if (name == "wal.bin") {
+            hasLive = true;
+        } else if (isRotatedSegmentName(name)) {
+            rotated.push_back(name);
+        } else if (isLegacySegmentName(name)) {
+            legacy.push_back(name);
+        }
+    }
+    dir.close();
+
+    std::sort(legacy.begin(), legacy.end(), [](const String& a, const String& b) {
+        uint32_t ka = legacySegmentSortKey(a);
+        uint32_t kb = legacySegmentSortKey(b);
+        if (ka == kb) {
+            return a.compareTo(b) < 0;
+        }
+        return ka < kb;
+    });
+    // Rotated names carry a zero-padded LSN, so lexical order is log order.
+    std::sort(rotated.begin(), rotated.end(), [](const String& a, const String& b) {
+        return a.compareTo(b) < 0;
+    });
+
+    std::vector<String> result;
+    for (const String& name : legacy) {
+        result.push_back(String("/kds/") + name);
+    }
+    for (const String& name : rotated) {
+        result.push_back(String("/kds/") + name);
+    }
+    if (hasLive) {
+        result.push_back(kWalLivePath);
+    }
+    if (g_walRing && !g_walRing->empty()) {
+        result.push_back(kWalRingPath);
+    }
+    return result;
+}
+
+static void orderFromLegacyWalJson(const JsonDocument& doc, WalRecord& rec) {
+    rec.hasOrder = false;
+    if (doc["order"].is<JsonObjectConst>()) {
+        rec.hasOrder = orderFromJson(doc["order"], rec.order);
+    }
+    if (rec.hasOrder || rec.action != kWalOrderCreate) {
+        return;
+    }
+
+    Order& restored = rec.order;
+    restored.orderNo = doc["orderNo"] | String("");
+    if (restored.orderNo.isEmpty() || !doc["items"].is<JsonArrayConst>()) {
+        return;
+    }
+    restored.status = doc["status"] | String("PENDING");
+    restored.ts = doc["orderTs"] | (uint32_t)(doc["ts"] | 0);
+    restored.printed = doc["printed"] | false;
+    restored.cooked = doc["cooked"] | false;
+    restored.pickup_called = doc["pickup_called"] | false;
+    restored.picked_up = doc["picked_up"] | false;
+    restored.cancelReason = doc["cancelReason"] | String("");
+    restored.items.clear();
+    for (JsonVariantConst itemVar : doc["items"].as<JsonArrayConst>()) {
+        if (!itemVar.is<JsonObjectConst>()) {
+            continue;
+        }
+        JsonObjectConst itemObj = itemVar.as<JsonObjectConst>();
+        LineItem item;
+        item.sku = itemObj["sku"] | String("");
+        item.name = itemObj["name"] | String("");
+        item.qty = itemObj["qty"] | 1;
+        item.unitPriceApplied = itemObj["unitPriceApplied"] | 0;
+        item.priceMode = itemObj["priceMode"] | String("");
+        item.kind = itemObj["kind"] | String("");
+        item.unitPrice = itemObj["unitPrice"] | 0;
+        item.discountName = itemObj["discountName"] | String("");
+        item.discountValue = itemObj["discountValue"] | 0;
+        restored.items.push_back(item);
+    }
+    rec.hasOrder = !restored.items.empty();
+}
+
+// Pre-binary firmware wrote one JSON object per line; map it onto the typed record.
+static bool walRecordFromLegacyJson(const JsonDocument& doc, WalRecord& rec) {
+    String action = doc["action"] | doc["type"] | "";
+    rec.lsn = 0;
+    rec.ts = doc["ts"] | 0;
+
+    if (action == "ORDER_CREATE") {
+        rec.action = kWalOrderCreate;
+        orderFromLegacyWalJson(doc, rec);
+        rec.orderNo = rec.order.orderNo;
+        return rec.hasOrder;
+    }
+    if (action == "ORDER_UPDATE") {
+        rec.action = kWalOrderUpdate;
+        rec.orderNo = doc["orderNo"] | "";
+        rec.status = doc["status"] | "";
+        rec.cooked = doc["cooked"] | false;
+        rec.pickupCalled = doc["pickup_called"] | false;
+        rec.pickedUp = doc["picked_up"] | false;
+        rec.printed = doc["printed"] | false;
+        return !rec.orderNo.isEmpty();
+    }
+    if (action == "ORDER_CANCEL") {
+        rec.action = kWalOrderCancel;
+        rec.orderNo = doc["orderNo"] | "";
+        rec.cancelReason = doc["cancelReason"] | "";
+        rec.archived = doc["archived"] | false;
+        return !rec.orderNo.isEmpty();
+    }
+    if (action == "ORDER_COOKED" || action == "ORDER_PICKED") {
+        rec.action = (action == "ORDER_COOKED") ? kWalOrderCooked : kWalOrderPicked;
+        rec.orderNo = doc["orderNo"] | "";
+        return !rec.orderNo.isEmpty();
+    }
+    if (action == "ORDER_ARCHIVE") {
+        rec.action = kWalOrderArchive;
+        rec.orderNo = doc["orderNo"] | "";
+        rec.sessionId = doc["sessionId"] | "";
+        rec.archivedAt = doc["archivedAt"] | rec.ts;
+        orderFromLegacyWalJson(doc, rec);
+        return !rec.orderNo.isEmpty();
+    }
+    if (action == "SETTINGS_UPDATE") {
+        rec.action = kWalSettingsUpdate;
+        rec.settingsMask = 0;
+        rec.settings = S().settings;
+        if (doc["chinchiro"].is<JsonObjectConst>()) {
+            rec.settingsMask |= kWalSettingsChinchiro;
+            rec.settings.chinchiro.enabled = doc["chinchiro"]["enabled"] | rec.settings.chinchiro.enabled;
+            rec.settings.chinchiro.rounding = doc["chinchiro"]["rounding"] | rec.settings.chinchiro.rounding;
+        }
+        if (doc["qrPrint"].is<JsonObjectConst>()) {
+            rec.settingsMask |= kWalSettingsQrPrint;
+            rec.settings.qrPrint.enabled = doc["qrPrint"]["enabled"] | rec.settings.qrPrint.enabled;
+            rec.settings.qrPrint.content = doc["qrPrint"]["content"] | rec.settings.qrPrint.content;
+        }
+        if (doc["store"].is<JsonObjectConst>()) {
+            rec.settingsMask |= kWalSettingsStore;
+            rec.settings.store.name = doc["store"]["name"] | rec.settings.store.name;
+            rec.settings.store.nameRomaji = doc["store"]["nameRomaji"] | rec.settings.store.nameRomaji;
+            rec.settings.store.registerId = doc["store"]["registerId"] | rec.settings.store.registerId;
+        }
+        return true;
+    }
+    if (action == "MAIN_UPSERT" || action == "SIDE_UPSERT") {
+        bool isMain = action == "MAIN_UPSERT";
+        rec.action = isMain ? kWalMainUpsert : kWalSideUpsert;
+        rec.item = MenuItem();
+        rec.item.sku = doc["sku"] | "";
+        rec.item.name = doc["name"] | "";
+        rec.item.nameRomaji = doc["nameRomaji"] | "";
+        rec.item.category = isMain ? "MAIN" : "SIDE";
+        rec.item.active = doc["active"] | true;
+        rec.item.price_normal = doc["price_normal"] | 0;
+        rec.item.presale_discount_amount = doc["presale_discount_amount"] | 0;
+        rec.item.price_single = doc["price_single"] | 0;
+        rec.item.price_as_side = doc["price_as_side"] | 0;
+        rec.catalogVersion = doc["catalogVersion"] | static_cast<uint32_t>(0);
+        return !rec.item.sku.isEmpty();
+    }
+    if (action == "SESSION_END" || action == "SYSTEM_RESET") {
+        rec.action = (action == "SESSION_END") ? kWalSessionEnd : kWalSystemReset;
+        return true;
+    }
+    return false;
+}
+
+// budgetMs == 0 means no limit; otherwise reads pause between records once it is spent.
+struct WalReadBudget {
+    uint32_t startedMs{0};
+    uint32_t budgetMs{0};
+    bool expired() const { return budgetMs > 0 && millis() - startedMs >= budgetMs; }
+};
+
+enum WalReadResult {
+    kWalReadDone,
+    kWalReadPaused,
+    kWalReadStopped,
+};
+
+static WalReadResult readLegacySegment(File& f, const String& path, WalRecordVisitor visitor, void* context,
+                                       WalSegmentInfo& info, const WalReadBudget& budget) {
+    JsonArenaLease arena;
+    JsonDocument doc(arena.allocator());
+    WalRecord rec;
+    while (f.available()) {
+        String line = f.readStringUntil('\n');
+        line.trim();
+        if (line.length() == 0) {
+            continue;
+        }
+        DeserializationError error = deserializeJson(doc, line);
+        if (error) {
+            Serial.printf("[E] wal parse failed (%s): %s\n", path.c_str(), error.c_str());
+            continue;
+        }
+        if (!walRecordFromLegacyJson(doc, rec)) {
+            Serial.printf("[E] wal record skipped (%s)\n", path.c_str());
+            continue;
+        }
+        info.records++;
+        if (visitor && !visitor(rec, context)) {
+            return kWalReadStopped;
+        }
+        if (budget.expired()) {
+            return kWalReadPaused;
+        }
+    }
+    return kWalReadDone;
+}
+
+static WalReadResult readBinarySegment(File& f, const String& path, WalRecordVisitor visitor, void* context,
+                                       WalSegmentInfo& info, WalTicket fromLsn, const WalReadBudget& budget) {
+    std::vector<uint8_t> frame;
+    frame.reserve(512);
+    WalRecord rec;
+
+    while (true) {
+        uint8_t header[kWalFrameHeaderSize];
+        size_t got = f.read(header, sizeof(header));
+        if (got == 0) {
+            return kWalReadDone;
+        }
+        if (got != sizeof(header) || header[0] != kWalFrameMagic) {
+            info.tornTail = true;
+            break;
+        }
+        size_t payloadLen = static_cast<size_t>(header[2] | (header[3] << 8));
+        WalTicket lsn = getLe32(header + 4);
+        if (lsn < fromLsn) {
+            if (!f.seek(payloadLen + kWalFrameTrailerSize, SeekCur)) {
+                info.tornTail = true;
+                break;
+            }
+            info.lastLsn = lsn;
+            info.skippedRecords++;
+            continue;
+        }
+        frame.resize(payloadLen + kWalFrameTrailerSize);
+        if (f.read(frame.data(), frame.size()) != frame.size()) {
+            info.tornTail = true;
+            break;
+        }
+        uint32_t crc = crc32Update(0, header, sizeof(header));
+        crc = crc32Update(crc, frame.data(), payloadLen);
+        if (crc != getLe32(frame.data() + payloadLen)) {
+            info.tornTail = true;
+            break;
+        }
+
+        rec.action = static_cast<WalAction>(header[1]);
+        rec.lsn = lsn;
+        rec.ts = getLe32(header + 8);
+        info.lastLsn = rec.lsn;
+        info.records++;
+
+        RecordReader r(frame.data(), payloadLen);
+        if (!decodeWalPayload(r, rec)) {
+            Serial.printf("[E] wal payload invalid (%s lsn=%u)\n", path.c_str(), static_cast<unsigned>(rec.lsn));
+            continue;
+        }
+        if (visitor && !visitor(rec, context)) {
+            return kWalReadStopped;
+        }
+        if (budget.expired()) {
+            return kWalReadPaused;
+        }
+    }
+
+    Serial.printf("[WAL] torn tail after lsn=%u: %s\n", static_cast<unsigned>(info.lastLsn), path.c_str());
+    return kWalReadDone;
+}
+
+// Walks the frames packed into one ring entry; false if any of them is malformed.
+static bool forEachRingFrame(const std::vector<uint8_t>& entry, WalTicket& lastLsn,
+                             bool (*frameVisitor)(const uint8_t* frame, size_t payloadLen, void* ctx), void* ctx) {
+    size_t offset = 0;
+    while (offset + kWalFrameHeaderSize + kWalFrameTrailerSize <= entry.size()) {
+        const uint8_t* frame = entry.data() + offset;
+        size_t payloadLen = static_cast<size_t>(frame[2] | (frame[3] << 8));
+        size_t frameLen = kWalFrameHeaderSize + payloadLen + kWalFrameTrailerSize;
+        if (frame[0] != kWalFrameMagic || offset + frameLen > entry.size() ||
+            crc32Update(0, frame, frameLen - kWalFrameTrailerSize) != getLe32(frame + frameLen - kWalFrameTrailerSize)) {
+            return false;
+        }
+        lastLsn = getLe32(frame + 4);
+        if (frameVisitor && !frameVisitor(frame, payloadLen, ctx)) {
+            return true;
+        }
+        offset += frameLen;
+    }
+    return offset == entry.size();
+}
+
+struct RingFrameContext {
+    WalRecordVisitor visitor;
+    void* context;
+    WalSegmentInfo* info;
+    WalTicket fromLsn;
+    WalRecord rec;
+    bool stopped;
+};
+
+static bool visitRingFrame(const uint8_t* frame, size_t payloadLen, void* ctx) {
+    RingFrameContext& c = *static_cast<RingFrameContext*>(ctx);
+    WalRecord& rec = c.rec;
+    rec.lsn = getLe32(frame + 4);
+    c.info->lastLsn = rec.lsn;
+    if (rec.lsn < c.fromLsn) {
+        c.info->skippedRecords++;
+        return true;
+    }
+    rec.action = static_cast<WalAction>(frame[1]);
+    rec.ts = getLe32(frame + 8);
+    c.info->records++;
+    RecordReader r(frame + kWalFrameHeaderSize, payloadLen);
+    if (!decodeWalPayload(r, rec)) {
+        Serial.printf("[E] wal payload invalid (%s lsn=%u)\n", kWalRingPath, static_cast<unsigned>(rec.lsn));
+        return true;
+    }
+    if (c.visitor && !c.visitor(rec, c.context)) {
+        c.stopped = true;
+        return false;
+    }
+    return true;
+}
+
+// page == 0 starts at the page holding fromLsn. The lock is held per entry only, so appends carry
+// on while replay decodes; pages recycled meanwhile are skipped by WalRing::read().
+static WalReadResult readRingSegment(uint32_t& page, uint32_t& offset, WalRecordVisitor visitor, void* context,
+                                     WalSegmentInfo& info, WalTicket fromLsn, const WalReadBudget& budget) {
+    RingFrameContext ctx{visitor, context, &info, fromLsn, WalRecord(), false};
+    std::vector<uint8_t> entry;
+    entry.reserve(kWalRingMaxEntry);
+    while (true) {
+        uint32_t entryLsn = 0;
+        bool got;
+        WalRingPosition pos;
+        {
+            WalLock lock;
+            if (!g_walRing) {
+                // Never mounted (always so without KDS_WAL_RAW_PARTITION): nothing to read.
+                return kWalReadDone;
+            }
+            if (page == 0) {
+                pos = g_walRing->start(fromLsn);
+            } else {
+                pos.seq = page;
+                pos.offset = offset;
+            }
+            got = g_walRing->read(pos, entryLsn, entry);
+        }
+        page = pos.seq;
+        offset = pos.offset;
+        if (!got) {
+            return kWalReadDone;
+        }
+        WalTicket lastLsn = 0;
+        if (!forEachRingFrame(entry, lastLsn, visitRingFrame, &ctx)) {
+            Serial.printf("[E] wal ring entry malformed (lsn=%u)\n", static_cast<unsigned>(entryLsn));
+        }
+        if (ctx.stopped) {
+            return kWalReadStopped;
+        }
+        if (budget.expired()) {
+            return kWalReadPaused;
+        }
+    }
+}
+
+// Reads one segment starting at offset and leaves offset at the resume point when paused. page
+// is only used by the ring, where offset is relative to that page.
+static WalReadResult readSegmentFrom(const String& path, uint32_t& page, uint32_t& offset, WalRecordVisitor visitor,
+                                     void* context, WalSegmentInfo& info, WalTicket fromLsn,
+                                     const WalReadBudget& budget) {
+    if (path == kWalRingPath) {
+        return readRingSegment(page, offset, visitor, context, info, fromLsn, budget);
+    }
+    if (fromLsn > 0) {
+        // Legacy JSON carries no LSNs; any checkpointed snapshot was written after it was retired.
+        String name = segmentFileName(path);
+        if (isLegacySegmentName(name) || (isRotatedSegmentName(name) && rotatedSegmentLastLsn(name) < fromLsn)) {
+            info.skipped = true;
+            return kWalReadDone;
+        }
+    }
+
+    FlashFile f = flashOpen(kFlashWal, path, "r");
+    if (!f) {
+        Serial.printf("[E] wal open failed: %s\n", path.c_str());
+        return kWalReadDone;
+    }
+    info.legacyJson = f.peek() == '{';
+    if (offset > 0 && !f.seek(offset, SeekSet)) {
+        f.close();
+        return kWalReadDone;
+    }
+    WalReadResult result = info.legacyJson ? readLegacySegment(f, path, visitor, context, info, budget)
+                                           : readBinarySegment(f, path, visitor, context, info, fromLsn, budget);
+    offset = static_cast<uint32_t>(f.position());
+    f.close();
+    return result;
+}
+
+bool walReadSegment(const String& path, WalRecordVisitor visitor, void* context, WalSegmentInfo* info,
+                    WalTicket fromLsn) {
+    WalSegmentInfo local;
+    WalSegmentInfo& out = info ? *info : local;
+    out = WalSegmentInfo();
+    uint32_t page = 0;
+    uint32_t offset = 0;
+    return readSegmentFrom(path, page, offset, visitor, context, out, fromLsn, WalReadBudget()) != kWalReadStopped;
+}
+
+void walReplayBegin(WalReplayCursor& cursor, WalTicket fromLsn) {
+    cursor = WalReplayCursor();
+    cursor.segments = walListSegments();
+    cursor.fromLsn = fromLsn;
+}
+
+bool walReplayStep(WalReplayCursor& cursor, WalRecordVisitor visitor, void* context, uint32_t budgetMs) {
+    WalReadBudget budget;
+    budget.startedMs = millis();
+    budget.budgetMs = budgetMs;
+
+    while (cursor.segment < cursor.segments.size()) {
+        WalSegmentInfo info;
+        WalReadResult result = readSegmentFrom(cursor.segments[cursor.segment], cursor.page, cursor.offset, visitor,
+                                               context, info, cursor.fromLsn, budget);
+        cursor.records += info.records;
+        cursor.skippedRecords += info.skippedRecords;
+        if (result == kWalReadPaused) {
+            return false;
+        }
+        if (info.skipped) {
+            cursor.skippedSegments++;
+        }
+        cursor.segment = (result == kWalReadStopped) ? cursor.segments.size() : cursor.segment + 1;
+        cursor.page = 0;
+        cursor.offset = 0;
+        if (budget.expired()) {
+            break;
+        }
+    }
+    return cursor.segment >= cursor.segments.size();
+}
+
+static void pruneRotatedSegmentsLocked(WalTicket obsoleteThrough) {
+    std::vector<String> segments = walListSegments();
+    if (!segments.empty() && segments.back() == kWalRingPath) {
+        segments.pop_back();
+    }
+    if (!segments.empty() && segments.back() == kWalLivePath) {
+        segments.pop_back();
+    }
+    if (obsoleteThrough > 0) {
+        for (const String& path : segments) {
+            String name = segmentFileName(path);
+            if (isLegacySegmentName(name) || rotatedSegmentLastLsn(name) <= obsoleteThrough) {
+                flashRemove(kFlashWal, path.c_str());
+            }
+        }
+        return;
+    }
+    for (size_t i = 0; i + kWalKeepRotated < segments.size(); ++i) {
+        flashRemove(kFlashWal, segments[i].c_str());
+    }
+}
+
+static void rotateLiveSegmentLocked(WalTicket lastLsn, uint32_t records, WalTicket obsoleteThrough) {
+    if (g_walFile) {
+        g_walFile.close();
+    }
+    if (!LittleFS.exists(kWalLivePath)) {
+        return;
+    }
+    if (records == 0) {
+        flashRemove(kFlashWal, kWalLivePath);
+        return;
+    }
+    String target = rotatedSegmentPath(lastLsn);
+    if (!flashRename(kFlashWal, kWalLivePath, target.c_str())) {
+        Serial.println("[E] wal rotate failed");
+        return;
+    }
+    pruneRotatedSegmentsLocked(obsoleteThrough);
+}
+
+static void mountRingLocked() {
+#if KDS_WAL_RAW_PARTITION
+    if (g_walRing) {
+        return;
+    }
+    WalRingFlash* flash = walRingPartitionFlash();
+    if (!flash) {
+        Serial.println("[E] wal partition not found; using LittleFS");
+        return;
+    }
+    static WalRing ring(*flash);
+    if (!ring.mount()) {
+        Serial.println("[E] wal partition mount failed; using LittleFS");
+        return;
+    }
+    if (ring.tornOnMount()) {
+        Serial.println("[WAL] ring head page torn; continuing on a fresh page");
+    }
+    g_walRing = &ring;
+#endif
+}
+
+// The ring only knows each entry's first LSN; the newest entry may hold several frames.
+static WalTicket ringLastLsnLocked() {
+    WalTicket lastLsn = 0;
+    WalRingPosition pos = g_walRing->start(g_walRing->lastLsn());
+    std::vector<uint8_t> entry;
+    uint32_t entryLsn = 0;
+    while (g_walRing->read(pos, entryLsn, entry)) {
+        forEachRingFrame(entry, lastLsn, nullptr, nullptr);
+    }
+    return lastLsn;
+}
+
+bool walBegin() {
+    WalLock lock;
+    g_walBuffer.reserve(kWalGroupBytes + 512);
+    mountRingLocked();
+
+    WalTicket lastLsn = 0;
+    for (const String& path : walListSegments()) {
+        if (path == kWalRingPath) {
+            continue;
+        }
+        WalSegmentInfo info;
+        walReadSegment(path, nullptr, nullptr, &info);
+        lastLsn = std::max(lastLsn, info.lastLsn);
+        // Appending after a torn frame would hide every later record from replay. With the ring,
+        // the file is retired as is so the ring stays the only live segment.
+        if (path == kWalLivePath && (info.tornTail || g_walRing)) {
+            rotateLiveSegmentLocked(info.lastLsn, info.records, 0);
+        }
+    }
+    if (g_walRing) {
+        lastLsn = std::max(lastLsn, ringLastLsnLocked());
+    }
+    g_walLastLsn = lastLsn;
+    g_walDurableLsn = lastLsn;
+    Serial.printf("[WAL] ready: lastLsn=%u%s\n", static_cast<unsigned>(lastLsn), g_walRing ? " (raw partition)" : "");
+    return g_walRing || openWalLocked();
+}
+
+bool walAppend(const WalRecord& record, WalTicket* ticket) {
+    WalLock lock;
+    size_t start = g_walBuffer.size();
+    g_walBuffer.resize(start + kWalFrameHeaderSize);
+    VectorSink sink(g_walBuffer);
+    RecordWriter w(sink);
+    encodeWalPayload(w, record);
+
+    size_t payloadLen = g_walBuffer.size() - start - kWalFrameHeaderSize;
+    if (payloadLen > (g_walRing ? kWalRingMaxPayload : kWalMaxPayload)) {
+        Serial.printf("[E] wal record too large: %u bytes\n", static_cast<unsigned>(payloadLen));
+        g_walBuffer.resize(start);
+        g_walStats.failures++;
+        return false;
+    }
+
+    if (start == 0) {
+        g_walOldestPendingMs = millis();
+    }
+    WalTicket lsn = ++g_walLastLsn;
+    uint8_t* header = g_walBuffer.data() + start;
+    header[0] = kWalFrameMagic;
+    header[1] = static_cast<uint8_t>(record.action);
+    putLe16(header + 2, static_cast<uint16_t>(payloadLen));
+    putLe32(header + 4, lsn);
+    putLe32(header + 8, record.ts);
+
+    uint8_t trailer[kWalFrameTrailerSize];
+    putLe32(trailer, crc32Update(0, g_walBuffer.data() + start, g_walBuffer.size() - start));
+    g_walBuffer.insert(g_walBuffer.end(), trailer, trailer + sizeof(trailer));
+
+    g_walStats.appends++;
+    if (ticket) {
+        *ticket = lsn;
+    }
+    if (g_walBuffer.size() >= kWalGroupBytes) {
+        return commitWalLocked();
+    }
+    return true;
+}
+
+// Commits the pending group early instead of waiting for the window, so a caller that needs
+// its record on flash pays for at most one write and flush.
+bool walWaitDurable(WalTicket ticket) {
+    WalLock lock;
+    if (g_walDurableLsn >= ticket) {
+        return true;
+    }
+    return commitWalLocked();
+}
+
+void walTick() {
+    WalLock lock;
+    if (!g_walBuffer.empty() && millis() - g_walOldestPendingMs >= kWalGroupWindowMs) {
+        commitWalLocked();
+    }
+    // Erasing here keeps the sector erase out of the next commit.
+    if (g_walRing && g_walBuffer.empty()) {
+        g_walRing->prepare();
+        if (g_walRing->livePages() * 100 >= g_walRing->pages() * kWalRingSnapshotPercent) {
+            requestSnapshotSave();
+        }
+    }
+}
+
+bool walFlush() {
+    WalLock lock;
+    return commitWalLocked();
+}
+
+void walRotate(WalTicket obsoleteThrough) {
+    WalLock lock;
+    commitWalLocked();
+    if (g_walRing) {
+        // Nothing to rename: released pages are simply erased again when the head comes round.
+        g_walRing->release(obsoleteThrough);
+        pruneRotatedSegmentsLocked(obsoleteThrough);
+        return;
+    }
+    if (g_walFile) {
+        g_walFile.close();
+    }
+    FlashFile live = flashOpen(kFlashWal, kWalLivePath, "r");
+    size_t liveSize = live ? live.size() : 0;
+    live.close();
+    rotateLiveSegmentLocked(g_walLastLsn, liveSize > 0 ? 1 : 0, obsoleteThrough);
+}
+
+void walRelease(WalTicket obsoleteThrough) {
+    WalLock lock;
+    if (g_walRing) {
+        g_walRing->release(obsoleteThrough);
+    }
+}
+
+void walAdvanceLsn(WalTicket lsn) {
+    WalLock lock;
+    if (lsn <= g_walLastLsn) {
+        return;
+    }
+    Serial.printf("[WAL] lsn advanced %u -> %u past the snapshot checkpoint\n", static_cast<unsigned>(g_walLastLsn),
+                  static_cast<unsigned>(lsn));
+    // Records up to a checkpoint are in the snapshot, so nothing below it can be pending.
+    g_walLastLsn = lsn;
+    g_walDurableLsn = std::max(g_walDurableLsn, lsn);
+}
+
+WalTicket walLastLsn() {
+    WalLock lock;
+    return g_walLastLsn;
+}
+
+WalStats getWalStats() {
+    WalLock lock;
+    WalStats stats = g_walStats;
+    stats.pendingBytes = g_walBuffer.size();
+    stats.lastLsn = g_walLastLsn;
+    if (g_walRing) {
+        stats.rawPartition = true;
+        stats.ringPages = g_walRing->pages();
+        stats.ringLivePages = g_walRing->livePages();
+        stats.ringErases = g_walRing->erases();
+    }
+    return stats;
+}
@@ -0,0 +1,262 @@
+#include "wal_ring.h"
+#include "record_codec.h"
+#include <algorithm>
+#include <string.h>
+
+static const uint32_t kWalRingMagic = 0x5257444B; // "KDWR"
+static const uint16_t kWalRingEntryErased = 0xFFFF;
+
+static void putLe16(uint8_t* out, uint16_t v) {
+    out[0] = static_cast<uint8_t>(v);
+    out[1] = static_cast<uint8_t>(v >> 8);
+}
+
+static void putLe32(uint8_t* out, uint32_t v) {
+    out[0] = static_cast<uint8_t>(v);
+    out[1] = static_cast<uint8_t>(v >> 8);
+    out[2] = static_cast<uint8_t>(v >> 16);
+    out[3] = static_cast<uint8_t>(v >> 24);
+}
+
+static uint32_t getLe32(const uint8_t* in) {
+    return static_cast<uint32_t>(in[0]) |
+           (static_cast<uint32_t>(in[1]) << 8) |
+           (static_cast<uint32_t>(in[2]) << 16) |
+           (static_cast<uint32_t>(in[3]) << 24);
+}
+
+static bool allErased(const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// CRC over length, LSN and data; the stored CRC field itself is excluded.
+static uint32_t entryCrc(const uint8_t* header, const uint8_t* data, size_t len) {
+    uint32_t crc = crc32Update(0, header, 6);
+    return crc32Update(crc, data, len);
+}
+
+bool WalRing::readPageHeader(uint32_t index, PageInfo& info) {
+    uint8_t raw[kWalRingPageHeaderSize];
+    if (!flash_.read(index * kWalRingPageSize, raw, sizeof(raw))) {
+        return false;
+    }
+    if (getLe32(raw) != kWalRingMagic || getLe32(raw + 12) != crc32Update(0, raw, 12)) {
+        return false;
+    }
+    info.seq = getLe32(raw + 4);
+    info.firstLsn = getLe32(raw + 8);
+    return info.seq != 0;
+}
+
+bool WalRing::mount() {
+    uint32_t count = flash_.size() / kWalRingPageSize;
+    if (count < 2) {
+        return false;
+    }
+    pages_.assign(count, PageInfo());
+    headSeq_ = 0;
+    tailSeq_ = 0;
+    writeOffset_ = kWalRingPageSize;
+    lastLsn_ = 0;
+    horizon_ = 0;
+    nextErased_ = false;
+    tornOnMount_ = false;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        PageInfo info;
+        if (readPageHeader(i, info) && info.seq % count == i) {
+            pages_[i] = info;
+            headSeq_ = std::max(headSeq_, info.seq);
+        }
+    }
+    if (headSeq_ == 0) {
+        return true;
+    }
+
+    // Live pages are the unbroken run of sequence numbers ending at the head.
+    tailSeq_ = headSeq_;
+    while (tailSeq_ > 1 && headSeq_ - (tailSeq_ - 1) < count && pages_[pageIndex(tailSeq_ - 1)].seq == tailSeq_ - 1) {
+        tailSeq_--;
+    }
+
+    const uint32_t base = pageAddress(headSeq_);
+    lastLsn_ = pages_[pageIndex(headSeq_)].firstLsn - 1;
+    uint32_t offset = kWalRingPageHeaderSize;
+    std::vector<uint8_t> data;
+    bool torn = false;
+    while (offset + kWalRingEntryHeaderSize <= kWalRingPageSize) {
+        uint8_t header[kWalRingEntryHeaderSize];
+        if (!flash_.read(base + offset, header, sizeof(header))) {
+            torn = true;
+            break;
+        }
+        uint16_t len = static_cast<uint16_t>(header[0] | (header[1] << 8));
+        if (len == kWalRingEntryErased) {
+            torn = !allErased(header, sizeof(header));
+            break;
+        }
+        if (len > kWalRingMaxEntry || offset + kWalRingEntryHeaderSize + len > kWalRingPageSize) {
+            torn = true;
+            break;
+        }
+        data.resize(len);
+        if (!flash_.read(base + offset + kWalRingEntryHeaderSize, data.data(), len) ||
+            getLe32(header + 6) != entryCrc(header, data.data(), len)) {
+            torn = true;
+            break;
+        }
+        lastLsn_ = getLe32(header + 2);
+        offset += kWalRingEntryHeaderSize + len;
+    }
+    writeOffset_ = torn ? kWalRingPageSize : offset;
+    tornOnMount_ = torn;
+    return true;
+}
+
+bool WalRing::canReuse(uint32_t seq) const {
+    const uint32_t count = pages();
+    if (seq <= count) {
+        return true;
+    }
+    uint32_t previous = seq - count;
+    if (previous < tailSeq_ || pages_[pageIndex(previous)].seq != previous) {
+        return true;
+    }
+    // The successor's first LSN bounds everything the outgoing page holds.
+    return pages_[pageIndex(previous + 1)].firstLsn - 1 <= horizon_;
+}
+
+bool WalRing::erasePage(uint32_t seq) {
+    const uint32_t count = pages();
+    uint32_t index = pageIndex(seq);
+    bool wasLive = seq > count && pages_[index].seq == seq - count && seq - count >= tailSeq_;
+    pages_[index] = PageInfo();
+    if (wasLive) {
+        tailSeq_ = seq - count + 1;
+    }
+    if (!flash_.erase(pageAddress(seq))) {
+        return false;
+    }
+    erases_++;
+    return true;
+}
+
+bool WalRing::prepare() {
+    if (pages_.empty() || nextErased_ || !canReuse(headSeq_ + 1)) {
+        return false;
+    }
+    nextErased_ = erasePage(headSeq_ + 1);
+    return nextErased_;
+}
+
+void WalRing::release(uint32_t obsoleteThrough) {
+    horizon_ = std::max(horizon_, obsoleteThrough);
+}
+
+bool WalRing::openPage(uint32_t firstLsn) {
+    uint32_t seq = headSeq_ + 1;
+    if (!nextErased_) {
+        if (!canReuse(seq)) {
+            return false;
+        }
+        if (!erasePage(seq)) {
+            return false;
+        }
+    }
+    nextErased_ = false;
+
+    uint8_t header[kWalRingPageHeaderSize];
+    putLe32(header, kWalRingMagic);
+    putLe32(header + 4, seq);
+    putLe32(header + 8, firstLsn);
+    putLe32(header + 12, crc32Update(0, header, 12));
+    if (!flash_.write(pageAddress(seq), header, sizeof(header))) {
+        return false;
+    }
+    pages_[pageIndex(seq)] = PageInfo{seq, firstLsn};
+    headSeq_ = seq;
+    if (tailSeq_ == 0) {
+        tailSeq_ = seq;
+    }
+    writeOffset_ = kWalRingPageHeaderSize;
+    return true;
+}
+
+bool WalRing::append(uint32_t lsn, const uint8_t* data, size_t len) {
+    if (pages_.empty() || len > kWalRingMaxEntry) {
+        return false;
+    }
+    if (headSeq_ == 0 || writeOffset_ + kWalRingEntryHeaderSize + len > kWalRingPageSize) {
+        if (!openPage(lsn)) {
+            return false;
+        }
+    }
+
+    uint8_t header[kWalRingEntryHeaderSize];
+    putLe16(header, static_cast<uint16_t>(len));
+    putLe32(header + 2, lsn);
+    putLe32(header + 6, entryCrc(header, data, len));
+    uint32_t address = pageAddress(headSeq_) + writeOffset_;
+    if (!flash_.write(address, header, sizeof(header)) ||
+        !flash_.write(address + sizeof(header), data, len)) {
+        // The entry may be half-programmed; never write behind it.
+        writeOffset_ = kWalRingPageSize;
+        return false;
+    }
+    writeOffset_ += kWalRingEntryHeaderSize + len;
+    lastLsn_ = lsn;
+    return true;
+}
+
+WalRingPosition WalRing::start(uint32_t fromLsn) const {
+    WalRingPosition pos;
+    pos.seq = tailSeq_;
+    pos.offset = kWalRingPageHeaderSize;
+    if (empty()) {
+        return pos;
+    }
+    for (uint32_t seq = tailSeq_; seq <= headSeq_; ++seq) {
+        if (pages_[pageIndex(seq)].firstLsn > fromLsn) {
+            break;
+        }
+        pos.seq = seq;
+    }
+    return pos;
+}
+
+bool WalRing::read(WalRingPosition& pos, uint32_t& lsn, std::vector<uint8_t>& out) {
+    while (!empty() && pos.seq <= headSeq_) {
+        if (pos.seq < tailSeq_) {
+            pos.seq = tailSeq_;
+            pos.offset = kWalRingPageHeaderSize;
+        }
+        uint32_t end = pos.seq == headSeq_ ? writeOffset_ : kWalRingPageSize;
+        uint32_t base = pageAddress(pos.seq);
+        uint8_t header[kWalRingEntryHeaderSize];
+        if (pos.offset + kWalRingEntryHeaderSize <= end && flash_.read(base + pos.offset, header, sizeof(header))) {
+            uint16_t len = static_cast<uint16_t>(header[0] | (header[1] << 8));
+            if (len != kWalRingEntryErased && len <= kWalRingMaxEntry &&
+                pos.offset + kWalRingEntryHeaderSize + len <= end) {
+                out.resize(len);
+                if (flash_.read(base + pos.offset + kWalRingEntryHeaderSize, out.data(), len) &&
+                    getLe32(header + 6) == entryCrc(header, out.data(), len)) {
+                    lsn = getLe32(header + 2);
+                    pos.offset += kWalRingEntryHeaderSize + len;
+                    return true;
+                }
+            }
+        }
+        // Erased or torn: nothing further in this page can be trusted.
+        if (pos.seq == headSeq_) {
+            return false;
+        }
+        pos.seq++;
+        pos.offset = kWalRingPageHeaderSize;
+    }
+    return false;
+}
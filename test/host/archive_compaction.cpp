@@ -0,0 +1,118 @@
+// Background compaction of an archive segment: 200 orders with 80 amendments are compacted in
+// loop()-sized ticks, scans and lookups give the same answers before and after, and an amendment
+// made while a job runs aborts it until the next check retries.
+//
+//   test/host/run.sh archive_compaction
+#include "archive.h"
+#include "store.h"
+#include <LittleFS.h>
+#include <chrono>
+#include <cstdio>
+
+extern bool g_quietSerial;
+extern unsigned long g_virtualMs;
+
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const String kSession = "bench";
+
+struct Census {
+    int orders;
+    int cancelled;
+};
+
+static bool countVisitor(const Order& order, const String&, uint32_t, void* context) {
+    Census* census = static_cast<Census*>(context);
+    census->orders++;
+    if (order.status == "CANCELLED") census->cancelled++;
+    return true;
+}
+
+static Census census() {
+    Census c{0, 0};
+    archiveForEach(kSession, countVisitor, &c);
+    return c;
+}
+
+static uint32_t segmentBytes() {
+    for (const ArchiveSegmentInfo& segment : archiveListSegments()) {
+        if (segment.sessionId == kSession) return segment.bytes;
+    }
+    return 0;
+}
+
+static Order makeOrder(int n, const char* status) {
+    Order o;
+    o.orderNo = String(n);
+    o.status = status;
+    o.ts = 1760000000 + n;
+    LineItem li;
+    li.sku = "main_0001";
+    li.name = "唐揚げ丼";
+    li.qty = 1;
+    li.unitPrice = 600;
+    li.unitPriceApplied = 600;
+    o.items.push_back(li);
+    return o;
+}
+
+static void amend(int count) {
+    for (int i = 0; i < count; ++i) archiveReplaceOrder(makeOrder(i % 40, "CANCELLED"), kSession, 0);
+}
+
+// Waits out the check interval, then ticks until the job ends. appendAt/amendAt inject writes
+// at that tick. Returns the number of ticks.
+static int compact(double& workUs, int appendAt = -1, int amendAt = -1) {
+    g_virtualMs += 5100;
+    int ticks = 0;
+    workUs = 0;
+    for (; ticks < 1000; ++ticks) {
+        double started = nowUs();
+        archiveCompactTick(4);
+        workUs += nowUs() - started;
+        if (ticks == appendAt) archiveAppend(makeOrder(9000, "PICKED_UP"), kSession, 1760009000);
+        if (ticks == amendAt) archiveReplaceOrder(makeOrder(7, "CANCELLED"), kSession, 0);
+        if (ticks > 2 && !getArchiveCompactionStatus().active) break;
+    }
+    return ticks;
+}
+
+int main() {
+    g_quietSerial = true;
+    LittleFS.mkdir("/kds");
+    for (int i = 0; i < 200; ++i) archiveAppend(makeOrder(i, "PICKED_UP"), kSession, 1760000000 + i);
+    amend(80);
+    archiveFlushManifest();
+
+    Census before = census();
+    uint32_t bytesBefore = segmentBytes();
+    double workUs = 0;
+    int ticks = compact(workUs, 3);
+    Census after = census();
+    uint32_t bytesAfter = segmentBytes();
+    Order found;
+    bool lookup = archiveFindOrder(kSession, "7", found) && found.status == "CANCELLED";
+    ArchiveCompactionStatus first = getArchiveCompactionStatus();
+    printf("compaction: %u -> %u bytes in %d ticks (%.1f ms of work), kept %u dropped %u\n",
+           static_cast<unsigned>(bytesBefore), static_cast<unsigned>(bytesAfter), ticks, workUs / 1000,
+           static_cast<unsigned>(first.recordsKept), static_cast<unsigned>(first.recordsDropped));
+    printf("  before: %d orders, %d cancelled; after: %d orders, %d cancelled (one appended mid-job)\n",
+           before.orders, before.cancelled, after.orders, after.cancelled);
+
+    amend(80);
+    compact(workUs, -1, 2);
+    ArchiveCompactionStatus aborted = getArchiveCompactionStatus();
+    compact(workUs);
+    ArchiveCompactionStatus retried = getArchiveCompactionStatus();
+    printf("amendment mid-job: aborted %u, runs %u -> %u after the next check\n",
+           static_cast<unsigned>(aborted.aborted), static_cast<unsigned>(aborted.runs),
+           static_cast<unsigned>(retried.runs));
+
+    bool ok = first.runs == 1 && bytesAfter < bytesBefore && after.orders == before.orders + 1 &&
+              after.cancelled == before.cancelled && lookup && aborted.aborted == 1 &&
+              retried.runs == aborted.runs + 1 && census().orders == after.orders;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
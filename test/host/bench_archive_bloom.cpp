@@ -0,0 +1,189 @@
+// Archive existence checks with the per-session Bloom filter: 2000 orders are archived into one
+// segment, then each boot below runs in a forked child so it starts from flash alone.
+//   - misses and hits through archiveOrderExists(), against the index walk every miss cost before
+//     the filter (archiveFindOrder() still takes that path), in bytes read and us per check;
+//   - false positives over 10000 misses;
+//   - a reboot must restore the filter from the snapshot instead of rebuilding it from the index;
+//   - recovery after the second half of the segment and its index is lost, so replay re-archives
+//     those 1000 orders and checks each one first.
+//
+//   test/host/run.sh bench_archive_bloom
+#include "archive.h"
+#include "store.h"
+#include "wal.h"
+#include <LittleFS.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern bool g_quietSerial;
+extern std::string g_fsRoot;
+namespace fs {
+extern unsigned long g_fsReadBytes;
+}
+
+static const int kOrders = 2000;
+static const int kMisses = 10000;
+static const String kSession = "S1";
+
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double boot() {
+    LittleFS.mkdir("/kds");
+    walBegin();
+    double started = nowUs();
+    beginRecovery();
+    while (!stepRecovery(0)) {
+    }
+    return nowUs() - started;
+}
+
+static uint32_t fileSize(const char* path) {
+    File f = LittleFS.open(path, "r");
+    uint32_t size = f ? f.size() : 0;
+    f.close();
+    return size;
+}
+
+// Archives kOrders orders through the WAL. With loseSecondHalf the segment and its index are cut
+// back to the first half afterwards, as if those writes never reached flash.
+static bool populate(bool loseSecondHalf) {
+    boot();
+    S().session.sessionId = kSession;
+    snapshotSave();
+    for (int n = 1; n <= kOrders; ++n) {
+        Order o;
+        o.orderNo = String(n);
+        o.status = "DONE";
+        o.ts = 1760000000 + n;
+        LineItem li;
+        li.sku = "main_0001";
+        li.name = "唐揚げ丼";
+        li.qty = 1;
+        li.unitPrice = 600;
+        li.unitPriceApplied = 600;
+        li.priceMode = "normal";
+        li.kind = "MAIN";
+        o.items.push_back(li);
+        uint32_t ticket = 0;
+        commitOrderCreate(o, &ticket);
+        archiveOrderAndRemove(o.orderNo, kSession, 1760003000 + n, true);
+        walTick();
+    }
+    walFlush();
+    archiveFlushManifest();
+    if (!loseSecondHalf) return true;
+
+    // Index entries are 8 bytes after an 8-byte header: key, then the record's offset.
+    const char* indexPath = "/kds/archive/S1.idx";
+    uint32_t keep = 8 + (kOrders / 2) * 8;
+    File index = LittleFS.open(indexPath, "r");
+    uint8_t entry[8] = {};
+    bool read = index && index.seek(keep) && index.read(entry, sizeof(entry)) == sizeof(entry);
+    index.close();
+    uint32_t offset = entry[4] | (entry[5] << 8) | (entry[6] << 16) | (static_cast<uint32_t>(entry[7]) << 24);
+    return read && truncate((g_fsRoot + "/kds/archive/S1.jsonl").c_str(), offset) == 0 &&
+           truncate((g_fsRoot + indexPath).c_str(), keep) == 0;
+}
+
+static bool probe() {
+    boot();
+    S().session.sessionId = kSession;
+    bool ok = true;
+    for (int pass = 1; pass <= 2; ++pass) {
+        unsigned long read = fs::g_fsReadBytes;
+        double started = nowUs();
+        int found = 0;
+        for (int i = 0; i < kOrders; ++i) {
+            Order o;
+            found += archiveFindOrder(kSession, String(100000 + i), o);
+        }
+        double walkUs = (nowUs() - started) / kOrders;
+        unsigned long walkBytes = (fs::g_fsReadBytes - read) / kOrders;
+
+        read = fs::g_fsReadBytes;
+        started = nowUs();
+        for (int i = 0; i < kOrders; ++i) found += archiveOrderExists(kSession, String(100000 + i));
+        double missUs = (nowUs() - started) / kOrders;
+        unsigned long missBytes = (fs::g_fsReadBytes - read) / kOrders;
+
+        read = fs::g_fsReadBytes;
+        started = nowUs();
+        int hits = 0;
+        for (int n = 1; n <= kOrders; ++n) hits += archiveOrderExists(kSession, String(n));
+        double hitUs = (nowUs() - started) / kOrders;
+        unsigned long hitBytes = (fs::g_fsReadBytes - read) / kOrders;
+
+        printf("pass %d: miss %5lu B, %5.1f us via the index, %5lu B, %5.1f us with the filter; hit %5lu B, %5.1f us\n",
+               pass, walkBytes, walkUs, missBytes, missUs, hitBytes, hitUs);
+        // False positives still walk the index, so the average is small rather than zero.
+        ok = ok && found == 0 && hits == kOrders && missBytes * 100 < walkBytes;
+    }
+
+    ArchiveBloomStats before = getArchiveBloomStats();
+    int found = 0;
+    for (int i = 0; i < kMisses; ++i) found += archiveOrderExists(kSession, String(200000 + i));
+    ArchiveBloomStats after = getArchiveBloomStats();
+    printf("filter %u B, %u false positives in %d misses\n", static_cast<unsigned>(after.bytes),
+           static_cast<unsigned>(after.falsePositives - before.falsePositives), kMisses);
+    snapshotSave();
+    return ok && found == 0 && after.filters == 1;
+}
+
+static bool reboot() {
+    boot();
+    unsigned long read = fs::g_fsReadBytes;
+    bool found = archiveOrderExists(kSession, "100000");
+    ArchiveBloomStats stats = getArchiveBloomStats();
+    printf("reboot: filter restored %u, rebuilt %u, first miss %lu B\n", static_cast<unsigned>(stats.restored),
+           static_cast<unsigned>(stats.rebuilds), fs::g_fsReadBytes - read);
+    return !found && stats.restored == 1 && stats.rebuilds == 0;
+}
+
+static bool replay() {
+    uint32_t before = fileSize("/kds/archive/S1.idx") / 8 - 1;
+    unsigned long read = fs::g_fsReadBytes;
+    double us = boot();
+    uint32_t archived = 0;
+    for (const ArchiveSegmentInfo& s : archiveListSegments()) archived += s.orders;
+    ArchiveBloomStats stats = getArchiveBloomStats();
+    printf("replay after losing the second half: %u -> %u archived, %.1f MB read, %.0f ms; "
+           "%u checks, %u definite misses, %u false positives\n",
+           static_cast<unsigned>(before), static_cast<unsigned>(archived), (fs::g_fsReadBytes - read) / 1e6,
+           us / 1000, static_cast<unsigned>(stats.checks), static_cast<unsigned>(stats.definitelyNot),
+           static_cast<unsigned>(stats.falsePositives));
+    return archived == static_cast<uint32_t>(kOrders) && S().orders.empty();
+}
+
+// Each step boots in its own process, the way a power cycle would.
+static bool inChild(bool (*step)()) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        bool ok = step();
+        fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main() {
+    g_quietSerial = true;
+    const std::string root = g_fsRoot;
+    printf("%d archived orders in one segment\n", kOrders);
+    bool ok = inChild([] { return populate(false); });
+    ok = ok && inChild(probe) && inChild(reboot);
+
+    g_fsRoot = root + "/lost";
+    mkdir(g_fsRoot.c_str(), 0755);
+    ok = ok && inChild([] { return populate(true); }) && inChild(replay);
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
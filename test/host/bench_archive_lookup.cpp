@@ -0,0 +1,100 @@
+// Archive lookups by orderNo through the sidecar index, against a full parse of the session's
+// segment (archiveForEach), with 500, 5,000 and 20,000 archived orders. Misses go through
+// archiveOrderExists(), which the Bloom filter should answer without reading flash.
+//
+//   test/host/run.sh bench_archive_lookup
+#include "archive.h"
+#include "store.h"
+#include <LittleFS.h>
+#include <chrono>
+#include <cstdio>
+
+extern bool g_quietSerial;
+
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t g_rng = 11;
+static uint32_t rnd() {
+    g_rng = g_rng * 1103515245 + 12345;
+    return g_rng >> 8;
+}
+
+static Order makeOrder(int n) {
+    Order o;
+    o.orderNo = String(n);
+    o.status = "PICKED_UP";
+    o.ts = 1760000000 + n;
+    o.picked_up = true;
+    int lines = 1 + rnd() % 4;
+    for (int i = 0; i < lines; ++i) {
+        LineItem li;
+        li.sku = "main_000" + String(1 + rnd() % 5);
+        li.name = "唐揚げ丼";
+        li.qty = 1 + rnd() % 3;
+        li.unitPrice = 600;
+        li.unitPriceApplied = 600;
+        li.priceMode = "normal";
+        li.kind = "MAIN";
+        o.items.push_back(li);
+    }
+    return o;
+}
+
+struct ScanTarget {
+    String orderNo;
+    bool found;
+};
+
+static bool scanVisitor(const Order& order, const String&, uint32_t, void* context) {
+    ScanTarget* target = static_cast<ScanTarget*>(context);
+    if (order.orderNo == target->orderNo) {
+        target->found = true;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    g_quietSerial = true;
+    LittleFS.mkdir("/kds");
+    const String session = "bench";
+    const int lookups = 50;
+    int archived = 0;
+    bool ok = true;
+    printf("archived   indexed   full scan   miss (exists)\n");
+    for (int size : {500, 5000, 20000}) {
+        while (archived < size) {
+            ++archived;
+            archiveAppend(makeOrder(archived), session, 1760000000 + archived);
+        }
+        archiveFlushManifest();
+
+        double indexed = 0;
+        double scanned = 0;
+        double missed = 0;
+        for (int i = 0; i < lookups; ++i) {
+            String orderNo(1 + static_cast<int>(rnd() % size));
+            Order found;
+            double started = nowUs();
+            bool hit = archiveFindOrder(session, orderNo, found);
+            indexed += nowUs() - started;
+
+            ScanTarget target{orderNo, false};
+            started = nowUs();
+            archiveForEach(session, scanVisitor, &target);
+            scanned += nowUs() - started;
+
+            started = nowUs();
+            bool phantom = archiveOrderExists(session, String(1000000 + i));
+            missed += nowUs() - started;
+
+            if (!hit || found.orderNo != orderNo || !target.found || phantom) ok = false;
+        }
+        printf("%8d %7.0f us %8.2f ms %9.1f us\n", size, indexed / lookups, scanned / lookups / 1000,
+               missed / lookups);
+    }
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+// Snapshot cadence over four hours of virtual service: quiet stretches with an order every
+// 30-270 s, two 40-minute rushes, and a settings change (requestSnapshotSave()) every 30 minutes.
+// The loop polls the way loop() does, either through the checkpoint scheduler or through the
+// fixed 30 s timer it replaced (emulated below), and the whole day runs again at ten times the
+// rush rate. Reports snapshots, snapshot flash and how much WAL sat outside any snapshot.
+//
+//   test/host/run.sh bench_checkpoints
+#include "checkpoint_scheduler.h"
+#include "flash_stats.h"
+#include "store.h"
+#include "wal.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+extern bool g_quietSerial;
+extern unsigned long g_virtualMs;
+extern std::string g_fsRoot;
+
+static const uint32_t kServiceMs = 4 * 3600 * 1000;
+static const uint32_t kStepMs = 10;
+static const uint32_t kOldSnapshotIntervalMs = 30000;
+
+struct Scenario {
+    const char* label;
+    bool scheduler;
+    // Rush orders arrive every rushGapMs to 7 x rushGapMs.
+    uint32_t rushGapMs;
+};
+
+static uint32_t g_rng = 5;
+static uint32_t rnd() {
+    g_rng = g_rng * 1103515245 + 12345;
+    return g_rng >> 8;
+}
+
+static Order makeOrder(int n) {
+    Order o;
+    o.orderNo = String(n);
+    o.status = "COOKING";
+    o.ts = 1760000000 + n;
+    int lines = 1 + rnd() % 3;
+    for (int i = 0; i < lines; ++i) {
+        LineItem li;
+        li.sku = "main_0001";
+        li.name = "唐揚げ丼";
+        li.qty = 1;
+        li.unitPrice = 600;
+        li.unitPriceApplied = 600;
+        li.priceMode = "normal";
+        li.kind = "MAIN";
+        o.items.push_back(li);
+    }
+    return o;
+}
+
+static void appendDurable(const WalRecord& record) {
+    WalTicket ticket = 0;
+    walAppend(record, &ticket);
+    walWaitDurable(ticket);
+}
+
+static uint32_t walBytes() {
+    WalStats w = getWalStats();
+    return w.bytesWritten + w.pendingBytes;
+}
+
+static bool run(const Scenario& scenario) {
+    LittleFS.mkdir("/kds");
+    walBegin();
+    beginRecovery();
+    while (!stepRecovery(0)) {
+    }
+    S().session.sessionId = "S1";
+    checkpointBegin();
+
+    FlashSubsystemStats snapshotBefore = getFlashStats(kFlashSnapshot);
+    FlashSubsystemStats walBefore = getFlashStats(kFlashWal);
+    uint32_t savesBefore = getSnapshotStats().saves;
+    uint32_t lastSaves = savesBefore;
+    uint32_t lastSnapshotMs = millis();
+    uint32_t coveredWal = walBytes();
+    uint32_t nextOrderMs = 60000;
+    uint32_t rotations = 0;
+    uint64_t dirtySum = 0;
+    uint32_t dirtyMax = 0;
+    uint32_t samples = 0;
+    int orders = 0;
+
+    for (uint32_t t = 0; t < kServiceMs; t += kStepMs) {
+        g_virtualMs += kStepMs;
+        uint32_t minute = t / 60000;
+        bool rush = (minute >= 60 && minute < 100) || (minute >= 170 && minute < 210);
+        if (minute < 225 && t >= nextOrderMs) {
+            Order o = makeOrder(++orders);
+            S().orders.push_back(o);
+            WalRecord create;
+            create.action = kWalOrderCreate;
+            create.ts = o.ts;
+            create.orderNo = o.orderNo;
+            create.order = o;
+            create.hasOrder = true;
+            appendDurable(create);
+            // Keep about 30 open orders, as the kitchen clears them.
+            if (S().orders.size() > 30) {
+                WalRecord cancel;
+                cancel.action = kWalOrderCancel;
+                cancel.ts = o.ts;
+                cancel.orderNo = S().orders.front().orderNo;
+                appendDurable(cancel);
+                S().orders.erase(S().orders.begin());
+            }
+            nextOrderMs = t + (rush ? scenario.rushGapMs + rnd() % (scenario.rushGapMs * 6) : 30000 + rnd() % 240000);
+        }
+        if (t && t % (30 * 60000) == 0) {
+            requestSnapshotSave();
+        }
+        walTick();
+
+        bool ok = false;
+        if (snapshotPoll(ok)) {
+            if (scenario.scheduler) {
+                checkpointFinished(ok);
+            }
+            uint32_t obsoleteThrough = 0;
+            if (ok && getOldestSnapshotCheckpoint(obsoleteThrough)) {
+                walRotate(obsoleteThrough);
+                rotations++;
+            }
+        }
+        if (!isSnapshotSaveInFlight()) {
+            if (scenario.scheduler) {
+                CheckpointReason reason = checkpointPoll();
+                if (reason != kCheckpointNone) {
+                    checkpointStarted(reason, snapshotSaveAsync());
+                }
+            } else if (consumeSnapshotSaveRequest() || millis() - lastSnapshotMs >= kOldSnapshotIntervalMs) {
+                // loop() before the scheduler: every request at once, and a snapshot every 30 s.
+                snapshotSaveAsync();
+                lastSnapshotMs = millis();
+            }
+        }
+        // The write runs on the snapshot task; virtual time stands still until it is done.
+        while (isSnapshotSaveInFlight()) {
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+
+        if (t % 1000 == 0) {
+            if (getSnapshotStats().saves != lastSaves) {
+                lastSaves = getSnapshotStats().saves;
+                coveredWal = walBytes();
+            }
+            uint32_t dirty = walBytes() - coveredWal;
+            dirtySum += dirty;
+            dirtyMax = std::max(dirtyMax, dirty);
+            samples++;
+        }
+    }
+
+    uint32_t saves = getSnapshotStats().saves - savesBefore;
+    uint32_t walKb = (getFlashStats(kFlashWal).bytesWritten - walBefore.bytesWritten) / 1024;
+    uint32_t snapshotKb = (getFlashStats(kFlashSnapshot).bytesWritten - snapshotBefore.bytesWritten) / 1024;
+    printf("%-22s %5d orders, %4u KB WAL; %3u snapshots, %5u KB snapshot flash, %3u rotations; "
+           "WAL outside a snapshot avg %4.1f KB, max %4.1f KB\n",
+           scenario.label, orders, static_cast<unsigned>(walKb), static_cast<unsigned>(saves),
+           static_cast<unsigned>(snapshotKb), static_cast<unsigned>(rotations), dirtySum / 1024.0 / samples,
+           dirtyMax / 1024.0);
+    if (!scenario.scheduler) {
+        return saves > 0;
+    }
+    CheckpointStats c = getCheckpointStats();
+    printf("%-22s reasons:", "");
+    for (int i = 1; i < kCheckpointReasonCount; ++i) {
+        printf(" %s %u", checkpointReasonName(i), static_cast<unsigned>(c.started[i]));
+    }
+    printf("; clean skips %u, postponed %u, failures %u\n", static_cast<unsigned>(c.cleanSkips),
+           static_cast<unsigned>(c.postponed), static_cast<unsigned>(c.failures));
+    // Twice KDS_CHECKPOINT_WAL_BYTES forces a checkpoint mid-burst; one rush step of slack.
+    return c.failures == 0 && dirtyMax <= 2 * KDS_CHECKPOINT_WAL_BYTES + 1024;
+}
+
+int main() {
+    g_quietSerial = true;
+    const Scenario scenarios[] = {{"30 s timer", false, 1000},
+                                  {"scheduler", true, 1000},
+                                  {"10x rush rate, timer", false, 100},
+                                  {"10x rush rate, sched", true, 100}};
+    const std::string root = g_fsRoot;
+    bool ok = true;
+    int index = 0;
+    for (const Scenario& scenario : scenarios) {
+        // Each scenario starts from an empty flash and the same order stream.
+        g_fsRoot = root + "/" + std::to_string(index++);
+        mkdir(g_fsRoot.c_str(), 0755);
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            bool passed = run(scenario);
+            fflush(stdout);
+            _exit(passed ? 0 : 1);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
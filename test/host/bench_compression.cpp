@@ -0,0 +1,237 @@
+// Block-compressed storage on a day of archive: 650 orders (1-4 lines, Japanese item names) and
+// 12 amendments. Reports segment size, full-scan and indexed-lookup time before and after the
+// compactor rewrites the sealed segment, the cost of that rewrite, raw codec throughput on the
+// segment's JSONL, and the stored size of a snapshot with 40 open orders. Also checks that an
+// amendment to the compressed segment and a snapshot reload still work.
+//
+//   test/host/run.sh bench_compression -DKDS_COMPRESSED_STORAGE=1 -O2
+#include "archive.h"
+#include "flash_stats.h"
+#include "lz_block.h"
+#include "store.h"
+#include "wal.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if !KDS_COMPRESSED_STORAGE
+#error "build with -DKDS_COMPRESSED_STORAGE=1"
+#endif
+
+extern bool g_quietSerial;
+extern unsigned long g_virtualMs;
+
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t g_rng = 12345;
+static uint32_t rnd() {
+    g_rng = g_rng * 1103515245 + 12345;
+    return g_rng >> 8;
+}
+
+struct MenuEntry {
+    const char* sku;
+    const char* name;
+    int price;
+    const char* kind;
+};
+
+static const MenuEntry kMains[] = {{"main_0001", "唐揚げ丼", 600, "MAIN"},
+                                   {"main_0002", "焼きそば", 500, "MAIN"},
+                                   {"main_0003", "たこ焼き 8個", 450, "MAIN"},
+                                   {"main_0004", "カレーライス", 650, "MAIN"},
+                                   {"main_0005", "フランクフルト", 300, "MAIN"}};
+static const MenuEntry kSides[] = {{"side_0001", "ポテト", 200, "SIDE_SINGLE"},
+                                   {"side_0002", "ラムネ", 150, "SIDE_SINGLE"},
+                                   {"side_0003", "お茶", 120, "SIDE_SINGLE"},
+                                   {"side_0004", "チュロス", 250, "SIDE_SINGLE"}};
+
+static const int kOrders = 650;
+static const String kSession = "2026-10-16-A";
+
+static Order makeOrder(int n) {
+    Order o;
+    o.orderNo = String(n);
+    o.status = (rnd() % 40 == 0) ? "CANCELLED" : "COOKING";
+    if (o.status == "CANCELLED") o.cancelReason = "お客様都合";
+    o.ts = 1760587200 + n * 55 + rnd() % 30;
+    o.printed = true;
+    o.cooked = true;
+    o.pickup_called = true;
+    o.picked_up = o.status != "CANCELLED";
+    int lines = 1 + rnd() % 4;
+    for (int i = 0; i < lines; ++i) {
+        const MenuEntry& m = (i == 0 || rnd() % 2) ? kMains[rnd() % 5] : kSides[rnd() % 4];
+        LineItem li;
+        li.sku = m.sku;
+        li.name = m.name;
+        li.qty = 1 + rnd() % 3;
+        li.unitPrice = m.price;
+        li.priceMode = (rnd() % 5 == 0) ? "presale" : "normal";
+        li.unitPriceApplied = li.priceMode == "presale" ? m.price - 50 : m.price;
+        li.kind = m.kind;
+        if (rnd() % 10 == 0) {
+            li.discountName = "セット割";
+            li.discountValue = 50;
+        }
+        o.items.push_back(li);
+    }
+    return o;
+}
+
+static ArchiveSegmentInfo segment() {
+    return archiveListSegments().front();
+}
+
+struct ScanTotals {
+    uint32_t orders;
+    uint64_t checksum;
+};
+
+static bool scanVisitor(const Order& order, const String&, uint32_t, void* context) {
+    ScanTotals* totals = static_cast<ScanTotals*>(context);
+    totals->orders++;
+    totals->checksum += order.ts + order.items.size();
+    return true;
+}
+
+// Averages 20 full scans and 2,000 lookups of random orders; the totals let the caller compare
+// what the two layouts returned.
+static bool measure(const char* label, ScanTotals& totals) {
+    const int scans = 20;
+    const int lookups = 2000;
+    double started = nowUs();
+    for (int i = 0; i < scans; ++i) {
+        totals = ScanTotals{0, 0};
+        archiveForEach(kSession, scanVisitor, &totals);
+    }
+    double scanUs = (nowUs() - started) / scans;
+
+    uint32_t lookupRng = 777;
+    int found = 0;
+    started = nowUs();
+    for (int i = 0; i < lookups; ++i) {
+        lookupRng = lookupRng * 1103515245 + 12345;
+        Order o;
+        if (archiveFindOrder(kSession, String(1 + (lookupRng >> 8) % kOrders), o)) found++;
+    }
+    double lookupUs = (nowUs() - started) / lookups;
+
+    ArchiveSegmentInfo s = segment();
+    printf("%-10s %7u bytes on flash (%u raw), scan %6.0f us (%4.1f MB/s), lookup %5.1f us\n", label,
+           static_cast<unsigned>(s.bytes), static_cast<unsigned>(s.rawBytes), scanUs, s.rawBytes / scanUs, lookupUs);
+    return found == lookups && totals.orders == static_cast<uint32_t>(kOrders);
+}
+
+static std::vector<uint8_t> readFile(const String& path) {
+    File f = LittleFS.open(path, "r");
+    std::vector<uint8_t> data(f.size());
+    f.read(data.data(), data.size());
+    f.close();
+    return data;
+}
+
+// lzCompressBlock/lzDecompressBlock over the raw JSONL, block by block, 20 times.
+static bool codec(const std::vector<uint8_t>& raw) {
+    std::vector<uint8_t> packed(kLzBlockSize);
+    std::vector<uint8_t> back(kLzBlockSize);
+    std::vector<uint16_t> table(1 << kLzHashBits);
+    size_t stored = 0;
+    double compressUs = 0;
+    double decompressUs = 0;
+    bool ok = true;
+    const int reps = 20;
+    for (int rep = 0; rep < reps; ++rep) {
+        for (size_t off = 0; off < raw.size(); off += kLzBlockSize) {
+            size_t len = std::min(kLzBlockSize, raw.size() - off);
+            double started = nowUs();
+            size_t packedLen = lzCompressBlock(raw.data() + off, len, packed.data(), len - 1, table.data());
+            compressUs += nowUs() - started;
+            if (rep == 0) stored += packedLen ? packedLen : len;
+            if (!packedLen) continue;
+            started = nowUs();
+            ok = lzDecompressBlock(packed.data(), packedLen, back.data(), len) && ok;
+            decompressUs += nowUs() - started;
+            ok = ok && memcmp(back.data(), raw.data() + off, len) == 0;
+        }
+    }
+    printf("codec      %zu -> %zu bytes (%.0f%%), compress %.0f MB/s, decompress %.0f MB/s\n", raw.size(), stored,
+           100.0 * stored / raw.size(), raw.size() * reps / compressUs, raw.size() * reps / decompressUs);
+    return ok;
+}
+
+int main() {
+    g_quietSerial = true;
+    LittleFS.mkdir("/kds");
+    walBegin();
+    beginRecovery();
+    while (!stepRecovery(0)) {
+    }
+    S().session.sessionId = kSession;
+
+    for (int n = 1; n <= kOrders; ++n) {
+        Order o = makeOrder(n);
+        archiveAppend(o, kSession, o.ts + 900);
+    }
+    for (int i = 0; i < 12; ++i) {
+        Order o;
+        if (archiveFindOrder(kSession, String(1 + rnd() % kOrders), o)) {
+            o.status = "CANCELLED";
+            o.cancelReason = "返金";
+            archiveReplaceOrder(o, kSession, 0);
+        }
+    }
+    archiveFlushManifest();
+    std::vector<uint8_t> raw = readFile(segment().path);
+
+    ScanTotals plain{0, 0};
+    bool ok = measure("plain", plain);
+
+    archiveSealSession(kSession);
+    uint32_t rewriteBefore = getFlashStats(kFlashArchiveCompaction).bytesWritten;
+    g_virtualMs += 5100;
+    double cpuUs = 0;
+    int ticks = 0;
+    while (!segment().compressed && ticks < 100000) {
+        double started = nowUs();
+        archiveCompactTick(4);
+        cpuUs += nowUs() - started;
+        ticks++;
+    }
+    printf("rewrite    %d ticks, %.1f ms CPU, %u bytes written\n", ticks, cpuUs / 1000,
+           static_cast<unsigned>(getFlashStats(kFlashArchiveCompaction).bytesWritten - rewriteBefore));
+
+    ScanTotals compressed{0, 0};
+    ok = segment().compressed && measure("compressed", compressed) && ok;
+    ok = ok && compressed.checksum == plain.checksum && segment().bytes < segment().rawBytes;
+    ok = codec(raw) && ok;
+
+    Order amended;
+    archiveFindOrder(kSession, "5", amended);
+    amended.status = "CANCELLED";
+    bool amendOk = archiveReplaceOrder(amended, kSession, 0) && archiveFindOrder(kSession, "5", amended) &&
+                   amended.status == "CANCELLED";
+
+    for (int i = 1; i <= 40; ++i) S().orders.push_back(makeOrder(10000 + i));
+    snapshotSave();
+    const SnapshotStats& snapshot = getSnapshotStats();
+    printf("snapshot   40 open orders: %u bytes raw, %u stored\n", static_cast<unsigned>(snapshot.lastBytes),
+           static_cast<unsigned>(snapshot.lastStoredBytes));
+    bool snapshotSmaller = snapshot.lastStoredBytes < snapshot.lastBytes;
+    S().orders.clear();
+    beginRecovery();
+    while (!stepRecovery(0)) {
+    }
+    bool reloaded = S().orders.size() == 40;
+    printf("amendment to the compressed segment %s, snapshot reload %s\n", amendOk ? "ok" : "failed",
+           reloaded ? "ok" : "failed");
+
+    ok = ok && amendOk && snapshotSmaller && reloaded;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+// Per-level acknowledgement latency of a mutation: walAppend() followed by the wait that
+// persistMutation() in server_routes.cpp does for the configured durability level.
+// Measured with 50, 150 and 300 open orders, since the snapshot level rewrites all of them.
+//
+//   test/host/run.sh bench_durability
+#include "store.h"
+#include "wal.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+extern bool g_quietSerial;
+
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t g_rng = 7;
+static uint32_t rnd() {
+    g_rng = g_rng * 1103515245 + 12345;
+    return g_rng >> 8;
+}
+
+static Order makeOrder(int n) {
+    Order o;
+    o.orderNo = String(n);
+    o.status = "COOKING";
+    o.ts = 1760000000 + n;
+    int lines = 1 + rnd() % 4;
+    for (int i = 0; i < lines; ++i) {
+        LineItem li;
+        li.sku = "main_000" + String(1 + rnd() % 5);
+        li.name = "唐揚げ丼";
+        li.qty = 1 + rnd() % 3;
+        li.unitPrice = 600;
+        li.unitPriceApplied = 600;
+        li.priceMode = "normal";
+        li.kind = "MAIN";
+        o.items.push_back(li);
+    }
+    return o;
+}
+
+// Same wait as persistMutation() without the HTTP side.
+static bool persist(uint8_t level, WalTicket ticket, bool appended) {
+    if (!appended) return false;
+    if (level == kDurabilitySnapshot) return walWaitDurable(ticket) && snapshotSave();
+    if (level == kDurabilityWal) return walWaitDurable(ticket);
+    return true;
+}
+
+int main() {
+    g_quietSerial = true;
+    LittleFS.mkdir("/kds");
+    walBegin();
+    beginRecovery();
+    stepRecovery(0);
+
+    const int reps = 20;
+    int next = 0;
+    for (int open : {50, 150, 300}) {
+        while (static_cast<int>(S().orders.size()) < open) S().orders.push_back(makeOrder(++next));
+        printf("%3d open:", open);
+        for (uint8_t level = 0; level < kDurabilityLevelCount; ++level) {
+            double total = 0;
+            double worst = 0;
+            int failed = 0;
+            for (int i = 0; i < reps; ++i) {
+                Order o = makeOrder(800000 + next + i);
+                WalRecord rec;
+                rec.action = kWalOrderCreate;
+                rec.order = o;
+                rec.orderNo = o.orderNo;
+                rec.hasOrder = true;
+                double started = nowUs();
+                WalTicket ticket = 0;
+                bool appended = walAppend(rec, &ticket);
+                if (!persist(level, ticket, appended)) failed++;
+                double elapsed = nowUs() - started;
+                total += elapsed;
+                worst = std::max(worst, elapsed);
+                walTick();
+            }
+            next += reps;
+            printf("  %-8s avg %7.0f us max %7.0f%s", durabilityLevelName(level), total / reps, worst,
+                   failed ? " (failures)" : "");
+        }
+        printf("\n");
+    }
+    return 0;
+}
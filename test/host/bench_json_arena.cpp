@@ -0,0 +1,348 @@
+// Heap churn and fragmentation from per-record JsonDocuments, with and without the pooled arenas.
+// malloc is replaced by a first-fit, address-ordered heap (below) so holes show up the way they do
+// on the ESP32. 800 archived orders plus 60 amendments are scanned three times through a streaming
+// visitor while a bystander task keeps a small allocation every 16 records, half of which it frees
+// after each scan. "heap" holds every arena for the whole run, so each document falls back to the
+// heap allocator as it did before the arenas; each mode runs in a child forked from the same heap.
+//
+// The stub ArduinoJson is several times larger per value than the real library, so the arenas
+// are enlarged to match; on the device the 6 KiB default applies.
+//
+//   test/host/run.sh bench_json_arena -DKDS_JSON_ARENA_BYTES=32768
+#include "archive.h"
+#include "json_arena.h"
+#include "store.h"
+#include "wal.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern bool g_quietSerial;
+
+// ---- first-fit heap -------------------------------------------------------------------------
+
+static const size_t kSimHeapBytes = 256u << 20;
+static const size_t kSimHeader = 16;
+alignas(64) static unsigned char g_simHeap[kSimHeapBytes];
+static size_t g_simTop = 0;
+static unsigned long g_simMallocs = 0;
+
+struct SimFreeBlock {
+    size_t size;
+    SimFreeBlock* next;
+};
+static SimFreeBlock* g_simFree = nullptr;
+static std::atomic_flag g_simLock = ATOMIC_FLAG_INIT;
+
+struct SimHeapLock {
+    SimHeapLock() {
+        while (g_simLock.test_and_set(std::memory_order_acquire)) {
+        }
+    }
+    ~SimHeapLock() { g_simLock.clear(std::memory_order_release); }
+};
+
+static size_t roundUp(size_t n) {
+    return (n + 15) & ~size_t(15);
+}
+
+// Blocks start with their size; word 1 holds the alignment offset of the user pointer.
+static void* simTake(size_t need) {
+    SimFreeBlock** link = &g_simFree;
+    for (SimFreeBlock* b = g_simFree; b; link = &b->next, b = b->next) {
+        if (b->size < need) continue;
+        if (b->size - need >= 48) {
+            SimFreeBlock* rest = reinterpret_cast<SimFreeBlock*>(reinterpret_cast<unsigned char*>(b) + need);
+            rest->size = b->size - need;
+            rest->next = b->next;
+            *link = rest;
+            b->size = need;
+        } else {
+            *link = b->next;
+        }
+        return b;
+    }
+    if (g_simTop + need > kSimHeapBytes) return nullptr;
+    void* p = g_simHeap + g_simTop;
+    g_simTop += need;
+    *static_cast<size_t*>(p) = need;
+    return p;
+}
+
+static void simGive(unsigned char* block) {
+    size_t size = *reinterpret_cast<size_t*>(block);
+    SimFreeBlock* prev = nullptr;
+    SimFreeBlock* cur = g_simFree;
+    while (cur && reinterpret_cast<unsigned char*>(cur) < block) {
+        prev = cur;
+        cur = cur->next;
+    }
+    SimFreeBlock* b = reinterpret_cast<SimFreeBlock*>(block);
+    b->size = size;
+    b->next = cur;
+    if (prev) {
+        prev->next = b;
+    } else {
+        g_simFree = b;
+    }
+    if (cur && block + b->size == reinterpret_cast<unsigned char*>(cur)) {
+        b->size += cur->size;
+        b->next = cur->next;
+    }
+    if (prev && reinterpret_cast<unsigned char*>(prev) + prev->size == block) {
+        prev->size += b->size;
+        prev->next = b->next;
+        b = prev;
+    }
+    if (reinterpret_cast<unsigned char*>(b) + b->size == g_simHeap + g_simTop) {
+        g_simTop -= b->size;
+        SimFreeBlock** link = &g_simFree;
+        while (*link != b) link = &(*link)->next;
+        *link = nullptr;
+    }
+}
+
+extern "C" {
+void* malloc(size_t n) {
+    SimHeapLock lock;
+    g_simMallocs++;
+    unsigned char* b = static_cast<unsigned char*>(simTake(roundUp(n ? n : 1) + kSimHeader));
+    if (!b) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    reinterpret_cast<size_t*>(b)[1] = 0;
+    return b + kSimHeader;
+}
+
+void free(void* p) {
+    if (!p) return;
+    SimHeapLock lock;
+    unsigned char* h = static_cast<unsigned char*>(p) - kSimHeader;
+    simGive(h - reinterpret_cast<size_t*>(h)[1]);
+}
+
+void* calloc(size_t count, size_t n) {
+    void* p = malloc(count * n);
+    if (p) memset(p, 0, count * n);
+    return p;
+}
+
+size_t malloc_usable_size(void* p) {
+    unsigned char* h = static_cast<unsigned char*>(p) - kSimHeader;
+    size_t offset = reinterpret_cast<size_t*>(h)[1];
+    return *reinterpret_cast<size_t*>(h - offset) - kSimHeader - offset;
+}
+
+void* realloc(void* p, size_t n) {
+    if (!p) return malloc(n);
+    if (!n) {
+        free(p);
+        return nullptr;
+    }
+    size_t have = malloc_usable_size(p);
+    if (n <= have) return p;
+    void* q = malloc(n);
+    if (q) {
+        memcpy(q, p, have);
+        free(p);
+    }
+    return q;
+}
+
+void* memalign(size_t alignment, size_t n) {
+    if (alignment <= 16) return malloc(n);
+    unsigned char* raw = static_cast<unsigned char*>(malloc(n + alignment + kSimHeader));
+    if (!raw) return nullptr;
+    unsigned char* block = raw - kSimHeader;
+    unsigned char* aligned =
+        reinterpret_cast<unsigned char*>((reinterpret_cast<uintptr_t>(raw) + alignment) & ~(uintptr_t)(alignment - 1));
+    reinterpret_cast<size_t*>(aligned - kSimHeader)[1] = (aligned - kSimHeader) - block;
+    return aligned;
+}
+
+int posix_memalign(void** out, size_t alignment, size_t n) {
+    void* p = memalign(alignment, n);
+    if (!p) return ENOMEM;
+    *out = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t n) {
+    return memalign(alignment, n);
+}
+
+void* valloc(size_t n) {
+    return memalign(4096, n);
+}
+
+void* pvalloc(size_t n) {
+    return memalign(4096, (n + 4095) & ~size_t(4095));
+}
+}
+
+struct SimHeapStats {
+    size_t top;
+    size_t holes;
+    size_t holeBytes;
+    size_t largestHole;
+};
+
+// top is the span in use; free blocks below it are what fragmentation leaves behind.
+static SimHeapStats simHeapStats() {
+    SimHeapLock lock;
+    SimHeapStats stats{g_simTop, 0, 0, 0};
+    for (SimFreeBlock* b = g_simFree; b; b = b->next) {
+        stats.holes++;
+        stats.holeBytes += b->size;
+        stats.largestHole = std::max(stats.largestHole, b->size);
+    }
+    return stats;
+}
+
+// ---- workload -------------------------------------------------------------------------------
+
+static uint32_t g_rng = 11;
+static uint32_t rnd() {
+    g_rng = g_rng * 1103515245 + 12345;
+    return g_rng >> 8;
+}
+
+static Order makeOrder(int n) {
+    Order o;
+    o.orderNo = String(n);
+    o.status = "DONE";
+    o.ts = 1760000000 + n;
+    o.printed = true;
+    int lines = 1 + rnd() % 4;
+    for (int i = 0; i < lines; ++i) {
+        LineItem li;
+        li.sku = "main_000" + String(1 + rnd() % 5);
+        li.name = (rnd() % 2) ? "唐揚げ丼（大盛り）" : "ポテト";
+        li.qty = 1 + rnd() % 3;
+        li.unitPrice = 600;
+        li.unitPriceApplied = 600;
+        li.priceMode = "normal";
+        li.kind = "MAIN";
+        o.items.push_back(li);
+    }
+    return o;
+}
+
+struct StreamByteCounter : Print {
+    size_t bytes{0};
+    size_t write(uint8_t) override {
+        bytes++;
+        return 1;
+    }
+    size_t write(const uint8_t*, size_t n) override {
+        bytes += n;
+        return n;
+    }
+};
+
+struct ScanContext {
+    StreamByteCounter* out;
+    std::vector<String>* bystanders;
+    int records;
+};
+
+// Streams each order as the archive endpoint does.
+static bool streamVisitor(const Order& order, const String&, uint32_t archivedAt, void* context) {
+    ScanContext* c = static_cast<ScanContext*>(context);
+    JsonArenaLease arena;
+    JsonDocument doc(arena.allocator());
+    JsonObject obj = doc.to<JsonObject>();
+    orderToJson(obj, order);
+    obj["archivedAt"] = archivedAt;
+    if (c->records) c->out->write(',');
+    serializeJson(doc, *c->out);
+    // Another task allocating while the scan runs (WS frames, print jobs); half of it outlives the scan.
+    if (c->records % 16 == 0) {
+        c->bystanders->push_back(String("ws frame ") + String(c->records) + std::string(120 + rnd() % 200, 'x').c_str());
+    }
+    c->records++;
+    return true;
+}
+
+static void report(const char* label, size_t base) {
+    SimHeapStats s = simHeapStats();
+    // ESP32-sized headroom above the heap in use before the first scan.
+    const size_t cap = base + 96 * 1024;
+    size_t largestFree = std::max(s.largestHole, cap > s.top ? cap - s.top : 0);
+    printf("  %-24s holes %3zu (%6zu B)  largest free block %6zu B\n", label, s.holes, s.holeBytes, largestFree);
+}
+
+// With the arenas free, no document should have needed the heap.
+static bool scanThreeTimes(bool arenas) {
+    std::vector<String> bystanders;
+    bystanders.reserve(256);
+    // Every arena leased up front, so each document in the scan gets the plain heap allocator.
+    std::vector<JsonArenaLease*> held;
+    if (!arenas) {
+        for (size_t i = 0; i < kJsonArenaCount; ++i) held.push_back(new JsonArenaLease());
+    }
+    size_t base = simHeapStats().top;
+    printf("%s\n", arenas ? "arenas" : "heap documents");
+    for (int pass = 1; pass <= 3; ++pass) {
+        StreamByteCounter* out = new StreamByteCounter();
+        ScanContext context{out, &bystanders, 0};
+        unsigned long mallocs = g_simMallocs;
+        archiveForEach("S1", streamVisitor, &context);
+        char label[64];
+        snprintf(label, sizeof(label), "scan %d: %lu mallocs", pass, g_simMallocs - mallocs);
+        delete out;
+        std::vector<String> keep;
+        for (size_t i = 0; i < bystanders.size(); i += 2) keep.push_back(bystanders[i]);
+        bystanders.swap(keep);
+        report(label, base);
+    }
+    JsonArenaStats a = getJsonArenaStats();
+    printf("  leases %u, heap leases %u, spills %u, high water %u B\n", static_cast<unsigned>(a.leases),
+           static_cast<unsigned>(a.heapLeases), static_cast<unsigned>(a.spills),
+           static_cast<unsigned>(a.highWaterBytes));
+    for (JsonArenaLease* lease : held) delete lease;
+    fflush(stdout);
+    return !arenas || (a.heapLeases == 0 && a.spills == 0);
+}
+
+int main() {
+    g_quietSerial = true;
+    jsonArenaBegin();
+    LittleFS.mkdir("/kds");
+    walBegin();
+    beginRecovery();
+    while (!stepRecovery(0)) {
+    }
+    S().session.sessionId = "S1";
+    for (int n = 1; n <= 800; ++n) archiveAppend(makeOrder(n), "S1", 1760003000 + n);
+    for (int n = 1; n <= 60; ++n) {
+        Order o;
+        archiveFindOrder("S1", String(n * 7), o);
+        o.status = "CANCELLED";
+        archiveReplaceOrder(o, "S1", 0);
+    }
+    archiveFlushManifest();
+    printf("800 archived orders, 60 amendments, 3 streamed scans\n");
+    fflush(stdout);
+
+    bool ok = true;
+    for (bool arenas : {false, true}) {
+        pid_t child = fork();
+        if (child == 0) {
+            _exit(scanThreeTimes(arenas) ? 0 : 1);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
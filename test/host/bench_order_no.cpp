@@ -0,0 +1,121 @@
+// Order number allocation: the bitmap allocator with leased NVS blocks against the old one, which
+// compared every candidate with S().orders and wrote nextSeq to NVS for each order (emulated
+// below as it was in store.cpp). 5,000 allocations with 300 live orders and a rolling archive.
+// Then a narrow range (100-140) across a simulated reboot, filled to the last free number.
+//
+//   test/host/run.sh bench_order_no
+#include "store.h"
+#include <Preferences.h>
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <string>
+
+extern bool g_quietSerial;
+extern size_t g_prefsWrites;
+
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static Preferences g_legacyPrefs;
+
+// allocateOrderNo() before the bitmap.
+static String legacyAllocateOrderNo() {
+    g_legacyPrefs.begin("kds", false);
+    uint16_t seq = g_legacyPrefs.getUShort("legacySeq", 1);
+    for (int i = 0; i < 100; i++) {
+        String candidate = String(seq);
+        while (candidate.length() < 4) {
+            candidate = "0" + candidate;
+        }
+        bool exists = false;
+        for (const auto& order : S().orders) {
+            if (order.orderNo == candidate) {
+                exists = true;
+                break;
+            }
+        }
+        seq++;
+        if (seq > 9999) seq = 1;
+        if (!exists) {
+            g_legacyPrefs.putUShort("legacySeq", seq);
+            g_legacyPrefs.end();
+            return candidate;
+        }
+    }
+    g_legacyPrefs.end();
+    return "9999";
+}
+
+static void addLive(const String& orderNo, bool hooks) {
+    Order o;
+    o.orderNo = orderNo;
+    S().orders.push_back(o);
+    if (hooks) markOrderNoUsed(orderNo);
+}
+
+// Allocates 5,000 numbers, archiving one of the oldest orders whenever more than 300 are live.
+static bool run(const char* label, String (*allocate)(), bool hooks) {
+    S().orders.clear();
+    invalidateOrderNoMap();
+    size_t writes = g_prefsWrites;
+    int duplicates = 0;
+    double elapsed = 0;
+    for (int i = 0; i < 5000; ++i) {
+        double started = nowUs();
+        String orderNo = allocate();
+        elapsed += nowUs() - started;
+        if (orderNo.isEmpty() || findOrderByNo(orderNo)) duplicates++;
+        addLive(orderNo, hooks);
+        if (S().orders.size() > 300) {
+            String archived = S().orders[i % 7].orderNo;
+            S().orders.erase(S().orders.begin() + i % 7);
+            if (hooks) releaseOrderNo(archived);
+        }
+    }
+    printf("%-4s %6.2f us/allocation, %4zu NVS writes, %d duplicates\n", label, elapsed / 5000,
+           g_prefsWrites - writes, duplicates);
+    return duplicates == 0;
+}
+
+// 30 orders in 100-140, a reboot, then the 11 numbers left; the one after that must be refused.
+static bool narrowRange() {
+    S().orders.clear();
+    S().settings.numbering.min = 100;
+    S().settings.numbering.max = 140;
+    invalidateOrderNoMap(true);
+    std::set<std::string> issued;
+    bool ok = true;
+    for (int i = 0; i < 30; ++i) {
+        String orderNo = allocateOrderNo();
+        ok = ok && issued.insert(orderNo.c_str()).second;
+        addLive(orderNo, true);
+    }
+    invalidateOrderNoMap(true);
+    String first = allocateOrderNo();
+    addLive(first, true);
+    ok = ok && issued.insert(first.c_str()).second;
+    for (int i = 0; i < 10; ++i) {
+        String orderNo = allocateOrderNo();
+        ok = ok && issued.insert(orderNo.c_str()).second;
+        addLive(orderNo, true);
+    }
+    for (const std::string& orderNo : issued) {
+        int n = atoi(orderNo.c_str());
+        ok = ok && n >= 100 && n <= 140;
+    }
+    String full = allocateOrderNo();
+    printf("range 100-140: first after reboot %s, %zu distinct, then %s\n", first.c_str(), issued.size(),
+           full.isEmpty() ? "refused" : full.c_str());
+    return ok && issued.size() == 41 && full.isEmpty();
+}
+
+int main() {
+    g_quietSerial = true;
+    bool ok = run("old", legacyAllocateOrderNo, false);
+    ok = run("new", allocateOrderNo, true) && ok;
+    ok = narrowRange() && ok;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
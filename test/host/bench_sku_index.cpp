@@ -0,0 +1,119 @@
+// Bulk menu upserts of new items (500, 2,000 and 5,000) with SKU generation and the lookup the
+// upsert handlers do: the per-prefix index against the old path, which scanned the menu twice per
+// candidate and wrote its counter to NVS on every call (emulated below as it was in store.cpp).
+//
+//   test/host/run.sh bench_sku_index
+#include "store.h"
+#include <Preferences.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+
+extern bool g_quietSerial;
+extern size_t g_prefsWrites;
+
+static double nowMs() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static Preferences g_legacyPrefs;
+
+static uint16_t legacyFindMaxSeq(const char* prefix, const char* category) {
+    uint16_t maxSeq = 0;
+    const size_t prefixLen = strlen(prefix);
+    for (const auto& item : S().menu) {
+        if (item.category == category && item.sku.startsWith(prefix)) {
+            uint16_t value = item.sku.substring(prefixLen).toInt();
+            if (value > maxSeq) maxSeq = value;
+        }
+    }
+    return maxSeq;
+}
+
+// nextSku() before the index.
+static String legacyNextSku(const char* prefix, const char* category, const char* counterKey) {
+    g_legacyPrefs.begin("kds", false);
+    uint16_t storedSeq = g_legacyPrefs.getUShort(counterKey, 1);
+    uint16_t maxExisting = legacyFindMaxSeq(prefix, category);
+    if (storedSeq <= maxExisting) storedSeq = maxExisting + 1;
+    uint16_t seq = storedSeq == 0 ? 1 : storedSeq;
+    String candidate;
+    for (int attempts = 0; attempts < 10000; ++attempts) {
+        if (seq > 9999) seq = 1;
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%s%04u", prefix, seq);
+        candidate = buffer;
+        bool exists = false;
+        for (const auto& item : S().menu) {
+            if (item.sku == candidate) {
+                exists = true;
+                break;
+            }
+        }
+        if (!exists) break;
+        seq++;
+    }
+    uint16_t nextSeq = seq + 1;
+    if (nextSeq > 9999) nextSeq = 1;
+    g_legacyPrefs.putUShort(counterKey, nextSeq);
+    g_legacyPrefs.end();
+    return candidate;
+}
+
+static MenuItem* legacyFind(const String& sku) {
+    for (auto& item : S().menu) {
+        if (item.sku == sku) return &item;
+    }
+    return nullptr;
+}
+
+// Alternates main and side items, as a bulk menu import would.
+static bool run(int count, bool indexed, double& ms, size_t& writes) {
+    S().menu.clear();
+    if (indexed) invalidateSkuIndex(true);
+    writes = g_prefsWrites;
+    std::set<std::string> seen;
+    int duplicates = 0;
+    double started = nowMs();
+    for (int i = 0; i < count; ++i) {
+        bool side = i % 2;
+        String sku;
+        MenuItem* existing;
+        if (indexed) {
+            sku = side ? generateSkuSide() : generateSkuMain();
+            existing = findMenuItemBySku(sku);
+        } else {
+            sku = side ? legacyNextSku("side_", "SIDE", "legacySideSeq") : legacyNextSku("main_", "MAIN", "legacyMainSeq");
+            existing = legacyFind(sku);
+        }
+        if (existing || !seen.insert(sku.c_str()).second) duplicates++;
+        MenuItem item;
+        item.sku = sku;
+        item.category = side ? "SIDE" : "MAIN";
+        S().menu.push_back(item);
+        if (indexed) noteMenuItemAdded();
+    }
+    ms = nowMs() - started;
+    writes = g_prefsWrites - writes;
+    return duplicates == 0;
+}
+
+int main() {
+    g_quietSerial = true;
+    bool ok = true;
+    printf("upserts   old                 new\n");
+    for (int count : {500, 2000, 5000}) {
+        double oldMs = 0;
+        double newMs = 0;
+        size_t oldWrites = 0;
+        size_t newWrites = 0;
+        ok = run(count, false, oldMs, oldWrites) && ok;
+        ok = run(count, true, newMs, newWrites) && ok;
+        printf("%7d %8.2f ms %5zu NVS %8.2f ms %zu NVS\n", count, oldMs, oldWrites, newMs, newWrites);
+        ok = ok && newWrites == 0 && findMenuItemBySku(S().menu[count / 2].sku) == &S().menu[count / 2];
+    }
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+// Snapshot of a 2,000-order state in the binary format against the JSON form the firmware used to
+// write (still rendered by writeSnapshotJsonFields() and still loadable once as a legacy
+// snapshot): bytes, encode and decode time. Binary encode includes the write to the scratch
+// filesystem. The JSON side runs on the stub ArduinoJson, so its times are only indicative.
+//
+//   test/host/run.sh bench_snapshot
+#include "store.h"
+#include <LittleFS.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+extern bool g_quietSerial;
+
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t g_rng = 7;
+static uint32_t rnd() {
+    g_rng = g_rng * 1103515245 + 12345;
+    return g_rng >> 8;
+}
+
+struct StringPrint : Print {
+    std::string text;
+    size_t write(uint8_t c) override {
+        text.push_back(static_cast<char>(c));
+        return 1;
+    }
+};
+
+static void buildState(int orders) {
+    S().orders.clear();
+    for (int n = 1; n <= orders; ++n) {
+        Order o;
+        o.orderNo = String(n);
+        o.status = (n % 3 == 0) ? "READY" : "COOKING";
+        o.ts = 1760000000 + n * 7;
+        o.cooked = n % 3 == 0;
+        int lines = 1 + rnd() % 4;
+        for (int i = 0; i < lines; ++i) {
+            LineItem li;
+            li.sku = "main_000" + String(1 + rnd() % 5);
+            li.name = "唐揚げ丼";
+            li.qty = 1 + rnd() % 3;
+            li.unitPrice = 600;
+            li.unitPriceApplied = 600;
+            li.priceMode = "normal";
+            li.kind = "MAIN";
+            o.items.push_back(li);
+        }
+        S().orders.push_back(o);
+    }
+}
+
+static bool sameOrders(const std::vector<Order>& expected) {
+    if (S().orders.size() != expected.size()) return false;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        const Order& a = S().orders[i];
+        const Order& b = expected[i];
+        if (a.orderNo != b.orderNo || a.status != b.status || a.ts != b.ts || a.cooked != b.cooked ||
+            a.items.size() != b.items.size()) {
+            return false;
+        }
+        for (size_t k = 0; k < a.items.size(); ++k) {
+            if (a.items[k].sku != b.items[k].sku || a.items[k].name != b.items[k].name ||
+                a.items[k].qty != b.items[k].qty) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main() {
+    g_quietSerial = true;
+    LittleFS.mkdir("/kds");
+    snapshotLoad();
+    buildState(2000);
+    const std::vector<Order> expected = S().orders;
+
+    double started = nowUs();
+    bool saved = snapshotSave();
+    double binaryEncode = nowUs() - started;
+    uint32_t binaryBytes = getSnapshotStats().lastStoredBytes;
+
+    StringPrint json;
+    started = nowUs();
+    json.print('{');
+    writeSnapshotJsonFields(json);
+    json.print('}');
+    double jsonEncode = nowUs() - started;
+    File legacy = LittleFS.open("/kds/snapA.json", "w");
+    legacy.write(reinterpret_cast<const uint8_t*>(json.text.data()), json.text.size());
+    legacy.close();
+
+    S().orders.clear();
+    started = nowUs();
+    bool binaryLoaded = snapshotLoad() && !getSnapshotStats().loadedLegacyJson && sameOrders(expected);
+    double binaryDecode = nowUs() - started;
+
+    // Without a binary slot the loader falls back to the JSON file.
+    for (const char* path : {"/kds/snapA.bin", "/kds/snapB.bin", "/kds/snapA.delta", "/kds/snapB.delta"}) {
+        if (LittleFS.exists(path)) LittleFS.remove(path);
+    }
+    S().orders.clear();
+    started = nowUs();
+    bool jsonLoaded = snapshotLoad() && getSnapshotStats().loadedLegacyJson && sameOrders(expected);
+    double jsonDecode = nowUs() - started;
+
+    printf("2000 orders   bytes      encode     decode\n");
+    printf("binary     %8u %8.2f ms %8.2f ms\n", static_cast<unsigned>(binaryBytes), binaryEncode / 1000,
+           binaryDecode / 1000);
+    printf("json       %8zu %8.2f ms %8.2f ms\n", json.text.size(), jsonEncode / 1000, jsonDecode / 1000);
+
+    bool ok = saved && binaryLoaded && jsonLoaded && binaryBytes > 0 && binaryBytes < json.text.size();
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+// Checkpoint bytes with 300 open orders: one cooked flip per checkpoint, then 1,000 status
+// changes, counting the merges into a new base along the way. After each kind of change (an order
+// leaving, an order arriving, a menu edit, a torn delta tail, orders logged to the WAL after the
+// last checkpoint) the state reloaded from flash must equal the one in memory.
+// KDS_SNAPSHOT_DELTA_PERCENT=0 writes every checkpoint as a full base, as before the deltas.
+//
+//   test/host/run.sh bench_snapshot_delta
+//   test/host/run.sh bench_snapshot_delta -DKDS_SNAPSHOT_DELTA_PERCENT=0
+//   test/host/run.sh bench_snapshot_delta -DKDS_COMPRESSED_STORAGE=1
+#include "flash_stats.h"
+#include "store.h"
+#include "wal.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+extern bool g_quietSerial;
+extern std::string g_fsRoot;
+
+static uint32_t g_rng = 3;
+static uint32_t rnd() {
+    g_rng = g_rng * 1103515245 + 12345;
+    return g_rng >> 8;
+}
+
+static Order makeOrder(int n) {
+    Order o;
+    o.orderNo = String(n);
+    o.status = "COOKING";
+    o.ts = 1760000000 + n;
+    int lines = 1 + rnd() % 4;
+    for (int i = 0; i < lines; ++i) {
+        LineItem li;
+        li.sku = "main_000" + String(1 + rnd() % 5);
+        li.name = "唐揚げ丼";
+        li.qty = 1 + rnd() % 3;
+        li.unitPrice = 600;
+        li.unitPriceApplied = 600;
+        li.priceMode = "normal";
+        li.kind = "MAIN";
+        o.items.push_back(li);
+    }
+    return o;
+}
+
+// Snapshot flash bytes written by one checkpoint.
+static uint32_t save() {
+    uint32_t before = getFlashStats(kFlashSnapshot).bytesWritten;
+    snapshotSave();
+    return getFlashStats(kFlashSnapshot).bytesWritten - before;
+}
+
+static String dump() {
+    String s;
+    for (const Order& o : S().orders) {
+        s += o.orderNo + o.status + (o.cooked ? "c" : "-") + (o.printed ? "p" : "-") + String(o.items.size()) + ";";
+    }
+    for (const MenuItem& m : S().menu) {
+        s += m.sku + m.name + ";";
+    }
+    return s;
+}
+
+static bool reloadEquals(const char* label, const String& expected, bool recover = false) {
+    S().orders.clear();
+    S().menu.clear();
+    if (recover) {
+        beginRecovery();
+        while (!stepRecovery(0)) {
+        }
+    } else {
+        snapshotLoad();
+    }
+    bool same = dump() == expected;
+    printf("reload after %-16s %3zu orders, %u deltas applied  %s\n", label, S().orders.size(),
+           static_cast<unsigned>(getSnapshotStats().loadDeltas), same ? "" : "MISMATCH");
+    return same;
+}
+
+int main() {
+    g_quietSerial = true;
+    LittleFS.mkdir("/kds");
+    walBegin();
+    beginRecovery();
+    while (!stepRecovery(0)) {
+    }
+    for (int n = 1; n <= 300; ++n) S().orders.push_back(makeOrder(n));
+    printf("first checkpoint (base): %u bytes\n", static_cast<unsigned>(save()));
+
+    const int flips = 50;
+    uint64_t flipBytes = 0;
+    uint32_t flipMax = 0;
+    for (int i = 0; i < flips; ++i) {
+        S().orders[rnd() % S().orders.size()].cooked ^= true;
+        uint32_t bytes = save();
+        flipBytes += bytes;
+        flipMax = std::max(flipMax, bytes);
+    }
+    printf("one cooked flip per checkpoint: avg %u bytes, max %u\n", static_cast<unsigned>(flipBytes / flips),
+           static_cast<unsigned>(flipMax));
+
+    bool ok = true;
+    S().orders.erase(S().orders.begin() + 10);
+    save();
+    ok = reloadEquals("an order left", dump()) && ok;
+    S().orders.push_back(makeOrder(301));
+    save();
+    ok = reloadEquals("an order came", dump()) && ok;
+    S().menu[0].name += "（大）";
+    save();
+    ok = reloadEquals("a menu edit", dump()) && ok;
+
+    uint32_t saves = getSnapshotStats().saves;
+    uint32_t deltas = getSnapshotStats().deltaSaves;
+    uint64_t total = 0;
+    for (int i = 0; i < 1000; ++i) {
+        S().orders[rnd() % S().orders.size()].status = (rnd() % 2) ? "DONE" : "COOKING";
+        total += save();
+    }
+    uint32_t bases = (getSnapshotStats().saves - saves) - (getSnapshotStats().deltaSaves - deltas);
+    printf("1000 status-change checkpoints: %.1f KB, %u of them bases\n", total / 1024.0,
+           static_cast<unsigned>(bases));
+    ok = ok && (KDS_SNAPSHOT_DELTA_PERCENT == 0 ? bases == 1000 : bases < 20);
+    ok = reloadEquals("1000 changes", dump()) && ok;
+
+#if KDS_SNAPSHOT_DELTA_PERCENT
+    auto fileSize = [](const char* path) -> uint32_t {
+        File f = LittleFS.open(path, "r");
+        uint32_t size = f ? f.size() : 0;
+        f.close();
+        return size;
+    };
+    // Cut the frame just appended short; the load must stop at the checkpoint before it.
+    String previous = dump();
+    uint32_t sizeA = fileSize("/kds/snapA.delta");
+    uint32_t sizeB = fileSize("/kds/snapB.delta");
+    S().orders[0].cooked ^= true;
+    save();
+    bool intoA = fileSize("/kds/snapA.delta") > sizeA;
+    const char* delta = intoA ? "/kds/snapA.delta" : "/kds/snapB.delta";
+    ok = ok && (intoA || fileSize(delta) > sizeB) &&
+         truncate((g_fsRoot + delta).c_str(), fileSize(delta) - 3) == 0;
+    ok = reloadEquals("a torn tail", previous) && ok;
+    save();
+#endif
+
+    // Orders after the last checkpoint only reach flash through the WAL.
+    for (int n = 302; n <= 305; ++n) {
+        uint32_t ticket = 0;
+        commitOrderCreate(makeOrder(n), &ticket);
+        walWaitDurable(ticket);
+    }
+    ok = reloadEquals("WAL replay", dump(), true) && ok;
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+// The WAL before and after the group-commit rewrite, on the same workload: 500 orders, each
+// created, cooked, called and picked up (four records). The old path is emulated as it was in
+// store.cpp: one JSON line per record, with exists/open/println/flush/close on /kds/wal.log for
+// every append. The new one runs twice: waiting for durability on every record (the default
+// durability=wal), and riding the 20 ms group commit from walTick() with a record every 5 ms.
+// Flash figures come from the kFlashWal counters, so both paths are charged the same way.
+//
+//   test/host/run.sh bench_wal_format
+#include "flash_stats.h"
+#include "store.h"
+#include "wal.h"
+#include <LittleFS.h>
+#include <chrono>
+#include <cstdio>
+
+extern bool g_quietSerial;
+extern unsigned long g_virtualMs;
+
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t g_rng = 5;
+static uint32_t rnd() {
+    g_rng = g_rng * 1103515245 + 12345;
+    return g_rng >> 8;
+}
+
+static const int kOrders = 500;
+static const char* kSteps[3] = {"COOKED", "READY", "PICKED"};
+
+static Order makeOrder(int n) {
+    Order o;
+    o.orderNo = String(n);
+    o.status = "COOKING";
+    o.ts = 1760000000 + n;
+    int lines = 1 + rnd() % 4;
+    for (int i = 0; i < lines; ++i) {
+        LineItem li;
+        li.sku = "main_000" + String(1 + rnd() % 5);
+        li.name = "唐揚げ丼";
+        li.qty = 1 + rnd() % 3;
+        li.unitPrice = 600;
+        li.unitPriceApplied = 600;
+        li.priceMode = "normal";
+        li.kind = "MAIN";
+        o.items.push_back(li);
+    }
+    return o;
+}
+
+// walAppend(const String&) as it was before the WAL module.
+static bool legacyWalAppend(const String& line) {
+    const char* walPath = "/kds/wal.log";
+    if (!LittleFS.exists(walPath)) {
+        FlashFile create = flashOpen(kFlashWal, walPath, FILE_WRITE);
+        if (!create) return false;
+        create.close();
+    }
+    FlashFile file = flashOpen(kFlashWal, walPath, FILE_APPEND);
+    if (!file) return false;
+    size_t written = file.println(line);
+    file.flush();
+    file.close();
+    return written > 0;
+}
+
+static bool legacyRecord(const Order& order, int step) {
+    JsonDocument doc;
+    doc["ts"] = order.ts + step;
+    if (step < 0) {
+        doc["action"] = "ORDER_CREATE";
+        doc["orderNo"] = order.orderNo;
+        orderToJson(doc["order"].to<JsonObject>(), order);
+    } else {
+        doc["action"] = "ORDER_UPDATE";
+        doc["orderNo"] = order.orderNo;
+        doc["status"] = kSteps[step];
+        doc["cooked"] = true;
+        doc["pickup_called"] = step >= 1;
+        doc["picked_up"] = step == 2;
+        doc["printed"] = true;
+    }
+    String line;
+    serializeJson(doc, line);
+    return legacyWalAppend(line);
+}
+
+static bool binaryRecord(const Order& order, int step, bool waitDurable) {
+    WalRecord rec;
+    rec.ts = order.ts + step;
+    rec.orderNo = order.orderNo;
+    if (step < 0) {
+        rec.action = kWalOrderCreate;
+        rec.order = order;
+        rec.hasOrder = true;
+    } else {
+        rec.action = kWalOrderUpdate;
+        rec.status = kSteps[step];
+        rec.cooked = true;
+        rec.pickupCalled = step >= 1;
+        rec.pickedUp = step == 2;
+        rec.printed = true;
+    }
+    WalTicket ticket = 0;
+    if (!walAppend(rec, &ticket)) return false;
+    return !waitDurable || walWaitDurable(ticket);
+}
+
+enum Mode { kLegacyJsonl, kBinaryEachRecord, kBinaryGroupCommit };
+
+static bool run(Mode mode, const char* label) {
+    g_rng = 5;
+    FlashSubsystemStats before = getFlashStats(kFlashWal);
+    double busy = 0;
+    bool ok = true;
+    for (int n = 1; n <= kOrders; ++n) {
+        Order order = makeOrder(n);
+        for (int step = -1; step < 3; ++step) {
+            double started = nowUs();
+            if (mode == kLegacyJsonl) {
+                ok = legacyRecord(order, step) && ok;
+            } else {
+                ok = binaryRecord(order, step, mode == kBinaryEachRecord) && ok;
+            }
+            if (mode == kBinaryGroupCommit) {
+                g_virtualMs += 5;
+                walTick();
+            }
+            busy += nowUs() - started;
+        }
+    }
+    if (mode != kLegacyJsonl) ok = walFlush() && ok;
+
+    FlashSubsystemStats after = getFlashStats(kFlashWal);
+    uint32_t records = kOrders * 4;
+    uint32_t bytes = after.bytesWritten - before.bytesWritten;
+    uint32_t flushes = after.flushes - before.flushes;
+    uint32_t opens = after.opens - before.opens;
+    printf("%-22s %9.0f %9.1f %9.2f %8.2f\n", label, records / (busy / 1e6), static_cast<double>(bytes) / kOrders,
+           static_cast<double>(flushes) / kOrders, static_cast<double>(opens) / kOrders);
+    return ok;
+}
+
+int main() {
+    g_quietSerial = true;
+    LittleFS.mkdir("/kds");
+    walBegin();
+
+    printf("%d orders, 4 records each\n", kOrders);
+    printf("%-22s %9s %9s %9s %8s\n", "", "appends/s", "bytes/ord", "flush/ord", "open/ord");
+    bool ok = run(kLegacyJsonl, "jsonl, open per record");
+    ok = run(kBinaryEachRecord, "binary, durability=wal") && ok;
+    ok = run(kBinaryGroupCommit, "binary, group commit") && ok;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+// Per-subsystem flash counters against what actually landed on flash: after creating, archiving
+// and snapshotting orders, the bytes charged to the WAL, the snapshot and the archive index must
+// equal the sizes of their files. Nothing here removes or rewrites those files, so the two agree
+// exactly when every write goes through the counting layer.
+//
+//   test/host/run.sh flash_accounting
+#include "flash_stats.h"
+#include "store.h"
+#include "wal.h"
+#include <LittleFS.h>
+#include <cstdio>
+#include <initializer_list>
+
+extern bool g_quietSerial;
+
+// Total size of the files in dirPath whose names end in one of the suffixes.
+static uint32_t filesEndingIn(const char* dirPath, std::initializer_list<const char*> suffixes) {
+    uint32_t total = 0;
+    File dir = LittleFS.open(dirPath);
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+        String name = f.name();
+        for (const char* suffix : suffixes) {
+            if (name.endsWith(suffix)) {
+                total += f.size();
+                break;
+            }
+        }
+        f.close();
+    }
+    return total;
+}
+
+static bool compare(FlashSubsystem subsystem, uint32_t onFlash) {
+    FlashSubsystemStats stats = getFlashStats(subsystem);
+    bool same = stats.bytesWritten == onFlash && stats.failures == 0;
+    printf("%-18s counted %6u bytes in %3u writes, %3u flushes; on flash %6u  %s\n", flashSubsystemName(subsystem),
+           static_cast<unsigned>(stats.bytesWritten), static_cast<unsigned>(stats.writes),
+           static_cast<unsigned>(stats.flushes), static_cast<unsigned>(onFlash), same ? "" : "MISMATCH");
+    return same;
+}
+
+int main() {
+    g_quietSerial = true;
+    LittleFS.mkdir("/kds");
+    walBegin();
+    beginRecovery();
+    while (!stepRecovery(0)) {
+    }
+    S().session.sessionId = "S1";
+
+    for (int n = 1; n <= 20; ++n) {
+        Order o;
+        o.orderNo = String(n);
+        o.status = "COOKING";
+        o.ts = 1760000000 + n;
+        LineItem li;
+        li.sku = "main_0001";
+        li.name = "唐揚げ丼";
+        li.qty = 1 + n % 3;
+        li.unitPrice = 600;
+        li.unitPriceApplied = 600;
+        o.items.push_back(li);
+        uint32_t ticket = 0;
+        commitOrderCreate(o, &ticket);
+    }
+    for (int n = 1; n <= 8; ++n) {
+        archiveOrderAndRemove(String(n), S().session.sessionId, 1760001000 + n, true);
+    }
+    walFlush();
+    uint32_t walBytes = 0;
+    for (const String& path : walListSegments()) {
+        File f = LittleFS.open(path, "r");
+        walBytes += f.size();
+        f.close();
+    }
+    bool ok = compare(kFlashWal, walBytes);
+
+    snapshotSave();
+    ok = compare(kFlashSnapshot, filesEndingIn("/kds", {"snapA.bin", "snapB.bin", ".delta"})) && ok;
+    ok = compare(kFlashArchiveIndex, filesEndingIn("/kds/archive", {".idx", ".sup"})) && ok;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+# Builds one host driver against the firmware sources and runs it.
+#
+#   test/host/run.sh bench_durability
+#   test/host/run.sh wal_ring_powercut -fsanitize=address
+#   test/host/run.sh all
+#
+# "all" runs every driver the way its header comment says (the "//   test/host/run.sh ..."
+# lines) and fails if any of them does.
+#
+# stubs/ stands in for Arduino, LittleFS, FreeRTOS and ArduinoJson just far enough for the
+# storage modules (store / wal / archive / snapshot). The web, printer and UI modules and the
+# ESP partition driver are not built. LittleFS maps to a scratch directory that starts empty on
+# every run.
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+root=$(cd "$here/../.." && pwd)
+name=${1:?usage: run.sh <driver>|all [g++ flags]}
+shift
+
+if [ "$name" = all ]; then
+    failed=
+    while read -r driver flags; do
+        echo "== $driver $flags"
+        "$here/run.sh" "$driver" $flags "$@" || failed="$failed $driver"
+    done < <(sed -n 's|^//   test/host/run\.sh ||p' "$here"/*.cpp)
+    if [ -n "$failed" ]; then
+        echo "failed:$failed"
+        exit 1
+    fi
+    exit 0
+fi
+
+skip='/(main|server_routes|ws_hub|csv_export|printer_render|printer_uart|printer_queue|esp_partition_flash)\.cpp$'
+srcs=$(ls "$root"/src/*.cpp | grep -v -E "$skip")
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+mkdir "$work/fs"
+
+g++ -std=gnu++17 -O1 -g -Wall -Wextra -I"$here/stubs" -I"$root/include" "$@" \
+    $srcs "$here/stubs/stubs.cpp" "$here/$name.cpp" -o "$work/$name" -lpthread
+KDS_HOST_FS="$work/fs" "$work/$name"
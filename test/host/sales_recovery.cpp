@@ -0,0 +1,172 @@
+// The in-RAM sales summary and rollup across a crash: orders are created, archived and cancelled
+// (live and archived) on both sides of a snapshot, then state is dropped and rebuilt from the
+// snapshot and the WAL tail. Both must equal what they were before the crash and what a full
+// recalculation gives.
+//
+//   test/host/run.sh sales_recovery
+#include "archive.h"
+#include "sales_rollup.h"
+#include "store.h"
+#include "wal.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+extern bool g_quietSerial;
+
+static Order makeOrder(int n) {
+    Order o;
+    o.orderNo = String(n);
+    o.status = "COOKING";
+    o.ts = 1760000000 + n * 400;
+    LineItem main;
+    main.sku = "main_000" + String(1 + n % 3);
+    main.name = "唐揚げ丼";
+    main.kind = "MAIN";
+    main.priceMode = (n % 2) ? "presale" : "normal";
+    main.qty = 2;
+    main.unitPrice = 300 + n;
+    main.unitPriceApplied = 300 + n;
+    o.items.push_back(main);
+    LineItem side;
+    side.sku = "side_0001";
+    side.name = "ポテト";
+    side.kind = "SIDE_SINGLE";
+    side.priceMode = "normal";
+    side.qty = 1;
+    side.unitPrice = 100;
+    side.unitPriceApplied = 100;
+    o.items.push_back(side);
+    return o;
+}
+
+static void create(int n) {
+    uint32_t ticket = 0;
+    commitOrderCreate(makeOrder(n), &ticket);
+}
+
+static void archive(int n) {
+    archiveOrderAndRemove(String(n), S().session.sessionId, 1760003000 + n, true);
+}
+
+// What the cancel handler does, without the HTTP side.
+static void cancel(int n, bool archived) {
+    Order order;
+    if (archived) {
+        archiveFindOrder(S().session.sessionId, String(n), order);
+    } else {
+        order = *findOrderByNo(String(n));
+    }
+    order.status = "CANCELLED";
+    applyCancellationToSalesSummary(order);
+    if (archived) {
+        archiveReplaceOrder(order, S().session.sessionId, 0);
+    } else {
+        findOrderByNo(String(n))->status = "CANCELLED";
+    }
+    WalRecord rec;
+    rec.action = kWalOrderCancel;
+    rec.ts = 1760002000 + n;
+    rec.orderNo = order.orderNo;
+    rec.archived = archived;
+    walAppend(rec);
+}
+
+static bool sameSummary(const SalesSummary& a, const SalesSummary& b) {
+    return a.confirmedOrders == b.confirmedOrders && a.cancelledOrders == b.cancelledOrders &&
+           a.revenue == b.revenue && a.cancelledAmount == b.cancelledAmount;
+}
+
+static bool byKey(const SalesRollupBreakdown& a, const SalesRollupBreakdown& b) {
+    return strcmp(a.key.c_str(), b.key.c_str()) < 0;
+}
+
+// Row order depends on the order SKUs were first seen, which replay does not preserve.
+static std::string dumpRollup() {
+    SalesRollup r = getSalesRollup();
+    std::sort(r.skus.begin(), r.skus.end(), [](const SalesRollupSku& a, const SalesRollupSku& b) {
+        return strcmp(a.sku.c_str(), b.sku.c_str()) < 0;
+    });
+    std::sort(r.priceModes.begin(), r.priceModes.end(), byKey);
+    std::sort(r.kinds.begin(), r.kinds.end(), byKey);
+    std::string out;
+    char line[128];
+    for (const SalesRollupSku& row : r.skus) {
+        snprintf(line, sizeof(line), "%s %d %d %d %d |", row.sku.c_str(), static_cast<int>(row.qty),
+                 static_cast<int>(row.amount), static_cast<int>(row.cancelledQty), static_cast<int>(row.cancelledAmount));
+        out += line;
+        for (const SalesRollupCell& cell : row.cells) {
+            snprintf(line, sizeof(line), " %u:%d/%d", static_cast<unsigned>(cell.bucket), static_cast<int>(cell.qty),
+                     static_cast<int>(cell.amount));
+            out += line;
+        }
+        out += "\n";
+    }
+    for (const std::vector<SalesRollupBreakdown>* list : {&r.priceModes, &r.kinds}) {
+        for (const SalesRollupBreakdown& b : *list) {
+            snprintf(line, sizeof(line), "%s %d %d %d %d\n", b.key.c_str(), static_cast<int>(b.qty),
+                     static_cast<int>(b.amount), static_cast<int>(b.cancelledQty), static_cast<int>(b.cancelledAmount));
+            out += line;
+        }
+    }
+    return out;
+}
+
+static void show(const char* label, const SalesSummary& s) {
+    printf("%-10s confirmed %u cancelled %u revenue %lld cancelled amount %lld\n", label,
+           static_cast<unsigned>(s.confirmedOrders), static_cast<unsigned>(s.cancelledOrders),
+           static_cast<long long>(s.revenue), static_cast<long long>(s.cancelledAmount));
+}
+
+static void recover() {
+    beginRecovery();
+    while (!stepRecovery(0)) {
+    }
+}
+
+int main() {
+    g_quietSerial = true;
+    LittleFS.mkdir("/kds");
+    walBegin();
+    recover();
+    S().session.sessionId = "S1";
+
+    for (int n = 1; n <= 20; ++n) create(n);
+    for (int n = 1; n <= 5; ++n) archive(n);
+    cancel(10, false);
+    cancel(2, true);
+    snapshotSave();
+    for (int n = 21; n <= 30; ++n) create(n);
+    for (int n = 21; n <= 23; ++n) archive(n);
+    cancel(25, false);
+    cancel(22, true);
+    cancel(3, true);
+    cancel(11, false);
+    walFlush();
+    const SalesSummary live = getSalesSummary();
+    const std::string liveRollup = dumpRollup();
+
+    // Power cut: RAM is gone, flash is not.
+    S().orders.clear();
+    S().session.sessionId = "";
+    walBegin();
+    recover();
+    const SalesSummary recovered = getSalesSummary();
+    const std::string recoveredRollup = dumpRollup();
+    recalculateSalesSummary();
+    const SalesSummary recalculated = getSalesSummary();
+    const std::string recalculatedRollup = dumpRollup();
+
+    show("live", live);
+    show("recovered", recovered);
+    show("recalc", recalculated);
+    printf("rollup: %zu SKUs; recovered %s, recalculated %s\n", getSalesRollup().skus.size(),
+           recoveredRollup == liveRollup ? "matches" : "differs", recalculatedRollup == liveRollup ? "matches" : "differs");
+    bool ok = live.confirmedOrders == 24 && live.cancelledOrders == 6 && sameSummary(live, recovered) &&
+              sameSummary(live, recalculated) && !LittleFS.exists("/kds/sales_summary.json") &&
+              recoveredRollup == liveRollup && recalculatedRollup == liveRollup;
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
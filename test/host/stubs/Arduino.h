@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include "WString.h"
+#include "Print.h"
+#include "freertos_stub.h"
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+void yield();
+class HardwareSerial : public Stream {
+public:
+    HardwareSerial(int = 0) {}
+    void begin(unsigned long, int = 0, int = -1, int = -1) {}
+    void end() {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* b, size_t n) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+extern HardwareSerial Serial;
+struct EspClass {
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+    uint32_t getPsramSize() { return 0; }
+    void restart() {}
+};
+extern EspClass ESP;
+struct tm;
+bool getLocalTime(struct tm*, uint32_t = 5000);
+void configTime(long, int, const char*, const char* = nullptr, const char* = nullptr);
+#define ESP32 1
+#define IRAM_ATTR
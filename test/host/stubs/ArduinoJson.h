@@ -0,0 +1,290 @@
+#pragma once
+// Minimal host-side functional stand-in for ArduinoJson v7 (harness only).
+#include "Arduino.h"
+#include <memory>
+#include <vector>
+#include <type_traits>
+#include <utility>
+#include <memory_resource>
+#include <string_view>
+
+namespace ArduinoJson {
+struct Allocator {
+    virtual void* allocate(size_t size) = 0;
+    virtual void deallocate(void* ptr) = 0;
+    virtual void* reallocate(void* ptr, size_t new_size) = 0;
+protected:
+    ~Allocator() = default;
+};
+}
+
+namespace ajs {
+struct Node;
+using NodePtr = std::shared_ptr<Node>;
+// Every node and its storage come from the owning document's allocator, like ArduinoJson v7.
+struct Res : std::pmr::memory_resource {
+    ArduinoJson::Allocator* a;
+    explicit Res(ArduinoJson::Allocator* al) : a(al) {}
+    void* do_allocate(size_t n, size_t) override { return a->allocate(n); }
+    void do_deallocate(void* p, size_t, size_t) override { a->deallocate(p); }
+    bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override { return this == &o; }
+};
+struct Node {
+    using Text = std::pmr::string;
+    std::pmr::memory_resource* r;
+    enum T { Null, Bool, Int, Float, Str, Arr, Obj } t = Null;
+    bool b = false; long long i = 0; double f = 0; Text s;
+    std::pmr::vector<NodePtr> arr;
+    std::pmr::vector<std::pair<Text, NodePtr>> obj;
+    explicit Node(std::pmr::memory_resource* res = std::pmr::new_delete_resource()) : r(res), s(res), arr(res), obj(res) {}
+    Node(const Node& o) : Node(o.r) { copyFrom(o); }
+    Node& operator=(const Node& o) { if (this != &o) { Node tmp(r); tmp.copyFrom(o); swapData(tmp); } return *this; }
+    void swapData(Node& o) { std::swap(t, o.t); std::swap(b, o.b); std::swap(i, o.i); std::swap(f, o.f); s.swap(o.s); arr.swap(o.arr); obj.swap(o.obj); }
+    void copyFrom(const Node& o) { t = o.t; b = o.b; i = o.i; f = o.f; s.assign(o.s.data(), o.s.size()); for (auto& a : o.arr) arr.push_back(a->cloneIn(r)); for (auto& kv : o.obj) obj.emplace_back(std::string_view(kv.first), kv.second->cloneIn(r)); }
+    NodePtr make() const { return std::allocate_shared<Node>(std::pmr::polymorphic_allocator<Node>(r), r); }
+    NodePtr cloneIn(std::pmr::memory_resource* res) const { auto n = std::allocate_shared<Node>(std::pmr::polymorphic_allocator<Node>(res), res); n->copyFrom(*this); return n; }
+    NodePtr clone() const { return cloneIn(r); }
+    Node* find(std::string_view k) const { for (auto& o : obj) if (std::string_view(o.first) == k) return o.second.get(); return nullptr; }
+    Node* member(std::string_view k) { if (t == Null) t = Obj; if (t != Obj) return nullptr; if (auto* n = find(k)) return n; obj.emplace_back(k, make()); return obj.back().second.get(); }
+    Node* at(size_t idx) const { return (t == Arr && idx < arr.size()) ? arr[idx].get() : nullptr; }
+    // Frees storage too: a cleared ArduinoJson document returns everything to its allocator.
+    void reset() { t = Null; decltype(arr)(r).swap(arr); decltype(obj)(r).swap(obj); Text(r).swap(s); }
+};
+}
+
+class JsonVariant; class JsonVariantConst; class JsonObject; class JsonObjectConst; class JsonArray; class JsonArrayConst; class JsonDocument;
+
+namespace ajs {
+template <typename T, typename = void> struct Conv;
+template <typename T> struct Conv<T, typename std::enable_if<std::is_same<T, bool>::value>::type> {
+    static bool is(const Node* n) { return n && n->t == Node::Bool; }
+    static T as(const Node* n) { return n && n->t == Node::Bool ? n->b : false; }
+    static void set(Node* n, T v) { n->reset(); n->t = Node::Bool; n->b = v; }
+};
+template <typename T> struct Conv<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+    static bool is(const Node* n) { return n && n->t == Node::Int && (std::is_signed<T>::value || n->i >= 0); }
+    static T as(const Node* n) { if (!n) return 0; if (n->t == Node::Int) return (T)n->i; if (n->t == Node::Float) return (T)n->f; if (n->t == Node::Bool) return n->b; return 0; }
+    static void set(Node* n, T v) { n->reset(); n->t = Node::Int; n->i = (long long)v; }
+};
+template <typename T> struct Conv<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static bool is(const Node* n) { return n && (n->t == Node::Float || n->t == Node::Int); }
+    static T as(const Node* n) { if (!n) return 0; if (n->t == Node::Float) return (T)n->f; if (n->t == Node::Int) return (T)n->i; return 0; }
+    static void set(Node* n, T v) { n->reset(); n->t = Node::Float; n->f = v; }
+};
+template <> struct Conv<const char*> {
+    static bool is(const Node* n) { return n && n->t == Node::Str; }
+    static const char* as(const Node* n) { return n && n->t == Node::Str ? n->s.c_str() : nullptr; }
+    static void set(Node* n, const char* v) { n->reset(); if (v) { n->t = Node::Str; n->s = v; } }
+};
+template <> struct Conv<char*> : Conv<const char*> {};
+template <> struct Conv<String> {
+    static bool is(const Node* n) { return n && n->t == Node::Str; }
+    static String as(const Node* n) { if (!n) return String("null"); if (n->t == Node::Str) return String(n->s.c_str()); return String(); }
+    static void set(Node* n, const String& v) { n->reset(); n->t = Node::Str; n->s = v.c_str(); }
+};
+void serializeNode(const Node* n, std::string& out);
+bool parseNode(Node* n, int (*get)(void*), int (*peek)(void*), void* ctx, int depth);
+}
+
+class JsonVariantConst {
+public:
+    const ajs::Node* node_ = nullptr;
+    JsonVariantConst() {}
+    explicit JsonVariantConst(const ajs::Node* n) : node_(n) {}
+    template <typename T> bool is() const;
+    template <typename T> T as() const;
+    template <typename T, typename = typename std::enable_if<!std::is_base_of<JsonVariantConst, T>::value && !std::is_same<T, JsonObjectConst>::value && !std::is_same<T, JsonArrayConst>::value && !std::is_same<T, JsonObject>::value && !std::is_same<T, JsonArray>::value && !std::is_same<T, JsonVariant>::value>::type>
+    operator T() const { return as<T>(); }
+    JsonVariantConst operator[](const char* k) const { return JsonVariantConst(node_ && node_->t == ajs::Node::Obj ? node_->find(k) : nullptr); }
+    JsonVariantConst operator[](const String& k) const { return (*this)[k.c_str()]; }
+    JsonVariantConst operator[](size_t i) const { return JsonVariantConst(node_ ? node_->at(i) : nullptr); }
+    JsonVariantConst operator[](int i) const { return (*this)[(size_t)i]; }
+    bool isNull() const { return !node_ || node_->t == ajs::Node::Null; }
+    size_t size() const { if (!node_) return 0; return node_->t == ajs::Node::Arr ? node_->arr.size() : node_->t == ajs::Node::Obj ? node_->obj.size() : 0; }
+    bool containsKey(const char* k) const { return node_ && node_->find(k); }
+};
+
+class JsonVariant : public JsonVariantConst {
+public:
+    ajs::Node* mnode_ = nullptr;
+    JsonVariant() {}
+    explicit JsonVariant(ajs::Node* n) : JsonVariantConst(n), mnode_(n) {}
+    JsonVariant operator[](const char* k) const { return JsonVariant(mnode_ ? mnode_->member(k) : nullptr); }
+    JsonVariant operator[](const String& k) const { return (*this)[k.c_str()]; }
+    JsonVariant operator[](size_t i) const { return JsonVariant(mnode_ ? mnode_->at(i) : nullptr); }
+    JsonVariant operator[](int i) const { return (*this)[(size_t)i]; }
+    template <typename T> T to() const;
+    template <typename T> T add() const;
+    template <typename T> bool add(const T& v) const;
+    bool set(JsonVariantConst v) const { if (!mnode_) return false; *mnode_ = v.node_ ? *v.node_->clone() : ajs::Node(); return true; }
+    template <typename T> typename std::enable_if<!std::is_base_of<JsonVariantConst, T>::value && !std::is_same<T, JsonObjectConst>::value && !std::is_same<T, JsonArrayConst>::value && !std::is_same<T, JsonObject>::value && !std::is_same<T, JsonArray>::value && !std::is_array<T>::value, const JsonVariant&>::type
+    operator=(const T& v) const { if (mnode_) ajs::Conv<T>::set(mnode_, v); return *this; }
+    const JsonVariant& operator=(const char* v) const { if (mnode_) ajs::Conv<const char*>::set(mnode_, v); return *this; }
+    const JsonVariant& operator=(const JsonVariant& v) const { set(v); return *this; }
+    const JsonVariant& operator=(const JsonVariantConst& v) const { set(v); return *this; }
+    const JsonVariant& operator=(const JsonObject& v) const;
+    const JsonVariant& operator=(const JsonArray& v) const;
+    bool remove(const char* k) const;
+    JsonObject createNestedObject(const char* k) const;
+    JsonArray createNestedArray(const char* k) const;
+};
+
+class JsonObjectConst {
+public:
+    const ajs::Node* node_ = nullptr;
+    JsonObjectConst() {}
+    explicit JsonObjectConst(const ajs::Node* n) : node_(n && n->t == ajs::Node::Obj ? n : nullptr) {}
+    explicit operator bool() const { return node_ != nullptr; }
+    bool isNull() const { return !node_; }
+    JsonVariantConst operator[](const char* k) const { return JsonVariantConst(node_ ? node_->find(k) : nullptr); }
+    JsonVariantConst operator[](const String& k) const { return (*this)[k.c_str()]; }
+    bool containsKey(const char* k) const { return node_ && node_->find(k); }
+    size_t size() const { return node_ ? node_->obj.size() : 0; }
+};
+class JsonObject : public JsonObjectConst {
+public:
+    ajs::Node* mnode_ = nullptr;
+    JsonObject() {}
+    explicit JsonObject(ajs::Node* n) : JsonObjectConst(n), mnode_(n && n->t == ajs::Node::Obj ? n : nullptr) {}
+    JsonVariant operator[](const char* k) const { return JsonVariant(mnode_ ? mnode_->member(k) : nullptr); }
+    JsonVariant operator[](const String& k) const { return (*this)[k.c_str()]; }
+    void remove(const char* k) const { if (!mnode_) return; for (auto it = mnode_->obj.begin(); it != mnode_->obj.end(); ++it) if (it->first == k) { mnode_->obj.erase(it); return; } }
+    JsonObject createNestedObject(const char* k) const { auto* n = mnode_ ? mnode_->member(k) : nullptr; if (n) { n->reset(); n->t = ajs::Node::Obj; } return JsonObject(n); }
+    JsonArray createNestedArray(const char* k) const;
+    bool set(JsonObjectConst o) const { if (!mnode_ || !o.node_) return false; *mnode_ = *o.node_->clone(); return true; }
+};
+template <typename V, typename N>
+struct ArrIter {
+    N* n; size_t i;
+    V operator*() const { return V(n->arr[i].get()); }
+    ArrIter& operator++() { ++i; return *this; }
+    bool operator!=(const ArrIter& o) const { return i != o.i; }
+};
+class JsonArrayConst {
+public:
+    const ajs::Node* node_ = nullptr;
+    JsonArrayConst() {}
+    explicit JsonArrayConst(const ajs::Node* n) : node_(n && n->t == ajs::Node::Arr ? n : nullptr) {}
+    explicit operator bool() const { return node_ != nullptr; }
+    bool isNull() const { return !node_; }
+    size_t size() const { return node_ ? node_->arr.size() : 0; }
+    JsonVariantConst operator[](size_t i) const { return JsonVariantConst(node_ ? node_->at(i) : nullptr); }
+    ArrIter<JsonVariantConst, const ajs::Node> begin() const { return {node_, 0}; }
+    ArrIter<JsonVariantConst, const ajs::Node> end() const { return {node_, size()}; }
+};
+class JsonArray : public JsonArrayConst {
+public:
+    ajs::Node* mnode_ = nullptr;
+    JsonArray() {}
+    explicit JsonArray(ajs::Node* n) : JsonArrayConst(n), mnode_(n && n->t == ajs::Node::Arr ? n : nullptr) {}
+    JsonVariant operator[](size_t i) const { return JsonVariant(mnode_ ? mnode_->at(i) : nullptr); }
+    template <typename T> T add() const { if (!mnode_) return T(); mnode_->arr.push_back(mnode_->make()); return JsonVariant(mnode_->arr.back().get()).to<T>(); }
+    template <typename T> bool add(const T& v) const { if (!mnode_) return false; mnode_->arr.push_back(mnode_->make()); JsonVariant(mnode_->arr.back().get()) = v; return true; }
+    bool add(const char* v) const { return add<const char*>(v); }
+    ArrIter<JsonVariant, ajs::Node> begin() const { return {mnode_, 0}; }
+    ArrIter<JsonVariant, ajs::Node> end() const { return {mnode_, size()}; }
+    JsonObject createNestedObject() const { return add<JsonObject>(); }
+};
+inline JsonArray JsonObject::createNestedArray(const char* k) const { auto* n = mnode_ ? mnode_->member(k) : nullptr; if (n) { n->reset(); n->t = ajs::Node::Arr; } return JsonArray(n); }
+inline JsonObject JsonVariant::createNestedObject(const char* k) const { if (mnode_ && mnode_->t == ajs::Node::Null) mnode_->t = ajs::Node::Obj; return JsonObject(mnode_).createNestedObject(k); }
+inline JsonArray JsonVariant::createNestedArray(const char* k) const { if (mnode_ && mnode_->t == ajs::Node::Null) mnode_->t = ajs::Node::Obj; return JsonObject(mnode_).createNestedArray(k); }
+inline bool JsonVariant::remove(const char* k) const { JsonObject(mnode_).remove(k); return true; }
+inline const JsonVariant& JsonVariant::operator=(const JsonObject& v) const { set(JsonVariantConst(v.node_)); return *this; }
+inline const JsonVariant& JsonVariant::operator=(const JsonArray& v) const { set(JsonVariantConst(v.node_)); return *this; }
+
+namespace ajs {
+template <typename T> struct Kind { static bool is(const Node* n) { return Conv<T>::is(n); } static T as(const Node* n) { return Conv<T>::as(n); } };
+template <> struct Kind<JsonObjectConst> { static bool is(const Node* n) { return n && n->t == Node::Obj; } static JsonObjectConst as(const Node* n) { return JsonObjectConst(n); } };
+template <> struct Kind<JsonObject> { static bool is(const Node* n) { return n && n->t == Node::Obj; } static JsonObject as(const Node* n) { return JsonObject(const_cast<Node*>(n)); } };
+template <> struct Kind<JsonArrayConst> { static bool is(const Node* n) { return n && n->t == Node::Arr; } static JsonArrayConst as(const Node* n) { return JsonArrayConst(n); } };
+template <> struct Kind<JsonArray> { static bool is(const Node* n) { return n && n->t == Node::Arr; } static JsonArray as(const Node* n) { return JsonArray(const_cast<Node*>(n)); } };
+template <> struct Kind<JsonVariantConst> { static bool is(const Node*) { return true; } static JsonVariantConst as(const Node* n) { return JsonVariantConst(n); } };
+template <> struct Kind<JsonVariant> { static bool is(const Node*) { return true; } static JsonVariant as(const Node* n) { return JsonVariant(const_cast<Node*>(n)); } };
+}
+template <typename T> bool JsonVariantConst::is() const { return ajs::Kind<T>::is(node_); }
+template <typename T> T JsonVariantConst::as() const { return ajs::Kind<T>::as(node_); }
+template <typename T> T JsonVariant::to() const { if (!mnode_) return T(); mnode_->reset(); if (std::is_same<T, JsonArray>::value) mnode_->t = ajs::Node::Arr; else if (std::is_same<T, JsonObject>::value) mnode_->t = ajs::Node::Obj; return ajs::Kind<T>::as(mnode_); }
+template <typename T> T JsonVariant::add() const { if (mnode_ && mnode_->t == ajs::Node::Null) mnode_->t = ajs::Node::Arr; return JsonArray(mnode_).add<T>(); }
+template <typename T> bool JsonVariant::add(const T& v) const { if (mnode_ && mnode_->t == ajs::Node::Null) mnode_->t = ajs::Node::Arr; return JsonArray(mnode_).add(v); }
+
+template <typename T>
+typename std::enable_if<!std::is_base_of<JsonVariantConst, T>::value && !std::is_array<T>::value, T>::type
+operator|(const JsonVariantConst& v, const T& def) { return ajs::Conv<T>::is(v.node_) ? ajs::Conv<T>::as(v.node_) : def; }
+inline const char* operator|(const JsonVariantConst& v, const char* def) { return ajs::Conv<const char*>::is(v.node_) ? v.node_->s.c_str() : def; }
+inline JsonVariantConst operator|(const JsonVariantConst& v, const JsonVariantConst& def) { return v.isNull() ? def : v; }
+
+class DeserializationError {
+public:
+    enum Code { Ok, EmptyInput, IncompleteInput, InvalidInput, NoMemory, TooDeep };
+    Code code_ = Ok;
+    DeserializationError() {}
+    DeserializationError(Code c) : code_(c) {}
+    explicit operator bool() const { return code_ != Ok; }
+    bool operator==(Code c) const { return code_ == c; }
+    bool operator!=(Code c) const { return code_ != c; }
+    Code code() const { return code_; }
+    const char* c_str() const { static const char* n[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"}; return n[code_]; }
+};
+
+class JsonDocument {
+public:
+    std::unique_ptr<ajs::Res> own_;
+    std::pmr::memory_resource* res_ = std::pmr::new_delete_resource();
+    ajs::NodePtr root_ = std::make_shared<ajs::Node>();
+    JsonDocument() {}
+    explicit JsonDocument(ArduinoJson::Allocator* a) : own_(new ajs::Res(a)), res_(own_.get()), root_(std::make_shared<ajs::Node>(res_)) {}
+    JsonDocument(const JsonDocument& o) : root_(o.root_->cloneIn(res_)) {}
+    JsonDocument(JsonDocument&& o) : own_(std::move(o.own_)), res_(o.res_), root_(std::move(o.root_)) { o.res_ = std::pmr::new_delete_resource(); o.root_ = std::make_shared<ajs::Node>(); }
+    JsonDocument& operator=(const JsonDocument& o) { root_ = o.root_->cloneIn(res_); return *this; }
+    JsonDocument& operator=(JsonDocument&& o) { std::swap(own_, o.own_); std::swap(res_, o.res_); std::swap(root_, o.root_); return *this; }
+    virtual ~JsonDocument() { root_.reset(); }
+    JsonVariant operator[](const char* k) { return JsonVariant(root_->member(k)); }
+    JsonVariant operator[](const String& k) { return (*this)[k.c_str()]; }
+    JsonVariantConst operator[](const char* k) const { return JsonVariantConst(root_->t == ajs::Node::Obj ? root_->find(k) : nullptr); }
+    JsonVariantConst operator[](const String& k) const { return (*this)[k.c_str()]; }
+    JsonVariant operator[](size_t i) { return JsonVariant(root_->at(i)); }
+    template <typename T> T to() { return JsonVariant(root_.get()).to<T>(); }
+    template <typename T> T as() { return ajs::Kind<T>::as(root_.get()); }
+    template <typename T> T as() const { return ajs::Kind<T>::as(root_.get()); }
+    template <typename T> bool is() const { return ajs::Kind<T>::is(root_.get()); }
+    template <typename T> T add() { return JsonVariant(root_.get()).add<T>(); }
+    template <typename T> bool add(const T& v) { return JsonVariant(root_.get()).add(v); }
+    bool set(const JsonDocument& o) { root_ = o.root_->cloneIn(res_); return true; }
+    bool set(JsonVariantConst v) { return JsonVariant(root_.get()).set(v); }
+    JsonObject createNestedObject(const char* k) { if (root_->t == ajs::Node::Null) root_->t = ajs::Node::Obj; return JsonObject(root_.get()).createNestedObject(k); }
+    JsonArray createNestedArray(const char* k) { if (root_->t == ajs::Node::Null) root_->t = ajs::Node::Obj; return JsonObject(root_.get()).createNestedArray(k); }
+    bool containsKey(const char* k) const { return root_->find(k); }
+    void remove(const char* k) { JsonObject(root_.get()).remove(k); }
+    size_t capacity() const { return 65536; }
+    size_t memoryUsage() const { return 0; }
+    bool overflowed() const { return false; }
+    void clear() { root_->reset(); }
+    void shrinkToFit() {}
+    bool isNull() const { return root_->t == ajs::Node::Null; }
+    size_t size() const { return JsonVariantConst(root_.get()).size(); }
+    operator JsonVariant() { return JsonVariant(root_.get()); }
+    operator JsonVariantConst() const { return JsonVariantConst(root_.get()); }
+};
+class DynamicJsonDocument : public JsonDocument { public: explicit DynamicJsonDocument(size_t) {} };
+template <size_t N> class StaticJsonDocument : public JsonDocument {};
+
+namespace ajs {
+inline const Node* rootOf(const JsonDocument& d) { return d.root_.get(); }
+inline const Node* rootOf(const JsonVariantConst& v) { return v.node_; }
+inline const Node* rootOf(const JsonObjectConst& v) { return v.node_; }
+inline const Node* rootOf(const JsonArrayConst& v) { return v.node_; }
+}
+template <typename T> size_t serializeJson(const T& src, String& out) { std::string s; ajs::serializeNode(ajs::rootOf(src), s); out = String(s); return s.size(); }
+template <typename T> size_t serializeJson(const T& src, Print& out) { static thread_local std::string s; s.clear(); ajs::serializeNode(ajs::rootOf(src), s); return out.write((const uint8_t*)s.data(), s.size()); }
+template <typename T> size_t serializeJson(const T& src, char* buf, size_t n) { std::string s; ajs::serializeNode(ajs::rootOf(src), s); size_t k = std::min(n ? n - 1 : 0, s.size()); memcpy(buf, s.data(), k); if (n) buf[k] = 0; return k; }
+template <typename T> size_t measureJson(const T& src) { std::string s; ajs::serializeNode(ajs::rootOf(src), s); return s.size(); }
+
+DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t len);
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input) { return deserializeJson(doc, input, strlen(input)); }
+inline DeserializationError deserializeJson(JsonDocument& doc, char* input, size_t len) { return deserializeJson(doc, (const char*)input, len); }
+inline DeserializationError deserializeJson(JsonDocument& doc, const uint8_t* input, size_t len) { return deserializeJson(doc, (const char*)input, len); }
+inline DeserializationError deserializeJson(JsonDocument& doc, uint8_t* input, size_t len) { return deserializeJson(doc, (const char*)input, len); }
+inline DeserializationError deserializeJson(JsonDocument& doc, const String& input) { return deserializeJson(doc, input.c_str(), input.length()); }
+DeserializationError deserializeJson(JsonDocument& doc, Stream& input);
+namespace DeserializationOption { struct Filter { explicit Filter(const JsonDocument&) {} }; }
+inline DeserializationError deserializeJson(JsonDocument& doc, const String& input, DeserializationOption::Filter) { return deserializeJson(doc, input); }
@@ -0,0 +1,48 @@
+#pragma once
+#include "Arduino.h"
+#include "FS.h"
+#include <functional>
+enum WebRequestMethod { HTTP_GET = 1, HTTP_POST = 2, HTTP_DELETE = 4, HTTP_PUT = 8, HTTP_PATCH = 16, HTTP_HEAD = 32, HTTP_OPTIONS = 64, HTTP_ANY = 127 };
+typedef int WebRequestMethodComposite;
+class AsyncWebParameter { public: String v; const String& value() const { return v; } const String& name() const { return v; } };
+class AsyncWebHeader { public: String v; const String& value() const { return v; } };
+class AsyncWebServerResponse { public: virtual ~AsyncWebServerResponse() {} void addHeader(const String&, const String&) {} void setCode(int) {} };
+class AsyncResponseStream : public AsyncWebServerResponse, public Print { public: std::string body; size_t write(uint8_t c) override { body += (char)c; return 1; } size_t write(const uint8_t* b, size_t n) override { body.append((const char*)b, n); return n; } using Print::write; };
+class AsyncWebServerRequest;
+typedef std::function<size_t(uint8_t*, size_t, size_t)> AwsResponseFiller;
+class AsyncWebServerRequest {
+public:
+    void send(int, const String& = String(), const String& = String()) {}
+    void send(AsyncWebServerResponse*) {}
+    AsyncWebServerResponse* beginResponse(int, const String& = String(), const String& = String()) { return new AsyncWebServerResponse; }
+    AsyncWebServerResponse* beginChunkedResponse(const String&, AwsResponseFiller) { return new AsyncWebServerResponse; }
+    AsyncResponseStream* beginResponseStream(const String&, size_t = 1460) { return new AsyncResponseStream; }
+    bool hasParam(const String&, bool = false, bool = false) const { return false; }
+    AsyncWebParameter* getParam(const String&, bool = false, bool = false) const { static AsyncWebParameter p; return &p; }
+    bool hasHeader(const String&) const { return false; }
+    AsyncWebHeader* getHeader(const String&) const { static AsyncWebHeader h; return &h; }
+    String url() const { return String(); }
+    String contentType() const { return String(); }
+    int method() const { return HTTP_GET; }
+    const String& pathArg(size_t) const { static String s; return s; }
+};
+typedef std::function<void(AsyncWebServerRequest*)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest*, const String&, size_t, uint8_t*, size_t, bool)> ArUploadHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest*, uint8_t*, size_t, size_t, size_t)> ArBodyHandlerFunction;
+class AsyncWebHandler { public: virtual ~AsyncWebHandler() {} virtual bool canHandle(AsyncWebServerRequest*) { return false; } virtual void handleRequest(AsyncWebServerRequest*) {} virtual bool isRequestHandlerTrivial() { return true; } };
+class AsyncStaticWebHandler : public AsyncWebHandler { public: AsyncStaticWebHandler& setDefaultFile(const char*) { return *this; } };
+class AsyncCallbackWebHandler : public AsyncWebHandler {};
+class AsyncWebServer {
+public:
+    AsyncWebServer(uint16_t) {}
+    void begin() {}
+    AsyncCallbackWebHandler& on(const char*, WebRequestMethodComposite, ArRequestHandlerFunction) { static AsyncCallbackWebHandler h; return h; }
+    AsyncCallbackWebHandler& on(const char*, WebRequestMethodComposite, ArRequestHandlerFunction, ArUploadHandlerFunction) { static AsyncCallbackWebHandler h; return h; }
+    AsyncCallbackWebHandler& on(const char*, WebRequestMethodComposite, ArRequestHandlerFunction, ArUploadHandlerFunction, ArBodyHandlerFunction) { static AsyncCallbackWebHandler h; return h; }
+    void onNotFound(ArRequestHandlerFunction) {}
+    AsyncWebHandler& addHandler(AsyncWebHandler* h) { return *h; }
+    AsyncStaticWebHandler& serveStatic(const char*, fs::FS&, const char*, const char* = nullptr) { static AsyncStaticWebHandler h; return h; }
+};
+enum AwsEventType { WS_EVT_CONNECT, WS_EVT_DISCONNECT, WS_EVT_PONG, WS_EVT_ERROR, WS_EVT_DATA };
+class AsyncWebSocketClient { public: void text(const String&) {} };
+class AsyncWebSocket : public AsyncWebHandler { public: AsyncWebSocket(const String&) {} typedef std::function<void(AsyncWebSocket*, AsyncWebSocketClient*, AwsEventType, void*, uint8_t*, size_t)> H; void onEvent(H) {} void textAll(const String&) {} };
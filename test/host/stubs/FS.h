@@ -0,0 +1,55 @@
+#pragma once
+#include "Arduino.h"
+#include <memory>
+#include <ctime>
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+namespace fs {
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+struct FileImpl;
+class File : public Stream {
+public:
+    std::shared_ptr<FileImpl> impl;
+    File() {}
+    explicit File(std::shared_ptr<FileImpl> i) : impl(i) {}
+    operator bool() const;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* b, size_t n) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t* b, size_t n);
+    size_t readBytes(char* b, size_t n) override { return read((uint8_t*)b, n); }
+    void flush() override;
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close();
+    const char* name() const;
+    const char* path() const;
+    time_t getLastWrite();
+    bool isDirectory() const;
+    File openNextFile(const char* mode = "r");
+};
+class FS {
+public:
+    File open(const char* path, const char* mode = "r", bool create = false);
+    File open(const String& path, const char* mode = "r", bool create = false) { return open(path.c_str(), mode, create); }
+    bool exists(const char* path);
+    bool exists(const String& p) { return exists(p.c_str()); }
+    bool remove(const char* path);
+    bool remove(const String& p) { return remove(p.c_str()); }
+    bool rename(const char* a, const char* b);
+    bool rename(const String& a, const String& b) { return rename(a.c_str(), b.c_str()); }
+    bool mkdir(const char* p);
+    bool mkdir(const String& p) { return mkdir(p.c_str()); }
+    bool rmdir(const char* p);
+};
+}
+using fs::File;
+using fs::FS;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
@@ -0,0 +1,10 @@
+#pragma once
+#include "FS.h"
+class LittleFSFS : public fs::FS {
+public:
+    bool begin(bool = false, const char* = "/littlefs", uint8_t = 10, const char* = "spiffs") { return true; }
+    size_t totalBytes() { return 0x270000; }
+    size_t usedBytes();
+    bool format() { return true; }
+};
+extern LittleFSFS LittleFS;
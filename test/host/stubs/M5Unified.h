@@ -0,0 +1,5 @@
+#pragma once
+#include "Arduino.h"
+class M5Canvas {};
+struct M5Stub { void begin() {} void update() {} };
+extern M5Stub M5;
@@ -0,0 +1,13 @@
+#pragma once
+#include "Arduino.h"
+class Preferences {
+public:
+    bool begin(const char* ns, bool ro = false);
+    void end();
+    bool clear();
+    uint16_t getUShort(const char* k, uint16_t d = 0);
+    size_t putUShort(const char* k, uint16_t v);
+    uint32_t getUInt(const char* k, uint32_t d = 0);
+    size_t putUInt(const char* k, uint32_t v);
+    bool isKey(const char* k);
+};
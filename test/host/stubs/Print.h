@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdarg>
+#include "WString.h"
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* b, size_t n) { size_t w = 0; for (size_t i = 0; i < n; ++i) w += write(b[i]); return w; }
+    size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t write(const char* s, size_t n) { return write((const uint8_t*)s, n); }
+    size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+    size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v) { return print(String(v)); }
+    size_t print(unsigned v) { return print(String(v)); }
+    size_t print(long v) { return print(String(v)); }
+    size_t print(unsigned long v) { return print(String(v)); }
+    size_t print(long long v) { return print(String(v)); }
+    size_t print(unsigned long long v) { return print(String(v)); }
+    size_t print(double v, int d = 2) { return print(String(v, d)); }
+    size_t println() { return print("\r\n"); }
+    template <typename T> size_t println(const T& v) { return print(v) + println(); }
+    size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) { char b[1024]; va_list a; va_start(a, fmt); int n = vsnprintf(b, sizeof b, fmt, a); va_end(a); return write((const uint8_t*)b, n < 0 ? 0 : (n > 1023 ? 1023 : n)); }
+    virtual void flush() {}
+};
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t readBytes(char* b, size_t n) { size_t i = 0; while (i < n) { int c = read(); if (c < 0) break; b[i++] = (char)c; } return i; }
+    size_t readBytes(uint8_t* b, size_t n) { return readBytes((char*)b, n); }
+    String readStringUntil(char t) { String r; while (true) { int c = read(); if (c < 0 || c == t) break; r += (char)c; } return r; }
+    void setTimeout(unsigned long) {}
+    bool find(const char* t) { return findUntil(t, nullptr); }
+    bool findUntil(const char* t, const char* term) { size_t ti = 0, mi = 0, tl = strlen(t), ml = term ? strlen(term) : 0; while (true) { int c = read(); if (c < 0) return false; if (c == t[ti]) { if (++ti == tl) return true; } else ti = (c == t[0]) ? 1 : 0; if (ml) { if (c == term[mi]) { if (++mi == ml) return false; } else mi = (c == term[0]) ? 1 : 0; } } }
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <strings.h>
+class String {
+public:
+    std::string s;
+    String() {}
+    String(const char* c) : s(c ? c : "") {}
+    String(const std::string& x) : s(x) {}
+    String(const char* c, unsigned n) : s(c, n) {}
+    String(char c) : s(1, c) {}
+    String(int v) : s(std::to_string(v)) {}
+    String(unsigned v) : s(std::to_string(v)) {}
+    String(long v) : s(std::to_string(v)) {}
+    String(unsigned long v) : s(std::to_string(v)) {}
+    String(long long v) : s(std::to_string(v)) {}
+    String(unsigned long long v) : s(std::to_string(v)) {}
+    String(float v, unsigned d = 2) { char b[64]; snprintf(b, sizeof b, "%.*f", d, v); s = b; }
+    String(double v, unsigned d = 2) { char b[64]; snprintf(b, sizeof b, "%.*f", d, v); s = b; }
+    const char* c_str() const { return s.c_str(); }
+    unsigned length() const { return s.size(); }
+    bool isEmpty() const { return s.empty(); }
+    bool reserve(unsigned n) { s.reserve(n); return true; }
+    String& operator+=(const String& o) { s += o.s; return *this; }
+    String& operator+=(const char* o) { s += o; return *this; }
+    String& operator+=(char c) { s += c; return *this; }
+    String& operator+=(int v) { s += std::to_string(v); return *this; }
+    String& operator+=(unsigned v) { s += std::to_string(v); return *this; }
+    String& operator+=(long v) { s += std::to_string(v); return *this; }
+    String& operator+=(unsigned long v) { s += std::to_string(v); return *this; }
+    bool concat(const String& o) { s += o.s; return true; }
+    bool concat(const char* o, unsigned n) { s.append(o, n); return true; }
+    bool concat(char c) { s += c; return true; }
+    bool operator==(const String& o) const { return s == o.s; }
+    bool operator==(const char* o) const { return s == (o ? o : ""); }
+    bool operator!=(const String& o) const { return s != o.s; }
+    bool operator!=(const char* o) const { return s != (o ? o : ""); }
+    bool operator<(const String& o) const { return s < o.s; }
+    bool operator>(const String& o) const { return s > o.s; }
+    explicit operator bool() const { return true; }
+    char operator[](unsigned i) const { return i < s.size() ? s[i] : 0; }
+    char& operator[](unsigned i) { return s[i]; }
+    char charAt(unsigned i) const { return (*this)[i]; }
+    void setCharAt(unsigned i, char c) { if (i < length()) (*this)[i] = c; }
+    bool startsWith(const String& p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+    bool endsWith(const String& p) const { return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0; }
+    String substring(unsigned b) const { return b >= s.size() ? String() : String(s.substr(b)); }
+    String substring(unsigned b, unsigned e) const { if (b > e) std::swap(b, e); if (b >= s.size()) return String(); return String(s.substr(b, e - b)); }
+    int indexOf(char c, unsigned from = 0) const { auto p = s.find(c, from); return p == std::string::npos ? -1 : (int)p; }
+    int indexOf(const String& c, unsigned from = 0) const { auto p = s.find(c.s, from); return p == std::string::npos ? -1 : (int)p; }
+    int lastIndexOf(char c) const { auto p = s.rfind(c); return p == std::string::npos ? -1 : (int)p; }
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return atof(s.c_str()); }
+    void trim() { size_t b = s.find_first_not_of(" \t\r\n"); if (b == std::string::npos) { s.clear(); return; } size_t e = s.find_last_not_of(" \t\r\n"); s = s.substr(b, e - b + 1); }
+    bool equalsIgnoreCase(const String& o) const { return strcasecmp(s.c_str(), o.s.c_str()) == 0; }
+    int compareTo(const String& o) const { return s.compare(o.s); }
+    void replace(const String& a, const String& b) { size_t p = 0; while ((p = s.find(a.s, p)) != std::string::npos) { s.replace(p, a.s.size(), b.s); p += b.s.size(); } }
+    void toLowerCase() { for (auto& c : s) c = tolower(c); }
+    void toUpperCase() { for (auto& c : s) c = toupper(c); }
+    void remove(unsigned i, unsigned n = 1) { s.erase(i, n); }
+};
+inline String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+inline String operator+(const String& a, const char* b) { return String(a.s + b); }
+inline String operator+(const char* a, const String& b) { return String(std::string(a) + b.s); }
+inline String operator+(const String& a, char b) { return String(a.s + b); }
+inline String operator+(const String& a, int b) { return String(a.s + std::to_string(b)); }
+inline String operator+(const String& a, unsigned b) { return String(a.s + std::to_string(b)); }
+#define F(x) x
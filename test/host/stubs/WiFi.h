@@ -0,0 +1,21 @@
+#pragma once
+#include "Arduino.h"
+typedef enum { WIFI_MODE_NULL, WIFI_MODE_STA, WIFI_MODE_AP, WIFI_MODE_APSTA } wifi_mode_t;
+#define WIFI_AP WIFI_MODE_AP
+#define WIFI_AP_STA WIFI_MODE_APSTA
+#define WL_CONNECTED 3
+struct IPAddress { String toString() const { return "0.0.0.0"; } };
+struct WiFiClass {
+    bool softAP(const char*, const char*, int = 1, int = 0, int = 4) { return true; }
+    bool softAPdisconnect(bool = false) { return true; }
+    bool enableAP(bool) { return true; }
+    wifi_mode_t getMode() { return WIFI_MODE_AP; }
+    bool mode(wifi_mode_t) { return true; }
+    bool isConnected() { return false; }
+    int status() { return 0; }
+    void begin(const char*, const char*) {}
+    void setSleep(bool) {}
+    bool softAPsetHostname(const char*) { return true; }
+    IPAddress softAPIP() { return {}; }
+};
+extern WiFiClass WiFi;
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+typedef void* SemaphoreHandle_t;
+typedef void* TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffffu
+#define pdMS_TO_TICKS(x) (x)
+#define portTICK_PERIOD_MS 1
+#define tskNO_AFFINITY 0x7fffffff
+typedef struct { int x; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+inline void portENTER_CRITICAL(portMUX_TYPE*) {}
+inline void portEXIT_CRITICAL(portMUX_TYPE*) {}
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t);
+typedef void (*TaskFunction_t)(void*);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t);
+BaseType_t xTaskCreate(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*);
+void vTaskDelay(TickType_t);
+void vTaskDelete(TaskHandle_t);
+TickType_t xTaskGetTickCount();
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t);
+BaseType_t xTaskNotifyGive(TaskHandle_t);
+TaskHandle_t xTaskGetCurrentTaskHandle();
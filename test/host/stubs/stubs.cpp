@@ -0,0 +1,184 @@
+#include "Arduino.h"
+#include "ArduinoJson.h"
+#include "LittleFS.h"
+#include "Preferences.h"
+#include "esp_timer.h"
+#include <chrono>
+#include <thread>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <ctime>
+#include <malloc.h>
+
+static auto g_t0 = std::chrono::steady_clock::now();
+unsigned long g_virtualMs = 0; // tests advance time without sleeping
+unsigned long millis() { return g_virtualMs + std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - g_t0).count(); }
+unsigned long micros() { return g_virtualMs * 1000 + std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_t0).count(); }
+int64_t esp_timer_get_time() { return micros(); }
+void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+void yield() {}
+bool g_quietSerial = false;
+size_t HardwareSerial::write(uint8_t c) { if (!g_quietSerial) fputc(c, stderr); return 1; }
+size_t HardwareSerial::write(const uint8_t* b, size_t n) { if (!g_quietSerial) fwrite(b, 1, n, stderr); return n; }
+HardwareSerial Serial;
+EspClass ESP;
+uint32_t EspClass::getFreeHeap() { return 200000; }
+uint32_t EspClass::getMinFreeHeap() { return 150000; }
+uint32_t EspClass::getMaxAllocHeap() { return 110000; }
+bool getLocalTime(struct tm* t, uint32_t) { time_t n = time(nullptr); localtime_r(&n, t); return true; }
+void configTime(long, int, const char*, const char*, const char*) {}
+
+// FreeRTOS
+#include <mutex>
+struct Mtx { std::recursive_mutex m; };
+SemaphoreHandle_t xSemaphoreCreateMutex() { return new Mtx; }
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() { return new Mtx; }
+SemaphoreHandle_t xSemaphoreCreateBinary() { return new Mtx; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t h, TickType_t) { static_cast<Mtx*>(h)->m.lock(); return pdTRUE; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t h) { static_cast<Mtx*>(h)->m.unlock(); return pdTRUE; }
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t h, TickType_t t) { return xSemaphoreTake(h, t); }
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t h) { return xSemaphoreGive(h); }
+#include <thread>
+#include <condition_variable>
+struct SimTask { std::mutex m; std::condition_variable cv; uint32_t notes = 0; };
+static thread_local SimTask* t_self = nullptr;
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t f, const char*, uint32_t, void* a, UBaseType_t, TaskHandle_t* h, BaseType_t) {
+    SimTask* t = new SimTask; if (h) *h = t;
+    std::thread([f, a, t] { t_self = t; f(a); }).detach(); return pdPASS; }
+BaseType_t xTaskCreate(TaskFunction_t f, const char* n, uint32_t s, void* a, UBaseType_t p, TaskHandle_t* h) { return xTaskCreatePinnedToCore(f, n, s, a, p, h, 0); }
+void vTaskDelay(TickType_t t) { delay(t); }
+void vTaskDelete(TaskHandle_t) {}
+TickType_t xTaskGetTickCount() { return millis(); }
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t) { if (!t_self) return 0; std::unique_lock<std::mutex> l(t_self->m); t_self->cv.wait(l, [] { return t_self->notes > 0; }); uint32_t n = t_self->notes; t_self->notes = clear ? 0 : n - 1; return n; }
+BaseType_t xTaskNotifyGive(TaskHandle_t h) { SimTask* t = static_cast<SimTask*>(h); { std::lock_guard<std::mutex> l(t->m); t->notes++; } t->cv.notify_one(); return pdPASS; }
+TaskHandle_t xTaskGetCurrentTaskHandle() { return (void*)2; }
+
+// Preferences
+static std::map<std::string, uint32_t> g_prefs;
+size_t g_prefsWrites = 0;
+bool Preferences::begin(const char*, bool) { return true; }
+void Preferences::end() {}
+bool Preferences::clear() { g_prefs.clear(); return true; }
+uint16_t Preferences::getUShort(const char* k, uint16_t d) { auto it = g_prefs.find(k); return it == g_prefs.end() ? d : it->second; }
+size_t Preferences::putUShort(const char* k, uint16_t v) { g_prefs[k] = v; ++g_prefsWrites; return 2; }
+uint32_t Preferences::getUInt(const char* k, uint32_t d) { auto it = g_prefs.find(k); return it == g_prefs.end() ? d : it->second; }
+size_t Preferences::putUInt(const char* k, uint32_t v) { g_prefs[k] = v; ++g_prefsWrites; return 4; }
+bool Preferences::isKey(const char* k) { return g_prefs.count(k); }
+
+// FS backed by a host dir
+// run.sh points KDS_HOST_FS at a scratch directory for each run
+std::string g_fsRoot = getenv("KDS_HOST_FS") ? getenv("KDS_HOST_FS") : "/tmp/kds-host-fs";
+static std::string hp(const char* p) { return g_fsRoot + p; }
+long g_fsWriteBudget = -1; // >= 0: bytes File::write() still accepts before writes come up short
+static size_t budgeted(size_t n) { if (g_fsWriteBudget < 0) return n; size_t k = std::min<size_t>(n, g_fsWriteBudget); g_fsWriteBudget -= k; return k; }
+namespace fs {
+struct FileImpl {
+    FILE* f = nullptr; std::string path; bool dir = false; DIR* d = nullptr;
+    ~FileImpl() { if (f) fclose(f); if (d) closedir(d); }
+};
+File::operator bool() const { return impl && (impl->f || impl->dir); }
+size_t File::write(uint8_t c) { return impl && impl->f && budgeted(1) ? fwrite(&c, 1, 1, impl->f) : 0; }
+size_t File::write(const uint8_t* b, size_t n) { return impl && impl->f ? fwrite(b, 1, budgeted(n), impl->f) : 0; }
+int File::available() { if (!impl || !impl->f) return 0; long p = ftell(impl->f); fseek(impl->f, 0, SEEK_END); long e = ftell(impl->f); fseek(impl->f, p, SEEK_SET); return e - p; }
+unsigned long g_fsReadBytes = 0;
+int File::read() { if (!impl || !impl->f) return -1; int c = fgetc(impl->f); if (c != EOF) g_fsReadBytes++; return c == EOF ? -1 : c; }
+int File::peek() { int c = read(); if (c >= 0) ungetc(c, impl->f); return c; }
+size_t File::read(uint8_t* b, size_t n) { size_t k = impl && impl->f ? fread(b, 1, n, impl->f) : 0; g_fsReadBytes += k; return k; }
+void File::flush() { if (impl && impl->f) fflush(impl->f); }
+bool File::seek(uint32_t pos, SeekMode m) { return impl && impl->f && fseek(impl->f, pos, m == SeekSet ? SEEK_SET : m == SeekCur ? SEEK_CUR : SEEK_END) == 0; }
+size_t File::position() const { return impl && impl->f ? ftell(impl->f) : 0; }
+size_t File::size() const { struct stat st; return impl && stat(hp(impl->path.c_str()).c_str(), &st) == 0 ? st.st_size : 0; }
+void File::close() { impl.reset(); }
+const char* File::name() const { if (!impl) return ""; auto p = impl->path.rfind('/'); return impl->path.c_str() + (p == std::string::npos ? 0 : p + 1); }
+const char* File::path() const { return impl ? impl->path.c_str() : ""; }
+time_t File::getLastWrite() { struct stat st; return impl && stat(hp(impl->path.c_str()).c_str(), &st) == 0 ? st.st_mtim.tv_sec * 1000 + st.st_mtim.tv_nsec / 1000000 : 0; }
+bool File::isDirectory() const { return impl && impl->dir; }
+File File::openNextFile(const char* mode) {
+    if (!impl || !impl->d) return File();
+    while (dirent* e = readdir(impl->d)) { if (e->d_name[0] == '.') continue; std::string p = impl->path + "/" + e->d_name; return LittleFS.open(p.c_str(), mode); }
+    return File();
+}
+File FS::open(const char* path, const char* mode, bool) {
+    auto i = std::make_shared<FileImpl>(); i->path = path;
+    struct stat st;
+    if (stat(hp(path).c_str(), &st) == 0 && S_ISDIR(st.st_mode)) { i->dir = true; i->d = opendir(hp(path).c_str()); return File(i); }
+    std::string m = mode; if (m == "r") m = "rb"; else if (m == "w") m = "wb"; else if (m == "a") m = "ab"; else if (m == "r+") m = "r+b";
+    i->f = fopen(hp(path).c_str(), m.c_str());
+    if (!i->f) return File();
+    return File(i);
+}
+bool FS::exists(const char* p) { struct stat st; return stat(hp(p).c_str(), &st) == 0; }
+bool FS::remove(const char* p) { return ::unlink(hp(p).c_str()) == 0; }
+bool FS::rename(const char* a, const char* b) { return ::rename(hp(a).c_str(), hp(b).c_str()) == 0; }
+bool FS::mkdir(const char* p) { return ::mkdir(hp(p).c_str(), 0755) == 0; }
+bool FS::rmdir(const char* p) { return ::rmdir(hp(p).c_str()) == 0; }
+}
+size_t LittleFSFS::usedBytes() { return 0; }
+LittleFSFS LittleFS;
+
+// JSON
+namespace ajs {
+static void esc(std::string_view s, std::string& o) {
+    o += '"';
+    for (unsigned char c : s) {
+        switch (c) { case '"': o += "\\\""; break; case '\\': o += "\\\\"; break; case '\n': o += "\\n"; break; case '\r': o += "\\r"; break; case '\t': o += "\\t"; break;
+        default: if (c < 0x20) { char b[8]; snprintf(b, sizeof b, "\\u%04x", c); o += b; } else o += (char)c; }
+    }
+    o += '"';
+}
+void serializeNode(const Node* n, std::string& o) {
+    if (!n) { o += "null"; return; }
+    switch (n->t) {
+    case Node::Null: o += "null"; break;
+    case Node::Bool: o += n->b ? "true" : "false"; break;
+    case Node::Int: o += std::to_string(n->i); break;
+    case Node::Float: { char b[32]; snprintf(b, sizeof b, "%.9g", n->f); o += b; break; }
+    case Node::Str: esc(n->s, o); break;
+    case Node::Arr: o += '['; for (size_t i = 0; i < n->arr.size(); ++i) { if (i) o += ','; serializeNode(n->arr[i].get(), o); } o += ']'; break;
+    case Node::Obj: o += '{'; for (size_t i = 0; i < n->obj.size(); ++i) { if (i) o += ','; esc(n->obj[i].first, o); o += ':'; serializeNode(n->obj[i].second.get(), o); } o += '}'; break;
+    }
+}
+struct P { int (*get)(void*); int (*peek)(void*); void* c; int g() { return get(c); } int p() { return peek(c); } void ws() { while (true) { int x = p(); if (x == ' ' || x == '\n' || x == '\r' || x == '\t') g(); else break; } } };
+template <typename S> static bool pstr(P& p, S& out) {
+    if (p.g() != '"') return false;
+    while (true) { int c = p.g(); if (c < 0) return false; if (c == '"') return true;
+        if (c == '\\') { int e = p.g(); switch (e) { case 'n': out += '\n'; break; case 'r': out += '\r'; break; case 't': out += '\t'; break; case 'b': out += '\b'; break; case 'f': out += '\f'; break;
+            case 'u': { char h[5] = {0}; for (int k = 0; k < 4; ++k) h[k] = p.g(); unsigned cp = strtoul(h, nullptr, 16); if (cp < 0x80) out += (char)cp; else if (cp < 0x800) { out += (char)(0xC0 | (cp >> 6)); out += (char)(0x80 | (cp & 0x3F)); } else { out += (char)(0xE0 | (cp >> 12)); out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F)); } break; }
+            default: out += (char)e; } }
+        else out += (char)c; }
+}
+static bool pv(P& p, Node* n, int d) {
+    if (d > 20) return false;
+    p.ws(); int c = p.p();
+    if (c == '{') { p.g(); n->t = Node::Obj; p.ws(); if (p.p() == '}') { p.g(); return true; }
+        while (true) { p.ws(); Node::Text k(n->r); if (!pstr(p, k)) return false; p.ws(); if (p.g() != ':') return false; auto ch = n->make(); if (!pv(p, ch.get(), d + 1)) return false; n->obj.emplace_back(std::move(k), ch); p.ws(); int x = p.g(); if (x == '}') return true; if (x != ',') return false; } }
+    if (c == '[') { p.g(); n->t = Node::Arr; p.ws(); if (p.p() == ']') { p.g(); return true; }
+        while (true) { auto ch = n->make(); if (!pv(p, ch.get(), d + 1)) return false; n->arr.push_back(ch); p.ws(); int x = p.g(); if (x == ']') return true; if (x != ',') return false; } }
+    if (c == '"') { n->t = Node::Str; return pstr(p, n->s); }
+    if (c == 't' || c == 'f' || c == 'n') { std::string w; while (isalpha(p.p())) w += (char)p.g(); if (w == "true") { n->t = Node::Bool; n->b = true; } else if (w == "false") { n->t = Node::Bool; n->b = false; } else if (w == "null") n->t = Node::Null; else return false; return true; }
+    if (c == '-' || (c >= '0' && c <= '9')) { std::string w; while (true) { int x = p.p(); if ((x >= '0' && x <= '9') || x == '-' || x == '+' || x == '.' || x == 'e' || x == 'E') w += (char)p.g(); else break; }
+        if (w.find_first_of(".eE") != std::string::npos) { n->t = Node::Float; n->f = atof(w.c_str()); } else { n->t = Node::Int; n->i = atoll(w.c_str()); } return true; }
+    return false;
+}
+}
+struct MemSrc { const char* s; size_t n, i; };
+static int memGet(void* c) { auto* m = (MemSrc*)c; return m->i < m->n ? (unsigned char)m->s[m->i++] : -1; }
+static int memPeek(void* c) { auto* m = (MemSrc*)c; return m->i < m->n ? (unsigned char)m->s[m->i] : -1; }
+DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t len) {
+    doc.clear(); MemSrc m{input, len, 0}; ajs::P p{memGet, memPeek, &m}; p.ws(); if (p.p() < 0) return DeserializationError::EmptyInput;
+    if (!ajs::pv(p, doc.root_.get(), 0)) { doc.clear(); return DeserializationError::InvalidInput; } return DeserializationError::Ok;
+}
+static int stGet(void* c) { return ((Stream*)c)->read(); }
+static int stPeek(void* c) { return ((Stream*)c)->peek(); }
+DeserializationError deserializeJson(JsonDocument& doc, Stream& in) {
+    doc.clear(); ajs::P p{stGet, stPeek, &in}; p.ws(); if (p.p() < 0) return DeserializationError::EmptyInput;
+    if (!ajs::pv(p, doc.root_.get(), 0)) { doc.clear(); return DeserializationError::InvalidInput; } return DeserializationError::Ok;
+}
+
+// printer_queue.cpp is not built on the host
+#include "printer_queue.h"
+void enqueuePrint(const Order&) {}
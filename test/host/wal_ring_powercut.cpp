@@ -0,0 +1,276 @@
+// WalRing on simulated NOR flash: power cuts at random points, wraparound against the release
+// horizon, and the horizon after a remount. With -DKDS_WAL_RAW_PARTITION=1 the WAL itself also
+// runs on the simulated partition.
+//
+//   test/host/run.sh wal_ring_powercut -DKDS_WAL_RAW_PARTITION=1
+#include "esp_partition_flash.h"
+#include "wal.h"
+#include "wal_ring.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+
+extern bool g_quietSerial;
+
+static uint32_t g_rng = 99;
+static uint32_t rnd() {
+    g_rng = g_rng * 1103515245 + 12345;
+    return g_rng >> 8;
+}
+
+// Erase-before-write flash: write() can only clear bits and erase() resets a page to 0xFF.
+// Once `budget` bytes have been programmed the power goes: the byte being written (or the page
+// being erased) is left with random bits and every later operation fails until the next mount.
+class SimFlash : public WalRingFlash {
+public:
+    explicit SimFlash(uint32_t pages) : mem(pages * kWalRingPageSize, 0xFF) {}
+
+    uint32_t size() const override { return static_cast<uint32_t>(mem.size()); }
+
+    bool read(uint32_t offset, void* out, size_t len) override {
+        if (offset + len > mem.size()) return false;
+        memcpy(out, &mem[offset], len);
+        return true;
+    }
+
+    bool write(uint32_t offset, const void* data, size_t len) override {
+        if (dead || offset + len > mem.size()) return false;
+        const uint8_t* in = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < len; ++i) {
+            if (budget == 0) {
+                mem[offset + i] &= static_cast<uint8_t>(rnd());
+                dead = true;
+                return false;
+            }
+            if (budget > 0) budget--;
+            if ((mem[offset + i] & in[i]) != in[i]) unerasedWrites++;
+            mem[offset + i] &= in[i];
+        }
+        return true;
+    }
+
+    bool erase(uint32_t offset) override {
+        if (dead || offset % kWalRingPageSize) return false;
+        if (budget == 0) {
+            for (size_t i = 0; i < kWalRingPageSize; i += 7) mem[offset + i] = static_cast<uint8_t>(rnd());
+            dead = true;
+            return false;
+        }
+        erases++;
+        memset(&mem[offset], 0xFF, kWalRingPageSize);
+        return true;
+    }
+
+    void powerOn() {
+        budget = -1;
+        dead = false;
+    }
+
+    std::vector<uint8_t> mem;
+    long budget{-1};
+    bool dead{false};
+    uint32_t erases{0};
+    uint32_t unerasedWrites{0};
+};
+
+// The WAL's partition when built with KDS_WAL_RAW_PARTITION (esp_partition_flash.cpp is device only).
+WalRingFlash* walRingPartitionFlash() {
+    static SimFlash flash(32);
+    return &flash;
+}
+
+static std::vector<uint8_t> payloadFor(uint32_t lsn) {
+    std::vector<uint8_t> v(8 + rnd() % 300);
+    for (size_t i = 0; i < v.size(); ++i) v[i] = static_cast<uint8_t>(lsn * 31 + i);
+    return v;
+}
+
+typedef std::map<uint32_t, std::vector<uint8_t>> Acked;
+
+// Mounts, checks that every acknowledged entry above the horizon reads back intact and in
+// order, then appends until the next simulated power cut.
+static bool crashRound(SimFlash& flash, Acked& acked, uint32_t& lsn, uint32_t& horizon, int round) {
+    WalRing ring(flash);
+    if (!ring.mount()) {
+        printf("round %d: mount failed\n", round);
+        return false;
+    }
+    WalRingPosition pos = ring.start(horizon + 1);
+    uint32_t entryLsn = 0;
+    uint32_t previous = 0;
+    std::vector<uint8_t> out;
+    Acked read;
+    while (ring.read(pos, entryLsn, out)) {
+        if (entryLsn <= previous) {
+            printf("round %d: lsn %u after %u\n", round, entryLsn, previous);
+            return false;
+        }
+        previous = entryLsn;
+        read[entryLsn] = out;
+    }
+    for (const auto& kv : acked) {
+        if (kv.first <= horizon) continue;
+        auto it = read.find(kv.first);
+        if (it == read.end() || it->second != kv.second) {
+            printf("round %d: lost lsn %u (horizon %u, %u pages live)\n", round, kv.first, horizon, ring.livePages());
+            return false;
+        }
+    }
+    uint32_t ackedLast = acked.empty() ? 0 : acked.rbegin()->first;
+    if (ring.lastLsn() < ackedLast) {
+        printf("round %d: lastLsn %u below acknowledged %u\n", round, ring.lastLsn(), ackedLast);
+        return false;
+    }
+    // Entries that reached flash without an acknowledgement may surface; the WAL keeps them too.
+    for (const auto& kv : read) acked[kv.first] = kv.second;
+    lsn = std::max(lsn, ring.lastLsn());
+
+    // The horizon is not on flash: restore it the way boot does from the snapshot checkpoints.
+    ring.release(horizon);
+    flash.powerOn();
+    flash.budget = 200 + rnd() % 20000;
+    while (true) {
+        if (rnd() % 5 == 0) ring.prepare();
+        if (rnd() % 40 == 0) {
+            horizon = std::max(horizon, lsn > 60 ? lsn - 60 : 0);
+            ring.release(horizon);
+        }
+        uint32_t next = lsn + 1;
+        std::vector<uint8_t> payload = payloadFor(next);
+        if (!ring.append(next, payload.data(), payload.size())) {
+            if (flash.dead) break;
+            // Full: a checkpoint covers everything so far.
+            horizon = lsn;
+            ring.release(horizon);
+            continue;
+        }
+        lsn = next;
+        acked[next] = payload;
+    }
+    flash.powerOn();
+    return true;
+}
+
+static bool powerCuts() {
+    SimFlash flash(8);
+    Acked acked;
+    uint32_t lsn = 0;
+    uint32_t horizon = 0;
+    const int rounds = 1000;
+    int ok = 0;
+    while (ok < rounds && crashRound(flash, acked, lsn, horizon, ok)) ok++;
+    printf("power cuts: %d/%d recovered, last lsn %u, %u erases, %u writes over unerased bytes\n", ok, rounds, lsn,
+           flash.erases, flash.unerasedWrites);
+    return ok == rounds && flash.unerasedWrites == 0;
+}
+
+static bool wraparound() {
+    SimFlash flash(4);
+    WalRing ring(flash);
+    ring.mount();
+    std::vector<uint8_t> payload(1000, 0x5A);
+    uint32_t lsn = 0;
+    while (ring.append(lsn + 1, payload.data(), payload.size())) lsn++;
+    uint32_t full = lsn;
+    ring.release(lsn / 2);
+    while (ring.append(lsn + 1, payload.data(), payload.size())) lsn++;
+    WalRingPosition pos = ring.start(0);
+    uint32_t oldest = 0;
+    std::vector<uint8_t> out;
+    ring.read(pos, oldest, out);
+    printf("wraparound: %u entries fill %u pages; after release(%u) last %u, oldest readable %u\n", full,
+           ring.pages(), full / 2, lsn, oldest);
+    return lsn > full && oldest > 1 && oldest <= full / 2 + 1;
+}
+
+// A remount forgets the horizon: the full ring refuses appends until release() is called again.
+static bool remountHorizon() {
+    SimFlash flash(4);
+    std::vector<uint8_t> payload(1000, 0x33);
+    uint32_t lsn = 0;
+    {
+        WalRing ring(flash);
+        ring.mount();
+        while (ring.append(lsn + 1, payload.data(), payload.size())) lsn++;
+        ring.release(lsn);
+    }
+    WalRing ring(flash);
+    ring.mount();
+    bool refused = !ring.append(lsn + 1, payload.data(), payload.size());
+    ring.release(lsn);
+    bool accepted = ring.append(lsn + 1, payload.data(), payload.size());
+    printf("remount: append before release %s, after release %s\n", refused ? "refused" : "accepted",
+           accepted ? "accepted" : "refused");
+    return refused && accepted;
+}
+
+#if KDS_WAL_RAW_PARTITION
+static double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool walOnPartition() {
+    LittleFS.mkdir("/kds");
+    walBegin();
+    const int n = 3000;
+    std::vector<double> latency;
+    for (int i = 0; i < n; ++i) {
+        WalRecord rec;
+        rec.action = kWalOrderUpdate;
+        rec.orderNo = String(i);
+        rec.status = "COOKING";
+        rec.ts = 1000 + i;
+        WalTicket ticket = 0;
+        walAppend(rec, &ticket);
+        if (i % 3 == 0) {
+            double started = nowUs();
+            walWaitDurable(ticket);
+            latency.push_back(nowUs() - started);
+        }
+        walTick();
+        if (i % 700 == 699) walRotate(ticket - 50);
+    }
+    walFlush();
+    WalStats stats = getWalStats();
+    std::sort(latency.begin(), latency.end());
+    double total = 0;
+    for (double d : latency) total += d;
+    printf("wal on partition: %u appends, %u commits, %u failures, %u/%u pages live, %u erases; "
+           "commit avg %.1f us p99 %.1f\n",
+           stats.appends, stats.commits, stats.failures, stats.ringLivePages, stats.ringPages, stats.ringErases,
+           total / latency.size(), latency[latency.size() * 99 / 100]);
+
+    WalReplayCursor cursor;
+    walReplayBegin(cursor, 2500);
+    struct Seen {
+        uint32_t count;
+        uint32_t last;
+    } seen{0, 0};
+    auto visit = [](const WalRecord& record, void* context) {
+        Seen* s = static_cast<Seen*>(context);
+        s->count++;
+        s->last = record.lsn;
+        return true;
+    };
+    while (!walReplayStep(cursor, visit, &seen, 1)) {
+    }
+    printf("replay from 2500: %u records, last %u\n", seen.count, seen.last);
+    return stats.failures == 0 && seen.last == static_cast<uint32_t>(n) && seen.count == static_cast<uint32_t>(n - 2499);
+}
+#endif
+
+int main() {
+    g_quietSerial = true;
+    bool ok = powerCuts();
+    ok = wraparound() && ok;
+    ok = remountHorizon() && ok;
+#if KDS_WAL_RAW_PARTITION
+    ok = walOnPartition() && ok;
+#endif
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}